@@ -0,0 +1,528 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#define chdir _chdir
+#define makeDirectory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define makeDirectory(path) mkdir(path, 0755)
+#endif
+#include "../include/sha256.h"
+#include "../include/library.h"
+#include "../include/loan_archive.h"
+#include "../include/circulation_stats.h"
+#include "../include/loan_join.h"
+#include "../include/output_buffer.h"
+#include "../include/dates.h"
+#include "../include/items.h"
+#include "../include/shards.h"
+#include "../include/parallel_scan.h"
+#include "datagen.h"
+
+// Benchmarks for the storage hot paths. Each operation runs a number of
+// timed iterations against a generated data directory and reports
+// throughput and latency percentiles as one JSON document on stdout.
+//
+//   bench [generate|run|all] [--dir DIR] [--scale N] [--books N]
+//         [--members N] [--loans N] [--skew S] [--open-fraction F]
+//         [--seed N] [--iterations N] [--heavy-iterations N] [--only NAME]
+//         [--shards N]
+//
+// --shards splits books and members into N files each before the run.
+
+#define DEFAULT_DIR "bench_data"
+#define DEFAULT_SCALE 1000
+#define DEFAULT_ITERATIONS 200
+#define DEFAULT_HEAVY_ITERATIONS 5
+#define SHA256_ITERATION_FACTOR 100
+
+typedef struct
+{
+    const char *dir;
+    DatagenConfig data;
+    long iterations;
+    long heavyIterations;
+    const char *only;
+    long shards; // 0: keep the layout on disk
+} BenchOptions;
+
+typedef struct
+{
+    const BenchOptions *options;
+    DatagenRng rng;
+    int *issuedBooks; // loans opened by issue_book, closed again by return_book
+    int *issuedMembers;
+    long issuedCount;
+    char (*issuedBarcodes)[ITEM_BARCODE_SIZE]; // copies lent by issue_item
+    long issuedItemCount;
+    OutputBuffer out;
+    long failures;
+    unsigned long long sink; // keeps results observable so no work is dropped
+} BenchState;
+
+typedef int (*BenchOp)(BenchState *state, long iteration);
+
+typedef struct
+{
+    const char *name;
+    BenchOp run;
+    int heavy; // iterations come from --heavy-iterations
+    long factor;
+} BenchCase;
+
+static double nowSeconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile over sorted samples
+static double percentile(const double *sorted, long count, double p)
+{
+    long rank = (long)(p * (double)count + 0.999999);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    return sorted[(rank > count ? count : rank) - 1];
+}
+
+static int opIsValidBookID(BenchState *state, long iteration)
+{
+    (void)iteration;
+    // Half of the probes miss, like a new ID being checked before an insert
+    long id = 1 + (long)(datagenNext(&state->rng) % (uint64_t)(2 * state->options->data.books));
+    state->sink += (unsigned long long)isValidBookID((int)id);
+    return 1;
+}
+
+static int countBook(const Book *book, void *ctx)
+{
+    *(unsigned long long *)ctx += (unsigned long long)book->quantity;
+    return 1;
+}
+
+static int opTitleSearch(BenchState *state, long iteration)
+{
+    (void)iteration;
+    char title[100];
+    datagenTitle(datagenPickID(&state->rng, state->options->data.books, state->options->data.skew), title,
+                 sizeof(title));
+    return librarySearchTitle(title, countBook, &state->sink) > 0;
+}
+
+// The borrowing policy turning a member away is a normal outcome, like a
+// counter clerk asking the next person in line
+static int isRefusal(LibraryStatus status)
+{
+    return status == LIBRARY_LIMIT_REACHED || status == LIBRARY_OVERDUE_BLOCKED;
+}
+
+static int opIssueBook(BenchState *state, long iteration)
+{
+    (void)iteration;
+    Book book;
+    Member member;
+    for (int attempt = 0; attempt < 16; attempt++)
+    {
+        int bookID = (int)datagenPickID(&state->rng, state->options->data.books, state->options->data.skew);
+        int memberID = (int)datagenPickID(&state->rng, state->options->data.members, state->options->data.skew);
+        LibraryStatus status = libraryIssueBook(memberID, bookID, &book, &member);
+        if (status == LIBRARY_OK)
+        {
+            state->issuedBooks[state->issuedCount] = bookID;
+            state->issuedMembers[state->issuedCount] = memberID;
+            state->issuedCount++;
+            return 1;
+        }
+        if (status != LIBRARY_OUT_OF_STOCK && !isRefusal(status))
+        {
+            return 0;
+        }
+    }
+    return 0; // Every pick was out of stock or refused
+}
+
+static int opReturnBook(BenchState *state, long iteration)
+{
+    if (iteration >= state->issuedCount)
+    {
+        return 0; // Nothing left that issue_book opened
+    }
+    BorrowedRecord record;
+    int heldFor;
+    return libraryReturnBook(state->issuedMembers[iteration], state->issuedBooks[iteration], &record, &heldFor) ==
+           LIBRARY_OK;
+}
+
+// A kiosk scan: a random member checks out a copy of a skewed pick
+static int opIssueItem(BenchState *state, long iteration)
+{
+    (void)iteration;
+    Book book;
+    Member member;
+    for (int attempt = 0; attempt < 16; attempt++)
+    {
+        long bookID = datagenPickID(&state->rng, state->options->data.books, state->options->data.skew);
+        int memberID = (int)datagenPickID(&state->rng, state->options->data.members, state->options->data.skew);
+        char *barcode = state->issuedBarcodes[state->issuedItemCount];
+        for (int copy = 0; copy < 10; copy++)
+        {
+            if (!datagenBarcode(bookID, copy, barcode, ITEM_BARCODE_SIZE))
+            {
+                break;
+            }
+            LibraryStatus status = libraryIssueItem(memberID, barcode, &book, &member);
+            if (status == LIBRARY_OK)
+            {
+                state->issuedItemCount++;
+                return 1;
+            }
+            if (status == LIBRARY_NO_ITEM)
+            {
+                break; // Past the book's last copy
+            }
+            if (isRefusal(status))
+            {
+                break; // The member may not borrow; try another
+            }
+            if (status != LIBRARY_ITEM_UNAVAILABLE && status != LIBRARY_OUT_OF_STOCK)
+            {
+                return 0;
+            }
+        }
+    }
+    return 0; // Every pick was out of stock
+}
+
+static int opReturnItem(BenchState *state, long iteration)
+{
+    if (iteration >= state->issuedItemCount)
+    {
+        return 0; // Nothing left that issue_item lent
+    }
+    BorrowedRecord record;
+    int heldFor;
+    return libraryReturnItem(state->issuedBarcodes[iteration], &record, &heldFor) == LIBRARY_OK;
+}
+
+static int formatLoan(const LoanView *view, void *ctx)
+{
+    BenchState *state = ctx;
+    char borrowed[DATETIME_TEXT_SIZE];
+    outputBufferPrintf(&state->out, "Member: %s (ID %d)\nBook: %s (ID %d)\nBorrow Date: %s\nDays Out: %d\n",
+                       view->memberName ? view->memberName : "(deleted)", view->loan.memberID,
+                       view->title ? view->title : "(deleted)", view->loan.bookID,
+                       dateTimeFormat(view->loan.borrowDate, borrowed), view->daysOut);
+    return 1;
+}
+
+// The same work as viewCurrentIssuedBooks, with the screen output kept in memory
+static int opViewCurrentIssued(BenchState *state, long iteration)
+{
+    (void)iteration;
+    LoanJoin join;
+    if (!loanJoinBuild(&join))
+    {
+        return 0;
+    }
+    outputBufferReset(&state->out);
+    state->sink += (unsigned long long)loanJoinOpenLoans(&join, formatLoan, state);
+    state->sink += state->out.length;
+    loanJoinFree(&join);
+    return 1;
+}
+
+static int opDeleteBook(BenchState *state, long iteration)
+{
+    (void)iteration;
+    long id = 1 + (long)(datagenNext(&state->rng) % (uint64_t)state->options->data.books);
+    return libraryDeleteBook((int)id);
+}
+
+static int opSha256(BenchState *state, long iteration)
+{
+    // A password-sized input, as hashed on every login
+    char password[32];
+    BYTE hash[SHA256_BLOCK_SIZE];
+    SHA256_CTX ctx;
+    int length = snprintf(password, sizeof(password), "password%ld", iteration);
+    sha256_init(&ctx);
+    sha256_update(&ctx, (const BYTE *)password, (size_t)length);
+    sha256_final(&ctx, hash);
+    state->sink += hash[0];
+    return 1;
+}
+
+// Order matters: return_book and return_item close the loans opened by
+// issue_book and issue_item, and delete_book runs last because it shrinks
+// the catalog
+static const BenchCase benchCases[] = {
+    {"sha256_password", opSha256, 0, SHA256_ITERATION_FACTOR},
+    {"is_valid_book_id", opIsValidBookID, 0, 1},
+    {"title_search", opTitleSearch, 0, 1},
+    {"issue_book", opIssueBook, 0, 1},
+    {"return_book", opReturnBook, 0, 1},
+    {"issue_item", opIssueItem, 0, 1},
+    {"return_item", opReturnItem, 0, 1},
+    {"view_current_issued", opViewCurrentIssued, 1, 1},
+    {"delete_book", opDeleteBook, 1, 1},
+};
+#define BENCH_CASE_COUNT (sizeof(benchCases) / sizeof(benchCases[0]))
+
+static void printResult(const char *name, const double *samples, long count, long failures, double total,
+                        int *first)
+{
+    printf("%s\n    {\"name\": \"%s\", \"iterations\": %ld, \"failures\": %ld, ", *first ? "" : ",", name, count,
+           failures);
+    printf("\"seconds\": %.6f, \"ops_per_sec\": %.1f, ", total, total > 0 ? (double)count / total : 0.0);
+    printf("\"p50_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f}", percentile(samples, count, 0.50) * 1e6,
+           percentile(samples, count, 0.99) * 1e6, samples[count - 1] * 1e6);
+    *first = 0;
+}
+
+static int runCase(BenchState *state, const BenchCase *bench, int *first)
+{
+    const BenchOptions *options = state->options;
+    long count = (bench->heavy ? options->heavyIterations : options->iterations) * bench->factor;
+    if (count <= 0)
+    {
+        return 1;
+    }
+    double *samples = malloc((size_t)count * sizeof(double));
+    if (!samples)
+    {
+        return 0;
+    }
+    fprintf(stderr, "running %s (%ld iterations)\n", bench->name, count);
+    long failures = 0;
+    double total = 0.0;
+    for (long i = 0; i < count; i++)
+    {
+        double start = nowSeconds();
+        failures += !bench->run(state, i);
+        samples[i] = nowSeconds() - start;
+        total += samples[i];
+    }
+    qsort(samples, (size_t)count, sizeof(double), compareDoubles);
+    printResult(bench->name, samples, count, failures, total, first);
+    state->failures += failures;
+    free(samples);
+    return 1;
+}
+
+// What the program does after login, timed once
+static void runStartup(int *first)
+{
+    double start = nowSeconds();
+    loanArchiveCompactIfNeeded();
+    statsLoad();
+    double total = nowSeconds() - start;
+    printResult("startup", &total, 1, 0, total, first);
+}
+
+static int runBenchmarks(const BenchOptions *options)
+{
+    BenchState state;
+    memset(&state, 0, sizeof(state));
+    state.options = options;
+    datagenSeed(&state.rng, options->data.seed ^ 0xB5AD4ECEDA1CE2A9ull);
+    state.issuedBooks = malloc((size_t)(options->iterations + 1) * sizeof(int));
+    state.issuedMembers = malloc((size_t)(options->iterations + 1) * sizeof(int));
+    state.issuedBarcodes = malloc((size_t)(options->iterations + 1) * ITEM_BARCODE_SIZE);
+    if (!state.issuedBooks || !state.issuedMembers || !state.issuedBarcodes ||
+        !outputBufferInit(&state.out, OUTPUT_BUFFER_DEFAULT_CAPACITY))
+    {
+        fprintf(stderr, "bench: out of memory\n");
+        return 0;
+    }
+
+    int first = 1;
+    printf("{\n  \"books\": %ld, \"members\": %ld, \"loans\": %ld, \"skew\": %.2f, \"shards\": %u,\n"
+           "  \"scan_threads\": %u, \"results\": [",
+           options->data.books, options->data.members, options->data.loans, options->data.skew,
+           shardsCount(SHARD_BOOKS), parallelScanThreads());
+    if (!options->only || strcmp(options->only, "startup") == 0)
+    {
+        runStartup(&first);
+    }
+    int ok = 1;
+    for (size_t i = 0; i < BENCH_CASE_COUNT && ok; i++)
+    {
+        if (!options->only || strcmp(options->only, benchCases[i].name) == 0)
+        {
+            ok = runCase(&state, &benchCases[i], &first);
+        }
+    }
+    printf("\n  ],\n  \"checksum\": %llu\n}\n", state.sink);
+
+    outputBufferFree(&state.out);
+    free(state.issuedBooks);
+    free(state.issuedMembers);
+    free(state.issuedBarcodes);
+    if (state.failures > 0)
+    {
+        fprintf(stderr, "bench: %ld operations failed\n", state.failures);
+    }
+    return ok && state.failures == 0;
+}
+
+static long borrowCount(void)
+{
+    FILE *file = fopen(BORROWED_BOOKS_FILE, "rb");
+    if (!file)
+    {
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    long count = ftell(file) / (long)sizeof(BorrowedRecord);
+    fclose(file);
+    return count;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: bench [generate|run|all] [--dir DIR] [--scale N] [--books N] [--members N]\n"
+                    "             [--loans N] [--skew S] [--open-fraction F] [--seed N]\n"
+                    "             [--iterations N] [--heavy-iterations N] [--only NAME] [--shards N]\n");
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options;
+    options.dir = DEFAULT_DIR;
+    options.data.books = DEFAULT_SCALE;
+    options.data.members = DEFAULT_SCALE;
+    options.data.loans = DEFAULT_SCALE;
+    options.data.skew = 1.0;
+    options.data.openFraction = 0.05;
+    options.data.seed = 42;
+    options.iterations = DEFAULT_ITERATIONS;
+    options.heavyIterations = DEFAULT_HEAVY_ITERATIONS;
+    options.only = NULL;
+    options.shards = 0;
+
+    int generate = 1;
+    int run = 1;
+    int i = 1;
+    if (argc > 1 && argv[1][0] != '-')
+    {
+        generate = strcmp(argv[1], "run") != 0;
+        run = strcmp(argv[1], "generate") != 0;
+        if (strcmp(argv[1], "generate") != 0 && strcmp(argv[1], "run") != 0 && strcmp(argv[1], "all") != 0)
+        {
+            usage();
+            return 2;
+        }
+        i = 2;
+    }
+    for (; i < argc; i++)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value)
+        {
+            usage();
+            return 2;
+        }
+        if (strcmp(argv[i], "--dir") == 0)
+            options.dir = value;
+        else if (strcmp(argv[i], "--scale") == 0)
+            options.data.books = options.data.members = options.data.loans = atol(value);
+        else if (strcmp(argv[i], "--books") == 0)
+            options.data.books = atol(value);
+        else if (strcmp(argv[i], "--members") == 0)
+            options.data.members = atol(value);
+        else if (strcmp(argv[i], "--loans") == 0)
+            options.data.loans = atol(value);
+        else if (strcmp(argv[i], "--skew") == 0)
+            options.data.skew = atof(value);
+        else if (strcmp(argv[i], "--open-fraction") == 0)
+            options.data.openFraction = atof(value);
+        else if (strcmp(argv[i], "--seed") == 0)
+            options.data.seed = strtoull(value, NULL, 10);
+        else if (strcmp(argv[i], "--iterations") == 0)
+            options.iterations = atol(value);
+        else if (strcmp(argv[i], "--heavy-iterations") == 0)
+            options.heavyIterations = atol(value);
+        else if (strcmp(argv[i], "--only") == 0)
+            options.only = value;
+        else if (strcmp(argv[i], "--shards") == 0)
+            options.shards = atol(value);
+        else
+        {
+            usage();
+            return 2;
+        }
+        i++;
+    }
+
+    // Every data path is relative to data/, so work inside the bench directory
+    makeDirectory(options.dir);
+    if (chdir(options.dir) != 0)
+    {
+        perror(options.dir);
+        return 1;
+    }
+    makeDirectory("data");
+
+    if (generate)
+    {
+        fprintf(stderr, "generating %ld books, %ld members, %ld loans in %s\n", options.data.books,
+                options.data.members, options.data.loans, options.dir);
+        double start = nowSeconds();
+        if (!datagenWrite(&options.data))
+        {
+            return 1;
+        }
+        fprintf(stderr, "generated in %.2f s\n", nowSeconds() - start);
+    }
+    if (options.shards > 0)
+    {
+        if (options.shards > SHARDS_MAX || !shardsReshard(SHARD_BOOKS, (unsigned)options.shards) ||
+            !shardsReshard(SHARD_MEMBERS, (unsigned)options.shards))
+        {
+            fprintf(stderr, "bench: cannot split the data into %ld shards (1 to %d)\n", options.shards, SHARDS_MAX);
+            return 1;
+        }
+    }
+    if (run)
+    {
+        // A plain run measures whatever data/ holds
+        options.data.books = shardsRecordCount(SHARD_BOOKS);
+        options.data.members = shardsRecordCount(SHARD_MEMBERS);
+        options.data.loans = borrowCount();
+        if (options.data.books <= 0 || options.data.members <= 0)
+        {
+            fprintf(stderr, "bench: no books or members in %s/data; run generate first\n", options.dir);
+            return 1;
+        }
+        if (!runBenchmarks(&options))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../include/library.h"
+#include "../include/dates.h"
+#include "../include/loan_archive.h"
+#include "../include/loan_query.h"
+#include "../include/circulation_stats.h"
+#include "../include/holds.h"
+#include "../include/items.h"
+#include "../include/policy.h"
+#include "../include/shards.h"
+#include "../include/changes.h"
+#include "../include/id_filter.h"
+#include "datagen.h"
+
+#define WRITE_BUFFER_SIZE (1 << 20)
+#define LOAN_HISTORY_DAYS (2 * 365)
+#define MAX_LOAN_DAYS 21
+
+static const char *const titleWords[] = {"Silent", "River", "Garden", "Winter", "Empire", "Shadow", "Letters",
+                                         "Harbor", "Glass", "Mountain", "Night", "Orchard", "Lantern", "Atlas",
+                                         "Copper", "Meridian"};
+#define TITLE_WORD_COUNT (sizeof(titleWords) / sizeof(titleWords[0]))
+
+void datagenSeed(DatagenRng *rng, uint64_t seed)
+{
+    rng->state = seed ? seed : 0x9E3779B97F4A7C15ull;
+}
+
+// xorshift64*
+uint64_t datagenNext(DatagenRng *rng)
+{
+    uint64_t x = rng->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+double datagenUniform(DatagenRng *rng)
+{
+    return (double)(datagenNext(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static long gcd(long a, long b)
+{
+    while (b)
+    {
+        long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Inverse CDF of the continuous power law on [1, count + 1), then a
+// multiplicative scatter that is a bijection on 0..count-1
+long datagenPickID(DatagenRng *rng, long count, double skew)
+{
+    double u = datagenUniform(rng);
+    double n = (double)count + 1.0;
+    double x;
+    if (skew <= 0.0)
+    {
+        x = 1.0 + u * (double)count;
+    }
+    else if (fabs(skew - 1.0) < 1e-9)
+    {
+        x = pow(n, u);
+    }
+    else
+    {
+        double e = 1.0 - skew;
+        x = pow(1.0 + u * (pow(n, e) - 1.0), 1.0 / e);
+    }
+    long rank = (long)x - 1;
+    if (rank < 0)
+    {
+        rank = 0;
+    }
+    if (rank >= count)
+    {
+        rank = count - 1;
+    }
+
+    long multiplier = (long)(2654435761u % (unsigned long)count);
+    while (multiplier == 0 || gcd(multiplier, count) != 1)
+    {
+        multiplier++;
+    }
+    return (long)(((long long)rank * multiplier) % count) + 1;
+}
+
+void datagenTitle(long bookID, char *out, size_t size)
+{
+    unsigned long h = (unsigned long)bookID * 2654435761u;
+    snprintf(out, size, "The %s %s %ld", titleWords[h % TITLE_WORD_COUNT],
+             titleWords[(h >> 8) % TITLE_WORD_COUNT], bookID);
+}
+
+int datagenBarcode(long bookID, int copy, char *out, size_t size)
+{
+    int length = snprintf(out, size, "%08ld%02d", bookID, copy);
+    return length >= 0 && (size_t)length < size;
+}
+
+static FILE *openForWrite(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        perror(path);
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, WRITE_BUFFER_SIZE);
+    return file;
+}
+
+static int finish(FILE *file, int ok)
+{
+    ok = !ferror(file) && ok;
+    return fclose(file) == 0 && ok;
+}
+
+static int writeBooks(const DatagenConfig *config, DatagenRng *rng)
+{
+    FILE *file = openForWrite(BOOKS_FILE);
+    if (!file)
+    {
+        return 0;
+    }
+    FILE *itemFile = openForWrite(ITEMS_FILE);
+    if (!itemFile)
+    {
+        fclose(file);
+        return 0;
+    }
+    long authorCount = config->books / 10 + 1;
+    DayNumber first = (DayNumber)daysFromCivil(1900, 1, 1);
+    DayNumber last = dateToday();
+    int ok = 1;
+    for (long id = 1; id <= config->books && ok; id++)
+    {
+        Book book;
+        memset(&book, 0, sizeof(book));
+        book.bookID = (int)id;
+        datagenTitle(id, book.title, sizeof(book.title));
+        snprintf(book.author, sizeof(book.author), "Author %ld", datagenPickID(rng, authorCount, config->skew));
+        book.publicationDate = dateToTime(first + (DayNumber)(datagenNext(rng) % (uint64_t)(last - first + 1)));
+        book.quantity = 1 + (int)(datagenNext(rng) % 10);
+        ok = fwrite(&book, sizeof(Book), 1, file) == 1;
+        for (int copy = 0; copy < book.quantity && ok; copy++)
+        {
+            ItemRecord item;
+            memset(&item, 0, sizeof(item));
+            if (!datagenBarcode(id, copy, item.barcode, sizeof(item.barcode)))
+            {
+                ok = 0;
+                break;
+            }
+            item.bookID = book.bookID;
+            item.status = ITEM_AVAILABLE;
+            item.loanIndex = -1;
+            item.since = book.publicationDate;
+            ok = fwrite(&item, sizeof(ItemRecord), 1, itemFile) == 1;
+        }
+    }
+    ok = finish(itemFile, ok);
+    return finish(file, ok);
+}
+
+static int writeMembers(const DatagenConfig *config)
+{
+    FILE *file = openForWrite(MEMBERS_FILE);
+    if (!file)
+    {
+        return 0;
+    }
+    int ok = 1;
+    for (long id = 1; id <= config->members && ok; id++)
+    {
+        Member member;
+        memset(&member, 0, sizeof(member));
+        member.memberID = (int)id;
+        snprintf(member.name, sizeof(member.name), "Member %ld", id);
+        snprintf(member.email, sizeof(member.email), "member%ld@example.com", id);
+        snprintf(member.phone, sizeof(member.phone), "09%08ld", id % 100000000L);
+        ok = fwrite(&member, sizeof(Member), 1, file) == 1;
+    }
+    return finish(file, ok);
+}
+
+// Loans are appended in borrow order over the last two years, as the
+// program itself would have written them
+static int writeLoans(const DatagenConfig *config, DatagenRng *rng)
+{
+    FILE *file = openForWrite(BORROWED_BOOKS_FILE);
+    if (!file)
+    {
+        return 0;
+    }
+    time_t now = time(NULL);
+    time_t start = now - (time_t)LOAN_HISTORY_DAYS * DATE_SECONDS_PER_DAY;
+    double step = config->loans > 0 ? (double)(now - start) / (double)config->loans : 0.0;
+    int ok = 1;
+    for (long i = 0; i < config->loans && ok; i++)
+    {
+        BorrowedRecord record;
+        memset(&record, 0, sizeof(record));
+        record.bookID = (int)datagenPickID(rng, config->books, config->skew);
+        record.memberID = (int)datagenPickID(rng, config->members, config->skew);
+        record.borrowDate = start + (time_t)((double)i * step);
+        if (datagenUniform(rng) >= config->openFraction)
+        {
+            time_t out = (time_t)(1 + datagenNext(rng) % (MAX_LOAN_DAYS * DATE_SECONDS_PER_DAY));
+            record.returnDate = record.borrowDate + out < now ? record.borrowDate + out : now;
+            record.isOverdue = record.returnDate - record.borrowDate > POLICY_STANDARD_LOAN_DAYS * DATE_SECONDS_PER_DAY;
+        }
+        ok = fwrite(&record, sizeof(BorrowedRecord), 1, file) == 1;
+    }
+    return finish(file, ok);
+}
+
+static void removeDerivedFiles(void)
+{
+    LoanSegmentInfo *segments;
+    size_t count;
+    if (loanArchiveSegments(&segments, &count))
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            char path[64];
+            snprintf(path, sizeof(path), LOAN_ARCHIVE_SEGMENT_FORMAT, segments[i].segmentID);
+            remove(path);
+        }
+        free(segments);
+    }
+    remove(LOAN_ARCHIVE_MANIFEST);
+    remove(LOAN_ZONE_MAP_FILE);
+    remove(STATS_BOOKS_FILE);
+    remove(STATS_MEMBERS_FILE);
+    remove(ID_FILTER_BOOKS_FILE);
+    remove(ID_FILTER_MEMBERS_FILE);
+}
+
+// Books and members are written unsharded; bench --shards splits them after
+static void removeShards(void)
+{
+    char path[64];
+    for (int kind = 0; kind < SHARD_KIND_COUNT; kind++)
+    {
+        unsigned count = shardsCount((ShardKind)kind);
+        for (unsigned i = 0; count > 1 && i < count; i++)
+        {
+            shardsPath((ShardKind)kind, i, count, path, sizeof(path));
+            remove(path);
+        }
+    }
+    remove(SHARDS_FILE);
+    shardsInvalidate();
+}
+
+int datagenWrite(const DatagenConfig *config)
+{
+    if (config->books <= 0 || config->members <= 0 || config->loans < 0)
+    {
+        fprintf(stderr, "datagen: need at least one book and one member\n");
+        return 0;
+    }
+    DatagenRng rng;
+    datagenSeed(&rng, config->seed);
+    removeDerivedFiles();
+    removeShards();
+    remove(HOLDS_FILE); // would point at books and members of the old data
+    remove(MEMBER_CATEGORIES_FILE);
+    changesInvalidate();
+    remove(CHANGES_FILE); // the history of the old data
+    return writeBooks(config, &rng) && writeMembers(config) && writeLoans(config, &rng);
+}
@@ -0,0 +1,46 @@
+#ifndef DATAGEN_H
+#define DATAGEN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Synthetic books.dat, members.dat and borrow.dat for the benchmarks.
+// Popularity follows a power law: rank r is picked with probability
+// proportional to r^-skew, and ranks are scattered over the IDs so the
+// popular records are not all at the front of the file.
+
+typedef struct
+{
+    long books;
+    long members;
+    long loans;
+    double skew;        // 0 is uniform; around 1 is typical for circulation
+    double openFraction; // share of loans not yet returned
+    uint64_t seed;
+} DatagenConfig;
+
+typedef struct
+{
+    uint64_t state;
+} DatagenRng;
+
+void datagenSeed(DatagenRng *rng, uint64_t seed);
+uint64_t datagenNext(DatagenRng *rng);
+double datagenUniform(DatagenRng *rng); // [0, 1)
+
+// Skewed pick of an ID in 1..count
+long datagenPickID(DatagenRng *rng, long count, double skew);
+
+// The generated title of a book, so a search can ask for one that exists
+void datagenTitle(long bookID, char *out, size_t size);
+// The barcode of a book's copy; every book has copies 0..quantity-1.
+// Returns 0 when it does not fit in size.
+int datagenBarcode(long bookID, int copy, char *out, size_t size);
+
+// Writes books.dat, members.dat, borrow.dat and items.dat (one copy per unit
+// of quantity) under data/ in the current directory and removes
+// the derived files (stats, zone map, archive) left by an earlier run.
+// Returns 1 on success.
+int datagenWrite(const DatagenConfig *config);
+
+#endif // DATAGEN_H
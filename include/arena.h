@@ -0,0 +1,49 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for the temporaries of one request: a scan's chunk table
+// and buffers, a join's hash tables. An allocation is a pointer increment,
+// and everything allocated after a mark is released at once by rewinding
+// to it (marks nest like a stack). Blocks freed by a rewind are kept for
+// reuse, and rewinding to the start merges them into one block as large as
+// the most the arena held, so a request no bigger than an earlier one does
+// not call malloc at all. Above ARENA_RETAIN_MAX the memory is returned
+// instead.
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_MIN_BLOCK (64 * 1024)
+#define ARENA_RETAIN_MAX (64 * 1024 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct
+{
+    ArenaBlock *blocks; // in use, newest first
+    ArenaBlock *spare;  // released by rewinds
+    size_t held;        // bytes handed out and not yet rewound
+    size_t peak;
+} Arena;
+
+typedef struct
+{
+    ArenaBlock *block;
+    size_t used;
+} ArenaMark;
+
+void arenaInit(Arena *arena);
+void arenaFree(Arena *arena);
+
+// Aligned to ARENA_ALIGNMENT; NULL when memory runs out
+void *arenaAlloc(Arena *arena, size_t size);
+ArenaMark arenaMark(const Arena *arena);
+void arenaRewind(Arena *arena, ArenaMark mark);
+
+// The arena for the temporaries of the request being served, shared by
+// the modules it calls; only the thread serving requests may use it.
+// Each user rewinds to the mark it took, so the arena is back at the
+// start, and keeps its memory, when the request ends.
+Arena *requestArena(void);
+
+#endif // ARENA_H
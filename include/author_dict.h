@@ -0,0 +1,41 @@
+#ifndef AUTHOR_DICT_H
+#define AUTHOR_DICT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Author dictionary: every distinct author (after normalization) gets a
+// 32-bit ID, and each ID keeps a posting list of the books written by that
+// author. Searching by author is one hash lookup plus a walk of the posting
+// list, and comparing two authors is comparing two integers.
+//
+// The dictionary is built from the books on first use and kept in sync by
+// addBook/editBookMenu. Deleting a book rewrites its shard and shifts record
+// positions, so the delete path invalidates the dictionary instead.
+
+typedef uint32_t AuthorID;
+
+#define AUTHOR_ID_NONE 0u
+
+typedef struct
+{
+    int bookID;
+    long recordIndex; // position of the Book record among the shards (shards.h)
+} AuthorPosting;
+
+// Lowercase, trim and collapse runs of whitespace so "  J.K.  Rowling" and
+// "j.k. rowling" map to the same ID.
+void authorDictNormalize(const char *author, char *out, size_t outSize);
+
+int authorDictLoad(void);
+void authorDictInvalidate(void);
+
+AuthorID authorDictLookup(const char *author);
+AuthorID authorDictIntern(const char *author);
+const char *authorDictName(AuthorID id);
+
+void authorDictAddBook(const char *author, int bookID, long recordIndex);
+void authorDictRemoveBook(const char *author, int bookID);
+const AuthorPosting *authorDictPostings(AuthorID id, size_t *count);
+
+#endif // AUTHOR_DICT_H
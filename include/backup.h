@@ -0,0 +1,51 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Incremental snapshots of data/. Every file is cut into fixed pages and
+// each page is stored once, under its SHA-256, in the backup directory; a
+// snapshot is a manifest listing the pages of every file. A new snapshot
+// therefore only writes the pages that changed since any earlier one, and
+// a file whose size and modification time match the previous snapshot is
+// not even read again.
+//
+// Snapshots are taken online: the file list is checked before and after
+// the copy, and the copy is retried when anything was written meanwhile,
+// so the image never mixes states from two operations. Restoring replaces
+// data/ with the newest snapshot taken at or before a given time, and must
+// be done with the program stopped.
+
+#define BACKUP_DEFAULT_DIR "backups"
+#define BACKUP_PAGE_SIZE (64 * 1024)
+#define BACKUP_ID_SIZE 32
+
+typedef struct
+{
+    char id[BACKUP_ID_SIZE]; // "YYYYMMDD-HHMMSS" in UTC, with a suffix if taken twice a second
+    time_t taken;
+    uint32_t files;
+    uint64_t bytes;        // size of the image
+    uint64_t pagesWritten; // pages this snapshot added to the store
+    uint64_t bytesWritten;
+} BackupSnapshotInfo;
+
+// backupDir NULL means LMS_BACKUP_DIR, or BACKUP_DEFAULT_DIR when unset
+const char *backupDirectory(const char *backupDir);
+
+int backupSnapshot(const char *backupDir, BackupSnapshotInfo *info);
+
+// Snapshots oldest first; the caller frees *snapshots
+int backupList(const char *backupDir, BackupSnapshotInfo **snapshots, size_t *count);
+
+// Restores the newest snapshot taken at or before `at` (0 for the latest).
+// The current data is snapshotted first, so a restore can itself be undone.
+int backupRestore(const char *backupDir, time_t at, BackupSnapshotInfo *restored);
+
+// Keeps the newest `keep` snapshots and deletes pages no other snapshot
+// uses. Returns the number of pages deleted, or -1 on error.
+long backupPrune(const char *backupDir, size_t keep);
+
+#endif // BACKUP_H
@@ -0,0 +1,87 @@
+#ifndef CHANGES_H
+#define CHANGES_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "library.h"
+
+// Change data capture. Every insert, update and delete of a book or member
+// and every issue and return is appended to data/changes.log as part of
+// the journaled operation that makes it, so a change is logged exactly
+// when its operation commits. Changes are numbered 1, 2, 3, ... in commit
+// order and stored as fixed-size records: change N sits at a known offset,
+// and a consumer that remembers the last sequence it handled resumes there
+// without reading anything before it.
+//
+// Records of an operation in flight are already in the file, so readers
+// stop at the committed count in the header, which the writer advances
+// after each commit (and startup recovery sets from the file length).
+
+#define CHANGES_FILE "data/changes.log"
+#define CHANGES_POLL_MS 2      // how often changesWait looks for new changes
+#define CHANGES_HEADER_SIZE 32 // change N starts at 32 + (N - 1) * sizeof(ChangeRecord)
+
+typedef enum
+{
+    CHANGE_BOOK_INSERT = 1,
+    CHANGE_BOOK_UPDATE,
+    CHANGE_BOOK_DELETE,
+    CHANGE_MEMBER_INSERT,
+    CHANGE_MEMBER_UPDATE,
+    CHANGE_MEMBER_DELETE,
+    CHANGE_LOAN_ISSUE,
+    CHANGE_LOAN_RETURN
+} ChangeType;
+
+// Stored as-is, like the .dat records
+typedef struct
+{
+    uint64_t sequence;
+    int64_t time;  // when the operation ran
+    int32_t type;  // ChangeType
+    int32_t id;    // bookID, or memberID for member changes; loans carry both
+    union
+    {
+        Book book;     // the new state; for a delete, the last one
+        Member member;
+        BorrowedRecord loan;
+    } record;
+} ChangeRecord;
+
+const char *changesTypeName(ChangeType type); // "book_insert", ...
+
+// Writer side: call inside the operation that makes the change
+int changesRecordBook(ChangeType type, const Book *book);
+int changesRecordMember(ChangeType type, const Member *member);
+int changesRecordLoan(ChangeType type, const BorrowedRecord *loan);
+// Publish the committed count. The journal calls Settle when an operation
+// ends and Recover after its own recovery.
+void changesSettle(void);
+void changesRecover(void);
+// Closes the log this process keeps open, for when data/ is replaced
+void changesInvalidate(void);
+
+// Reader side
+typedef struct
+{
+    const char *path;
+    FILE *file; // opened once the log exists
+    uint64_t next;
+    uint64_t committed; // as last read from the header
+} ChangeCursor;
+
+// Positions a cursor after the given sequence (0: at the first change)
+void changesOpen(ChangeCursor *cursor, uint64_t after);
+// The same on another folder's log, such as a primary's (see replica.h);
+// path must outlive the cursor
+void changesOpenFile(ChangeCursor *cursor, const char *path, uint64_t after);
+void changesClose(ChangeCursor *cursor);
+// 1 with the next committed change, 0 when there is none yet, -1 on error
+int changesNext(ChangeCursor *cursor, ChangeRecord *change);
+// Waits up to timeoutMs for a change past the cursor; 1 when one is there,
+// 0 on timeout, -1 on error
+int changesWait(ChangeCursor *cursor, long timeoutMs);
+// The committed count, which is also the last sequence
+uint64_t changesCommitted(void);
+
+#endif // CHANGES_H
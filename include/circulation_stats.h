@@ -0,0 +1,56 @@
+#ifndef CIRCULATION_STATS_H
+#define CIRCULATION_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Circulation aggregates kept up to date as loans are issued and returned,
+// so reports never have to scan the loan history. Each book and member has
+// a fixed-size counter record in its own file; an in-memory index maps IDs
+// to record slots, so an update is a single in-place write.
+//
+// statsRebuild recomputes everything from borrow.dat and the archive, and
+// statsVerify does the same into scratch tables and reports any counter
+// that disagrees with the maintained ones.
+
+#define STATS_BOOKS_FILE "data/stats_books.dat"
+#define STATS_MEMBERS_FILE "data/stats_members.dat"
+
+typedef struct
+{
+    int id; // bookID or memberID
+    uint32_t loans;
+    uint32_t open;
+    uint32_t returned;
+    uint32_t overdue;     // returned after the loan period
+    int64_t durationSum;  // seconds, over returned loans
+} CirculationCounter;
+
+typedef struct
+{
+    uint64_t loans;
+    uint64_t open;
+    uint64_t returned;
+    uint64_t overdue;
+    int64_t durationSum;
+} CirculationTotals;
+
+int statsLoad(void);
+void statsInvalidate(void); // reload the counter files on next use
+void statsRecordIssue(int bookID, int memberID);
+void statsRecordReturn(int bookID, int memberID, time_t borrowDate, time_t returnDate, int isOverdue);
+
+int statsBookCounter(int bookID, CirculationCounter *counter);
+int statsMemberCounter(int memberID, CirculationCounter *counter);
+void statsTotals(CirculationTotals *totals);
+
+// Top n by number of loans, most borrowed first; returns how many were filled
+size_t statsTopBooks(CirculationCounter *top, size_t n);
+size_t statsTopMembers(CirculationCounter *top, size_t n);
+
+int statsRebuild(void);
+// Returns the number of mismatched counters, or -1 if the history can't be read
+long statsVerify(void);
+
+#endif // CIRCULATION_STATS_H
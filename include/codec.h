@@ -0,0 +1,41 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte-level encodings used by the archive and log files.
+
+#define VARINT_MAX_BYTES 10
+
+// LEB128 varint: 7 bits per byte, high bit set on every byte but the last.
+// Returns the number of bytes written / consumed, 0 on malformed input.
+size_t varintEncode(uint64_t value, uint8_t *out);
+size_t varintDecode(const uint8_t *in, size_t avail, uint64_t *value);
+
+// Zigzag maps small negative deltas to small unsigned values
+static inline uint64_t zigzagEncode(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+static inline int64_t zigzagDecode(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// Worst-case output size of lzCompress for an input of n bytes
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+// LZ77 block codec in the LZ4 style: a token byte holding literal and match
+// lengths, the literals, then a 16-bit back-reference offset. Blocks are
+// self-contained. lzCompress returns the compressed size, or 0 when the
+// output would not fit in outCap. lzDecompress returns 1 only when the input
+// decodes to exactly outLen bytes.
+size_t lzCompress(const uint8_t *in, size_t n, uint8_t *out, size_t outCap);
+int lzDecompress(const uint8_t *in, size_t n, uint8_t *out, size_t outLen);
+
+// CRC-32 (IEEE, as in zlib). Start from 0 and feed the running value back
+// in to checksum data that arrives in pieces.
+uint32_t crc32Update(uint32_t crc, const void *data, size_t n);
+
+#endif // CODEC_H
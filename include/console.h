@@ -0,0 +1,15 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+// Screen handling without spawning a shell. system("cls") and
+// system("pause") started a process on every screen change and only worked
+// on Windows.
+
+// Clears the terminal: Win32 console calls on Windows, ANSI escapes
+// elsewhere. Does nothing when stdout is not a terminal.
+void consoleClear(void);
+
+// Waits for a key on Windows, or for Enter elsewhere
+void consolePause(void);
+
+#endif // CONSOLE_H
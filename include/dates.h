@@ -0,0 +1,40 @@
+#ifndef DATES_H
+#define DATES_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Calendar arithmetic without mktime/localtime. Dates are day numbers
+// (days since 1970-01-01 in the proleptic Gregorian calendar) converted with
+// days-from-civil; the only timezone lookup is the local UTC offset, taken
+// once and cached until the next hour or day boundary.
+
+#define DATE_SECONDS_PER_DAY (24 * 60 * 60)
+#define DATE_TEXT_SIZE 11     // "YYYY-MM-DD" plus '\0'
+#define DATETIME_TEXT_SIZE 20 // "YYYY-MM-DD HH:MM:SS" plus '\0'
+
+typedef int32_t DayNumber;
+
+int64_t daysFromCivil(int year, int month, int day);
+void civilFromDays(int64_t days, int *year, int *month, int *day);
+
+// Parses YYYY-MM-DD (month and day may have one digit) and rejects dates
+// that do not exist, e.g. 2023-02-29. Returns 1 on success.
+int dateParse(const char *text, DayNumber *day);
+
+// Date-only fields (publicationDate) are stored as UTC midnight of the day.
+// Records written before this module hold local midnight instead; unless the
+// zone is UTC that is never a whole number of days, and it is read back
+// relative to the current local offset.
+time_t dateToTime(DayNumber day);
+DayNumber dateFromTime(time_t stored);
+
+DayNumber dateToday(void);            // local calendar day
+time_t dateLocalStart(DayNumber day); // local midnight of day, for timestamp ranges
+
+const char *dateFormat(DayNumber day, char out[DATE_TEXT_SIZE]);
+// Local time using the cached current offset, so a timestamp from the other
+// side of a daylight-saving change shows one hour off.
+const char *dateTimeFormat(time_t timestamp, char out[DATETIME_TEXT_SIZE]);
+
+#endif // DATES_H
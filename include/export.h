@@ -0,0 +1,58 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdio.h>
+#include <time.h>
+#include <stdint.h>
+
+// Streaming export of books, members and loans as CSV (with a header row)
+// or JSON Lines. Each table is read once, front to back, and rows are
+// formatted into one large buffer that is written out whenever it fills, so
+// memory stays bounded however long the loan history grows. Only a joined
+// loan export keeps more: the titles and member names, one row per book and
+// member (see loan_join.h).
+//
+// Timestamps are written in UTC as YYYY-MM-DDTHH:MM:SSZ, publication dates
+// as YYYY-MM-DD, and a loan that is still open has an empty (CSV) or null
+// (JSON) returnDate.
+//
+// The change log (see changes.h) exports the same way: one row per change
+// with its sequence, time and type, then the columns of the book, member or
+// loan it carries (CSV leaves the others empty, JSON leaves them out).
+
+#define EXPORT_BUFFER_SIZE (1024 * 1024)
+
+typedef enum
+{
+    EXPORT_BOOKS,
+    EXPORT_MEMBERS,
+    EXPORT_LOANS,
+    EXPORT_CHANGES
+} ExportTable;
+
+typedef enum
+{
+    EXPORT_CSV,
+    EXPORT_JSONL
+} ExportFormat;
+
+typedef struct
+{
+    ExportTable table;
+    ExportFormat format;
+    int outOfStockOnly; // books: quantity == 0
+    int openOnly;       // loans: not yet returned
+    int joined;         // loans: add the book title and member name
+    int hasRange;       // loans: borrowDate within [from, to]
+    time_t from;
+    time_t to;
+    uint64_t after; // changes: start after this sequence
+    int follow;     // changes: keep waiting for new ones, never returning
+} ExportOptions;
+
+void exportDefaults(ExportOptions *options, ExportTable table);
+
+// Writes the table to out. Returns the number of rows, or -1 on error.
+long exportRun(const ExportOptions *options, FILE *out);
+
+#endif // EXPORT_H
@@ -0,0 +1,67 @@
+#ifndef HOLDS_H
+#define HOLDS_H
+
+#include <stddef.h>
+#include <time.h>
+
+// Holds on out-of-stock books. holds.dat is an append-only array of fixed
+// records whose state is updated in place. At load, an in-memory index maps
+// each bookID to a FIFO queue threaded through the waiting records, so a
+// returned copy goes to the head of the queue without a scan. The book's
+// ready holds are kept on a list of their own, so finding a member's open
+// hold only walks that book's open holds.
+//
+// A returned copy that is handed to a hold is set aside (HOLD_READY) rather
+// than added back to the book's quantity. The member collects it by issuing
+// the book as usual.
+
+#define HOLDS_FILE "data/holds.dat"
+
+typedef enum
+{
+    HOLD_WAITING,
+    HOLD_READY, // a returned copy is set aside for the member
+    HOLD_FULFILLED,
+    HOLD_CANCELLED
+} HoldState;
+
+typedef struct
+{
+    int bookID;
+    int memberID;
+    time_t placedDate;
+    time_t readyDate; // 0 while waiting
+    int state;        // HoldState
+} HoldRecord;
+
+typedef struct
+{
+    HoldRecord hold;
+    long position; // 1 = next in line; 0 once the copy is ready
+} MemberHold;
+
+int holdsLoad(void);
+void holdsInvalidate(void); // reload holds.dat on next use, e.g. after a rollback
+
+// Queues the member for the book. Returns 0 when the member already has an
+// open hold on it or the write fails; *position is the place in the queue.
+int holdsPlace(int bookID, int memberID, long *position);
+
+// HOLD_WAITING or HOLD_READY for the member's open hold on the book, else -1
+int holdsFind(int bookID, int memberID);
+long holdsWaiting(int bookID); // length of the book's queue
+
+// Sets a returned copy aside for the head of the queue. Returns that
+// member's ID, or 0 when nobody is waiting.
+int holdsAssignCopy(int bookID);
+
+// Closes the member's open hold as HOLD_FULFILLED or HOLD_CANCELLED.
+// Returns the state it was in, or -1 when there was none.
+int holdsClose(int bookID, int memberID, HoldState closedAs);
+void holdsCancelBook(int bookID); // the book was deleted
+
+// Fills up to max of the member's open holds, oldest first; returns the
+// number of open holds, which may exceed max
+size_t holdsForMember(int memberID, MemberHold *out, size_t max);
+
+#endif // HOLDS_H
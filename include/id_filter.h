@@ -0,0 +1,34 @@
+#ifndef ID_FILTER_H
+#define ID_FILTER_H
+
+#include "shards.h"
+
+// Bloom filter of the book IDs, and one of the member IDs, kept on disk so
+// that checking a new ID (isValidBookID, isValidMemberID) can usually tell
+// it is free without reading a shard. A miss is certain; a hit means the
+// ID may be used and the shard has to be read.
+//
+// shardsAppend adds the ID in the same journaled operation as the record,
+// and shardsDelete takes it off the record count: a Bloom filter cannot
+// forget an ID, so a deleted one just reads as a hit until the next
+// rebuild. The filter is rebuilt with one scan when it is missing, when
+// its record count does not match the shards (the data was written around
+// them), when more IDs were added than it was sized for, and when
+// shardsReshard compacts the shards.
+
+#define ID_FILTER_BOOKS_FILE "data/books.bloom"
+#define ID_FILTER_MEMBERS_FILE "data/members.bloom"
+#define ID_FILTER_BITS_PER_ID 10 // about 1% false hits with 7 hashes
+#define ID_FILTER_MIN_IDS 1024
+
+// 0 when no record of the kind has the ID; 1 when one may
+int idFilterMayContain(ShardKind kind, int id);
+// Join the caller's operation; 0 when the filter could not be written
+int idFilterAdd(ShardKind kind, int id);
+int idFilterNoteDelete(ShardKind kind);
+// Builds the filter from the shards and saves it
+int idFilterRebuild(ShardKind kind);
+// Drops the filters read into memory
+void idFilterInvalidate(void);
+
+#endif // ID_FILTER_H
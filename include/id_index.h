@@ -0,0 +1,33 @@
+#ifndef ID_INDEX_H
+#define ID_INDEX_H
+
+#include <stddef.h>
+#include "arena.h"
+
+// Hash index from a positive record ID (bookID, memberID, ...) to a long,
+// usually a record slot or array position. Open addressing with linear
+// probing; ID 0 marks an empty slot, which is fine because the program never
+// accepts IDs <= 0.
+typedef struct
+{
+    int *keys;
+    long *values;
+    size_t capacity; // always a power of two
+    size_t count;
+    Arena *arena; // NULL: the tables are malloc'd
+} IdIndex;
+
+void idIndexInit(IdIndex *index);
+// Takes the tables from arena, sized for count IDs; idIndexFree then only
+// forgets them. Returns 0 when memory runs out.
+int idIndexInitArena(IdIndex *index, Arena *arena, size_t count);
+void idIndexFree(IdIndex *index);
+void idIndexClear(IdIndex *index);
+
+// Inserts or overwrites; returns 0 only when memory runs out
+int idIndexPut(IdIndex *index, int id, long value);
+// Returns 1 and sets *value when id is present
+int idIndexFind(const IdIndex *index, int id, long *value);
+int idIndexRemove(IdIndex *index, int id);
+
+#endif // ID_INDEX_H
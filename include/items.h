@@ -0,0 +1,67 @@
+#ifndef ITEMS_H
+#define ITEMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Physical copies of books. items.dat holds one fixed record per copy,
+// keyed by its barcode; the table is mirrored in memory with a hash index on
+// the barcode and a chain of copies per book, so a scanned barcode resolves
+// to its copy without touching the disk.
+//
+// Books with no registered copies keep working from Book.quantity alone.
+// For the others, quantity is kept equal to the number of copies on the
+// shelf (ITEM_AVAILABLE); libraryReconcileItems repairs any drift.
+
+#define ITEMS_FILE "data/items.dat"
+#define ITEM_BARCODE_SIZE 24
+
+typedef enum
+{
+    ITEM_AVAILABLE,
+    ITEM_ON_LOAN,
+    ITEM_ON_HOLD_SHELF, // set aside for a hold
+    ITEM_WITHDRAWN
+} ItemStatus;
+
+typedef struct
+{
+    char barcode[ITEM_BARCODE_SIZE];
+    int bookID;
+    int status;         // ItemStatus
+    int memberID;       // borrower, or the member a held copy waits for
+    int64_t loanIndex;  // position of the open loan in borrow.dat, -1 if none
+    time_t since;       // last status change
+} ItemRecord;
+
+#define ITEM_NONE (-1L)
+
+int itemsLoad(void);
+void itemsInvalidate(void); // reload items.dat on next use
+
+// Printable, no spaces, shorter than ITEM_BARCODE_SIZE
+int itemsValidBarcode(const char *barcode);
+
+// Registers a new copy on the shelf. Returns its slot, or ITEM_NONE when the
+// barcode is already taken or the write fails.
+long itemsAdd(int bookID, const char *barcode);
+
+// Slot of the copy with this barcode, or ITEM_NONE; O(1)
+long itemsFind(const char *barcode);
+const ItemRecord *itemsGet(long slot);
+
+// First copy of the book in the given status (and held by or lent to
+// memberID, when it is not 0), or ITEM_NONE
+long itemsPick(int bookID, ItemStatus status, int memberID);
+int itemsHasCopies(int bookID); // 1 once a copy has been registered
+size_t itemsCount(int bookID, ItemStatus status);
+
+// Writes the new status through to items.dat
+int itemsUpdate(long slot, ItemStatus status, int memberID, int64_t loanIndex);
+
+// Visits the copies of one book, newest first; return 0 to stop
+typedef int (*ItemVisitor)(const ItemRecord *item, void *ctx);
+void itemsForBook(int bookID, ItemVisitor visit, void *ctx);
+
+#endif // ITEMS_H
@@ -0,0 +1,63 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Crash safety for everything under data/. An operation that touches
+// several files (an issue updates books.dat, borrow.dat, the statistics,
+// items and holds) runs between journalBegin and journalCommit. Before any
+// byte of a data file is overwritten or appended to, the bytes it replaces
+// and the file's size are appended to data/journal.dat with a CRC-32 and
+// synced. Commit syncs the touched files, writes a commit record, then
+// performs the file swaps the operation asked for and empties the journal.
+//
+// After a crash, journalRecover finds the journal non-empty: without a
+// commit record every saved range is put back and appended tails are cut
+// off, so the operation never happened; with one, the remaining swaps are
+// finished. A torn journal entry fails its checksum and ends the replay;
+// its data write had not started.
+//
+// LMS_SYNC=off skips fsync. Operations then stay atomic across a killed
+// process but not across a power cut.
+
+#define JOURNAL_FILE "data/journal.dat"
+#define JOURNAL_APPEND (-1L) // offset for journalWrite: the current end of file
+
+typedef enum
+{
+    JOURNAL_CLEAN,       // nothing was in flight
+    JOURNAL_ROLLED_BACK, // an unfinished operation was undone
+    JOURNAL_COMPLETED,   // a committed operation's file swaps were finished
+    JOURNAL_FAILED
+} JournalRecovery;
+
+// Nested pairs join the outermost operation. Commit returns 0 when a write
+// inside the operation failed; the operation is then rolled back on disk
+// and cached state must be reloaded.
+void journalBegin(void);
+int journalCommit(void);
+// Rolls the current operation back at its commit. Modules call it when a
+// file they must update cannot even be opened.
+void journalAbort(void);
+
+// Saves what is at [offset, offset + size) of the open file, then writes
+// data there. Outside journalBegin/journalCommit the write is an operation
+// of its own. The file must be open for update ("rb+") or append ("ab").
+int journalWrite(FILE *file, const char *path, long offset, const void *data, size_t size);
+
+// Swaps a fully written temp file in for path with rename, never removing
+// path first. ReplaceFile does it now, for rewrites that keep the content
+// (compaction); ReplaceOnCommit makes it part of the current operation.
+int journalReplaceFile(const char *tempPath, const char *path);
+int journalReplaceOnCommit(const char *tempPath, const char *path);
+
+// Run once at startup, before any module loads its data
+JournalRecovery journalRecover(void);
+
+// Makes every journaled write fail before it touches a file, for a process
+// that must only read the data (a replica; see replica.h)
+void journalSetReadOnly(int on);
+int journalIsReadOnly(void);
+
+#endif // JOURNAL_H
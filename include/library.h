@@ -0,0 +1,96 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include <time.h>
+
+// Record layouts shared by the main program and its index modules.
+// These structs are written to the .dat files as-is, so changing a field
+// changes the on-disk format.
+typedef struct
+{
+    int bookID;
+    char title[100];
+    char author[100];
+    time_t publicationDate;
+    int quantity;
+} Book;
+typedef struct
+{
+    int memberID;
+    char name[100];
+    char email[100];
+    char phone[11]; // 10 digits + null terminator
+} Member;
+typedef struct
+{
+    int bookID;
+    int memberID;
+    time_t borrowDate;
+    time_t returnDate; // 0 if not yet returned
+    int isOverdue;     // 1 if overdue, 0 otherwise
+} BorrowedRecord;
+
+#define BOOKS_FILE "data/books.dat"
+#define MEMBERS_FILE "data/members.dat"
+#define BORROWED_BOOKS_FILE "data/borrow.dat"
+
+// Storage operations behind the menus, kept free of console I/O so the
+// benchmark can drive them directly (src/library.c)
+typedef enum
+{
+    LIBRARY_OK,
+    LIBRARY_NO_MEMBER,
+    LIBRARY_NO_BOOK,
+    LIBRARY_OUT_OF_STOCK,
+    LIBRARY_NO_LOAN,
+    LIBRARY_NO_HOLD,
+    LIBRARY_HOLD_EXISTS,
+    LIBRARY_NO_ITEM,
+    LIBRARY_ITEM_UNAVAILABLE, // on loan, set aside for someone else or withdrawn
+    LIBRARY_ITEM_EXISTS,
+    LIBRARY_LIMIT_REACHED,   // the member's category caps concurrent loans (policy.h)
+    LIBRARY_OVERDUE_BLOCKED, // too many overdue loans to borrow more
+    LIBRARY_IO_ERROR
+} LibraryStatus;
+
+typedef int (*BookVisitor)(const Book *book, void *ctx); // return 0 to stop
+
+// ASCII case-insensitive ordering, the portable form of _stricmp/strcasecmp
+int libraryCompareText(const char *a, const char *b);
+
+int isValidBookID(int bookID);     // 1 if the ID is positive and unused
+int isValidMemberID(int memberID); // 1 if the ID is positive and unused
+long librarySearchTitle(const char *title, BookVisitor visit, void *ctx); // case-insensitive exact match
+
+// On success book and member hold the updated records
+LibraryStatus libraryIssueBook(int memberID, int bookID, Book *book, Member *member);
+// *heldFor is the member whose hold the returned copy was set aside for, or 0
+LibraryStatus libraryReturnBook(int memberID, int bookID, BorrowedRecord *record, int *heldFor);
+
+// The same, keyed by a copy's barcode (see items.h). Issuing by book ID
+// lends a registered copy when the book has any.
+LibraryStatus libraryIssueItem(int memberID, const char *barcode, Book *book, Member *member);
+LibraryStatus libraryReturnItem(const char *barcode, BorrowedRecord *record, int *heldFor);
+
+// Registers a copy (it goes to a waiting hold, else adds to quantity), or
+// withdraws one from the shelf
+LibraryStatus libraryAddItem(int bookID, const char *barcode, int *heldFor);
+LibraryStatus libraryWithdrawItem(const char *barcode);
+// Sets quantity to the copies on the shelf for every book with registered
+// copies; returns how many books were corrected, or -1
+long libraryReconcileItems(void);
+
+// Holds on out-of-stock books (see holds.h). Cancelling a hold whose copy
+// was already set aside passes that copy on, as a return would.
+LibraryStatus libraryPlaceHold(int memberID, int bookID, long *position);
+LibraryStatus libraryCancelHold(int memberID, int bookID, int *heldFor);
+
+// Rewrite the file without the record through a temp file
+int libraryDeleteBook(int bookID);
+int libraryDeleteMember(int memberID);
+
+// Drops every cached view of the data files, after a rollback or when
+// another process has changed them (a replica's follower)
+void libraryReload(void);
+
+#endif // LIBRARY_H
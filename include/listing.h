@@ -0,0 +1,45 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <stddef.h>
+#include "library.h"
+
+// Sorted, paginated access to the books and members shards for the listing
+// screens. For each sort key the module keeps the record positions in sorted
+// order; an order is built with one scan the first time it is used and then
+// kept current by the add/change hooks, so fetching a page is a slice of the
+// order plus one read per record on the page.
+
+#define LISTING_PAGE_SIZE 20
+
+typedef enum
+{
+    BOOK_SORT_ID,
+    BOOK_SORT_TITLE,
+    BOOK_SORT_AUTHOR,
+    BOOK_SORT_DATE,
+    BOOK_SORT_QUANTITY,
+    BOOK_SORT_KEY_COUNT
+} BookSortKey;
+
+typedef enum
+{
+    MEMBER_SORT_ID,
+    MEMBER_SORT_NAME,
+    MEMBER_SORT_KEY_COUNT
+} MemberSortKey;
+
+// Fills page with up to limit records starting at offset in key order and
+// returns how many were filled; *total receives the number of records.
+size_t listBooks(BookSortKey key, size_t offset, size_t limit, Book *page, size_t *total);
+size_t listMembers(MemberSortKey key, size_t offset, size_t limit, Member *page, size_t *total);
+
+// Hooks for writers. Changed means rewritten in place at the same position.
+void listingBookAdded(long recordIndex);
+void listingBookChanged(long recordIndex);
+void listingBooksInvalidate(void);
+void listingMemberAdded(long recordIndex);
+void listingMemberChanged(long recordIndex);
+void listingMembersInvalidate(void);
+
+#endif // LISTING_H
@@ -0,0 +1,71 @@
+#ifndef LOAN_ARCHIVE_H
+#define LOAN_ARCHIVE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "library.h"
+
+// Tiered loan history. borrow.dat keeps only open loans (plus loans returned
+// since the last compaction); closed loans are moved into immutable archive
+// segments. A segment is a run of blocks of up to LOAN_ARCHIVE_BLOCK_RECORDS
+// loans sorted by borrowDate, each block delta+varint encoded and optionally
+// LZ compressed. The manifest lists every segment with its min/max borrow and
+// return times so readers can skip segments that cannot match.
+
+#define LOAN_ARCHIVE_MANIFEST "data/borrow_archive.idx"
+#define LOAN_ARCHIVE_SEGMENT_FORMAT "data/borrow_archive_%06u.seg"
+#define LOAN_ARCHIVE_BLOCK_RECORDS 1024
+// Startup compaction runs once this many returned loans sit in borrow.dat
+#define LOAN_ARCHIVE_MIN_CLOSED 512
+
+enum
+{
+    LOAN_CODEC_NONE = 0,
+    LOAN_CODEC_LZ = 1
+};
+
+typedef struct
+{
+    uint32_t segmentID;
+    uint32_t recordCount;
+    uint32_t blockCount;
+    uint32_t reserved;
+    int64_t minBorrow;
+    int64_t maxBorrow;
+    int64_t minReturn;
+    int64_t maxReturn;
+} LoanSegmentInfo;
+
+typedef struct
+{
+    uint32_t recordCount;
+    uint32_t rawLength;
+    uint32_t storedLength;
+    uint32_t codec;
+    int64_t minBorrow;
+    int64_t maxBorrow;
+    int64_t minReturn;
+    int64_t maxReturn;
+    long payloadOffset; // where the block payload starts in the segment file
+} LoanBlockInfo;
+
+// Move every returned loan out of borrow.dat into a new segment.
+// Returns the number of loans archived, or -1 on error.
+int loanArchiveCompact(int codec);
+int loanArchiveCompactIfNeeded(void);
+
+// Segment list from the manifest; the caller frees *segments
+int loanArchiveSegments(LoanSegmentInfo **segments, size_t *count);
+
+FILE *loanArchiveOpenSegment(uint32_t segmentID);
+// Block directory of an open segment; the caller frees *blocks
+int loanArchiveReadBlocks(FILE *segment, LoanBlockInfo **blocks, size_t *count);
+// Decodes one block into out, which must hold block->recordCount records
+int loanArchiveDecodeBlock(FILE *segment, const LoanBlockInfo *block, BorrowedRecord *out);
+
+// Visits every archived loan, segment by segment in borrowDate order within
+// each segment. Stops early when visit returns 0.
+int loanArchiveForEach(int (*visit)(const BorrowedRecord *record, void *ctx), void *ctx);
+
+#endif // LOAN_ARCHIVE_H
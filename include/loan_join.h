@@ -0,0 +1,48 @@
+#ifndef LOAN_JOIN_H
+#define LOAN_JOIN_H
+
+#include <stddef.h>
+#include <time.h>
+#include "library.h"
+#include "id_index.h"
+#include "arena.h"
+
+// Hash join of loans against books and members. loanJoinBuild reads
+// the book and member shards once into hash tables keyed by ID (keeping only
+// the columns the reports print), after which each loan is enriched by two
+// hash probes. A report over L loans costs O(L + B + M) instead of one scan
+// of each file per loan. The tables live in the request arena: free joins
+// in the reverse order they were built, and only after any arena use that
+// started in between has ended.
+
+typedef struct
+{
+    IdIndex bookIndex;   // bookID -> row in titles
+    IdIndex memberIndex; // memberID -> row in names
+    char (*titles)[100];
+    char (*names)[100];
+    size_t bookCount;
+    size_t memberCount;
+    ArenaMark mark; // where the tables start in the request arena
+} LoanJoin;
+
+typedef struct
+{
+    BorrowedRecord loan;
+    const char *title;      // NULL when the book has been deleted
+    const char *memberName; // NULL when the member has been deleted
+    int daysOut;            // until today for open loans, else until return
+} LoanView;
+
+typedef int (*LoanViewVisitor)(const LoanView *view, void *ctx);
+
+int loanJoinBuild(LoanJoin *join);
+void loanJoinFree(LoanJoin *join);
+void loanJoinProbe(const LoanJoin *join, const BorrowedRecord *loan, time_t now, LoanView *view);
+
+// Streams the open loans in borrow.dat through the join, in file order;
+// the scan for them runs on all cores.
+// Returns the number of loans visited, or -1 on error.
+long loanJoinOpenLoans(const LoanJoin *join, LoanViewVisitor visit, void *ctx);
+
+#endif // LOAN_JOIN_H
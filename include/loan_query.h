@@ -0,0 +1,53 @@
+#ifndef LOAN_QUERY_H
+#define LOAN_QUERY_H
+
+#include <stddef.h>
+#include <time.h>
+#include "library.h"
+
+// Time-range queries over the full loan history: borrow.dat plus every
+// archive segment. Both sources are read in blocks, and every block carries
+// a zone map (min/max borrowDate and returnDate, count of open loans), so a
+// query only decodes blocks whose zone can overlap the requested range.
+// Candidate blocks are merged on borrowDate, which yields results in time
+// order and lets a query stop as soon as it passes the end of the range or
+// reaches its limit.
+//
+// The zone maps for borrow.dat live in a sidecar file that a query extends
+// over the loans appended since it was saved, then swaps in whole. A missed
+// update only makes a zone wider, never narrower, so a stale sidecar costs
+// speed but not results. A read-only process builds the extension in memory.
+
+#define LOAN_ZONE_MAP_FILE "data/borrow.zmap"
+#define LOAN_ZONE_TEMP_FILE "data/borrow.zmap.tmp"
+#define LOAN_ZONE_BLOCK_RECORDS 256
+
+typedef enum
+{
+    LOAN_QUERY_BORROWED, // borrowDate inside [from, to]
+    LOAN_QUERY_ACTIVE    // loan was out at some point in [from, to]
+} LoanQueryMode;
+
+typedef struct
+{
+    time_t from; // inclusive
+    time_t to;   // inclusive
+    LoanQueryMode mode;
+    int bookID;   // 0 matches every book
+    int memberID; // 0 matches every member
+    size_t limit; // 0 means no limit
+} LoanQuery;
+
+typedef int (*LoanVisitor)(const BorrowedRecord *record, void *ctx);
+
+// Calls visit for each matching loan in borrowDate order; stops early when
+// visit returns 0. Returns the number of loans visited, or -1 on error.
+long loanQueryRun(const LoanQuery *query, LoanVisitor visit, void *ctx);
+
+// Zone map maintenance for borrow.dat. Reset swaps in an empty map when
+// the current operation commits; call it from inside an operation that
+// rewrites borrow.dat.
+void loanZoneMapNoteReturn(long recordIndex, time_t returnDate);
+int loanZoneMapReset(void);
+
+#endif // LOAN_QUERY_H
@@ -0,0 +1,74 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Always-on instrumentation. Timers feed log-linear latency histograms
+// (16 sub-buckets per power of two, so about 6% resolution) and counters
+// track the I/O behind each operation. Every thread updates its own block
+// without locks; a dump merges the blocks.
+//
+// The report is written at exit, and on SIGUSR1 the next time an operation
+// finishes. LMS_METRICS_FILE selects the destination: a path (default
+// data/metrics.log, appended), "-" for stderr, or "off". Building with
+// LMS_NO_METRICS compiles every call away.
+
+typedef enum
+{
+    TIMER_LOGIN,
+    TIMER_IS_VALID_BOOK_ID,
+    TIMER_IS_VALID_MEMBER_ID,
+    TIMER_ADD_RECORD,
+    TIMER_EDIT_RECORD,
+    TIMER_DELETE_BOOK,
+    TIMER_DELETE_MEMBER,
+    TIMER_LIST_PAGE,
+    TIMER_SEARCH_BOOKS,
+    TIMER_ISSUE_BOOK,
+    TIMER_RETURN_BOOK,
+    TIMER_VIEW_ISSUED,
+    TIMER_LOAN_HISTORY,
+    TIMER_ARCHIVE_COMPACT,
+    TIMER_STATS_LOAD,
+    TIMER_REPORT,
+    TIMER_EXPORT,
+    TIMER_COUNT
+} MetricsTimer;
+
+typedef enum
+{
+    COUNTER_FILE_OPENS,
+    COUNTER_RECORDS_SCANNED,
+    COUNTER_BYTES_READ,
+    COUNTER_BYTES_WRITTEN,
+    COUNTER_FSYNCS,
+    COUNTER_CACHE_HITS, // record cache lookups (record_cache.h)
+    COUNTER_CACHE_MISSES,
+    COUNTER_COUNT
+} MetricsCounter;
+
+#ifndef LMS_NO_METRICS
+
+uint64_t metricsNow(void); // monotonic nanoseconds
+void metricsRecord(MetricsTimer timer, uint64_t nanoseconds);
+void metricsCount(MetricsCounter counter, uint64_t amount);
+
+// Scoped timing: uint64_t start = metricsNow(); ... metricsStop(TIMER_X, start);
+#define metricsStop(timer, start) metricsRecord((timer), metricsNow() - (start))
+
+void metricsInit(void); // installs the exit and signal dumps
+int metricsDump(FILE *out);
+
+#else
+
+#define metricsNow() ((uint64_t)0)
+#define metricsRecord(timer, nanoseconds) ((void)0)
+#define metricsCount(counter, amount) ((void)0)
+#define metricsStop(timer, start) ((void)(start))
+#define metricsInit() ((void)0)
+#define metricsDump(out) (0)
+
+#endif // LMS_NO_METRICS
+
+#endif // METRICS_H
@@ -0,0 +1,30 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Growable text buffer for screens and exports: everything is formatted
+// into memory and handed to the stream in one fwrite, instead of one stdio
+// call per field.
+typedef struct
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+} OutputBuffer;
+
+#define OUTPUT_BUFFER_DEFAULT_CAPACITY (64 * 1024)
+
+int outputBufferInit(OutputBuffer *buffer, size_t capacity);
+void outputBufferFree(OutputBuffer *buffer);
+void outputBufferReset(OutputBuffer *buffer);
+
+int outputBufferAppend(OutputBuffer *buffer, const char *text, size_t length);
+int outputBufferPuts(OutputBuffer *buffer, const char *line); // adds '\n' like puts
+int outputBufferPrintf(OutputBuffer *buffer, const char *format, ...);
+
+// Writes the contents with a single fwrite, flushes and empties the buffer
+int outputBufferFlush(OutputBuffer *buffer, FILE *stream);
+
+#endif // OUTPUT_BUFFER_H
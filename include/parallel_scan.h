@@ -0,0 +1,45 @@
+#ifndef PARALLEL_SCAN_H
+#define PARALLEL_SCAN_H
+
+#include <stddef.h>
+
+// Full scans of fixed-size record files spread over all cores. The files
+// are cut into chunks of about SCAN_CHUNK_BYTES; each worker thread starts
+// on its own contiguous run of chunks and, once that is done, steals the
+// back half of the largest run left. Workers only evaluate the filter and
+// keep the matching records; the calling thread visits them in file order,
+// chunk by chunk, so results come out exactly as a sequential fread loop
+// would produce them. Buffers come from the request arena and matches from
+// one arena per worker (see arena.h), so a scan no larger than an earlier
+// one allocates nothing but the FILE handles.
+//
+// LMS_SCAN_THREADS sets the number of workers (default: one per core). A
+// scan with one worker, or with a single chunk, runs on the calling thread
+// without buffering.
+
+#define SCAN_CHUNK_BYTES (256 * 1024)
+#define SCAN_MAX_THREADS 64
+
+// Called on worker threads: it may only read the record and ctx
+typedef int (*ScanFilter)(const void *record, void *ctx);
+// Called on the calling thread, in order; returning 0 stops the scan.
+// index is the record's position within files[file].
+typedef int (*ScanVisitor)(const void *record, unsigned file, long index, void *ctx);
+
+typedef struct
+{
+    const char *const *files; // scanned one after the other; a missing file is empty
+    unsigned fileCount;
+    size_t recordSize;
+    ScanFilter filter; // NULL keeps every record
+    void *filterCtx;
+    ScanVisitor visit;
+    void *visitCtx;
+} ScanJob;
+
+// Returns the number of records visited, or -1 when a file could not be
+// opened or read (the records visited before that stand)
+long parallelScan(const ScanJob *job);
+unsigned parallelScanThreads(void);
+
+#endif // PARALLEL_SCAN_H
@@ -0,0 +1,72 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stddef.h>
+#include <time.h>
+
+// Borrowing policy: every member belongs to a category (Standard unless
+// assigned otherwise), and each category sets a loan period, a cap on
+// concurrent loans and how many overdue loans block further issues.
+//
+// The check on issue reads only in-memory state: each member's open loans,
+// kept sorted by borrow date. That state is built from borrow.dat once, on
+// first use, and updated by every issue and return, so a check is a count
+// and one borrow date compared against the policy, never a history scan.
+//
+// The policies are kept in policies.dat (defaults when it is missing), and
+// category assignments in member_categories.dat with an in-memory index.
+
+#define POLICIES_FILE "data/policies.dat"
+#define MEMBER_CATEGORIES_FILE "data/member_categories.dat"
+#define POLICY_NAME_SIZE 24
+#define POLICY_STANDARD_LOAN_DAYS 7 // Standard's period when policies.dat is missing
+
+typedef enum
+{
+    POLICY_STANDARD,
+    POLICY_STUDENT,
+    POLICY_STAFF,
+    POLICY_RESTRICTED,
+    POLICY_CATEGORY_COUNT
+} PolicyCategory;
+
+typedef struct
+{
+    char name[POLICY_NAME_SIZE];
+    int maxLoans;     // concurrent loans; 0 means no cap
+    int loanDays;     // loan period
+    int overdueBlock; // overdue loans that block new issues; 0 never blocks
+} LoanPolicy;
+
+typedef enum
+{
+    POLICY_ALLOW,
+    POLICY_LIMIT_REACHED,
+    POLICY_OVERDUE_BLOCKED
+} PolicyDecision;
+
+typedef struct
+{
+    int category;
+    int openLoans;
+    int overdueLoans;
+} MemberStanding;
+
+int policyLoad(void);
+void policyInvalidate(void); // rebuild from the files on next use
+
+const LoanPolicy *policyGet(int category); // NULL for an unknown category
+int policySet(int category, const LoanPolicy *policy);
+
+int policyMemberCategory(int memberID);
+int policySetMemberCategory(int memberID, int category);
+
+// Whether the member may borrow one more book at time now
+PolicyDecision policyCheckIssue(int memberID, time_t now, MemberStanding *standing);
+time_t policyDueDate(int memberID, time_t borrowDate);
+
+// Keep the open-loan state in step with borrow.dat
+void policyNoteIssue(int memberID, time_t borrowDate);
+void policyNoteReturn(int memberID, time_t borrowDate);
+
+#endif // POLICY_H
@@ -0,0 +1,33 @@
+#ifndef RECORD_CACHE_H
+#define RECORD_CACHE_H
+
+#include <stddef.h>
+#include "shards.h"
+
+// Bounded cache of book and member records by ID, least recently used out
+// first, so the bestsellers and regulars of a skewed circulation load are
+// served from memory instead of their shard. An entry keeps the record's
+// position, so an update can be written back without a lookup.
+//
+// The shards keep it current: shardsFind and the library's lookups fill it,
+// shardsWrite and shardsAppend write the new record through, and
+// shardsDelete drops the record. An operation that swapped files in (a
+// delete, a reshard) or was rolled back empties it when it ends, since
+// positions may have moved, as does shardsInvalidate.
+//
+// LMS_RECORD_CACHE sets the memory budget in KiB (default
+// RECORD_CACHE_DEFAULT_KB, about 14,000 records); 0 or "off" turns it off.
+// Lookups are counted in the metrics as cache_hits and cache_misses.
+
+#define RECORD_CACHE_DEFAULT_KB 4096
+
+// Returns 1 and copies the record and its position when the ID is cached
+int recordCacheGet(ShardKind kind, int id, void *record, long *position);
+// Adds or refreshes the record found or written at position
+void recordCachePut(ShardKind kind, long position, const void *record);
+void recordCacheRemove(ShardKind kind, int id);
+void recordCacheClear(void);
+// Records the budget holds
+size_t recordCacheCapacity(void);
+
+#endif // RECORD_CACHE_H
@@ -0,0 +1,43 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <stdint.h>
+#include "changes.h"
+
+// Warm standby. A follower is a data folder kept in step with a primary's
+// by applying the primary's change log (changes.h), read straight from the
+// primary's data/ through a shared directory: books and members, issues
+// and returns with their statistics and zone maps. Copies, holds and member
+// categories are not in the log, so a follower keeps the ones of the copy
+// of data/ it started from.
+//
+// data/replica.pos marks the folder as a follower and holds the primary
+// sequence it has applied. It is written in the journal operation that
+// applies the changes, so a follower killed at any point resumes right
+// after the last batch that committed. The applied changes are logged again
+// in the follower's own change log, which stays in step with the primary's
+// when the follower started from a copy of it. While the marker exists the
+// program serves the folder read-only; promoting the follower removes it.
+
+#define REPLICA_FILE "data/replica.pos"
+#define REPLICA_BATCH 256 // changes applied per journal operation
+
+int replicaIsFollower(void);
+// The last primary sequence applied; 0 for a folder that is not a follower
+uint64_t replicaApplied(void);
+
+// Makes the current folder a follower, positioned at the end of its own
+// change log: a copy of the primary's data/ resumes where it was taken
+int replicaInit(void);
+// Applies up to REPLICA_BATCH committed changes from the cursor as one
+// operation; a delete gets an operation of its own. Returns how many, or -1 when the batch was rolled back (the
+// cursor is then back at the position).
+long replicaApply(ChangeCursor *cursor);
+// Applies primaryLog as it grows until the folder is promoted (returns 1)
+// or applying fails (0). Stop it with a signal: the journal settles the
+// batch in flight at the next start.
+int replicaFollow(const char *primaryLog);
+// Turns a stopped follower into a primary
+int replicaPromote(void);
+
+#endif // REPLICA_H
@@ -0,0 +1,90 @@
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "parallel_scan.h"
+
+// Books and members split by ID into N shard files, so that a lookup by ID
+// and a delete only read or rewrite the one shard the ID hashes to. The
+// count for each kind is kept in data/shards.idx:
+//
+//   LMS-SHARDS 1
+//   books 8
+//   members 4
+//
+// With no manifest, or a count of 1, the data lives in the single
+// books.dat/members.dat as before. Otherwise record ID % N picks the file
+// data/books_NNN.dat (members_NNN.dat).
+//
+// Callers address a record by its position, slot * N + shard, where slot
+// is its index within the shard file. With one shard that is the record
+// index in the file, and like it, a position stays valid until a delete
+// or a reshard rewrites the file.
+
+#define SHARDS_FILE "data/shards.idx"
+#define SHARDS_MAX 64
+
+typedef enum
+{
+    SHARD_BOOKS,
+    SHARD_MEMBERS,
+    SHARD_KIND_COUNT
+} ShardKind;
+
+// The shard files of one kind, opened on first use. Scans visit the shards
+// in order and each shard in file order.
+typedef struct
+{
+    ShardKind kind;
+    unsigned count;
+    int writable;
+    int failed; // a shard could not be opened (other than not existing) or read
+    int moved;  // a read or write moved a file since the scan's last record
+    unsigned scanShard;
+    long scanSlot;
+    FILE *files[SHARDS_MAX];
+    unsigned char opened[SHARDS_MAX];
+} ShardSet;
+
+size_t shardsRecordSize(ShardKind kind);
+unsigned shardsCount(ShardKind kind);
+void shardsPath(ShardKind kind, unsigned shard, unsigned count, char *path, size_t size);
+
+// Writable sets open their files for update and journal every write
+void shardsOpen(ShardSet *set, ShardKind kind, int writable);
+// Returns 0 when any shard failed to open or read
+int shardsClose(ShardSet *set);
+
+// Next record of a scan and its position; 0 at the end or on a read error
+int shardsNext(ShardSet *set, void *record, long *position);
+void shardsRewind(ShardSet *set);
+int shardsRead(ShardSet *set, long position, void *record);
+// Write, Append and Delete also log the change (see changes.h) and keep the
+// record cache (record_cache.h) and ID filters (id_filter.h) current; Find
+// reads through the cache
+int shardsWrite(ShardSet *set, long position, const void *record);
+// Scans only the shard the ID hashes to; the first record with it wins
+int shardsFind(ShardSet *set, int id, void *record, long *position);
+
+// Appends to the record's shard and returns its position, or -1
+long shardsAppend(ShardKind kind, const void *record);
+long shardsRecordCount(ShardKind kind);
+
+typedef int (*ShardVisitor)(const void *record, long position, void *ctx);
+// Full scan on all cores: visits the records filter keeps in the same order
+// as shardsNext. Returns the number visited, or -1 on a read error.
+long shardsScan(ShardKind kind, ScanFilter filter, void *filterCtx, ShardVisitor visit, void *ctx);
+// Rewrites the ID's shard without it; the swap is part of the current
+// journal operation
+int shardsDelete(ShardKind kind, int id);
+
+// Redistributes the records of a kind over count shards as one journaled
+// operation, then removes the files it no longer uses. Stop the program
+// first: cached positions do not survive it.
+int shardsReshard(ShardKind kind, unsigned count);
+
+// Drops the cached manifest and records, after a rollback or a reshard
+void shardsInvalidate(void);
+
+#endif // SHARDS_H
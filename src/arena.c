@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "../include/arena.h"
+
+struct ArenaBlock
+{
+    ArenaBlock *next;
+    char *base; // first aligned byte after the header
+    size_t size;
+    size_t used;
+};
+
+static Arena request = {NULL, NULL, 0, 0};
+
+static size_t roundUp(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+static ArenaBlock *newBlock(size_t size)
+{
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + size + ARENA_ALIGNMENT);
+    if (!block)
+    {
+        return NULL;
+    }
+    uintptr_t start = (uintptr_t)(block + 1);
+    block->base = (char *)((start + ARENA_ALIGNMENT - 1) & ~(uintptr_t)(ARENA_ALIGNMENT - 1));
+    block->size = size;
+    block->used = 0;
+    block->next = NULL;
+    return block;
+}
+
+static void freeBlocks(ArenaBlock *block)
+{
+    while (block)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+void arenaInit(Arena *arena)
+{
+    arena->blocks = NULL;
+    arena->spare = NULL;
+    arena->held = 0;
+    arena->peak = 0;
+}
+
+void arenaFree(Arena *arena)
+{
+    freeBlocks(arena->blocks);
+    freeBlocks(arena->spare);
+    arenaInit(arena);
+}
+
+void *arenaAlloc(Arena *arena, size_t size)
+{
+    // Every size is a multiple of the alignment, so the blocks need no
+    // padding and one block of the peak size fits any earlier request
+    size = roundUp(size ? size : 1);
+    ArenaBlock *block = arena->blocks;
+    if (!block || block->size - block->used < size)
+    {
+        ArenaBlock **link = &arena->spare;
+        while (*link && (*link)->size < size)
+        {
+            link = &(*link)->next;
+        }
+        block = *link;
+        if (block)
+        {
+            *link = block->next;
+        }
+        else
+        {
+            size_t blockSize = arena->blocks ? arena->blocks->size * 2 : ARENA_MIN_BLOCK;
+            block = newBlock(blockSize > size ? blockSize : size);
+            if (!block)
+            {
+                return NULL;
+            }
+        }
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    void *memory = block->base + block->used;
+    block->used += size;
+    arena->held += size;
+    if (arena->held > arena->peak)
+    {
+        arena->peak = arena->held;
+    }
+    return memory;
+}
+
+ArenaMark arenaMark(const Arena *arena)
+{
+    ArenaMark mark = {arena->blocks, arena->blocks ? arena->blocks->used : 0};
+    return mark;
+}
+
+void arenaRewind(Arena *arena, ArenaMark mark)
+{
+    while (arena->blocks && arena->blocks != mark.block)
+    {
+        ArenaBlock *block = arena->blocks;
+        arena->blocks = block->next;
+        arena->held -= block->used;
+        block->next = arena->spare;
+        arena->spare = block;
+    }
+    if (arena->blocks)
+    {
+        arena->held -= arena->blocks->used - mark.used;
+        arena->blocks->used = mark.used;
+        return;
+    }
+
+    // Back at the start: keep one block that holds the peak
+    if (arena->peak > ARENA_RETAIN_MAX)
+    {
+        freeBlocks(arena->spare);
+        arena->spare = NULL;
+        arena->peak = 0;
+    }
+    else if (arena->spare && arena->spare->next)
+    {
+        freeBlocks(arena->spare);
+        arena->spare = newBlock(arena->peak);
+    }
+}
+
+Arena *requestArena(void)
+{
+    return &request;
+}
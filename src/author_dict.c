@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../include/library.h"
+#include "../include/author_dict.h"
+#include "../include/metrics.h"
+#include "../include/shards.h"
+
+#define AUTHOR_DICT_INITIAL_SLOTS 64
+
+typedef struct
+{
+    char *key;  // normalized author, owned by the dictionary
+    char *name; // first spelling seen, used for display
+    AuthorPosting *postings;
+    size_t postingCount;
+    size_t postingCapacity;
+} AuthorEntry;
+
+static AuthorEntry *entries = NULL; // entries[id - 1]
+static size_t entryCount = 0;
+static size_t entryCapacity = 0;
+
+static AuthorID *slots = NULL; // open addressing table of IDs, 0 = empty
+static size_t slotCount = 0;
+
+static int loaded = 0;
+
+// FNV-1a over the normalized key
+static uint32_t hashKey(const char *key)
+{
+    uint32_t h = 2166136261u;
+    while (*key)
+    {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static char *copyString(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = malloc(len);
+    if (copy)
+    {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
+
+void authorDictNormalize(const char *author, char *out, size_t outSize)
+{
+    size_t len = 0;
+    int pendingSpace = 0;
+
+    if (outSize == 0)
+    {
+        return;
+    }
+    while (*author && isspace((unsigned char)*author))
+    {
+        author++;
+    }
+    for (; *author && len + 1 < outSize; author++)
+    {
+        unsigned char c = (unsigned char)*author;
+        if (isspace(c))
+        {
+            pendingSpace = 1;
+            continue;
+        }
+        if (pendingSpace && len + 2 < outSize)
+        {
+            out[len++] = ' ';
+        }
+        pendingSpace = 0;
+        out[len++] = (char)tolower(c);
+    }
+    out[len] = '\0';
+}
+
+// Returns the slot holding key, or the empty slot where it would go
+static size_t findSlot(const char *key)
+{
+    size_t mask = slotCount - 1;
+    size_t i = hashKey(key) & mask;
+    while (slots[i] != AUTHOR_ID_NONE && strcmp(entries[slots[i] - 1].key, key) != 0)
+    {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static int growSlots(void)
+{
+    size_t newCount = slotCount ? slotCount * 2 : AUTHOR_DICT_INITIAL_SLOTS;
+    AuthorID *newSlots = calloc(newCount, sizeof(AuthorID));
+    if (!newSlots)
+    {
+        return 0;
+    }
+    free(slots);
+    slots = newSlots;
+    slotCount = newCount;
+    for (size_t id = 1; id <= entryCount; id++)
+    {
+        slots[findSlot(entries[id - 1].key)] = (AuthorID)id;
+    }
+    return 1;
+}
+
+static void clearDict(void)
+{
+    for (size_t i = 0; i < entryCount; i++)
+    {
+        free(entries[i].key);
+        free(entries[i].name);
+        free(entries[i].postings);
+    }
+    free(entries);
+    free(slots);
+    entries = NULL;
+    slots = NULL;
+    entryCount = entryCapacity = slotCount = 0;
+    loaded = 0;
+}
+
+static AuthorID lookupKey(const char *key)
+{
+    if (slotCount == 0)
+    {
+        return AUTHOR_ID_NONE;
+    }
+    return slots[findSlot(key)];
+}
+
+static AuthorID internKey(const char *key, const char *name)
+{
+    AuthorID id = lookupKey(key);
+    if (id != AUTHOR_ID_NONE)
+    {
+        return id;
+    }
+
+    // Keep the load factor under 70%
+    if ((entryCount + 1) * 10 > slotCount * 7 && !growSlots())
+    {
+        return AUTHOR_ID_NONE;
+    }
+    if (entryCount == entryCapacity)
+    {
+        size_t newCapacity = entryCapacity ? entryCapacity * 2 : AUTHOR_DICT_INITIAL_SLOTS;
+        AuthorEntry *grown = realloc(entries, newCapacity * sizeof(AuthorEntry));
+        if (!grown)
+        {
+            return AUTHOR_ID_NONE;
+        }
+        entries = grown;
+        entryCapacity = newCapacity;
+    }
+
+    AuthorEntry *entry = &entries[entryCount];
+    memset(entry, 0, sizeof(*entry));
+    entry->key = copyString(key);
+    entry->name = copyString(name);
+    if (!entry->key || !entry->name)
+    {
+        free(entry->key);
+        free(entry->name);
+        return AUTHOR_ID_NONE;
+    }
+    entryCount++;
+    id = (AuthorID)entryCount;
+    slots[findSlot(key)] = id;
+    return id;
+}
+
+static void addPosting(AuthorID id, int bookID, long recordIndex)
+{
+    AuthorEntry *entry = &entries[id - 1];
+    if (entry->postingCount == entry->postingCapacity)
+    {
+        size_t newCapacity = entry->postingCapacity ? entry->postingCapacity * 2 : 4;
+        AuthorPosting *grown = realloc(entry->postings, newCapacity * sizeof(AuthorPosting));
+        if (!grown)
+        {
+            return;
+        }
+        entry->postings = grown;
+        entry->postingCapacity = newCapacity;
+    }
+    entry->postings[entry->postingCount].bookID = bookID;
+    entry->postings[entry->postingCount].recordIndex = recordIndex;
+    entry->postingCount++;
+}
+
+// Build the dictionary with one pass over the books
+int authorDictLoad(void)
+{
+    if (loaded)
+    {
+        return 1;
+    }
+    clearDict();
+    if (!growSlots())
+    {
+        return 0;
+    }
+
+    ShardSet books;
+    shardsOpen(&books, SHARD_BOOKS, 0);
+    Book book;
+    long index;
+    long scanned = 0;
+    char key[sizeof(book.author)];
+    while (shardsNext(&books, &book, &index))
+    {
+        book.author[sizeof(book.author) - 1] = '\0';
+        authorDictNormalize(book.author, key, sizeof(key));
+        AuthorID id = internKey(key, book.author);
+        if (id != AUTHOR_ID_NONE)
+        {
+            addPosting(id, book.bookID, index);
+        }
+        scanned++;
+    }
+    shardsClose(&books);
+    metricsCount(COUNTER_RECORDS_SCANNED, (uint64_t)scanned);
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)scanned * sizeof(Book));
+    loaded = 1;
+    return 1;
+}
+
+void authorDictInvalidate(void)
+{
+    clearDict();
+}
+
+AuthorID authorDictLookup(const char *author)
+{
+    char key[100];
+    if (!authorDictLoad())
+    {
+        return AUTHOR_ID_NONE;
+    }
+    authorDictNormalize(author, key, sizeof(key));
+    return lookupKey(key);
+}
+
+AuthorID authorDictIntern(const char *author)
+{
+    char key[100];
+    if (!authorDictLoad())
+    {
+        return AUTHOR_ID_NONE;
+    }
+    authorDictNormalize(author, key, sizeof(key));
+    return internKey(key, author);
+}
+
+const char *authorDictName(AuthorID id)
+{
+    if (id == AUTHOR_ID_NONE || id > entryCount)
+    {
+        return NULL;
+    }
+    return entries[id - 1].name;
+}
+
+// The add/remove hooks only touch a dictionary that is already built; an
+// unbuilt one picks the change up from the books when it is first loaded.
+void authorDictAddBook(const char *author, int bookID, long recordIndex)
+{
+    char key[100];
+    if (!loaded)
+    {
+        return;
+    }
+    authorDictNormalize(author, key, sizeof(key));
+    AuthorID id = internKey(key, author);
+    if (id != AUTHOR_ID_NONE)
+    {
+        addPosting(id, bookID, recordIndex);
+    }
+}
+
+void authorDictRemoveBook(const char *author, int bookID)
+{
+    char key[100];
+    if (!loaded)
+    {
+        return;
+    }
+    authorDictNormalize(author, key, sizeof(key));
+    AuthorID id = lookupKey(key);
+    if (id == AUTHOR_ID_NONE)
+    {
+        return;
+    }
+
+    AuthorEntry *entry = &entries[id - 1];
+    for (size_t i = 0; i < entry->postingCount; i++)
+    {
+        if (entry->postings[i].bookID == bookID)
+        {
+            // Keep postings in file order so search output matches a scan
+            memmove(&entry->postings[i], &entry->postings[i + 1],
+                    (entry->postingCount - i - 1) * sizeof(AuthorPosting));
+            entry->postingCount--;
+            return;
+        }
+    }
+}
+
+const AuthorPosting *authorDictPostings(AuthorID id, size_t *count)
+{
+    if (id == AUTHOR_ID_NONE || id > entryCount)
+    {
+        *count = 0;
+        return NULL;
+    }
+    *count = entries[id - 1].postingCount;
+    return entries[id - 1].postings;
+}
@@ -0,0 +1,897 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#define makeDirectory(path) _mkdir(path)
+#else
+#include <dirent.h>
+#include <unistd.h>
+#define makeDirectory(path) mkdir(path, 0755)
+#endif
+#include "../include/sha256.h"
+#include "../include/dates.h"
+#include "../include/backup.h"
+#include "../include/metrics.h"
+
+#define DATA_DIR "data"
+#define BACKUP_NAME_SIZE 128
+#define BACKUP_PATH_SIZE 512
+#define BACKUP_HASH_TEXT_SIZE (SHA256_BLOCK_SIZE * 2 + 1)
+#define BACKUP_ATTEMPTS 5 // copies retried when data/ changes underneath
+#define MANIFEST_MAGIC "LMS-SNAPSHOT 1"
+
+typedef char HashText[BACKUP_HASH_TEXT_SIZE];
+
+typedef struct
+{
+    char name[BACKUP_NAME_SIZE];
+    uint64_t size;
+    int64_t mtimeSeconds;
+    long mtimeNanoseconds;
+} FileStamp;
+
+typedef struct
+{
+    FileStamp *files;
+    size_t count;
+    size_t capacity;
+} FileList;
+
+typedef struct
+{
+    FileStamp stamp;
+    size_t firstPage;
+    size_t pageCount;
+} ManifestFile;
+
+typedef struct
+{
+    BackupSnapshotInfo info;
+    ManifestFile *files;
+    size_t fileCount;
+    size_t fileCapacity;
+    HashText *pages;
+    size_t pageCount;
+    size_t pageCapacity;
+} Manifest;
+
+typedef int (*NameVisitor)(const char *name, int isDirectory, void *ctx);
+
+const char *backupDirectory(const char *backupDir)
+{
+    if (backupDir && *backupDir)
+    {
+        return backupDir;
+    }
+    const char *fromEnvironment = getenv("LMS_BACKUP_DIR");
+    return fromEnvironment && *fromEnvironment ? fromEnvironment : BACKUP_DEFAULT_DIR;
+}
+
+static int forEachName(const char *directory, NameVisitor visit, void *ctx)
+{
+#ifdef _WIN32
+    char pattern[BACKUP_PATH_SIZE];
+    snprintf(pattern, sizeof(pattern), "%s/*", directory);
+    struct _finddata_t entry;
+    intptr_t handle = _findfirst(pattern, &entry);
+    if (handle == -1)
+    {
+        return 0;
+    }
+    int ok = 1;
+    do
+    {
+        if (entry.name[0] != '.')
+        {
+            ok = visit(entry.name, (entry.attrib & _A_SUBDIR) != 0, ctx);
+        }
+    } while (ok && _findnext(handle, &entry) == 0);
+    _findclose(handle);
+    return ok;
+#else
+    DIR *dir = opendir(directory);
+    if (!dir)
+    {
+        return 0;
+    }
+    int ok = 1;
+    struct dirent *entry;
+    while (ok && (entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        char path[BACKUP_PATH_SIZE];
+        struct stat st;
+        int length = snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        if (length < 0 || (size_t)length >= sizeof(path))
+        {
+            fprintf(stderr, "Path too long: %s/%s\n", directory, entry->d_name);
+            ok = 0; // Skipping the file would leave it out of the snapshot
+        }
+        else if (stat(path, &st) == 0)
+        {
+            ok = visit(entry->d_name, S_ISDIR(st.st_mode), ctx);
+        }
+    }
+    closedir(dir);
+    return ok;
+#endif
+}
+
+static long mtimeNanoseconds(const struct stat *st)
+{
+#if defined(_WIN32)
+    (void)st;
+    return 0;
+#elif defined(__APPLE__)
+    return st->st_mtimespec.tv_nsec;
+#else
+    return st->st_mtim.tv_nsec;
+#endif
+}
+
+static int endsWith(const char *text, const char *suffix)
+{
+    size_t length = strlen(text);
+    size_t suffixLength = strlen(suffix);
+    return length >= suffixLength && strcmp(text + length - suffixLength, suffix) == 0;
+}
+
+// Scratch files of the running program, its logs and exports are not data
+static int isDataFile(const char *name)
+{
+    return strlen(name) < BACKUP_NAME_SIZE && strchr(name, ' ') == NULL && strncmp(name, "temp_", 5) != 0 &&
+           strncmp(name, "export.", 7) != 0 && strcmp(name, "metrics.log") != 0 && !endsWith(name, ".tmp") &&
+           !endsWith(name, ".restore");
+}
+
+static int addDataFile(const char *name, int isDirectory, void *ctx)
+{
+    FileList *list = ctx;
+    if (isDirectory || !isDataFile(name))
+    {
+        return 1;
+    }
+    char path[BACKUP_PATH_SIZE];
+    struct stat st;
+    snprintf(path, sizeof(path), DATA_DIR "/%s", name);
+    if (stat(path, &st) != 0)
+    {
+        return 1; // Removed since the directory was read
+    }
+    if (list->count == list->capacity)
+    {
+        size_t newCapacity = list->capacity ? list->capacity * 2 : 32;
+        FileStamp *grown = realloc(list->files, newCapacity * sizeof(FileStamp));
+        if (!grown)
+        {
+            return 0;
+        }
+        list->files = grown;
+        list->capacity = newCapacity;
+    }
+    FileStamp *stamp = &list->files[list->count++];
+    strcpy(stamp->name, name);
+    stamp->size = (uint64_t)st.st_size;
+    stamp->mtimeSeconds = (int64_t)st.st_mtime;
+    stamp->mtimeNanoseconds = mtimeNanoseconds(&st);
+    return 1;
+}
+
+static int compareStamps(const void *a, const void *b)
+{
+    return strcmp(((const FileStamp *)a)->name, ((const FileStamp *)b)->name);
+}
+
+static int listDataFiles(FileList *list)
+{
+    memset(list, 0, sizeof(*list));
+    if (!forEachName(DATA_DIR, addDataFile, list))
+    {
+        free(list->files);
+        return 0;
+    }
+    qsort(list->files, list->count, sizeof(FileStamp), compareStamps);
+    return 1;
+}
+
+static int sameStamp(const FileStamp *a, const FileStamp *b)
+{
+    return strcmp(a->name, b->name) == 0 && a->size == b->size && a->mtimeSeconds == b->mtimeSeconds &&
+           a->mtimeNanoseconds == b->mtimeNanoseconds;
+}
+
+static int sameLists(const FileList *a, const FileList *b)
+{
+    if (a->count != b->count)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < a->count; i++)
+    {
+        if (!sameStamp(&a->files[i], &b->files[i]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void manifestFree(Manifest *manifest)
+{
+    free(manifest->files);
+    free(manifest->pages);
+    memset(manifest, 0, sizeof(*manifest));
+}
+
+static ManifestFile *manifestAddFile(Manifest *manifest, const FileStamp *stamp)
+{
+    if (manifest->fileCount == manifest->fileCapacity)
+    {
+        size_t newCapacity = manifest->fileCapacity ? manifest->fileCapacity * 2 : 32;
+        ManifestFile *grown = realloc(manifest->files, newCapacity * sizeof(ManifestFile));
+        if (!grown)
+        {
+            return NULL;
+        }
+        manifest->files = grown;
+        manifest->fileCapacity = newCapacity;
+    }
+    ManifestFile *file = &manifest->files[manifest->fileCount++];
+    file->stamp = *stamp;
+    file->firstPage = manifest->pageCount;
+    file->pageCount = 0;
+    return file;
+}
+
+static int manifestAddPage(Manifest *manifest, ManifestFile *file, const char *hash)
+{
+    if (manifest->pageCount == manifest->pageCapacity)
+    {
+        size_t newCapacity = manifest->pageCapacity ? manifest->pageCapacity * 2 : 256;
+        HashText *grown = realloc(manifest->pages, newCapacity * sizeof(HashText));
+        if (!grown)
+        {
+            return 0;
+        }
+        manifest->pages = grown;
+        manifest->pageCapacity = newCapacity;
+    }
+    memcpy(manifest->pages[manifest->pageCount++], hash, BACKUP_HASH_TEXT_SIZE);
+    file->pageCount++;
+    return 1;
+}
+
+// Reads a manifest; with headerOnly the file and page lists are skipped
+static int readManifest(const char *path, Manifest *manifest, int headerOnly)
+{
+    memset(manifest, 0, sizeof(*manifest));
+    FILE *file = fopen(path, "r");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        return 0;
+    }
+    char line[BACKUP_PATH_SIZE];
+    int ok = fgets(line, sizeof(line), file) && strncmp(line, MANIFEST_MAGIC, strlen(MANIFEST_MAGIC)) == 0;
+    long long taken = 0;
+    unsigned long long bytes = 0, pagesWritten = 0, bytesWritten = 0;
+    unsigned files = 0;
+    ok = ok && fgets(line, sizeof(line), file) && sscanf(line, "id %31s", manifest->info.id) == 1;
+    ok = ok && fgets(line, sizeof(line), file) && sscanf(line, "taken %lld", &taken) == 1;
+    ok = ok && fgets(line, sizeof(line), file) &&
+         sscanf(line, "stats %u %llu %llu %llu", &files, &bytes, &pagesWritten, &bytesWritten) == 4;
+    manifest->info.taken = (time_t)taken;
+    manifest->info.files = files;
+    manifest->info.bytes = bytes;
+    manifest->info.pagesWritten = pagesWritten;
+    manifest->info.bytesWritten = bytesWritten;
+
+    int ended = 0;
+    while (ok && !headerOnly && fgets(line, sizeof(line), file))
+    {
+        if (strncmp(line, "end", 3) == 0)
+        {
+            ended = 1;
+            break;
+        }
+        FileStamp stamp;
+        long long mtime;
+        unsigned long long size;
+        size_t pages;
+        ok = sscanf(line, "file %llu %lld %ld %zu %127s", &size, &mtime, &stamp.mtimeNanoseconds, &pages,
+                    stamp.name) == 5;
+        stamp.size = size;
+        stamp.mtimeSeconds = mtime;
+        ManifestFile *entry = ok ? manifestAddFile(manifest, &stamp) : NULL;
+        ok = entry != NULL;
+        for (size_t i = 0; ok && i < pages; i++)
+        {
+            HashText hash;
+            ok = fgets(line, sizeof(line), file) && sscanf(line, "%64s", hash) == 1 &&
+                 strlen(hash) == BACKUP_HASH_TEXT_SIZE - 1 && manifestAddPage(manifest, entry, hash);
+        }
+    }
+    fclose(file);
+    if (!ok || (!headerOnly && !ended))
+    {
+        manifestFree(manifest);
+        return 0; // Unreadable or cut short: not a snapshot
+    }
+    return 1;
+}
+
+static void snapshotPath(const char *dir, const char *id, char *path, size_t size)
+{
+    snprintf(path, size, "%s/snapshots/%s.snap", dir, id);
+}
+
+static void pagePath(const char *dir, const char *hash, char *path, size_t size)
+{
+    snprintf(path, size, "%s/pages/%.2s/%s", dir, hash, hash);
+}
+
+static void hashToText(const BYTE digest[SHA256_BLOCK_SIZE], char *text)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++)
+    {
+        text[2 * i] = hex[digest[i] >> 4];
+        text[2 * i + 1] = hex[digest[i] & 15];
+    }
+    text[2 * SHA256_BLOCK_SIZE] = '\0';
+}
+
+static void hashPage(const unsigned char *data, size_t length, char *text)
+{
+    SHA256_CTX ctx;
+    BYTE digest[SHA256_BLOCK_SIZE];
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, length);
+    sha256_final(&ctx, digest);
+    hashToText(digest, text);
+}
+
+static int fileExists(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+// Stores a page under its hash unless an earlier snapshot already did
+static int storePage(const char *dir, const char *hash, const unsigned char *data, size_t length,
+                     BackupSnapshotInfo *info)
+{
+    char path[BACKUP_PATH_SIZE];
+    pagePath(dir, hash, path, sizeof(path));
+    if (fileExists(path))
+    {
+        return 1;
+    }
+    char fanOut[BACKUP_PATH_SIZE];
+    snprintf(fanOut, sizeof(fanOut), "%s/pages/%.2s", dir, hash);
+    makeDirectory(fanOut);
+
+    char tempPath[BACKUP_PATH_SIZE + 4];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    FILE *file = fopen(tempPath, "wb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to write backup page");
+        return 0;
+    }
+    int ok = fwrite(data, 1, length, file) == length;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tempPath, path) != 0)
+    {
+        remove(tempPath);
+        return 0;
+    }
+    metricsCount(COUNTER_BYTES_WRITTEN, length);
+    info->pagesWritten++;
+    info->bytesWritten += length;
+    return 1;
+}
+
+static int copyFile(const char *dir, const FileStamp *stamp, Manifest *manifest, unsigned char *page)
+{
+    char path[BACKUP_PATH_SIZE];
+    snprintf(path, sizeof(path), DATA_DIR "/%s", stamp->name);
+    FILE *file = fopen(path, "rb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    ManifestFile *entry = manifestAddFile(manifest, stamp);
+    if (!file || !entry)
+    {
+        if (file)
+        {
+            fclose(file);
+        }
+        return 0;
+    }
+    int ok = 1;
+    size_t length;
+    uint64_t copied = 0;
+    while (ok && (length = fread(page, 1, BACKUP_PAGE_SIZE, file)) > 0)
+    {
+        HashText hash;
+        hashPage(page, length, hash);
+        ok = storePage(dir, hash, page, length, &manifest->info) && manifestAddPage(manifest, entry, hash);
+        copied += length;
+    }
+    fclose(file);
+    metricsCount(COUNTER_BYTES_READ, copied);
+    // A size change shows up in the second listing and forces a retry
+    return ok;
+}
+
+// A file unchanged since before the previous snapshot started keeps its pages
+static const ManifestFile *reusable(const Manifest *previous, const FileStamp *stamp)
+{
+    for (size_t i = 0; previous && i < previous->fileCount; i++)
+    {
+        const ManifestFile *file = &previous->files[i];
+        if (sameStamp(&file->stamp, stamp))
+        {
+            return stamp->mtimeSeconds < (int64_t)previous->info.taken ? file : NULL;
+        }
+    }
+    return NULL;
+}
+
+static int copyImage(const char *dir, const FileList *files, const Manifest *previous, Manifest *manifest)
+{
+    unsigned char *page = malloc(BACKUP_PAGE_SIZE);
+    int ok = page != NULL;
+    for (size_t i = 0; ok && i < files->count; i++)
+    {
+        const ManifestFile *same = reusable(previous, &files->files[i]);
+        if (!same)
+        {
+            ok = copyFile(dir, &files->files[i], manifest, page);
+            continue;
+        }
+        ManifestFile *entry = manifestAddFile(manifest, &files->files[i]);
+        ok = entry != NULL;
+        for (size_t p = 0; ok && p < same->pageCount; p++)
+        {
+            ok = manifestAddPage(manifest, entry, previous->pages[same->firstPage + p]);
+        }
+    }
+    free(page);
+    return ok;
+}
+
+static void makeSnapshotID(const char *dir, time_t taken, char *id)
+{
+    int64_t seconds = (int64_t)taken;
+    int64_t days = seconds / DATE_SECONDS_PER_DAY;
+    int intoDay = (int)(seconds % DATE_SECONDS_PER_DAY);
+    if (intoDay < 0)
+    {
+        days--;
+        intoDay += DATE_SECONDS_PER_DAY;
+    }
+    int year, month, day;
+    civilFromDays(days, &year, &month, &day);
+    char base[BACKUP_ID_SIZE - 12]; // room for "-" and any counter
+    snprintf(base, sizeof(base), "%04d%02d%02d-%02d%02d%02d", year, month, day, intoDay / 3600,
+             intoDay / 60 % 60, intoDay % 60);
+    char path[BACKUP_PATH_SIZE];
+    strcpy(id, base);
+    snapshotPath(dir, id, path, sizeof(path));
+    for (int n = 2; fileExists(path); n++)
+    {
+        snprintf(id, BACKUP_ID_SIZE, "%s-%d", base, n);
+        snapshotPath(dir, id, path, sizeof(path));
+    }
+}
+
+static int writeManifest(const char *dir, const Manifest *manifest)
+{
+    char path[BACKUP_PATH_SIZE];
+    char tempPath[BACKUP_PATH_SIZE + 4];
+    snapshotPath(dir, manifest->info.id, path, sizeof(path));
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    FILE *file = fopen(tempPath, "w");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to write snapshot manifest");
+        return 0;
+    }
+    const BackupSnapshotInfo *info = &manifest->info;
+    fprintf(file, "%s\nid %s\ntaken %lld\nstats %u %llu %llu %llu\n", MANIFEST_MAGIC, info->id,
+            (long long)info->taken, info->files, (unsigned long long)info->bytes,
+            (unsigned long long)info->pagesWritten, (unsigned long long)info->bytesWritten);
+    for (size_t i = 0; i < manifest->fileCount; i++)
+    {
+        const ManifestFile *entry = &manifest->files[i];
+        fprintf(file, "file %llu %lld %ld %zu %s\n", (unsigned long long)entry->stamp.size,
+                (long long)entry->stamp.mtimeSeconds, entry->stamp.mtimeNanoseconds, entry->pageCount,
+                entry->stamp.name);
+        for (size_t p = 0; p < entry->pageCount; p++)
+        {
+            fprintf(file, "%s\n", manifest->pages[entry->firstPage + p]);
+        }
+    }
+    fputs("end\n", file);
+    int ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tempPath, path) != 0)
+    {
+        remove(tempPath);
+        return 0;
+    }
+    return 1;
+}
+
+static int addSnapshotInfo(const char *name, int isDirectory, void *ctx)
+{
+    void **args = ctx;
+    const char *dir = args[0];
+    BackupSnapshotInfo **list = args[1];
+    size_t *count = args[2];
+    if (isDirectory || !endsWith(name, ".snap"))
+    {
+        return 1;
+    }
+    char path[BACKUP_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/snapshots/%s", dir, name);
+    Manifest manifest;
+    if (!readManifest(path, &manifest, 1))
+    {
+        return 1; // Not a finished snapshot
+    }
+    BackupSnapshotInfo *grown = realloc(*list, (*count + 1) * sizeof(BackupSnapshotInfo));
+    if (!grown)
+    {
+        return 0;
+    }
+    *list = grown;
+    (*list)[(*count)++] = manifest.info;
+    return 1;
+}
+
+static int compareSnapshots(const void *a, const void *b)
+{
+    const BackupSnapshotInfo *x = a;
+    const BackupSnapshotInfo *y = b;
+    if (x->taken != y->taken)
+    {
+        return x->taken < y->taken ? -1 : 1;
+    }
+    return strcmp(x->id, y->id);
+}
+
+int backupList(const char *backupDir, BackupSnapshotInfo **snapshots, size_t *count)
+{
+    const char *dir = backupDirectory(backupDir);
+    char path[BACKUP_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/snapshots", dir);
+    *snapshots = NULL;
+    *count = 0;
+    void *args[3] = {(void *)dir, snapshots, count};
+    if (!forEachName(path, addSnapshotInfo, args) && !fileExists(path))
+    {
+        return 1; // No snapshots yet
+    }
+    qsort(*snapshots, *count, sizeof(BackupSnapshotInfo), compareSnapshots);
+    return 1;
+}
+
+static int loadSnapshot(const char *dir, const char *id, Manifest *manifest)
+{
+    char path[BACKUP_PATH_SIZE];
+    snapshotPath(dir, id, path, sizeof(path));
+    return readManifest(path, manifest, 0);
+}
+
+int backupSnapshot(const char *backupDir, BackupSnapshotInfo *info)
+{
+    const char *dir = backupDirectory(backupDir);
+    char path[BACKUP_PATH_SIZE];
+    makeDirectory(dir);
+    snprintf(path, sizeof(path), "%s/pages", dir);
+    makeDirectory(path);
+    snprintf(path, sizeof(path), "%s/snapshots", dir);
+    makeDirectory(path);
+
+    BackupSnapshotInfo *snapshots;
+    size_t count;
+    Manifest previous;
+    int havePrevious = backupList(dir, &snapshots, &count) && count > 0 &&
+                       loadSnapshot(dir, snapshots[count - 1].id, &previous);
+    free(snapshots);
+
+    int ok = 0;
+    for (int attempt = 0; attempt < BACKUP_ATTEMPTS && !ok; attempt++)
+    {
+        FileList before, after;
+        Manifest manifest;
+        memset(&manifest, 0, sizeof(manifest));
+        manifest.info.taken = time(NULL);
+        if (!listDataFiles(&before))
+        {
+            break;
+        }
+        int copied = copyImage(dir, &before, havePrevious ? &previous : NULL, &manifest);
+        int listed = copied && listDataFiles(&after);
+        if (listed && sameLists(&before, &after))
+        {
+            manifest.info.files = (uint32_t)before.count;
+            for (size_t i = 0; i < before.count; i++)
+            {
+                manifest.info.bytes += before.files[i].size;
+            }
+            makeSnapshotID(dir, manifest.info.taken, manifest.info.id);
+            ok = writeManifest(dir, &manifest);
+            if (ok)
+            {
+                *info = manifest.info;
+            }
+        }
+        if (listed)
+        {
+            free(after.files);
+        }
+        free(before.files);
+        manifestFree(&manifest);
+        if (!copied)
+        {
+            break; // An I/O error, not a concurrent write
+        }
+    }
+    if (havePrevious)
+    {
+        manifestFree(&previous);
+    }
+    return ok;
+}
+
+// Rebuilds one file as data/<name>.restore, checking every page's hash
+static int assembleFile(const char *dir, const Manifest *manifest, const ManifestFile *entry, unsigned char *page)
+{
+    char path[BACKUP_PATH_SIZE];
+    snprintf(path, sizeof(path), DATA_DIR "/%s.restore", entry->stamp.name);
+    FILE *out = fopen(path, "wb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!out)
+    {
+        perror("Failed to create restored file");
+        return 0;
+    }
+    int ok = 1;
+    uint64_t remaining = entry->stamp.size;
+    for (size_t p = 0; ok && p < entry->pageCount; p++)
+    {
+        const char *hash = manifest->pages[entry->firstPage + p];
+        size_t expected = remaining < BACKUP_PAGE_SIZE ? (size_t)remaining : BACKUP_PAGE_SIZE;
+        char pageFile[BACKUP_PATH_SIZE];
+        pagePath(dir, hash, pageFile, sizeof(pageFile));
+        FILE *in = fopen(pageFile, "rb");
+        metricsCount(COUNTER_FILE_OPENS, 1);
+        size_t length = in ? fread(page, 1, BACKUP_PAGE_SIZE, in) : 0;
+        if (in)
+        {
+            fclose(in);
+        }
+        HashText actual;
+        hashPage(page, length, actual);
+        ok = in && length == expected && strcmp(actual, hash) == 0 && fwrite(page, 1, length, out) == length;
+        if (!ok)
+        {
+            fprintf(stderr, "Backup page %s is missing or damaged\n", hash);
+        }
+        remaining -= length;
+    }
+    ok = fclose(out) == 0 && ok && remaining == 0;
+    if (!ok)
+    {
+        remove(path);
+    }
+    return ok;
+}
+
+static int findInManifest(const Manifest *manifest, const char *name)
+{
+    for (size_t i = 0; i < manifest->fileCount; i++)
+    {
+        if (strcmp(manifest->files[i].stamp.name, name) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int replaceFile(const char *from, const char *to)
+{
+    if (rename(from, to) == 0)
+    {
+        return 1;
+    }
+    remove(to); // Windows will not rename over an existing file
+    return rename(from, to) == 0;
+}
+
+int backupRestore(const char *backupDir, time_t at, BackupSnapshotInfo *restored)
+{
+    const char *dir = backupDirectory(backupDir);
+    BackupSnapshotInfo *snapshots;
+    size_t count;
+    if (!backupList(dir, &snapshots, &count))
+    {
+        return 0;
+    }
+    size_t chosen = count;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (at == 0 || snapshots[i].taken <= at)
+        {
+            chosen = i;
+        }
+    }
+    if (chosen == count)
+    {
+        free(snapshots);
+        return 0; // Nothing that old
+    }
+    *restored = snapshots[chosen];
+    free(snapshots);
+
+    Manifest manifest;
+    if (!loadSnapshot(dir, restored->id, &manifest))
+    {
+        return 0;
+    }
+    BackupSnapshotInfo undo;
+    makeDirectory(DATA_DIR);
+    unsigned char *page = malloc(BACKUP_PAGE_SIZE);
+    int ok = page != NULL && backupSnapshot(dir, &undo);
+    size_t assembled = 0;
+    for (; ok && assembled < manifest.fileCount; assembled++)
+    {
+        ok = assembleFile(dir, &manifest, &manifest.files[assembled], page);
+    }
+    free(page);
+
+    char from[BACKUP_PATH_SIZE];
+    char to[BACKUP_PATH_SIZE];
+    if (!ok)
+    {
+        for (size_t i = 0; i < assembled; i++)
+        {
+            snprintf(from, sizeof(from), DATA_DIR "/%s.restore", manifest.files[i].stamp.name);
+            remove(from);
+        }
+        manifestFree(&manifest);
+        return 0;
+    }
+
+    // Every file is in place before anything is replaced
+    for (size_t i = 0; ok && i < manifest.fileCount; i++)
+    {
+        snprintf(from, sizeof(from), DATA_DIR "/%s.restore", manifest.files[i].stamp.name);
+        snprintf(to, sizeof(to), DATA_DIR "/%s", manifest.files[i].stamp.name);
+        ok = replaceFile(from, to);
+    }
+    FileList current;
+    if (ok && listDataFiles(&current))
+    {
+        for (size_t i = 0; i < current.count; i++)
+        {
+            if (!findInManifest(&manifest, current.files[i].name))
+            {
+                snprintf(to, sizeof(to), DATA_DIR "/%s", current.files[i].name);
+                remove(to); // Created after the snapshot
+            }
+        }
+        free(current.files);
+    }
+    manifestFree(&manifest);
+    return ok;
+}
+
+static int compareHashes(const void *a, const void *b)
+{
+    return strcmp(*(const HashText *)a, *(const HashText *)b);
+}
+
+typedef struct
+{
+    const char *dir;
+    const char *fanOut;
+    HashText *live;
+    size_t liveCount;
+    long removed;
+} PruneState;
+
+static int prunePage(const char *name, int isDirectory, void *ctx)
+{
+    PruneState *state = ctx;
+    if (isDirectory || strlen(name) != BACKUP_HASH_TEXT_SIZE - 1 ||
+        bsearch(name, state->live, state->liveCount, sizeof(HashText), compareHashes))
+    {
+        return 1;
+    }
+    char path[BACKUP_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/pages/%s/%s", state->dir, state->fanOut, name);
+    state->removed += remove(path) == 0;
+    return 1;
+}
+
+static int pruneFanOut(const char *name, int isDirectory, void *ctx)
+{
+    PruneState *state = ctx;
+    if (!isDirectory)
+    {
+        return 1;
+    }
+    char path[BACKUP_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/pages/%s", state->dir, name);
+    state->fanOut = name;
+    forEachName(path, prunePage, state);
+    return 1;
+}
+
+long backupPrune(const char *backupDir, size_t keep)
+{
+    const char *dir = backupDirectory(backupDir);
+    BackupSnapshotInfo *snapshots;
+    size_t count;
+    if (!backupList(dir, &snapshots, &count))
+    {
+        return -1;
+    }
+    char path[BACKUP_PATH_SIZE];
+    for (size_t i = 0; i + keep < count; i++)
+    {
+        snapshotPath(dir, snapshots[i].id, path, sizeof(path));
+        remove(path);
+    }
+
+    // Mark the pages the remaining snapshots use, then sweep the rest
+    Manifest live;
+    FileStamp none;
+    memset(&live, 0, sizeof(live));
+    memset(&none, 0, sizeof(none));
+    ManifestFile *all = manifestAddFile(&live, &none); // one list holding every live page
+    int ok = all != NULL;
+    for (size_t i = count > keep ? count - keep : 0; ok && i < count; i++)
+    {
+        Manifest manifest;
+        ok = loadSnapshot(dir, snapshots[i].id, &manifest);
+        if (!ok)
+        {
+            break;
+        }
+        for (size_t p = 0; ok && p < manifest.pageCount; p++)
+        {
+            ok = manifestAddPage(&live, all, manifest.pages[p]);
+        }
+        manifestFree(&manifest);
+    }
+    free(snapshots);
+    if (!ok)
+    {
+        manifestFree(&live);
+        return -1; // Deleting pages without knowing every live one is unsafe
+    }
+    qsort(live.pages, live.pageCount, sizeof(HashText), compareHashes);
+
+    PruneState state = {dir, NULL, live.pages, live.pageCount, 0};
+    snprintf(path, sizeof(path), "%s/pages", dir);
+    forEachName(path, pruneFanOut, &state);
+    manifestFree(&live);
+    return state.removed;
+}
@@ -0,0 +1,302 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stddef.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "../include/changes.h"
+#include "../include/journal.h"
+#include "../include/metrics.h"
+
+#define CHANGES_MAGIC "LMSCHG1"
+
+typedef struct
+{
+    char magic[8];
+    uint32_t recordSize;
+    uint32_t reserved;
+    uint64_t committed; // changes of finished operations; the records behind them are in flight
+    uint64_t spare;
+} ChangesHeader; // CHANGES_HEADER_SIZE bytes
+
+static const char *const typeNames[] = {"",
+                                        "book_insert",   "book_update",   "book_delete",
+                                        "member_insert", "member_update", "member_delete",
+                                        "loan_issue",    "loan_return"};
+
+// The log stays open between operations, as the journal does
+static FILE *logFile = NULL;
+static uint64_t published; // the committed count in its header
+static int appended = 0;   // since the last settle that went through
+
+const char *changesTypeName(ChangeType type)
+{
+    return type >= CHANGE_BOOK_INSERT && type <= CHANGE_LOAN_RETURN ? typeNames[type] : "unknown";
+}
+
+static int readHeader(FILE *file, ChangesHeader *header)
+{
+    return fseek(file, 0, SEEK_SET) == 0 && fread(header, sizeof(*header), 1, file) == 1 &&
+           memcmp(header->magic, CHANGES_MAGIC, sizeof(header->magic)) == 0 &&
+           header->recordSize == sizeof(ChangeRecord);
+}
+
+// Opens the log for update, first creating it with its header when it is
+// missing; that write joins the caller's operation
+static FILE *openLog(void)
+{
+    if (logFile)
+    {
+        return logFile;
+    }
+    FILE *file = fopen(CHANGES_FILE, "ab");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to open change log");
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    int ok = 1;
+    if (ftell(file) == 0)
+    {
+        ChangesHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CHANGES_MAGIC, sizeof(header.magic));
+        header.recordSize = sizeof(ChangeRecord);
+        ok = journalWrite(file, CHANGES_FILE, JOURNAL_APPEND, &header, sizeof(header));
+    }
+    fclose(file);
+    // Append mode could not rewrite the header
+    file = ok ? fopen(CHANGES_FILE, "rb+") : NULL;
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    ChangesHeader header;
+    if (file && !readHeader(file, &header))
+    {
+        fprintf(stderr, "%s: not a change log\n", CHANGES_FILE);
+        fclose(file);
+        file = NULL;
+    }
+    if (file)
+    {
+        logFile = file;
+        published = header.committed;
+    }
+    return file;
+}
+
+static int append(ChangeType type, int id, const void *record, size_t size)
+{
+    ChangeRecord change;
+    memset(&change, 0, sizeof(change));
+    change.time = (int64_t)time(NULL);
+    change.type = (int32_t)type;
+    change.id = id;
+    memcpy(&change.record, record, size);
+
+    // The record joins the caller's operation, so a change is rolled back
+    // with the write it describes
+    journalBegin();
+    FILE *file = openLog();
+    long end = file && fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    int ok = end >= CHANGES_HEADER_SIZE && (end - CHANGES_HEADER_SIZE) % sizeof(ChangeRecord) == 0;
+    if (file && !ok)
+    {
+        fprintf(stderr, "%s: damaged, not logging changes\n", CHANGES_FILE);
+    }
+    if (ok)
+    {
+        change.sequence = (uint64_t)((end - CHANGES_HEADER_SIZE) / sizeof(ChangeRecord)) + 1;
+        ok = journalWrite(file, CHANGES_FILE, JOURNAL_APPEND, &change, sizeof(change));
+        appended = 1;
+        metricsCount(COUNTER_BYTES_WRITTEN, sizeof(change));
+    }
+    if (!ok)
+    {
+        journalAbort();
+    }
+    return journalCommit() && ok;
+}
+
+int changesRecordBook(ChangeType type, const Book *book)
+{
+    return append(type, book->bookID, book, sizeof(*book));
+}
+
+int changesRecordMember(ChangeType type, const Member *member)
+{
+    return append(type, member->memberID, member, sizeof(*member));
+}
+
+int changesRecordLoan(ChangeType type, const BorrowedRecord *loan)
+{
+    return append(type, loan->bookID, loan, sizeof(*loan));
+}
+
+void changesSettle(void)
+{
+    if (!appended || !logFile)
+    {
+        return;
+    }
+    // Outside the journal: a lost update is redone by the next settle or by
+    // recovery, and the count only covers records already synced. A
+    // rollback may have cut the file back.
+    long end = fseek(logFile, 0, SEEK_END) == 0 ? ftell(logFile) : -1;
+    int ok = end >= CHANGES_HEADER_SIZE;
+    uint64_t committed = ok ? (uint64_t)((end - CHANGES_HEADER_SIZE) / sizeof(ChangeRecord)) : 0;
+    if (ok && committed != published)
+    {
+        ok = fseek(logFile, (long)offsetof(ChangesHeader, committed), SEEK_SET) == 0 &&
+             fwrite(&committed, sizeof(committed), 1, logFile) == 1 && fflush(logFile) == 0;
+        published = ok ? committed : published;
+    }
+    appended = !ok;
+}
+
+void changesRecover(void)
+{
+    // An operation that committed just before a crash left its records in
+    // the file but not in the count. The log is only kept open by appends.
+    changesInvalidate();
+    FILE *file = fopen(CHANGES_FILE, "rb+");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    ChangesHeader header;
+    if (file && readHeader(file, &header))
+    {
+        logFile = file;
+        published = header.committed;
+        appended = 1;
+        changesSettle();
+        logFile = NULL;
+    }
+    if (file)
+    {
+        fclose(file);
+    }
+}
+
+void changesInvalidate(void)
+{
+    if (logFile)
+    {
+        fclose(logFile);
+        logFile = NULL;
+    }
+    appended = 0;
+}
+
+static void sleepMs(long ms)
+{
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    struct timespec delay = {ms / 1000, ms % 1000 * 1000000L};
+    nanosleep(&delay, NULL);
+#endif
+}
+
+void changesOpen(ChangeCursor *cursor, uint64_t after)
+{
+    changesOpenFile(cursor, CHANGES_FILE, after);
+}
+
+void changesOpenFile(ChangeCursor *cursor, const char *path, uint64_t after)
+{
+    cursor->path = path;
+    cursor->file = NULL;
+    cursor->next = after + 1;
+    cursor->committed = 0;
+}
+
+void changesClose(ChangeCursor *cursor)
+{
+    if (cursor->file)
+    {
+        fclose(cursor->file);
+        cursor->file = NULL;
+    }
+}
+
+// Reads the committed count again; 0 when the log does not exist yet
+static int refresh(ChangeCursor *cursor)
+{
+    if (!cursor->file)
+    {
+        cursor->file = fopen(cursor->path, "rb");
+        if (!cursor->file)
+        {
+            return errno == ENOENT ? 0 : -1;
+        }
+        // Unbuffered, so every header read sees the writer's last update
+        setvbuf(cursor->file, NULL, _IONBF, 0);
+    }
+    ChangesHeader header;
+    if (!readHeader(cursor->file, &header))
+    {
+        // Created but the header not written yet reads as empty
+        return ferror(cursor->file) ? -1 : 0;
+    }
+    cursor->committed = header.committed;
+    return 1;
+}
+
+int changesNext(ChangeCursor *cursor, ChangeRecord *change)
+{
+    if (cursor->next > cursor->committed)
+    {
+        if (refresh(cursor) < 0)
+        {
+            return -1;
+        }
+        if (cursor->next > cursor->committed)
+        {
+            return 0;
+        }
+    }
+    long offset = CHANGES_HEADER_SIZE + (long)(cursor->next - 1) * (long)sizeof(ChangeRecord);
+    if (fseek(cursor->file, offset, SEEK_SET) != 0 || fread(change, sizeof(*change), 1, cursor->file) != 1)
+    {
+        return -1;
+    }
+    cursor->next++;
+    return 1;
+}
+
+int changesWait(ChangeCursor *cursor, long timeoutMs)
+{
+    for (long waited = 0;; waited += CHANGES_POLL_MS)
+    {
+        if (cursor->next <= cursor->committed)
+        {
+            return 1;
+        }
+        if (refresh(cursor) < 0)
+        {
+            return -1;
+        }
+        if (cursor->next <= cursor->committed)
+        {
+            return 1;
+        }
+        if (waited >= timeoutMs)
+        {
+            return 0;
+        }
+        sleepMs(CHANGES_POLL_MS);
+    }
+}
+
+uint64_t changesCommitted(void)
+{
+    ChangeCursor cursor;
+    changesOpen(&cursor, 0);
+    refresh(&cursor);
+    changesClose(&cursor);
+    return cursor.committed;
+}
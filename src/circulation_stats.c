@@ -0,0 +1,512 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/library.h"
+#include "../include/id_index.h"
+#include "../include/journal.h"
+#include "../include/loan_archive.h"
+#include "../include/circulation_stats.h"
+#include "../include/metrics.h"
+
+typedef struct
+{
+    const char *path;
+    CirculationCounter *counters;
+    size_t count;
+    size_t capacity;
+    IdIndex index; // id -> slot in counters and in the file
+} CounterTable;
+
+static CounterTable bookTable = {STATS_BOOKS_FILE, NULL, 0, 0, {NULL, NULL, 0, 0, NULL}};
+static CounterTable memberTable = {STATS_MEMBERS_FILE, NULL, 0, 0, {NULL, NULL, 0, 0, NULL}};
+static int loaded = 0;
+static int seededFromHistory = 0; // set when statsLoad had to rebuild
+
+static void tableFree(CounterTable *table)
+{
+    free(table->counters);
+    table->counters = NULL;
+    table->count = table->capacity = 0;
+    idIndexFree(&table->index);
+}
+
+// Appends a zeroed counter and returns its slot, or -1 when memory runs out
+static long tableAppend(CounterTable *table)
+{
+    if (table->count == table->capacity)
+    {
+        size_t newCapacity = table->capacity ? table->capacity * 2 : 64;
+        CirculationCounter *grown = realloc(table->counters, newCapacity * sizeof(CirculationCounter));
+        if (!grown)
+        {
+            return -1;
+        }
+        table->counters = grown;
+        table->capacity = newCapacity;
+    }
+    memset(&table->counters[table->count], 0, sizeof(CirculationCounter));
+    return (long)table->count++;
+}
+
+// Returns the slot for id, appending a zeroed counter when create is set
+static long tableSlot(CounterTable *table, int id, int create)
+{
+    long slot;
+    if (idIndexFind(&table->index, id, &slot))
+    {
+        return slot;
+    }
+    if (!create || (slot = tableAppend(table)) < 0)
+    {
+        return -1;
+    }
+    if (!idIndexPut(&table->index, id, slot))
+    {
+        table->count--;
+        return -1;
+    }
+    table->counters[slot].id = id;
+    return slot;
+}
+
+static int tableLoad(CounterTable *table)
+{
+    FILE *file = fopen(table->path, "rb");
+    if (!file)
+    {
+        return 1;
+    }
+    // Slot i is record i of the file, so tableWriteSlot lands on it
+    CirculationCounter counter;
+    while (fread(&counter, sizeof(counter), 1, file) == 1)
+    {
+        // A hole left by a write past the end of a missing file stays an
+        // empty slot that no ID maps to
+        long slot = counter.id > 0 ? tableSlot(table, counter.id, 1) : tableAppend(table);
+        if (slot < 0)
+        {
+            fclose(file);
+            return 0;
+        }
+        table->counters[slot] = counter;
+    }
+    fclose(file);
+    return 1;
+}
+
+static void tableWriteSlot(const CounterTable *table, long slot)
+{
+    if (slot < 0)
+    {
+        journalAbort(); // The counter could not even be created
+        return;
+    }
+    FILE *file = fopen(table->path, "rb+");
+    if (!file)
+    {
+        file = fopen(table->path, "wb");
+        if (!file)
+        {
+            perror("Failed to open statistics file");
+            journalAbort();
+            return;
+        }
+    }
+    journalWrite(file, table->path, slot * (long)sizeof(CirculationCounter), &table->counters[slot],
+                 sizeof(CirculationCounter));
+    fclose(file);
+}
+
+static int tableSave(const CounterTable *table)
+{
+    char tempPath[64];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", table->path);
+    FILE *file = fopen(tempPath, "wb");
+    if (!file)
+    {
+        return 0;
+    }
+    int ok = fwrite(table->counters, sizeof(CirculationCounter), table->count, file) == table->count;
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        remove(tempPath);
+        return 0;
+    }
+    return journalReplaceOnCommit(tempPath, table->path);
+}
+
+static void applyIssue(CounterTable *books, CounterTable *members, int bookID, int memberID)
+{
+    long bookSlot = tableSlot(books, bookID, 1);
+    long memberSlot = tableSlot(members, memberID, 1);
+    if (bookSlot >= 0)
+    {
+        books->counters[bookSlot].loans++;
+        books->counters[bookSlot].open++;
+    }
+    if (memberSlot >= 0)
+    {
+        members->counters[memberSlot].loans++;
+        members->counters[memberSlot].open++;
+    }
+}
+
+static void applyReturnTo(CirculationCounter *counter, int64_t duration, int isOverdue)
+{
+    if (counter->open > 0)
+    {
+        counter->open--;
+    }
+    counter->returned++;
+    counter->durationSum += duration;
+    if (isOverdue)
+    {
+        counter->overdue++;
+    }
+}
+
+static void applyReturn(CounterTable *books, CounterTable *members, int bookID, int memberID,
+                        int64_t duration, int isOverdue)
+{
+    long bookSlot = tableSlot(books, bookID, 1);
+    long memberSlot = tableSlot(members, memberID, 1);
+    if (bookSlot >= 0)
+    {
+        applyReturnTo(&books->counters[bookSlot], duration, isOverdue);
+    }
+    if (memberSlot >= 0)
+    {
+        applyReturnTo(&members->counters[memberSlot], duration, isOverdue);
+    }
+}
+
+typedef struct
+{
+    CounterTable *books;
+    CounterTable *members;
+} ReplayTarget;
+
+static int replayLoan(const BorrowedRecord *record, void *ctx)
+{
+    ReplayTarget *target = ctx;
+    applyIssue(target->books, target->members, record->bookID, record->memberID);
+    if (record->returnDate != 0)
+    {
+        applyReturn(target->books, target->members, record->bookID, record->memberID,
+                    (int64_t)(record->returnDate - record->borrowDate), record->isOverdue);
+    }
+    return 1;
+}
+
+// Recomputes every counter from the archive and borrow.dat
+static int replayHistory(CounterTable *books, CounterTable *members)
+{
+    ReplayTarget target = {books, members};
+    if (!loanArchiveForEach(replayLoan, &target))
+    {
+        return 0;
+    }
+    FILE *file = fopen(BORROWED_BOOKS_FILE, "rb");
+    if (file)
+    {
+        BorrowedRecord record;
+        while (fread(&record, sizeof(record), 1, file) == 1)
+        {
+            replayLoan(&record, &target);
+        }
+        fclose(file);
+    }
+    return 1;
+}
+
+static int loadTables(void)
+{
+    FILE *books = fopen(STATS_BOOKS_FILE, "rb");
+    FILE *members = fopen(STATS_MEMBERS_FILE, "rb");
+    int haveStats = books || members;
+    if (books)
+    {
+        fclose(books);
+    }
+    if (members)
+    {
+        fclose(members);
+    }
+
+    if (!haveStats)
+    {
+        // First run on an existing history: seed the counters from it
+        seededFromHistory = 1;
+        return statsRebuild();
+    }
+    if (!tableLoad(&bookTable) || !tableLoad(&memberTable))
+    {
+        tableFree(&bookTable);
+        tableFree(&memberTable);
+        return 0;
+    }
+    loaded = 1;
+    return 1;
+}
+
+void statsInvalidate(void)
+{
+    tableFree(&bookTable);
+    tableFree(&memberTable);
+    loaded = 0;
+}
+
+int statsLoad(void)
+{
+    if (loaded)
+    {
+        return 1;
+    }
+    uint64_t start = metricsNow();
+    int ok = loadTables();
+    metricsStop(TIMER_STATS_LOAD, start);
+    return ok;
+}
+
+// True when this call's statsLoad seeded the counters from a history that
+// already contains the loan being recorded
+static int alreadyCounted(void)
+{
+    int wasLoaded = loaded;
+    seededFromHistory = 0;
+    if (!statsLoad())
+    {
+        return 1;
+    }
+    return !wasLoaded && seededFromHistory;
+}
+
+void statsRecordIssue(int bookID, int memberID)
+{
+    if (alreadyCounted())
+    {
+        return;
+    }
+    applyIssue(&bookTable, &memberTable, bookID, memberID);
+    tableWriteSlot(&bookTable, tableSlot(&bookTable, bookID, 0));
+    tableWriteSlot(&memberTable, tableSlot(&memberTable, memberID, 0));
+}
+
+void statsRecordReturn(int bookID, int memberID, time_t borrowDate, time_t returnDate, int isOverdue)
+{
+    if (alreadyCounted())
+    {
+        return;
+    }
+    applyReturn(&bookTable, &memberTable, bookID, memberID, (int64_t)(returnDate - borrowDate), isOverdue);
+    tableWriteSlot(&bookTable, tableSlot(&bookTable, bookID, 0));
+    tableWriteSlot(&memberTable, tableSlot(&memberTable, memberID, 0));
+}
+
+static int tableGet(CounterTable *table, int id, CirculationCounter *counter)
+{
+    long slot;
+    if (!statsLoad() || (slot = tableSlot(table, id, 0)) < 0)
+    {
+        memset(counter, 0, sizeof(*counter));
+        counter->id = id;
+        return 0;
+    }
+    *counter = table->counters[slot];
+    return 1;
+}
+
+int statsBookCounter(int bookID, CirculationCounter *counter)
+{
+    return tableGet(&bookTable, bookID, counter);
+}
+
+int statsMemberCounter(int memberID, CirculationCounter *counter)
+{
+    return tableGet(&memberTable, memberID, counter);
+}
+
+void statsTotals(CirculationTotals *totals)
+{
+    memset(totals, 0, sizeof(*totals));
+    if (!statsLoad())
+    {
+        return;
+    }
+    // Every loan is counted exactly once in the book table
+    for (size_t i = 0; i < bookTable.count; i++)
+    {
+        const CirculationCounter *c = &bookTable.counters[i];
+        totals->loans += c->loans;
+        totals->open += c->open;
+        totals->returned += c->returned;
+        totals->overdue += c->overdue;
+        totals->durationSum += c->durationSum;
+    }
+}
+
+// Ranks by loans, then by lower ID so ties come out in a stable order
+static int ranksBelow(const CirculationCounter *a, const CirculationCounter *b)
+{
+    return a->loans < b->loans || (a->loans == b->loans && a->id > b->id);
+}
+
+static size_t topN(const CounterTable *table, CirculationCounter *top, size_t n)
+{
+    size_t size = 0;
+    if (n == 0)
+    {
+        return 0;
+    }
+    // Bounded min-heap: top[0] is the weakest of the current top n
+    for (size_t i = 0; i < table->count; i++)
+    {
+        const CirculationCounter *c = &table->counters[i];
+        if (c->loans == 0)
+        {
+            continue;
+        }
+        size_t pos;
+        if (size < n)
+        {
+            pos = size++;
+            top[pos] = *c;
+            while (pos > 0 && ranksBelow(&top[pos], &top[(pos - 1) / 2]))
+            {
+                CirculationCounter tmp = top[pos];
+                top[pos] = top[(pos - 1) / 2];
+                top[(pos - 1) / 2] = tmp;
+                pos = (pos - 1) / 2;
+            }
+            continue;
+        }
+        if (!ranksBelow(&top[0], c))
+        {
+            continue;
+        }
+        top[0] = *c;
+        pos = 0;
+        for (;;)
+        {
+            size_t weakest = pos;
+            size_t left = 2 * pos + 1;
+            size_t right = left + 1;
+            if (left < size && ranksBelow(&top[left], &top[weakest]))
+            {
+                weakest = left;
+            }
+            if (right < size && ranksBelow(&top[right], &top[weakest]))
+            {
+                weakest = right;
+            }
+            if (weakest == pos)
+            {
+                break;
+            }
+            CirculationCounter tmp = top[pos];
+            top[pos] = top[weakest];
+            top[weakest] = tmp;
+            pos = weakest;
+        }
+    }
+
+    // Heap order to best-first order (n is small)
+    for (size_t i = 1; i < size; i++)
+    {
+        CirculationCounter key = top[i];
+        size_t j = i;
+        while (j > 0 && ranksBelow(&top[j - 1], &key))
+        {
+            top[j] = top[j - 1];
+            j--;
+        }
+        top[j] = key;
+    }
+    return size;
+}
+
+size_t statsTopBooks(CirculationCounter *top, size_t n)
+{
+    return statsLoad() ? topN(&bookTable, top, n) : 0;
+}
+
+size_t statsTopMembers(CirculationCounter *top, size_t n)
+{
+    return statsLoad() ? topN(&memberTable, top, n) : 0;
+}
+
+int statsRebuild(void)
+{
+    CounterTable books = {STATS_BOOKS_FILE, NULL, 0, 0, {NULL, NULL, 0, 0, NULL}};
+    CounterTable members = {STATS_MEMBERS_FILE, NULL, 0, 0, {NULL, NULL, 0, 0, NULL}};
+    // Both files are swapped in at the end of the operation, or neither is
+    journalBegin();
+    if (!replayHistory(&books, &members) || !tableSave(&books) || !tableSave(&members))
+    {
+        journalAbort();
+        journalCommit();
+        tableFree(&books);
+        tableFree(&members);
+        return 0;
+    }
+    if (!journalCommit())
+    {
+        tableFree(&books);
+        tableFree(&members);
+        return 0;
+    }
+    tableFree(&bookTable);
+    tableFree(&memberTable);
+    bookTable = books;
+    memberTable = members;
+    loaded = 1;
+    return 1;
+}
+
+static int counterEquals(const CirculationCounter *a, const CirculationCounter *b)
+{
+    return a->id == b->id && a->loans == b->loans && a->open == b->open && a->returned == b->returned &&
+           a->overdue == b->overdue && a->durationSum == b->durationSum;
+}
+
+static long countMismatches(CounterTable *maintained, CounterTable *expected)
+{
+    long mismatches = 0;
+    for (size_t i = 0; i < expected->count; i++)
+    {
+        long slot = tableSlot(maintained, expected->counters[i].id, 0);
+        if (slot < 0 || !counterEquals(&maintained->counters[slot], &expected->counters[i]))
+        {
+            mismatches++;
+        }
+    }
+    // Counters that exist only on the maintained side must be empty
+    for (size_t i = 0; i < maintained->count; i++)
+    {
+        const CirculationCounter *c = &maintained->counters[i];
+        if (tableSlot(expected, c->id, 0) < 0 && (c->loans || c->open || c->returned))
+        {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+long statsVerify(void)
+{
+    if (!statsLoad())
+    {
+        return -1;
+    }
+    CounterTable books = {STATS_BOOKS_FILE, NULL, 0, 0, {NULL, NULL, 0, 0, NULL}};
+    CounterTable members = {STATS_MEMBERS_FILE, NULL, 0, 0, {NULL, NULL, 0, 0, NULL}};
+    long mismatches = -1;
+    if (replayHistory(&books, &members))
+    {
+        mismatches = countMismatches(&bookTable, &books) + countMismatches(&memberTable, &members);
+    }
+    tableFree(&books);
+    tableFree(&members);
+    return mismatches;
+}
@@ -0,0 +1,224 @@
+#include <string.h>
+#include "../include/codec.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+// The last bytes of a block are always emitted as literals so the match
+// finder never reads past the end of the input
+#define LZ_LAST_LITERALS 5
+
+size_t varintEncode(uint64_t value, uint8_t *out)
+{
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+size_t varintDecode(const uint8_t *in, size_t avail, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (size_t i = 0; i < avail && i < VARINT_MAX_BYTES; i++)
+    {
+        result |= (uint64_t)(in[i] & 0x7f) << (7 * i);
+        if (!(in[i] & 0x80))
+        {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lzHash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes the remainder of a 4-bit length field as 255-continuation bytes
+static uint8_t *writeLength(uint8_t *op, size_t len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t *emitSequence(uint8_t *op, const uint8_t *literals, size_t literalLen,
+                             size_t offset, size_t matchLen)
+{
+    uint8_t *token = op++;
+    size_t matchCode = matchLen ? matchLen - LZ_MIN_MATCH : 0;
+
+    *token = (uint8_t)((literalLen >= 15 ? 15 : literalLen) << 4);
+    if (literalLen >= 15)
+    {
+        op = writeLength(op, literalLen - 15);
+    }
+    memcpy(op, literals, literalLen);
+    op += literalLen;
+    if (matchLen)
+    {
+        *op++ = (uint8_t)(offset & 0xff);
+        *op++ = (uint8_t)(offset >> 8);
+        *token |= (uint8_t)(matchCode >= 15 ? 15 : matchCode);
+        if (matchCode >= 15)
+        {
+            op = writeLength(op, matchCode - 15);
+        }
+    }
+    return op;
+}
+
+size_t lzCompress(const uint8_t *in, size_t n, uint8_t *out, size_t outCap)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    const uint8_t *ip = in;
+    const uint8_t *anchor = in;
+    const uint8_t *end = in + n;
+    const uint8_t *matchLimit = n > LZ_LAST_LITERALS ? end - LZ_LAST_LITERALS : in;
+    uint8_t *op = out;
+
+    if (outCap < LZ_BOUND(n))
+    {
+        return 0;
+    }
+    memset(table, 0, sizeof(table));
+
+    while (ip + LZ_MIN_MATCH <= matchLimit)
+    {
+        uint32_t h = lzHash(read32(ip));
+        const uint8_t *candidate = in + table[h];
+        table[h] = (uint32_t)(ip - in);
+
+        if (candidate >= ip || (size_t)(ip - candidate) > LZ_MAX_OFFSET ||
+            read32(candidate) != read32(ip))
+        {
+            ip++;
+            continue;
+        }
+
+        size_t matchLen = LZ_MIN_MATCH;
+        while (ip + matchLen < matchLimit && candidate[matchLen] == ip[matchLen])
+        {
+            matchLen++;
+        }
+        op = emitSequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - candidate), matchLen);
+        ip += matchLen;
+        anchor = ip;
+    }
+    op = emitSequence(op, anchor, (size_t)(end - anchor), 0, 0);
+
+    size_t written = (size_t)(op - out);
+    return written < n ? written : 0; // Not worth it if it did not shrink
+}
+
+static int readLength(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+    uint8_t b;
+    do
+    {
+        if (*ip >= end)
+        {
+            return 0;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+int lzDecompress(const uint8_t *in, size_t n, uint8_t *out, size_t outLen)
+{
+    const uint8_t *ip = in;
+    const uint8_t *end = in + n;
+    uint8_t *op = out;
+    uint8_t *outEnd = out + outLen;
+
+    while (ip < end)
+    {
+        uint8_t token = *ip++;
+        size_t literalLen = token >> 4;
+        if (literalLen == 15 && !readLength(&ip, end, &literalLen))
+        {
+            return 0;
+        }
+        if ((size_t)(end - ip) < literalLen || (size_t)(outEnd - op) < literalLen)
+        {
+            return 0;
+        }
+        memcpy(op, ip, literalLen);
+        ip += literalLen;
+        op += literalLen;
+        if (ip == end)
+        {
+            break; // Final sequence carries literals only
+        }
+
+        if (end - ip < 2)
+        {
+            return 0;
+        }
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && !readLength(&ip, end, &matchLen))
+        {
+            return 0;
+        }
+        matchLen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - out) || (size_t)(outEnd - op) < matchLen)
+        {
+            return 0;
+        }
+        // Byte-by-byte: overlapping matches repeat the most recent bytes
+        const uint8_t *match = op - offset;
+        for (size_t i = 0; i < matchLen; i++)
+        {
+            op[i] = match[i];
+        }
+        op += matchLen;
+    }
+    return op == outEnd;
+}
+
+uint32_t crc32Update(uint32_t crc, const void *data, size_t n)
+{
+    static uint32_t table[256];
+    static int tableReady = 0;
+    if (!tableReady)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        tableReady = 1;
+    }
+    const uint8_t *bytes = data;
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++)
+    {
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
@@ -0,0 +1,72 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <conio.h>
+#else
+#include <unistd.h>
+#endif
+#include "../include/console.h"
+
+#ifdef _WIN32
+
+void consoleClear(void)
+{
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    fflush(stdout);
+    if (console == INVALID_HANDLE_VALUE || !GetConsoleScreenBufferInfo(console, &info))
+    {
+        return; // redirected
+    }
+    COORD home = {0, 0};
+    DWORD cells = (DWORD)info.dwSize.X * (DWORD)info.dwSize.Y;
+    DWORD written;
+    FillConsoleOutputCharacterA(console, ' ', cells, home, &written);
+    FillConsoleOutputAttribute(console, info.wAttributes, cells, home, &written);
+    SetConsoleCursorPosition(console, home);
+}
+
+void consolePause(void)
+{
+    fputs("Press any key to continue . . . ", stdout);
+    fflush(stdout);
+    if (_isatty(_fileno(stdin)))
+    {
+        _getch();
+    }
+    else
+    {
+        int c;
+        while ((c = getchar()) != '\n' && c != EOF)
+        {
+        }
+    }
+    putchar('\n');
+}
+
+#else
+
+void consoleClear(void)
+{
+    if (isatty(STDOUT_FILENO))
+    {
+        // Home the cursor, clear the screen, then the scrollback
+        fputs("\033[H\033[2J\033[3J", stdout);
+        fflush(stdout);
+    }
+}
+
+void consolePause(void)
+{
+    fputs("Press Enter to continue . . . ", stdout);
+    fflush(stdout);
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF)
+    {
+    }
+}
+
+#endif
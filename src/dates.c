@@ -0,0 +1,184 @@
+#include <string.h>
+#include <ctype.h>
+#include "../include/dates.h"
+
+#define SECONDS_PER_HOUR (60 * 60)
+
+static struct
+{
+    time_t validFrom;  // start of the cached local day
+    time_t validUntil; // next local midnight or UTC hour, whichever is first
+    DayNumber today;
+    int64_t offset; // local time minus UTC, in seconds
+    int loaded;
+} localClock;
+
+static int64_t floorDiv(int64_t a, int64_t b)
+{
+    int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+// Howard Hinnant's days_from_civil: 400-year eras, March-based years
+int64_t daysFromCivil(int year, int month, int day)
+{
+    int64_t y = (int64_t)year - (month <= 2);
+    int64_t era = floorDiv(y, 400);
+    int64_t yearOfEra = y - era * 400;
+    int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+void civilFromDays(int64_t days, int *year, int *month, int *day)
+{
+    days += 719468;
+    int64_t era = floorDiv(days, 146097);
+    int64_t dayOfEra = days - era * 146097;
+    int64_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int64_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int64_t monthIndex = (5 * dayOfYear + 2) / 153;
+    *day = (int)(dayOfYear - (153 * monthIndex + 2) / 5 + 1);
+    *month = (int)(monthIndex < 10 ? monthIndex + 3 : monthIndex - 9);
+    *year = (int)(yearOfEra + era * 400 + (*month <= 2));
+}
+
+static int daysInMonth(int year, int month)
+{
+    static const int lengths[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return lengths[month - 1] + (month == 2 && leap);
+}
+
+// Reads between minDigits and maxDigits decimal digits
+static const char *readNumber(const char *p, int minDigits, int maxDigits, int *value)
+{
+    int digits = 0;
+    *value = 0;
+    while (digits < maxDigits && isdigit((unsigned char)*p))
+    {
+        *value = *value * 10 + (*p++ - '0');
+        digits++;
+    }
+    return digits >= minDigits ? p : NULL;
+}
+
+int dateParse(const char *text, DayNumber *day)
+{
+    int year, month, dayOfMonth;
+    const char *p = readNumber(text, 4, 4, &year);
+    if (!p || *p++ != '-' || !(p = readNumber(p, 1, 2, &month)) || *p++ != '-' ||
+        !(p = readNumber(p, 1, 2, &dayOfMonth)) || *p != '\0')
+    {
+        return 0;
+    }
+    if (year < 1 || month < 1 || month > 12 || dayOfMonth < 1 || dayOfMonth > daysInMonth(year, month))
+    {
+        return 0;
+    }
+    *day = (DayNumber)daysFromCivil(year, month, dayOfMonth);
+    return 1;
+}
+
+time_t dateToTime(DayNumber day)
+{
+    return (time_t)((int64_t)day * DATE_SECONDS_PER_DAY);
+}
+
+// One localtime call per hour at most: it yields the offset, and the local
+// day and its boundaries follow from the offset by arithmetic.
+static void refreshLocalClock(time_t now)
+{
+    if (localClock.loaded && now >= localClock.validFrom && now < localClock.validUntil)
+    {
+        return;
+    }
+    struct tm *tm = localtime(&now);
+    int64_t localSeconds = (int64_t)now;
+    if (tm)
+    {
+        localSeconds = daysFromCivil(tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday) * DATE_SECONDS_PER_DAY +
+                       tm->tm_hour * SECONDS_PER_HOUR + tm->tm_min * 60 + tm->tm_sec;
+    }
+    localClock.offset = localSeconds - (int64_t)now;
+    localClock.today = (DayNumber)floorDiv(localSeconds, DATE_SECONDS_PER_DAY);
+
+    int64_t intoDay = localSeconds - (int64_t)localClock.today * DATE_SECONDS_PER_DAY;
+    time_t dayEnd = (time_t)((int64_t)now - intoDay + DATE_SECONDS_PER_DAY);
+    time_t hourEnd = (time_t)(((int64_t)now / SECONDS_PER_HOUR + 1) * SECONDS_PER_HOUR);
+    localClock.validFrom = (time_t)((int64_t)now - intoDay);
+    localClock.validUntil = dayEnd < hourEnd ? dayEnd : hourEnd;
+    localClock.loaded = 1;
+}
+
+DayNumber dateToday(void)
+{
+    refreshLocalClock(time(NULL));
+    return localClock.today;
+}
+
+time_t dateLocalStart(DayNumber day)
+{
+    refreshLocalClock(time(NULL));
+    return (time_t)((int64_t)dateToTime(day) - localClock.offset);
+}
+
+DayNumber dateFromTime(time_t stored)
+{
+    int64_t seconds = (int64_t)stored;
+    if (seconds % DATE_SECONDS_PER_DAY != 0)
+    {
+        // Written as local midnight; the offset then was within a few hours
+        // of the offset now, so shift to local time and round
+        refreshLocalClock(time(NULL));
+        seconds += localClock.offset + DATE_SECONDS_PER_DAY / 2;
+    }
+    return (DayNumber)floorDiv(seconds, DATE_SECONDS_PER_DAY);
+}
+
+static char *putDigits(char *p, int value, int width)
+{
+    for (int i = width - 1; i >= 0; i--)
+    {
+        p[i] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    return p + width;
+}
+
+const char *dateFormat(DayNumber day, char out[DATE_TEXT_SIZE])
+{
+    int year, month, dayOfMonth;
+    civilFromDays(day, &year, &month, &dayOfMonth);
+    if (year < 0 || year > 9999)
+    {
+        strcpy(out, "0000-00-00");
+        return out;
+    }
+    char *p = putDigits(out, year, 4);
+    *p++ = '-';
+    p = putDigits(p, month, 2);
+    *p++ = '-';
+    p = putDigits(p, dayOfMonth, 2);
+    *p = '\0';
+    return out;
+}
+
+const char *dateTimeFormat(time_t timestamp, char out[DATETIME_TEXT_SIZE])
+{
+    refreshLocalClock(time(NULL));
+    int64_t local = (int64_t)timestamp + localClock.offset;
+    int64_t day = floorDiv(local, DATE_SECONDS_PER_DAY);
+    int seconds = (int)(local - day * DATE_SECONDS_PER_DAY);
+
+    dateFormat((DayNumber)day, out);
+    char *p = out + DATE_TEXT_SIZE - 1;
+    *p++ = ' ';
+    p = putDigits(p, seconds / SECONDS_PER_HOUR, 2);
+    *p++ = ':';
+    p = putDigits(p, seconds / 60 % 60, 2);
+    *p++ = ':';
+    p = putDigits(p, seconds % 60, 2);
+    *p = '\0';
+    return out;
+}
@@ -0,0 +1,617 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/library.h"
+#include "../include/loan_archive.h"
+#include "../include/loan_query.h"
+#include "../include/loan_join.h"
+#include "../include/output_buffer.h"
+#include "../include/dates.h"
+#include "../include/export.h"
+#include "../include/metrics.h"
+#include "../include/shards.h"
+#include "../include/changes.h"
+
+// Room kept free for one row (or the CSV header); a row with every text
+// field escaped to \u00XX sequences stays well under this
+#define EXPORT_ROW_RESERVE (16 * 1024)
+#define EXPORT_READ_RECORDS 4096 // borrow.dat records per fread
+#define EXPORT_DAY_CACHE 64      // formatted dates, by day number modulo this
+
+typedef struct
+{
+    int64_t day;
+    char text[24]; // "YYYY-MM-DDT", empty until first used
+    size_t length;
+} DayText;
+
+typedef struct
+{
+    const ExportOptions *options;
+    FILE *out;
+    OutputBuffer buffer;
+    LoanJoin join;
+    time_t now;
+    long rows;
+    int firstField;
+    int failed;
+    DayText days[EXPORT_DAY_CACHE];
+} ExportState;
+
+static const char *const bookColumns[] = {"bookID", "title", "author", "publicationDate", "quantity"};
+static const char *const memberColumns[] = {"memberID", "name", "email", "phone"};
+static const char *const loanColumns[] = {"bookID", "memberID", "borrowDate", "returnDate", "isOverdue",
+                                          "title", "memberName"};
+#define LOAN_PLAIN_COLUMNS 5 // the joined export adds the last two
+// The three above in turn; a change fills the columns of its record
+static const char *const changeColumns[] = {"sequence", "time", "type", "bookID", "title", "author", "publicationDate",
+                                            "quantity", "memberID", "name", "email", "phone", "borrowDate",
+                                            "returnDate", "isOverdue"};
+
+void exportDefaults(ExportOptions *options, ExportTable table)
+{
+    memset(options, 0, sizeof(*options));
+    options->table = table;
+    options->format = EXPORT_CSV;
+}
+
+// Rows are formatted straight into the buffer: endRow flushes whenever less
+// than EXPORT_ROW_RESERVE is left, so a row always fits without checks
+static void append(ExportState *state, const char *text, size_t length)
+{
+    memcpy(state->buffer.data + state->buffer.length, text, length);
+    state->buffer.length += length;
+}
+
+static void writeHeader(ExportState *state, const char *const *columns, size_t count)
+{
+    if (state->options->format != EXPORT_CSV)
+    {
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i > 0)
+        {
+            append(state, ",", 1);
+        }
+        append(state, columns[i], strlen(columns[i]));
+    }
+    append(state, "\n", 1);
+}
+
+static void beginRow(ExportState *state)
+{
+    state->firstField = 1;
+    if (state->options->format == EXPORT_JSONL)
+    {
+        append(state, "{", 1);
+    }
+}
+
+static void endRow(ExportState *state)
+{
+    if (state->options->format == EXPORT_JSONL)
+    {
+        append(state, "}\n", 2);
+    }
+    else
+    {
+        append(state, "\n", 1);
+    }
+    state->rows++;
+    if (state->buffer.length + EXPORT_ROW_RESERVE > state->buffer.capacity)
+    {
+        metricsCount(COUNTER_BYTES_WRITTEN, state->buffer.length);
+        if (!outputBufferFlush(&state->buffer, state->out))
+        {
+            state->failed = 1;
+        }
+    }
+}
+
+static void beginField(ExportState *state, const char *name)
+{
+    if (!state->firstField)
+    {
+        append(state, ",", 1);
+    }
+    state->firstField = 0;
+    if (state->options->format == EXPORT_JSONL)
+    {
+        append(state, "\"", 1);
+        append(state, name, strlen(name));
+        append(state, "\":", 2);
+    }
+}
+
+static void fieldLong(ExportState *state, const char *name, long value)
+{
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    do
+    {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0)
+    {
+        *--p = '-';
+    }
+    beginField(state, name);
+    append(state, p, (size_t)(digits + sizeof(digits) - p));
+}
+
+// Empty in CSV, null in JSON
+static void fieldNull(ExportState *state, const char *name)
+{
+    beginField(state, name);
+    if (state->options->format == EXPORT_JSONL)
+    {
+        append(state, "null", 4);
+    }
+}
+
+// Columns a CSV row leaves empty; JSON leaves them out
+static void fieldsAbsent(ExportState *state, int count)
+{
+    for (int i = 0; i < count && state->options->format == EXPORT_CSV; i++)
+    {
+        beginField(state, "");
+    }
+}
+
+static void fieldBool(ExportState *state, const char *name, int value)
+{
+    beginField(state, name);
+    if (state->options->format == EXPORT_JSONL)
+    {
+        append(state, value ? "true" : "false", value ? 4 : 5);
+    }
+    else
+    {
+        append(state, value ? "1" : "0", 1);
+    }
+}
+
+// Fixed-size record fields are not always terminated
+static size_t boundedLength(const char *text, size_t size)
+{
+    const char *end = memchr(text, '\0', size);
+    return end ? (size_t)(end - text) : size;
+}
+
+// CSV quotes a field only when it holds a separator, quote or line break,
+// doubling the quotes inside
+static void appendCsvText(ExportState *state, const char *text, size_t length)
+{
+    size_t plain = 0;
+    while (plain < length && text[plain] != ',' && text[plain] != '"' && text[plain] != '\r' && text[plain] != '\n')
+    {
+        plain++;
+    }
+    if (plain == length)
+    {
+        append(state, text, length);
+        return;
+    }
+    append(state, "\"", 1);
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (text[i] == '"')
+        {
+            append(state, text + start, i + 1 - start);
+            start = i; // the quote goes out twice
+        }
+    }
+    append(state, text + start, length - start);
+    append(state, "\"", 1);
+}
+
+// Runs of plain characters are copied at once; only quotes, backslashes
+// and control characters are escaped
+static void appendJsonText(ExportState *state, const char *text, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    append(state, "\"", 1);
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+        append(state, text + start, i - start);
+        start = i + 1;
+        char escape[6] = {'\\', (char)c, 0, 0, 0, 0};
+        size_t escapeLength = 2;
+        if (c == '\n')
+        {
+            escape[1] = 'n';
+        }
+        else if (c == '\r')
+        {
+            escape[1] = 'r';
+        }
+        else if (c == '\t')
+        {
+            escape[1] = 't';
+        }
+        else if (c < 0x20)
+        {
+            memcpy(escape, "\\u00", 4);
+            escape[4] = hex[c >> 4];
+            escape[5] = hex[c & 15];
+            escapeLength = 6;
+        }
+        append(state, escape, escapeLength);
+    }
+    append(state, text + start, length - start);
+    append(state, "\"", 1);
+}
+
+static void fieldText(ExportState *state, const char *name, const char *text, size_t size)
+{
+    if (!text)
+    {
+        fieldNull(state, name);
+        return;
+    }
+    size_t length = boundedLength(text, size);
+    beginField(state, name);
+    if (state->options->format == EXPORT_JSONL)
+    {
+        appendJsonText(state, text, length);
+    }
+    else
+    {
+        appendCsvText(state, text, length);
+    }
+}
+
+static void appendQuoted(ExportState *state, const char *text, size_t length)
+{
+    int quote = state->options->format == EXPORT_JSONL;
+    if (quote)
+    {
+        append(state, "\"", 1);
+    }
+    append(state, text, length);
+    if (quote)
+    {
+        append(state, "\"", 1);
+    }
+}
+
+static void fieldDate(ExportState *state, const char *name, time_t stored)
+{
+    char text[DATE_TEXT_SIZE];
+    dateFormat(dateFromTime(stored), text);
+    beginField(state, name);
+    appendQuoted(state, text, strlen(text));
+}
+
+static void putTwoDigits(char *out, int value)
+{
+    out[0] = (char)('0' + value / 10);
+    out[1] = (char)('0' + value % 10);
+}
+
+// UTC, so rows from either side of a daylight-saving change compare cleanly.
+// Borrow and return dates cluster in a few recent days, so the date part
+// comes from a small cache rather than being formatted every time.
+static void fieldTimestamp(ExportState *state, const char *name, time_t timestamp)
+{
+    int64_t seconds = (int64_t)timestamp;
+    int64_t days = seconds / DATE_SECONDS_PER_DAY;
+    int intoDay = (int)(seconds % DATE_SECONDS_PER_DAY);
+    if (intoDay < 0)
+    {
+        days--;
+        intoDay += DATE_SECONDS_PER_DAY;
+    }
+    DayText *date = &state->days[(uint64_t)days % EXPORT_DAY_CACHE];
+    if (date->length == 0 || date->day != days)
+    {
+        int year, month, day;
+        civilFromDays(days, &year, &month, &day);
+        snprintf(date->text, sizeof(date->text), "%04d-%02d-%02dT", year, month, day);
+        date->length = strlen(date->text);
+        date->day = days;
+    }
+    char clock[9] = "00:00:00Z";
+    putTwoDigits(clock, intoDay / 3600);
+    putTwoDigits(clock + 3, intoDay / 60 % 60);
+    putTwoDigits(clock + 6, intoDay % 60);
+
+    int quote = state->options->format == EXPORT_JSONL;
+    beginField(state, name);
+    if (quote)
+    {
+        append(state, "\"", 1);
+    }
+    append(state, date->text, date->length);
+    append(state, clock, sizeof(clock));
+    if (quote)
+    {
+        append(state, "\"", 1);
+    }
+}
+
+static void bookFields(ExportState *state, const Book *book)
+{
+    fieldLong(state, "bookID", book->bookID);
+    fieldText(state, "title", book->title, sizeof(book->title));
+    fieldText(state, "author", book->author, sizeof(book->author));
+    fieldDate(state, "publicationDate", book->publicationDate);
+    fieldLong(state, "quantity", book->quantity);
+}
+
+static void memberFields(ExportState *state, const Member *member)
+{
+    fieldLong(state, "memberID", member->memberID);
+    fieldText(state, "name", member->name, sizeof(member->name));
+    fieldText(state, "email", member->email, sizeof(member->email));
+    fieldText(state, "phone", member->phone, sizeof(member->phone));
+}
+
+// The loan columns after bookID and memberID
+static void loanDateFields(ExportState *state, const BorrowedRecord *loan)
+{
+    fieldTimestamp(state, "borrowDate", loan->borrowDate);
+    if (loan->returnDate != 0)
+    {
+        fieldTimestamp(state, "returnDate", loan->returnDate);
+    }
+    else
+    {
+        fieldNull(state, "returnDate");
+    }
+    fieldBool(state, "isOverdue", loan->isOverdue);
+}
+
+static int exportBooks(ExportState *state)
+{
+    ShardSet set;
+    shardsOpen(&set, SHARD_BOOKS, 0);
+    writeHeader(state, bookColumns, sizeof(bookColumns) / sizeof(bookColumns[0]));
+    Book book;
+    long position;
+    long scanned = 0;
+    while (!state->failed && shardsNext(&set, &book, &position))
+    {
+        scanned++;
+        if (state->options->outOfStockOnly && book.quantity != 0)
+        {
+            continue;
+        }
+        beginRow(state);
+        bookFields(state, &book);
+        endRow(state);
+    }
+    int ok = shardsClose(&set);
+    metricsCount(COUNTER_RECORDS_SCANNED, (uint64_t)scanned);
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)scanned * sizeof(Book));
+    return ok;
+}
+
+static int exportMembers(ExportState *state)
+{
+    ShardSet set;
+    shardsOpen(&set, SHARD_MEMBERS, 0);
+    writeHeader(state, memberColumns, sizeof(memberColumns) / sizeof(memberColumns[0]));
+    Member member;
+    long position;
+    long scanned = 0;
+    while (!state->failed && shardsNext(&set, &member, &position))
+    {
+        scanned++;
+        beginRow(state);
+        memberFields(state, &member);
+        endRow(state);
+    }
+    int ok = shardsClose(&set);
+    metricsCount(COUNTER_RECORDS_SCANNED, (uint64_t)scanned);
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)scanned * sizeof(Member));
+    return ok;
+}
+
+static int exportLoan(const BorrowedRecord *loan, void *ctx)
+{
+    ExportState *state = ctx;
+    const ExportOptions *options = state->options;
+    if ((options->openOnly && loan->returnDate != 0) ||
+        (options->hasRange && (loan->borrowDate < options->from || loan->borrowDate > options->to)))
+    {
+        return 1;
+    }
+    beginRow(state);
+    fieldLong(state, "bookID", loan->bookID);
+    fieldLong(state, "memberID", loan->memberID);
+    loanDateFields(state, loan);
+    if (options->joined)
+    {
+        LoanView view;
+        loanJoinProbe(&state->join, loan, state->now, &view);
+        fieldText(state, "title", view.title, 100);
+        fieldText(state, "memberName", view.memberName, 100);
+    }
+    endRow(state);
+    return !state->failed;
+}
+
+// borrow.dat in large reads; it holds every open loan and the loans
+// returned since the last archive compaction
+static int exportActiveLoans(ExportState *state)
+{
+    FILE *file = fopen(BORROWED_BOOKS_FILE, "rb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        return 1; // No loans yet
+    }
+    BorrowedRecord *records = malloc(EXPORT_READ_RECORDS * sizeof(BorrowedRecord));
+    if (!records)
+    {
+        fclose(file);
+        return 0;
+    }
+    size_t count;
+    uint64_t scanned = 0;
+    while (!state->failed && (count = fread(records, sizeof(BorrowedRecord), EXPORT_READ_RECORDS, file)) > 0)
+    {
+        scanned += count;
+        for (size_t i = 0; i < count && exportLoan(&records[i], state); i++)
+        {
+        }
+    }
+    free(records);
+    fclose(file);
+    metricsCount(COUNTER_RECORDS_SCANNED, scanned);
+    metricsCount(COUNTER_BYTES_READ, scanned * sizeof(BorrowedRecord));
+    return 1;
+}
+
+static int exportLoans(ExportState *state)
+{
+    const ExportOptions *options = state->options;
+    size_t columns = options->joined ? sizeof(loanColumns) / sizeof(loanColumns[0]) : LOAN_PLAIN_COLUMNS;
+    if (options->joined && !loanJoinBuild(&state->join))
+    {
+        return 0;
+    }
+    writeHeader(state, loanColumns, columns);
+
+    int ok;
+    if (options->openOnly)
+    {
+        ok = exportActiveLoans(state); // The archive holds returned loans only
+    }
+    else if (options->hasRange)
+    {
+        // The zone maps skip every block outside the range
+        LoanQuery query;
+        memset(&query, 0, sizeof(query));
+        query.from = options->from;
+        query.to = options->to;
+        query.mode = LOAN_QUERY_BORROWED;
+        ok = loanQueryRun(&query, exportLoan, state) >= 0;
+    }
+    else
+    {
+        ok = loanArchiveForEach(exportLoan, state) && exportActiveLoans(state);
+    }
+    if (options->joined)
+    {
+        loanJoinFree(&state->join);
+    }
+    return ok;
+}
+
+static void exportChange(ExportState *state, const ChangeRecord *change)
+{
+    const char *type = changesTypeName((ChangeType)change->type);
+    beginRow(state);
+    fieldLong(state, "sequence", (long)change->sequence);
+    fieldTimestamp(state, "time", (time_t)change->time);
+    fieldText(state, "type", type, strlen(type));
+    switch (change->type)
+    {
+    case CHANGE_BOOK_INSERT:
+    case CHANGE_BOOK_UPDATE:
+    case CHANGE_BOOK_DELETE:
+        bookFields(state, &change->record.book);
+        fieldsAbsent(state, 7);
+        break;
+    case CHANGE_MEMBER_INSERT:
+    case CHANGE_MEMBER_UPDATE:
+    case CHANGE_MEMBER_DELETE:
+        fieldsAbsent(state, 5);
+        memberFields(state, &change->record.member);
+        fieldsAbsent(state, 3);
+        break;
+    default:
+        fieldLong(state, "bookID", change->record.loan.bookID);
+        fieldsAbsent(state, 4);
+        fieldLong(state, "memberID", change->record.loan.memberID);
+        fieldsAbsent(state, 3);
+        loanDateFields(state, &change->record.loan);
+        break;
+    }
+    endRow(state);
+}
+
+// The changes after options->after; with follow, keeps waiting for more and
+// hands each batch to out as soon as it is read
+static int exportChanges(ExportState *state)
+{
+    const ExportOptions *options = state->options;
+    writeHeader(state, changeColumns, sizeof(changeColumns) / sizeof(changeColumns[0]));
+    ChangeCursor cursor;
+    changesOpen(&cursor, options->after);
+    ChangeRecord change;
+    int read;
+    for (;;)
+    {
+        while (!state->failed && (read = changesNext(&cursor, &change)) == 1)
+        {
+            exportChange(state, &change);
+        }
+        if (read < 0 || state->failed || !options->follow)
+        {
+            break;
+        }
+        metricsCount(COUNTER_BYTES_WRITTEN, state->buffer.length);
+        if (!outputBufferFlush(&state->buffer, state->out))
+        {
+            state->failed = 1;
+            break;
+        }
+        if (changesWait(&cursor, 1000) < 0)
+        {
+            read = -1;
+            break;
+        }
+    }
+    changesClose(&cursor);
+    return read >= 0;
+}
+
+long exportRun(const ExportOptions *options, FILE *out)
+{
+    uint64_t start = metricsNow();
+    ExportState state;
+    memset(&state, 0, sizeof(state));
+    state.options = options;
+    state.out = out;
+    state.now = time(NULL);
+    if (!outputBufferInit(&state.buffer, EXPORT_BUFFER_SIZE))
+    {
+        return -1;
+    }
+
+    int ok;
+    switch (options->table)
+    {
+    case EXPORT_BOOKS:
+        ok = exportBooks(&state);
+        break;
+    case EXPORT_MEMBERS:
+        ok = exportMembers(&state);
+        break;
+    case EXPORT_CHANGES:
+        ok = exportChanges(&state);
+        break;
+    default:
+        ok = exportLoans(&state);
+        break;
+    }
+    metricsCount(COUNTER_BYTES_WRITTEN, state.buffer.length);
+    ok = outputBufferFlush(&state.buffer, out) && ok && !state.failed;
+    outputBufferFree(&state.buffer);
+    metricsStop(TIMER_EXPORT, start);
+    return ok ? state.rows : -1;
+}
@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/holds.h"
+#include "../include/id_index.h"
+#include "../include/journal.h"
+#include "../include/metrics.h"
+
+#define HOLDS_TEMP_FILE "data/holds.dat.tmp"
+#define COMPACT_MIN_CLOSED 256 // closed records before a load rewrites the file
+#define NO_SLOT (-1L)
+
+typedef struct
+{
+    long head; // oldest waiting hold
+    long tail;
+    long length;
+    long ready; // holds whose copy is set aside, threaded through nextSlot too
+} HoldQueue;
+
+static HoldRecord *slots; // mirror of holds.dat
+static long *nextSlot;    // next waiting (or ready) hold on the same book
+static size_t slotCount;
+static size_t slotCapacity;
+
+static HoldQueue *queues;
+static size_t queueCount;
+static size_t queueCapacity;
+static IdIndex queueIndex; // bookID -> position in queues
+
+static int loaded = 0;
+
+static int isOpen(const HoldRecord *hold)
+{
+    return hold->state == HOLD_WAITING || hold->state == HOLD_READY;
+}
+
+static HoldQueue *findQueue(int bookID, int create)
+{
+    long position;
+    if (idIndexFind(&queueIndex, bookID, &position))
+    {
+        return &queues[position];
+    }
+    if (!create)
+    {
+        return NULL;
+    }
+    if (queueCount == queueCapacity)
+    {
+        size_t newCapacity = queueCapacity ? queueCapacity * 2 : 64;
+        HoldQueue *grown = realloc(queues, newCapacity * sizeof(HoldQueue));
+        if (!grown)
+        {
+            return NULL;
+        }
+        queues = grown;
+        queueCapacity = newCapacity;
+    }
+    if (!idIndexPut(&queueIndex, bookID, (long)queueCount))
+    {
+        return NULL;
+    }
+    HoldQueue *queue = &queues[queueCount++];
+    queue->head = queue->tail = queue->ready = NO_SLOT;
+    queue->length = 0;
+    return queue;
+}
+
+static int reserveSlot(void)
+{
+    if (slotCount < slotCapacity)
+    {
+        return 1;
+    }
+    size_t newCapacity = slotCapacity ? slotCapacity * 2 : 256;
+    HoldRecord *grownSlots = realloc(slots, newCapacity * sizeof(HoldRecord));
+    if (!grownSlots)
+    {
+        return 0;
+    }
+    slots = grownSlots;
+    long *grownNext = realloc(nextSlot, newCapacity * sizeof(long));
+    if (!grownNext)
+    {
+        return 0;
+    }
+    nextSlot = grownNext;
+    slotCapacity = newCapacity;
+    return 1;
+}
+
+static int enqueue(long slot)
+{
+    HoldQueue *queue = findQueue(slots[slot].bookID, 1);
+    if (!queue)
+    {
+        return 0;
+    }
+    nextSlot[slot] = NO_SLOT;
+    if (queue->tail == NO_SLOT)
+    {
+        queue->head = slot;
+    }
+    else
+    {
+        nextSlot[queue->tail] = slot;
+    }
+    queue->tail = slot;
+    queue->length++;
+    return 1;
+}
+
+static int addReady(long slot)
+{
+    HoldQueue *queue = findQueue(slots[slot].bookID, 1);
+    if (!queue)
+    {
+        return 0;
+    }
+    nextSlot[slot] = queue->ready;
+    queue->ready = slot;
+    return 1;
+}
+
+static void removeReady(HoldQueue *queue, long slot)
+{
+    long *link = &queue->ready;
+    while (*link != NO_SLOT && *link != slot)
+    {
+        link = &nextSlot[*link];
+    }
+    if (*link == slot)
+    {
+        *link = nextSlot[slot];
+    }
+}
+
+// Unlinks a waiting hold; O(1) for the head, a walk otherwise
+static void removeFromQueue(HoldQueue *queue, long slot)
+{
+    long previous = NO_SLOT;
+    long current = queue->head;
+    while (current != NO_SLOT && current != slot)
+    {
+        previous = current;
+        current = nextSlot[current];
+    }
+    if (current == NO_SLOT)
+    {
+        return;
+    }
+    if (previous == NO_SLOT)
+    {
+        queue->head = nextSlot[slot];
+    }
+    else
+    {
+        nextSlot[previous] = nextSlot[slot];
+    }
+    if (queue->tail == slot)
+    {
+        queue->tail = previous;
+    }
+    queue->length--;
+}
+
+static void writeSlot(long slot)
+{
+    FILE *file = fopen(HOLDS_FILE, "rb+");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to open holds file");
+        journalAbort();
+        return;
+    }
+    journalWrite(file, HOLDS_FILE, slot * (long)sizeof(HoldRecord), &slots[slot], sizeof(HoldRecord));
+    fclose(file);
+    metricsCount(COUNTER_BYTES_WRITTEN, sizeof(HoldRecord));
+}
+
+static void resetTables(void)
+{
+    free(slots);
+    free(nextSlot);
+    free(queues);
+    slots = NULL;
+    nextSlot = NULL;
+    queues = NULL;
+    slotCount = slotCapacity = queueCount = queueCapacity = 0;
+    idIndexFree(&queueIndex);
+    idIndexInit(&queueIndex);
+}
+
+// Rewrites holds.dat with only the open holds, in their original order
+static int compact(void)
+{
+    FILE *file = fopen(HOLDS_TEMP_FILE, "wb");
+    if (!file)
+    {
+        return 0;
+    }
+    int ok = 1;
+    for (size_t i = 0; i < slotCount && ok; i++)
+    {
+        if (isOpen(&slots[i]))
+        {
+            ok = fwrite(&slots[i], sizeof(HoldRecord), 1, file) == 1;
+        }
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        remove(HOLDS_TEMP_FILE);
+        return 0;
+    }
+    if (!journalReplaceFile(HOLDS_TEMP_FILE, HOLDS_FILE))
+    {
+        return 0;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        if (isOpen(&slots[i]))
+        {
+            slots[kept++] = slots[i];
+        }
+    }
+    metricsCount(COUNTER_BYTES_WRITTEN, (uint64_t)kept * sizeof(HoldRecord));
+    slotCount = kept;
+    return 1;
+}
+
+void holdsInvalidate(void)
+{
+    loaded = 0;
+}
+
+int holdsLoad(void)
+{
+    if (loaded)
+    {
+        return 1;
+    }
+    resetTables();
+    FILE *file = fopen(HOLDS_FILE, "rb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (file)
+    {
+        HoldRecord hold;
+        while (fread(&hold, sizeof(HoldRecord), 1, file) == 1)
+        {
+            if (!reserveSlot())
+            {
+                fclose(file);
+                resetTables();
+                return 0;
+            }
+            slots[slotCount++] = hold;
+        }
+        fclose(file);
+        metricsCount(COUNTER_RECORDS_SCANNED, slotCount);
+        metricsCount(COUNTER_BYTES_READ, (uint64_t)slotCount * sizeof(HoldRecord));
+    }
+
+    size_t closed = 0;
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        closed += !isOpen(&slots[i]);
+    }
+    if (closed >= COMPACT_MIN_CLOSED && closed > slotCount - closed)
+    {
+        compact(); // On failure the closed records are simply kept
+    }
+
+    // Records are appended in the order holds are placed, so replaying the
+    // waiting ones rebuilds every queue in FIFO order
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        if ((slots[i].state == HOLD_WAITING && !enqueue((long)i)) ||
+            (slots[i].state == HOLD_READY && !addReady((long)i)))
+        {
+            resetTables();
+            return 0;
+        }
+    }
+    loaded = 1;
+    return 1;
+}
+
+// Slot of the member's open hold on the book, or NO_SLOT. Only that book's
+// open holds are walked, so the cost does not grow with closed ones.
+static long findSlot(int bookID, int memberID)
+{
+    HoldQueue *queue = findQueue(bookID, 0);
+    if (!queue)
+    {
+        return NO_SLOT;
+    }
+    for (long current = queue->ready; current != NO_SLOT; current = nextSlot[current])
+    {
+        if (slots[current].memberID == memberID)
+        {
+            return current;
+        }
+    }
+    for (long current = queue->head; current != NO_SLOT; current = nextSlot[current])
+    {
+        if (slots[current].memberID == memberID)
+        {
+            return current;
+        }
+    }
+    return NO_SLOT;
+}
+
+// 1-based place of a waiting hold in its book's queue
+static long queuePosition(long slot)
+{
+    HoldQueue *queue = findQueue(slots[slot].bookID, 0);
+    long position = 1;
+    for (long current = queue ? queue->head : NO_SLOT; current != NO_SLOT; current = nextSlot[current])
+    {
+        if (current == slot)
+        {
+            return position;
+        }
+        position++;
+    }
+    return 0;
+}
+
+int holdsPlace(int bookID, int memberID, long *position)
+{
+    if (!holdsLoad() || findSlot(bookID, memberID) != NO_SLOT || !reserveSlot())
+    {
+        return 0;
+    }
+    long slot = (long)slotCount;
+    HoldRecord *hold = &slots[slot];
+    memset(hold, 0, sizeof(*hold));
+    hold->bookID = bookID;
+    hold->memberID = memberID;
+    hold->placedDate = time(NULL);
+    hold->state = HOLD_WAITING;
+
+    FILE *file = fopen(HOLDS_FILE, "ab");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to open holds file");
+        journalAbort();
+        return 0;
+    }
+    int ok = journalWrite(file, HOLDS_FILE, JOURNAL_APPEND, hold, sizeof(HoldRecord));
+    ok = fclose(file) == 0 && ok;
+    if (!ok || !enqueue(slot))
+    {
+        loaded = 0; // Reload from the file rather than guess what it holds
+        return 0;
+    }
+    metricsCount(COUNTER_BYTES_WRITTEN, sizeof(HoldRecord));
+    slotCount++;
+    *position = findQueue(bookID, 0)->length;
+    return 1;
+}
+
+int holdsFind(int bookID, int memberID)
+{
+    if (!holdsLoad())
+    {
+        return -1;
+    }
+    long slot = findSlot(bookID, memberID);
+    return slot == NO_SLOT ? -1 : slots[slot].state;
+}
+
+long holdsWaiting(int bookID)
+{
+    HoldQueue *queue = holdsLoad() ? findQueue(bookID, 0) : NULL;
+    return queue ? queue->length : 0;
+}
+
+int holdsAssignCopy(int bookID)
+{
+    HoldQueue *queue = holdsLoad() ? findQueue(bookID, 0) : NULL;
+    if (!queue || queue->head == NO_SLOT)
+    {
+        return 0;
+    }
+    long slot = queue->head;
+    queue->head = nextSlot[slot];
+    if (queue->head == NO_SLOT)
+    {
+        queue->tail = NO_SLOT;
+    }
+    queue->length--;
+    nextSlot[slot] = queue->ready;
+    queue->ready = slot;
+    slots[slot].state = HOLD_READY;
+    slots[slot].readyDate = time(NULL);
+    writeSlot(slot);
+    return slots[slot].memberID;
+}
+
+static void closeSlot(long slot, HoldState closedAs)
+{
+    if (slots[slot].state == HOLD_WAITING)
+    {
+        removeFromQueue(findQueue(slots[slot].bookID, 0), slot);
+    }
+    else if (slots[slot].state == HOLD_READY)
+    {
+        removeReady(findQueue(slots[slot].bookID, 0), slot);
+    }
+    slots[slot].state = closedAs;
+    writeSlot(slot);
+}
+
+int holdsClose(int bookID, int memberID, HoldState closedAs)
+{
+    if (!holdsLoad())
+    {
+        return -1;
+    }
+    long slot = findSlot(bookID, memberID);
+    if (slot == NO_SLOT)
+    {
+        return -1;
+    }
+    int previous = slots[slot].state;
+    closeSlot(slot, closedAs);
+    return previous;
+}
+
+void holdsCancelBook(int bookID)
+{
+    if (!holdsLoad())
+    {
+        return;
+    }
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        if (slots[i].bookID == bookID && isOpen(&slots[i]))
+        {
+            closeSlot((long)i, HOLD_CANCELLED);
+        }
+    }
+}
+
+size_t holdsForMember(int memberID, MemberHold *out, size_t max)
+{
+    size_t count = 0;
+    if (!holdsLoad())
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        if (slots[i].memberID != memberID || !isOpen(&slots[i]))
+        {
+            continue;
+        }
+        if (count < max)
+        {
+            out[count].hold = slots[i];
+            out[count].position = slots[i].state == HOLD_WAITING ? queuePosition((long)i) : 0;
+        }
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "../include/library.h"
+#include "../include/id_filter.h"
+#include "../include/journal.h"
+#include "../include/metrics.h"
+
+#define ID_FILTER_MAGIC "LMSIDF1"
+#define ID_FILTER_HASHES 7
+
+typedef struct
+{
+    char magic[8];
+    uint32_t hashes;
+    uint32_t reserved;
+    uint64_t bits;     // a power of two
+    uint64_t capacity; // IDs it was sized for
+    uint64_t added;    // IDs set since it was built, deleted ones included
+    int64_t records;   // records in the shards it covers
+} FilterHeader;
+
+typedef struct
+{
+    int state;  // FILTER_UNREAD, FILTER_READY or FILTER_NONE
+    int onDisk; // the file holds this filter; a rebuild may not have been saved
+    FilterHeader header;
+    unsigned char *bits;
+} IdFilter;
+
+enum
+{
+    FILTER_UNREAD,
+    FILTER_READY,
+    FILTER_NONE // missing or out of date on disk
+};
+
+static IdFilter filters[SHARD_KIND_COUNT];
+static const char *const filterPaths[SHARD_KIND_COUNT] = {ID_FILTER_BOOKS_FILE, ID_FILTER_MEMBERS_FILE};
+
+static uint64_t mixID(int id)
+{
+    uint64_t x = (uint64_t)(uint32_t)id + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Bit i of the hashes (double hashing from one 64-bit mix)
+static uint64_t bitOf(const FilterHeader *header, uint64_t hash, uint32_t i)
+{
+    uint64_t step = (hash >> 32) | 1;
+    return (hash + i * step) & (header->bits - 1);
+}
+
+static void dropFilter(IdFilter *filter, int state)
+{
+    free(filter->bits);
+    filter->bits = NULL;
+    filter->state = state;
+}
+
+// Reads the kind's filter into memory; NULL when there is none on disk or
+// it does not cover the shards as they are
+static IdFilter *readFilter(ShardKind kind)
+{
+    IdFilter *filter = &filters[kind];
+    if (filter->state != FILTER_UNREAD)
+    {
+        return filter->state == FILTER_READY ? filter : NULL;
+    }
+    filter->state = FILTER_NONE;
+    FILE *file = fopen(filterPaths[kind], "rb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        return NULL;
+    }
+    FilterHeader *header = &filter->header;
+    int ok = fread(header, sizeof(*header), 1, file) == 1 &&
+             memcmp(header->magic, ID_FILTER_MAGIC, sizeof(header->magic)) == 0 &&
+             header->hashes == ID_FILTER_HASHES && header->bits >= 8 && (header->bits & (header->bits - 1)) == 0 &&
+             header->records == (int64_t)shardsRecordCount(kind);
+    filter->bits = ok ? malloc(header->bits / 8) : NULL;
+    ok = filter->bits && fread(filter->bits, header->bits / 8, 1, file) == 1;
+    fclose(file);
+    if (!ok)
+    {
+        dropFilter(filter, FILTER_NONE);
+        return NULL;
+    }
+    metricsCount(COUNTER_BYTES_READ, sizeof(*header) + header->bits / 8);
+    filter->state = FILTER_READY;
+    filter->onDisk = 1;
+    return filter;
+}
+
+int idFilterRebuild(ShardKind kind)
+{
+    IdFilter *filter = &filters[kind];
+    dropFilter(filter, FILTER_NONE);
+    FilterHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ID_FILTER_MAGIC, sizeof(header.magic));
+    header.hashes = ID_FILTER_HASHES;
+    long records = shardsRecordCount(kind);
+    // Room to double before the next rebuild
+    header.capacity = records * 2 > ID_FILTER_MIN_IDS ? (uint64_t)records * 2 : ID_FILTER_MIN_IDS;
+    header.bits = 8;
+    while (header.bits < header.capacity * ID_FILTER_BITS_PER_ID)
+    {
+        header.bits *= 2;
+    }
+    unsigned char *bits = calloc(header.bits / 8, 1);
+    if (!bits)
+    {
+        return 0;
+    }
+
+    ShardSet set;
+    union
+    {
+        Book book;
+        Member member;
+    } record;
+    long position;
+    shardsOpen(&set, kind, 0);
+    while (shardsNext(&set, &record, &position))
+    {
+        uint64_t hash = mixID(record.book.bookID); // Both records start with their ID
+        for (uint32_t i = 0; i < ID_FILTER_HASHES; i++)
+        {
+            uint64_t bit = bitOf(&header, hash, i);
+            bits[bit / 8] |= (unsigned char)(1u << (bit % 8));
+        }
+        header.records++;
+    }
+    header.added = (uint64_t)header.records;
+    metricsCount(COUNTER_RECORDS_SCANNED, (uint64_t)header.records);
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)header.records * shardsRecordSize(kind));
+    if (!shardsClose(&set))
+    {
+        free(bits);
+        return 0;
+    }
+
+    // Saved as its own operation; a read-only folder keeps it in memory
+    char temp[64];
+    snprintf(temp, sizeof(temp), "%s.tmp", filterPaths[kind]);
+    FILE *file = fopen(temp, "wb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    int saved = file && fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(bits, header.bits / 8, 1, file) == 1;
+    saved = file && fclose(file) == 0 && saved;
+    if (saved)
+    {
+        metricsCount(COUNTER_BYTES_WRITTEN, sizeof(header) + header.bits / 8);
+        journalBegin();
+        saved = journalReplaceOnCommit(temp, filterPaths[kind]);
+        saved = journalCommit() && saved;
+    }
+    else
+    {
+        remove(temp);
+    }
+    // Installed after the commit, which drops the filters when it fails
+    filter->header = header;
+    filter->bits = bits;
+    filter->state = FILTER_READY;
+    filter->onDisk = saved;
+    return saved;
+}
+
+int idFilterMayContain(ShardKind kind, int id)
+{
+    IdFilter *filter = readFilter(kind);
+    if (!filter || filter->header.added > filter->header.capacity)
+    {
+        idFilterRebuild(kind);
+        filter = filters[kind].state == FILTER_READY ? &filters[kind] : NULL;
+    }
+    if (!filter)
+    {
+        return 1; // Only the full lookup can tell
+    }
+    uint64_t hash = mixID(id);
+    for (uint32_t i = 0; i < ID_FILTER_HASHES; i++)
+    {
+        uint64_t bit = bitOf(&filter->header, hash, i);
+        if (!(filter->bits[bit / 8] & (1u << (bit % 8))))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The filter to update when the shards change. A file that does not hold
+// it is marked stale, since the shards could come to match its count.
+static IdFilter *filterToUpdate(ShardKind kind, FILE **file, int *ok)
+{
+    *ok = 1;
+    IdFilter *filter = readFilter(kind);
+    *file = fopen(filterPaths[kind], "rb+");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!*file)
+    {
+        // None to keep current: the next check builds one
+        dropFilter(&filters[kind], FILTER_NONE);
+        return NULL;
+    }
+    if (!filter || !filter->onDisk)
+    {
+        static const char stale[sizeof(((FilterHeader *)0)->magic)] = {0};
+        *ok = journalWrite(*file, filterPaths[kind], 0, stale, sizeof(stale));
+        fclose(*file);
+        dropFilter(&filters[kind], FILTER_NONE);
+        return NULL;
+    }
+    return filter;
+}
+
+int idFilterAdd(ShardKind kind, int id)
+{
+    FILE *file;
+    int ok;
+    IdFilter *filter = filterToUpdate(kind, &file, &ok);
+    if (!filter)
+    {
+        return ok;
+    }
+    uint64_t hash = mixID(id);
+    for (uint32_t i = 0; ok && i < ID_FILTER_HASHES; i++)
+    {
+        uint64_t bit = bitOf(&filter->header, hash, i);
+        unsigned char *byte = &filter->bits[bit / 8];
+        if (!(*byte & (1u << (bit % 8))))
+        {
+            *byte |= (unsigned char)(1u << (bit % 8));
+            ok = journalWrite(file, filterPaths[kind], (long)(sizeof(FilterHeader) + bit / 8), byte, 1);
+        }
+    }
+    filter->header.added++;
+    filter->header.records++;
+    ok = ok && journalWrite(file, filterPaths[kind], 0, &filter->header, sizeof(filter->header));
+    fclose(file);
+    if (!ok)
+    {
+        dropFilter(filter, FILTER_UNREAD); // Read back as the rollback left it
+    }
+    return ok;
+}
+
+int idFilterNoteDelete(ShardKind kind)
+{
+    FILE *file;
+    int ok;
+    IdFilter *filter = filterToUpdate(kind, &file, &ok);
+    if (!filter)
+    {
+        return ok;
+    }
+    filter->header.records--;
+    ok = journalWrite(file, filterPaths[kind], 0, &filter->header, sizeof(filter->header));
+    fclose(file);
+    if (!ok)
+    {
+        dropFilter(filter, FILTER_UNREAD);
+    }
+    return ok;
+}
+
+void idFilterInvalidate(void)
+{
+    for (int kind = 0; kind < SHARD_KIND_COUNT; kind++)
+    {
+        dropFilter(&filters[kind], FILTER_UNREAD);
+    }
+}
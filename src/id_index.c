@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "../include/id_index.h"
+
+#define ID_INDEX_INITIAL_CAPACITY 64
+
+static size_t slotOf(const IdIndex *index, int id)
+{
+    // Fibonacci hashing spreads sequential IDs across the table
+    return (size_t)(((uint32_t)id * 2654435769u) & (uint32_t)(index->capacity - 1));
+}
+
+void idIndexInit(IdIndex *index)
+{
+    index->keys = NULL;
+    index->values = NULL;
+    index->capacity = 0;
+    index->count = 0;
+    index->arena = NULL;
+}
+
+void idIndexFree(IdIndex *index)
+{
+    if (!index->arena)
+    {
+        free(index->keys);
+        free(index->values);
+    }
+    idIndexInit(index);
+}
+
+void idIndexClear(IdIndex *index)
+{
+    for (size_t i = 0; i < index->capacity; i++)
+    {
+        index->keys[i] = 0;
+    }
+    index->count = 0;
+}
+
+static int allocateTables(IdIndex *index, size_t capacity, int **keys, long **values)
+{
+    if (index->arena)
+    {
+        *keys = arenaAlloc(index->arena, capacity * sizeof(int));
+        *values = arenaAlloc(index->arena, capacity * sizeof(long));
+        if (*keys)
+        {
+            memset(*keys, 0, capacity * sizeof(int));
+        }
+        return *keys && *values; // A failed pair stays in the arena until it rewinds
+    }
+    *keys = calloc(capacity, sizeof(int));
+    *values = malloc(capacity * sizeof(long));
+    if (!*keys || !*values)
+    {
+        free(*keys);
+        free(*values);
+        return 0;
+    }
+    return 1;
+}
+
+static int growTo(IdIndex *index, size_t newCapacity)
+{
+    int *newKeys;
+    long *newValues;
+    if (!allocateTables(index, newCapacity, &newKeys, &newValues))
+    {
+        return 0;
+    }
+
+    IdIndex grown = {newKeys, newValues, newCapacity, 0, index->arena};
+    for (size_t i = 0; i < index->capacity; i++)
+    {
+        if (index->keys[i] != 0)
+        {
+            size_t slot = slotOf(&grown, index->keys[i]);
+            while (grown.keys[slot] != 0)
+            {
+                slot = (slot + 1) & (newCapacity - 1);
+            }
+            grown.keys[slot] = index->keys[i];
+            grown.values[slot] = index->values[i];
+            grown.count++;
+        }
+    }
+    if (!index->arena)
+    {
+        free(index->keys);
+        free(index->values);
+    }
+    *index = grown;
+    return 1;
+}
+
+static int grow(IdIndex *index)
+{
+    return growTo(index, index->capacity ? index->capacity * 2 : ID_INDEX_INITIAL_CAPACITY);
+}
+
+int idIndexInitArena(IdIndex *index, Arena *arena, size_t count)
+{
+    idIndexInit(index);
+    index->arena = arena;
+    size_t capacity = ID_INDEX_INITIAL_CAPACITY;
+    while (count * 10 > capacity * 7) // The load factor idIndexPut keeps
+    {
+        capacity *= 2;
+    }
+    return growTo(index, capacity);
+}
+
+int idIndexPut(IdIndex *index, int id, long value)
+{
+    // Keep the load factor under 70%
+    if ((index->count + 1) * 10 > index->capacity * 7 && !grow(index))
+    {
+        return 0;
+    }
+    size_t slot = slotOf(index, id);
+    while (index->keys[slot] != 0 && index->keys[slot] != id)
+    {
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+    if (index->keys[slot] == 0)
+    {
+        index->keys[slot] = id;
+        index->count++;
+    }
+    index->values[slot] = value;
+    return 1;
+}
+
+int idIndexFind(const IdIndex *index, int id, long *value)
+{
+    if (index->capacity == 0 || id == 0)
+    {
+        return 0;
+    }
+    size_t slot = slotOf(index, id);
+    while (index->keys[slot] != 0)
+    {
+        if (index->keys[slot] == id)
+        {
+            if (value)
+            {
+                *value = index->values[slot];
+            }
+            return 1;
+        }
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+    return 0;
+}
+
+int idIndexRemove(IdIndex *index, int id)
+{
+    if (index->capacity == 0 || id == 0)
+    {
+        return 0;
+    }
+    size_t mask = index->capacity - 1;
+    size_t slot = slotOf(index, id);
+    while (index->keys[slot] != id)
+    {
+        if (index->keys[slot] == 0)
+        {
+            return 0;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    size_t hole = slot;
+    size_t next = (hole + 1) & mask;
+    while (index->keys[next] != 0)
+    {
+        size_t home = slotOf(index, index->keys[next]);
+        // Move the entry into the hole unless its home lies between them
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            index->keys[hole] = index->keys[next];
+            index->values[hole] = index->values[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    index->keys[hole] = 0;
+    index->count--;
+    return 1;
+}
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../include/items.h"
+#include "../include/id_index.h"
+#include "../include/journal.h"
+#include "../include/metrics.h"
+
+#define ITEMS_INITIAL_SLOTS 256
+
+static ItemRecord *items; // mirror of items.dat
+static long *nextOfBook;  // next copy of the same book, ITEM_NONE at the end
+static size_t itemCount;
+static size_t itemCapacity;
+
+static long *barcodeTable; // open addressing, slot + 1 per entry, 0 = empty
+static size_t tableSize;   // always a power of two
+
+static IdIndex firstOfBook; // bookID -> most recently added copy
+
+static int loaded = 0;
+
+// FNV-1a, as for author names
+static uint32_t hashBarcode(const char *barcode)
+{
+    uint32_t h = 2166136261u;
+    while (*barcode)
+    {
+        h ^= (unsigned char)*barcode++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Returns the table position holding barcode, or the empty one where it would go
+static size_t findPosition(const char *barcode)
+{
+    size_t mask = tableSize - 1;
+    size_t i = hashBarcode(barcode) & mask;
+    while (barcodeTable[i] != 0 && strcmp(items[barcodeTable[i] - 1].barcode, barcode) != 0)
+    {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static int growTable(void)
+{
+    size_t newSize = tableSize ? tableSize * 2 : ITEMS_INITIAL_SLOTS;
+    long *newTable = calloc(newSize, sizeof(long));
+    if (!newTable)
+    {
+        return 0;
+    }
+    free(barcodeTable);
+    barcodeTable = newTable;
+    tableSize = newSize;
+    for (size_t slot = 0; slot < itemCount; slot++)
+    {
+        barcodeTable[findPosition(items[slot].barcode)] = (long)slot + 1;
+    }
+    return 1;
+}
+
+static int reserveItem(void)
+{
+    // Keep the barcode table under 70% full
+    if ((itemCount + 1) * 10 > tableSize * 7 && !growTable())
+    {
+        return 0;
+    }
+    if (itemCount < itemCapacity)
+    {
+        return 1;
+    }
+    size_t newCapacity = itemCapacity ? itemCapacity * 2 : ITEMS_INITIAL_SLOTS;
+    ItemRecord *grownItems = realloc(items, newCapacity * sizeof(ItemRecord));
+    if (!grownItems)
+    {
+        return 0;
+    }
+    items = grownItems;
+    long *grownNext = realloc(nextOfBook, newCapacity * sizeof(long));
+    if (!grownNext)
+    {
+        return 0;
+    }
+    nextOfBook = grownNext;
+    itemCapacity = newCapacity;
+    return 1;
+}
+
+// Adds items[itemCount] to the barcode table and its book's chain
+static int indexNewItem(void)
+{
+    long slot = (long)itemCount;
+    long first;
+    nextOfBook[slot] = idIndexFind(&firstOfBook, items[slot].bookID, &first) ? first : ITEM_NONE;
+    if (!idIndexPut(&firstOfBook, items[slot].bookID, slot))
+    {
+        return 0;
+    }
+    barcodeTable[findPosition(items[slot].barcode)] = slot + 1;
+    itemCount++;
+    return 1;
+}
+
+static void clearItems(void)
+{
+    free(items);
+    free(nextOfBook);
+    free(barcodeTable);
+    items = NULL;
+    nextOfBook = NULL;
+    barcodeTable = NULL;
+    itemCount = itemCapacity = tableSize = 0;
+    idIndexFree(&firstOfBook);
+    idIndexInit(&firstOfBook);
+}
+
+void itemsInvalidate(void)
+{
+    loaded = 0;
+}
+
+int itemsLoad(void)
+{
+    if (loaded)
+    {
+        return 1;
+    }
+    clearItems();
+    FILE *file = fopen(ITEMS_FILE, "rb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (file)
+    {
+        ItemRecord item;
+        while (fread(&item, sizeof(ItemRecord), 1, file) == 1)
+        {
+            if (!reserveItem())
+            {
+                fclose(file);
+                clearItems();
+                return 0;
+            }
+            items[itemCount] = item;
+            items[itemCount].barcode[ITEM_BARCODE_SIZE - 1] = '\0';
+            if (!indexNewItem())
+            {
+                fclose(file);
+                clearItems();
+                return 0;
+            }
+        }
+        fclose(file);
+        metricsCount(COUNTER_RECORDS_SCANNED, itemCount);
+        metricsCount(COUNTER_BYTES_READ, (uint64_t)itemCount * sizeof(ItemRecord));
+    }
+    loaded = 1;
+    return 1;
+}
+
+int itemsValidBarcode(const char *barcode)
+{
+    size_t len = strlen(barcode);
+    if (len == 0 || len >= ITEM_BARCODE_SIZE)
+    {
+        return 0;
+    }
+    for (; *barcode; barcode++)
+    {
+        if (!isgraph((unsigned char)*barcode))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+long itemsAdd(int bookID, const char *barcode)
+{
+    if (!itemsLoad() || !itemsValidBarcode(barcode) || itemsFind(barcode) != ITEM_NONE || !reserveItem())
+    {
+        return ITEM_NONE;
+    }
+    ItemRecord *item = &items[itemCount];
+    memset(item, 0, sizeof(*item));
+    strcpy(item->barcode, barcode);
+    item->bookID = bookID;
+    item->status = ITEM_AVAILABLE;
+    item->loanIndex = -1;
+    item->since = time(NULL);
+
+    FILE *file = fopen(ITEMS_FILE, "ab");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to open items file");
+        journalAbort();
+        return ITEM_NONE;
+    }
+    int ok = journalWrite(file, ITEMS_FILE, JOURNAL_APPEND, item, sizeof(ItemRecord));
+    ok = fclose(file) == 0 && ok;
+    if (!ok || !indexNewItem())
+    {
+        loaded = 0; // Reload from the file rather than guess what it holds
+        return ITEM_NONE;
+    }
+    metricsCount(COUNTER_BYTES_WRITTEN, sizeof(ItemRecord));
+    return (long)itemCount - 1;
+}
+
+long itemsFind(const char *barcode)
+{
+    if (!itemsLoad() || tableSize == 0)
+    {
+        return ITEM_NONE;
+    }
+    long entry = barcodeTable[findPosition(barcode)];
+    return entry ? entry - 1 : ITEM_NONE;
+}
+
+const ItemRecord *itemsGet(long slot)
+{
+    return slot >= 0 && (size_t)slot < itemCount ? &items[slot] : NULL;
+}
+
+long itemsPick(int bookID, ItemStatus status, int memberID)
+{
+    long slot;
+    if (!itemsLoad() || !idIndexFind(&firstOfBook, bookID, &slot))
+    {
+        return ITEM_NONE;
+    }
+    for (; slot != ITEM_NONE; slot = nextOfBook[slot])
+    {
+        if (items[slot].status == (int)status && (memberID == 0 || items[slot].memberID == memberID))
+        {
+            return slot;
+        }
+    }
+    return ITEM_NONE;
+}
+
+int itemsHasCopies(int bookID)
+{
+    long slot;
+    return itemsLoad() && idIndexFind(&firstOfBook, bookID, &slot);
+}
+
+size_t itemsCount(int bookID, ItemStatus status)
+{
+    size_t count = 0;
+    long slot;
+    if (!itemsLoad() || !idIndexFind(&firstOfBook, bookID, &slot))
+    {
+        return 0;
+    }
+    for (; slot != ITEM_NONE; slot = nextOfBook[slot])
+    {
+        count += items[slot].status == (int)status;
+    }
+    return count;
+}
+
+int itemsUpdate(long slot, ItemStatus status, int memberID, int64_t loanIndex)
+{
+    if (slot < 0 || (size_t)slot >= itemCount)
+    {
+        return 0;
+    }
+    ItemRecord *item = &items[slot];
+    item->status = status;
+    item->memberID = memberID;
+    item->loanIndex = loanIndex;
+    item->since = time(NULL);
+
+    FILE *file = fopen(ITEMS_FILE, "rb+");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to open items file");
+        journalAbort();
+        return 0;
+    }
+    int ok = journalWrite(file, ITEMS_FILE, slot * (long)sizeof(ItemRecord), item, sizeof(ItemRecord));
+    ok = fclose(file) == 0 && ok;
+    metricsCount(COUNTER_BYTES_WRITTEN, sizeof(ItemRecord));
+    return ok;
+}
+
+void itemsForBook(int bookID, ItemVisitor visit, void *ctx)
+{
+    long slot;
+    if (!itemsLoad() || !idIndexFind(&firstOfBook, bookID, &slot))
+    {
+        return;
+    }
+    for (; slot != ITEM_NONE; slot = nextOfBook[slot])
+    {
+        if (!visit(&items[slot], ctx))
+        {
+            return;
+        }
+    }
+}
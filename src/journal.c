@@ -0,0 +1,615 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "../include/journal.h"
+#include "../include/codec.h"
+#include "../include/metrics.h"
+#include "../include/changes.h"
+#include "../include/record_cache.h"
+#include "../include/shards.h"
+
+#define DATA_DIR "data"
+#define JOURNAL_MAGIC 0x4E524A4Cu // "LJRN"
+#define JOURNAL_PATH_SIZE 128
+#define JOURNAL_MAX_FILES 32
+#define JOURNAL_MAX_REPLACES 72 // a reshard swaps in up to 64 shard files and the manifest
+
+enum
+{
+    ENTRY_UNDO = 1,    // bytes and size of a file before a write
+    ENTRY_REPLACE = 2, // temp file to rename over the path at commit
+    ENTRY_COMMIT = 3
+};
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t kind;
+    uint32_t checksum;   // CRC-32 of the header with this field zero, then the payload
+    uint32_t pathLength; // payload: the path, then `length` bytes
+    int64_t fileSize;
+    int64_t offset;
+    uint64_t length; // UNDO: the saved bytes; REPLACE: the temp path
+} EntryHeader;
+
+typedef struct
+{
+    EntryHeader header;
+    char path[JOURNAL_PATH_SIZE];
+    const unsigned char *data;
+} Entry;
+
+typedef struct
+{
+    char path[JOURNAL_PATH_SIZE];
+    int created; // empty or missing before the operation, so its directory entry needs a sync
+} TouchedFile;
+
+typedef struct
+{
+    char tempPath[JOURNAL_PATH_SIZE];
+    char path[JOURNAL_PATH_SIZE];
+} PendingReplace;
+
+static int depth = 0;
+static int failed = 0; // the current operation must be rolled back
+static int stuck = 0;  // a rollback failed; writing more would bury it
+static int readOnly = 0;
+static FILE *journal = NULL;
+static TouchedFile touched[JOURNAL_MAX_FILES];
+static size_t touchedCount = 0;
+static PendingReplace pending[JOURNAL_MAX_REPLACES];
+static size_t pendingCount = 0;
+static int syncMode = -1;
+
+static int syncEnabled(void)
+{
+    if (syncMode < 0)
+    {
+        const char *mode = getenv("LMS_SYNC");
+        syncMode = !(mode && strcmp(mode, "off") == 0);
+    }
+    return syncMode;
+}
+
+static int syncDescriptor(int fd)
+{
+    metricsCount(COUNTER_FSYNCS, 1);
+#ifdef _WIN32
+    return _commit(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+static int syncStream(FILE *file)
+{
+    if (fflush(file) != 0)
+    {
+        return 0;
+    }
+#ifdef _WIN32
+    return !syncEnabled() || syncDescriptor(_fileno(file));
+#else
+    return !syncEnabled() || syncDescriptor(fileno(file));
+#endif
+}
+
+static int syncPath(const char *path)
+{
+    if (!syncEnabled())
+    {
+        return 1;
+    }
+#ifdef _WIN32
+    int fd = _open(path, _O_RDWR | _O_BINARY); // _commit needs write access
+#else
+    int fd = open(path, O_RDONLY);
+#endif
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    int ok = syncDescriptor(fd);
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+    return ok;
+}
+
+// Created and renamed files survive a power cut only once their directory
+// entry is on disk too
+static int syncDirectory(void)
+{
+#ifdef _WIN32
+    return 1; // NTFS orders its own metadata, and a directory cannot be flushed
+#else
+    if (!syncEnabled())
+    {
+        return 1;
+    }
+    int fd = open(DATA_DIR, O_RDONLY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    int ok = syncDescriptor(fd);
+    close(fd);
+    return ok;
+#endif
+}
+
+static int truncateStream(FILE *file, int64_t size)
+{
+    if (fflush(file) != 0)
+    {
+        return 0;
+    }
+#ifdef _WIN32
+    return _chsize_s(_fileno(file), size) == 0;
+#else
+    return ftruncate(fileno(file), (off_t)size) == 0;
+#endif
+}
+
+static int renameOver(const char *from, const char *to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(from, to) == 0; // atomic: readers see the old or the new file
+#endif
+}
+
+static int fileExists(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+static uint32_t entryChecksum(EntryHeader header, const char *path, const void *data)
+{
+    header.checksum = 0;
+    uint32_t crc = crc32Update(0, &header, sizeof(header));
+    crc = crc32Update(crc, path, header.pathLength);
+    return crc32Update(crc, data, (size_t)header.length);
+}
+
+static int appendEntry(uint32_t kind, const char *path, int64_t fileSize, int64_t offset, const void *data,
+                       size_t length)
+{
+    if (!journal)
+    {
+        int existed = fileExists(JOURNAL_FILE);
+        journal = fopen(JOURNAL_FILE, "wb");
+        metricsCount(COUNTER_FILE_OPENS, 1);
+        if (!journal)
+        {
+            perror("Failed to open journal");
+            return 0;
+        }
+        if (!existed && !syncDirectory())
+        {
+            return 0;
+        }
+    }
+    EntryHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = JOURNAL_MAGIC;
+    header.kind = kind;
+    header.pathLength = (uint32_t)strlen(path);
+    header.fileSize = fileSize;
+    header.offset = offset;
+    header.length = length;
+    header.checksum = entryChecksum(header, path, data);
+    int ok = fwrite(&header, sizeof(header), 1, journal) == 1 &&
+             fwrite(path, 1, header.pathLength, journal) == header.pathLength &&
+             (length == 0 || fwrite(data, 1, length, journal) == length);
+    metricsCount(COUNTER_BYTES_WRITTEN, sizeof(header) + header.pathLength + length);
+    // The entry must be on disk before the write it protects
+    return syncStream(journal) && ok;
+}
+
+static int noteTouched(const char *path, int64_t size)
+{
+    for (size_t i = 0; i < touchedCount; i++)
+    {
+        if (strcmp(touched[i].path, path) == 0)
+        {
+            return 1;
+        }
+    }
+    if (touchedCount == JOURNAL_MAX_FILES || strlen(path) >= JOURNAL_PATH_SIZE)
+    {
+        return 0;
+    }
+    strcpy(touched[touchedCount].path, path);
+    touched[touchedCount++].created = size == 0;
+    return 1;
+}
+
+static int readJournal(unsigned char **buffer, long *size)
+{
+    FILE *file = fopen(JOURNAL_FILE, "rb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    *buffer = NULL;
+    *size = 0;
+    if (!file)
+    {
+        return 1; // Never written
+    }
+    int ok = fseek(file, 0, SEEK_END) == 0 && (*size = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0;
+    if (ok && *size > 0)
+    {
+        *buffer = malloc((size_t)*size);
+        ok = *buffer && fread(*buffer, 1, (size_t)*size, file) == (size_t)*size;
+    }
+    fclose(file);
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)*size);
+    return ok;
+}
+
+// Entries up to the first torn or damaged one
+static size_t parseEntries(const unsigned char *buffer, long size, Entry **entries)
+{
+    size_t count = 0;
+    size_t capacity = 0;
+    long pos = 0;
+    *entries = NULL;
+    while (pos + (long)sizeof(EntryHeader) <= size)
+    {
+        Entry entry;
+        memcpy(&entry.header, buffer + pos, sizeof(EntryHeader));
+        const EntryHeader *header = &entry.header;
+        long payload = pos + (long)sizeof(EntryHeader);
+        if (header->magic != JOURNAL_MAGIC || header->kind < ENTRY_UNDO || header->kind > ENTRY_COMMIT ||
+            header->pathLength >= JOURNAL_PATH_SIZE || header->length > (uint64_t)(size - payload) ||
+            (header->kind == ENTRY_REPLACE && header->length >= JOURNAL_PATH_SIZE) ||
+            header->pathLength > (uint64_t)(size - payload) - header->length)
+        {
+            break;
+        }
+        memcpy(entry.path, buffer + payload, header->pathLength);
+        entry.path[header->pathLength] = '\0';
+        entry.data = buffer + payload + header->pathLength;
+        if (entryChecksum(*header, entry.path, entry.data) != header->checksum)
+        {
+            break;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            Entry *grown = realloc(*entries, capacity * sizeof(Entry));
+            if (!grown)
+            {
+                break; // Treated as torn here: the rollback stops short
+            }
+            *entries = grown;
+        }
+        (*entries)[count++] = entry;
+        pos = payload + (long)header->pathLength + (long)header->length;
+    }
+    return count;
+}
+
+static int restoreRange(const Entry *entry)
+{
+    FILE *file = fopen(entry->path, "rb+");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        return entry->header.fileSize == 0; // Created by the operation and gone again
+    }
+    size_t length = (size_t)entry->header.length;
+    int ok = length == 0 || (fseek(file, (long)entry->header.offset, SEEK_SET) == 0 &&
+                             fwrite(entry->data, 1, length, file) == length);
+    ok = ok && truncateStream(file, entry->header.fileSize) && syncStream(file);
+    ok = fclose(file) == 0 && ok;
+    metricsCount(COUNTER_BYTES_WRITTEN, length);
+    return ok;
+}
+
+static void tempPathOf(const Entry *entry, char *tempPath)
+{
+    memcpy(tempPath, entry->data, (size_t)entry->header.length);
+    tempPath[entry->header.length] = '\0';
+}
+
+static JournalRecovery replay(void)
+{
+    unsigned char *buffer;
+    long size;
+    if (!readJournal(&buffer, &size))
+    {
+        free(buffer);
+        return JOURNAL_FAILED;
+    }
+    Entry *entries;
+    size_t count = parseEntries(buffer, size, &entries);
+    int committed = count > 0 && entries[count - 1].header.kind == ENTRY_COMMIT;
+    // Only the last operation can be unfinished; earlier ones, left behind
+    // when emptying the journal failed, end at their own commit records
+    size_t first = committed ? count - 1 : count;
+    while (first > 0 && entries[first - 1].header.kind != ENTRY_COMMIT)
+    {
+        first--;
+    }
+    int ok = 1;
+    char tempPath[JOURNAL_PATH_SIZE];
+    if (committed)
+    {
+        // Everything before the commit record is on disk; finish the swaps
+        for (size_t i = first; i < count; i++)
+        {
+            if (entries[i].header.kind == ENTRY_REPLACE)
+            {
+                tempPathOf(&entries[i], tempPath);
+                ok = (!fileExists(tempPath) || renameOver(tempPath, entries[i].path)) && ok;
+            }
+        }
+        ok = syncDirectory() && ok;
+    }
+    else
+    {
+        // Newest first, so a range written twice ends with its oldest bytes
+        for (size_t i = count; i-- > first;)
+        {
+            if (entries[i].header.kind == ENTRY_UNDO)
+            {
+                ok = restoreRange(&entries[i]) && ok;
+            }
+            else if (entries[i].header.kind == ENTRY_REPLACE)
+            {
+                tempPathOf(&entries[i], tempPath);
+                remove(tempPath);
+            }
+        }
+    }
+    free(entries);
+    free(buffer);
+    if (!ok)
+    {
+        return JOURNAL_FAILED; // The journal stays for the next attempt
+    }
+    if (size > 0)
+    {
+        FILE *file = fopen(JOURNAL_FILE, "wb");
+        metricsCount(COUNTER_FILE_OPENS, 1);
+        if (!file || !syncStream(file))
+        {
+            if (file)
+            {
+                fclose(file);
+            }
+            return JOURNAL_FAILED;
+        }
+        fclose(file);
+    }
+    if (count == 0)
+    {
+        return JOURNAL_CLEAN;
+    }
+    return committed ? JOURNAL_COMPLETED : JOURNAL_ROLLED_BACK;
+}
+
+static void endOperation(void)
+{
+    touchedCount = 0;
+    if (pendingCount > 0)
+    {
+        recordCacheClear(); // A swapped-in shard may have moved cached records
+    }
+    pendingCount = 0;
+    failed = 0;
+    changesSettle(); // Readers may now see the changes the operation logged
+}
+
+// Undoes the current operation on disk, reading back what was journaled
+static int rollBack(void)
+{
+    if (journal)
+    {
+        fclose(journal);
+        journal = NULL;
+    }
+    if (replay() == JOURNAL_FAILED)
+    {
+        fputs("The journal could not be rolled back; restart the program to recover.\n", stderr);
+        stuck = 1;
+    }
+    shardsInvalidate(); // The cached records and ID filters may hold its writes
+    endOperation();
+    return 0;
+}
+
+void journalBegin(void)
+{
+    depth++;
+}
+
+void journalAbort(void)
+{
+    if (depth > 0)
+    {
+        failed = 1;
+    }
+}
+
+int journalCommit(void)
+{
+    if (depth == 0)
+    {
+        return 0;
+    }
+    if (--depth > 0)
+    {
+        return 1;
+    }
+    if (touchedCount == 0 && pendingCount == 0)
+    {
+        int ok = !failed;
+        endOperation();
+        return ok;
+    }
+    int ok = !failed;
+    int created = 0;
+    for (size_t i = 0; ok && i < touchedCount; i++)
+    {
+        ok = syncPath(touched[i].path);
+        created |= touched[i].created;
+    }
+    ok = ok && (!created || syncDirectory());
+    ok = ok && appendEntry(ENTRY_COMMIT, "", 0, 0, NULL, 0);
+    if (!ok)
+    {
+        return rollBack();
+    }
+
+    for (size_t i = 0; i < pendingCount; i++)
+    {
+        ok = renameOver(pending[i].tempPath, pending[i].path) && ok;
+    }
+    ok = (pendingCount == 0 || syncDirectory()) && ok;
+    if (!ok)
+    {
+        // Committed but not finished: retry the swaps from the journal as
+        // startup recovery would, and leave them to it if they fail again
+        fclose(journal);
+        journal = NULL;
+        endOperation();
+        if (replay() == JOURNAL_FAILED)
+        {
+            fputs("A file swap failed; restart the program to finish it.\n", stderr);
+            stuck = 1;
+        }
+        return 1;
+    }
+    // Emptying the journal needs no sync: a commit record found after a
+    // crash only finishes swaps that are already done. If it fails, the
+    // next operation reopens the journal, which truncates it.
+    if (!truncateStream(journal, 0))
+    {
+        fclose(journal);
+        journal = NULL;
+    }
+    else
+    {
+        rewind(journal);
+    }
+    endOperation();
+    return 1;
+}
+
+int journalWrite(FILE *file, const char *path, long offset, const void *data, size_t size)
+{
+    journalBegin();
+    // After a failure the journal may end in a torn entry, which would hide
+    // anything appended behind it from the rollback
+    int ok = !stuck && !readOnly && !failed && fseek(file, 0, SEEK_END) == 0;
+    long end = ok ? ftell(file) : -1;
+    ok = ok && end >= 0;
+    if (offset == JOURNAL_APPEND)
+    {
+        offset = end;
+    }
+    size_t saved = ok && offset < end ? (size_t)(end - offset < (long)size ? end - offset : (long)size) : 0;
+    unsigned char small[256];
+    unsigned char *before = saved <= sizeof(small) ? small : malloc(saved);
+    ok = ok && before && (saved == 0 || (fseek(file, offset, SEEK_SET) == 0 && fread(before, 1, saved, file) == saved));
+    ok = ok && noteTouched(path, end) && appendEntry(ENTRY_UNDO, path, end, offset, before, saved);
+    if (before != small)
+    {
+        free(before);
+    }
+    ok = ok && fseek(file, offset, SEEK_SET) == 0 && fwrite(data, 1, size, file) == size && fflush(file) == 0;
+    if (!ok)
+    {
+        // Bytes stdio still buffers must not reach the file after the
+        // rollback, when the caller closes it
+        fflush(file);
+        failed = 1;
+    }
+    int committed = journalCommit();
+    return ok && committed;
+}
+
+int journalReplaceFile(const char *tempPath, const char *path)
+{
+    int ok = !stuck && !readOnly;
+    // Undo entries for the old file would land in the new one
+    for (size_t i = 0; ok && i < touchedCount; i++)
+    {
+        ok = strcmp(touched[i].path, path) != 0;
+    }
+    ok = ok && syncPath(tempPath) && renameOver(tempPath, path) && syncDirectory();
+    if (!ok)
+    {
+        remove(tempPath);
+    }
+    return ok;
+}
+
+int journalReplaceOnCommit(const char *tempPath, const char *path)
+{
+    if (depth == 0)
+    {
+        return journalReplaceFile(tempPath, path);
+    }
+    int ok = !stuck && !readOnly && !failed && pendingCount < JOURNAL_MAX_REPLACES && strlen(tempPath) < JOURNAL_PATH_SIZE &&
+             strlen(path) < JOURNAL_PATH_SIZE && syncPath(tempPath) &&
+             appendEntry(ENTRY_REPLACE, path, 0, 0, tempPath, strlen(tempPath));
+    if (!ok)
+    {
+        remove(tempPath);
+        failed = 1;
+        return 0;
+    }
+    strcpy(pending[pendingCount].tempPath, tempPath);
+    strcpy(pending[pendingCount].path, path);
+    pendingCount++;
+    return 1;
+}
+
+JournalRecovery journalRecover(void)
+{
+    if (depth > 0)
+    {
+        return JOURNAL_FAILED;
+    }
+    if (journal)
+    {
+        fclose(journal);
+        journal = NULL;
+    }
+    JournalRecovery result = replay();
+    stuck = result == JOURNAL_FAILED;
+    shardsInvalidate();
+    changesRecover();
+    return result;
+}
+
+void journalSetReadOnly(int on)
+{
+    readOnly = on;
+}
+
+int journalIsReadOnly(void)
+{
+    return readOnly;
+}
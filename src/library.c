@@ -0,0 +1,664 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "../include/library.h"
+#include "../include/author_dict.h"
+#include "../include/loan_query.h"
+#include "../include/circulation_stats.h"
+#include "../include/listing.h"
+#include "../include/dates.h"
+#include "../include/holds.h"
+#include "../include/items.h"
+#include "../include/policy.h"
+#include "../include/id_index.h"
+#include "../include/journal.h"
+#include "../include/metrics.h"
+#include "../include/shards.h"
+#include "../include/changes.h"
+#include "../include/record_cache.h"
+#include "../include/id_filter.h"
+
+static void noteScan(long records, size_t recordSize)
+{
+    metricsCount(COUNTER_RECORDS_SCANNED, (uint64_t)records);
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)records * recordSize);
+}
+
+int libraryCompareText(const char *a, const char *b)
+{
+    while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b))
+    {
+        a++;
+        b++;
+    }
+    return tolower((unsigned char)*a) - tolower((unsigned char)*b);
+}
+
+// Check if bookID is valid, to use for adding or editing books
+int isValidBookID(int bookID)
+{
+    if (bookID <= 0)
+    {
+        return 0; // Invalid book ID
+    }
+
+    // Most IDs checked are free, which the filter usually tells without a
+    // read. Otherwise only the shard the ID hashes to can hold it; a
+    // missing shard file holds no books, so any ID is valid there.
+    uint64_t start = metricsNow();
+    int valid = !idFilterMayContain(SHARD_BOOKS, bookID);
+    if (!valid)
+    {
+        ShardSet books;
+        Book book;
+        long position;
+        shardsOpen(&books, SHARD_BOOKS, 0);
+        valid = !shardsFind(&books, bookID, &book, &position);
+        shardsClose(&books);
+    }
+    metricsStop(TIMER_IS_VALID_BOOK_ID, start);
+    return valid;
+}
+int isValidMemberID(int memberID)
+{
+    if (memberID <= 0)
+    {
+        return 0; // Invalid member ID
+    }
+
+    uint64_t start = metricsNow();
+    int valid = !idFilterMayContain(SHARD_MEMBERS, memberID);
+    if (!valid)
+    {
+        ShardSet members;
+        Member member;
+        long position;
+        shardsOpen(&members, SHARD_MEMBERS, 0);
+        valid = !shardsFind(&members, memberID, &member, &position);
+        shardsClose(&members);
+    }
+    metricsStop(TIMER_IS_VALID_MEMBER_ID, start);
+    return valid;
+}
+
+typedef struct
+{
+    BookVisitor visit;
+    void *ctx;
+} TitleSearch;
+
+static int titleMatches(const void *record, void *title)
+{
+    return libraryCompareText(((const Book *)record)->title, title) == 0; // case-insensitive match
+}
+
+static int visitTitleMatch(const void *record, long position, void *ctx)
+{
+    (void)position;
+    TitleSearch *search = ctx;
+    return search->visit(record, search->ctx);
+}
+
+long librarySearchTitle(const char *title, BookVisitor visit, void *ctx)
+{
+    TitleSearch search = {visit, ctx};
+    long found = shardsScan(SHARD_BOOKS, titleMatches, (void *)title, visitTitleMatch, &search);
+    return found < 0 ? 0 : found;
+}
+
+// ID -> record position among the book and member shards, built with one
+// scan on first use. Every position is checked against the record read
+// there, so a shard rewritten by a delete or appended to by the menus just
+// triggers a rebuild instead of needing invalidation hooks.
+typedef struct
+{
+    size_t recordSize;
+    IdIndex index;
+    int loaded;
+} RecordIndex;
+
+static RecordIndex bookRecords = {sizeof(Book), {NULL, NULL, 0, 0, NULL}, 0};
+static RecordIndex memberRecords = {sizeof(Member), {NULL, NULL, 0, 0, NULL}, 0};
+
+static int buildRecordIndex(RecordIndex *records, ShardSet *set)
+{
+    union
+    {
+        Book book;
+        Member member;
+    } record;
+    long position;
+    long scanned = 0;
+    long first;
+    idIndexClear(&records->index);
+    records->loaded = 0;
+    shardsRewind(set);
+    while (shardsNext(set, &record, &position))
+    {
+        int id = record.book.bookID; // Both records start with their ID
+        // The first record with an ID wins, as it did for the old scans
+        if (!idIndexFind(&records->index, id, &first) && !idIndexPut(&records->index, id, position))
+        {
+            return 0;
+        }
+        scanned++;
+    }
+    noteScan(scanned, records->recordSize);
+    if (set->failed)
+    {
+        return 0;
+    }
+    records->loaded = 1;
+    return 1;
+}
+
+// Reads the record with the given ID into out and returns its position, or
+// -1 when there is none
+static long readRecord(RecordIndex *records, ShardSet *set, int id, void *out)
+{
+    long cached;
+    if (recordCacheGet(set->kind, id, out, &cached))
+    {
+        return cached;
+    }
+    int rebuilt = 0;
+    for (;;)
+    {
+        long position;
+        int foundID;
+        if (records->loaded && idIndexFind(&records->index, id, &position) && shardsRead(set, position, out))
+        {
+            memcpy(&foundID, out, sizeof(int));
+            if (foundID == id)
+            {
+                noteScan(1, records->recordSize);
+                recordCachePut(set->kind, position, out);
+                return position;
+            }
+        }
+        if (rebuilt || !buildRecordIndex(records, set))
+        {
+            return -1;
+        }
+        rebuilt = 1;
+    }
+}
+
+void libraryReload(void)
+{
+    bookRecords.loaded = 0;
+    memberRecords.loaded = 0;
+    shardsInvalidate();
+    authorDictInvalidate();
+    listingBooksInvalidate();
+    listingMembersInvalidate();
+    holdsInvalidate();
+    itemsInvalidate();
+    policyInvalidate();
+    statsInvalidate();
+}
+
+// Ends an operation started with journalBegin. One that failed part way
+// is rolled back, so none of its writes survive.
+static LibraryStatus finish(LibraryStatus status)
+{
+    if (status == LIBRARY_IO_ERROR)
+    {
+        journalAbort();
+    }
+    if (!journalCommit())
+    {
+        libraryReload();
+        return LIBRARY_IO_ERROR;
+    }
+    return status;
+}
+
+// Adds delta to the book's quantity. A book deleted while copies were out
+// has nothing to update, which is not an error.
+static LibraryStatus adjustQuantity(int bookID, int delta)
+{
+    ShardSet books;
+    shardsOpen(&books, SHARD_BOOKS, 1);
+    Book book;
+    long pos = readRecord(&bookRecords, &books, bookID, &book);
+    int ok = 1;
+    if (pos >= 0)
+    {
+        book.quantity += delta;
+        ok = shardsWrite(&books, pos, &book);
+        metricsCount(COUNTER_BYTES_WRITTEN, sizeof(Book));
+        listingBookChanged(pos);
+    }
+    // A shard that could not be read may hold the book
+    ok = shardsClose(&books) && ok;
+    return ok ? LIBRARY_OK : LIBRARY_IO_ERROR;
+}
+
+// A copy that comes back goes to the next hold, or back on the shelf
+static LibraryStatus releaseCopy(int bookID, long item, int *heldFor)
+{
+    *heldFor = holdsAssignCopy(bookID);
+    if (item != ITEM_NONE)
+    {
+        itemsUpdate(item, *heldFor ? ITEM_ON_HOLD_SHELF : ITEM_AVAILABLE, *heldFor, -1);
+    }
+    return *heldFor ? LIBRARY_OK : adjustQuantity(bookID, 1);
+}
+
+// Lends one copy of the book: the given item, or when item is ITEM_NONE the
+// copy set aside for the member's hold or any copy on the shelf
+static LibraryStatus issue(int memberID, int bookID, long item, Book *book, Member *member)
+{
+    ShardSet members;
+    shardsOpen(&members, SHARD_MEMBERS, 0);
+
+    // Step 1: Validate Member ID
+    long memberPos = readRecord(&memberRecords, &members, memberID, member);
+    if (!shardsClose(&members))
+    {
+        return LIBRARY_IO_ERROR;
+    }
+    if (memberPos < 0)
+    {
+        return LIBRARY_NO_MEMBER;
+    }
+    time_t now = time(NULL);
+    switch (policyCheckIssue(memberID, now, NULL))
+    {
+    case POLICY_LIMIT_REACHED:
+        return LIBRARY_LIMIT_REACHED;
+    case POLICY_OVERDUE_BLOCKED:
+        return LIBRARY_OVERDUE_BLOCKED;
+    default:
+        break;
+    }
+
+    // Step 2: Validate Book ID
+    ShardSet books;
+    shardsOpen(&books, SHARD_BOOKS, 1);
+    long pos = readRecord(&bookRecords, &books, bookID, book);
+    if (pos < 0)
+    {
+        return shardsClose(&books) ? LIBRARY_NO_BOOK : LIBRARY_IO_ERROR;
+    }
+
+    // Step 3: Choose the copy. One set aside for the member's hold has
+    // already left the quantity.
+    int hold = holdsFind(bookID, memberID);
+    int heldCopy;
+    if (item != ITEM_NONE)
+    {
+        const ItemRecord *copy = itemsGet(item);
+        heldCopy = copy->status == ITEM_ON_HOLD_SHELF && copy->memberID == memberID;
+        if (!heldCopy && copy->status != ITEM_AVAILABLE)
+        {
+            shardsClose(&books);
+            return LIBRARY_ITEM_UNAVAILABLE;
+        }
+    }
+    else
+    {
+        heldCopy = hold == HOLD_READY;
+        item = itemsPick(bookID, heldCopy ? ITEM_ON_HOLD_SHELF : ITEM_AVAILABLE, heldCopy ? memberID : 0);
+    }
+
+    // Step 4: Deduct quantity
+    if (!heldCopy)
+    {
+        if (book->quantity <= 0)
+        {
+            shardsClose(&books);
+            return LIBRARY_OUT_OF_STOCK;
+        }
+        book->quantity -= 1;
+        if (!shardsWrite(&books, pos, book))
+        {
+            shardsClose(&books);
+            return LIBRARY_IO_ERROR;
+        }
+        metricsCount(COUNTER_BYTES_WRITTEN, sizeof(Book));
+        listingBookChanged(pos);
+    }
+    shardsClose(&books);
+
+    // Step 5: Create borrowing record
+    BorrowedRecord record;
+    memset(&record, 0, sizeof(record));
+    record.memberID = memberID;
+    record.bookID = bookID;
+    record.borrowDate = now;
+    record.returnDate = 0; // 0 indicates the book is not returned yet
+    record.isOverdue = 0;
+
+    FILE *borrowFile = fopen(BORROWED_BOOKS_FILE, "ab");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!borrowFile)
+    {
+        perror("Failed to open borrow file");
+        return LIBRARY_IO_ERROR;
+    }
+    fseek(borrowFile, 0, SEEK_END);
+    long loanIndex = ftell(borrowFile) / (long)sizeof(BorrowedRecord);
+    int written = journalWrite(borrowFile, BORROWED_BOOKS_FILE, JOURNAL_APPEND, &record, sizeof(BorrowedRecord));
+    fclose(borrowFile);
+    if (!written)
+    {
+        return LIBRARY_IO_ERROR;
+    }
+    metricsCount(COUNTER_BYTES_WRITTEN, sizeof(BorrowedRecord));
+    changesRecordLoan(CHANGE_LOAN_ISSUE, &record);
+    statsRecordIssue(bookID, memberID);
+    policyNoteIssue(memberID, record.borrowDate);
+
+    // Step 6: The copy goes out on the loan and the member's hold is done.
+    // If another copy had been set aside for that hold, it is free again.
+    if (item != ITEM_NONE)
+    {
+        itemsUpdate(item, ITEM_ON_LOAN, memberID, loanIndex);
+    }
+    if (hold >= 0)
+    {
+        holdsClose(bookID, memberID, HOLD_FULFILLED);
+    }
+    if (hold == HOLD_READY && !heldCopy)
+    {
+        int heldFor;
+        releaseCopy(bookID, itemsPick(bookID, ITEM_ON_HOLD_SHELF, memberID), &heldFor);
+    }
+    return LIBRARY_OK;
+}
+
+static int isOpenLoan(const BorrowedRecord *record, int memberID, int bookID)
+{
+    return record->memberID == memberID && record->bookID == bookID && record->returnDate == 0;
+}
+
+static LibraryStatus giveBack(int memberID, int bookID, long item, BorrowedRecord *record, int *heldFor)
+{
+    FILE *borrowFile = fopen(BORROWED_BOOKS_FILE, "rb+");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!borrowFile)
+    {
+        perror("Failed to open borrow file");
+        return LIBRARY_IO_ERROR;
+    }
+
+    // A copy remembers where its loan was written. Archiving moves open
+    // loans, so the position is only a hint and is checked first.
+    long index = 0;
+    int found = 0;
+    int64_t hint = item != ITEM_NONE ? itemsGet(item)->loanIndex : -1;
+    if (hint >= 0 && fseek(borrowFile, (long)hint * (long)sizeof(BorrowedRecord), SEEK_SET) == 0 &&
+        fread(record, sizeof(BorrowedRecord), 1, borrowFile) == 1 && isOpenLoan(record, memberID, bookID))
+    {
+        index = (long)hint;
+        found = 1;
+        noteScan(1, sizeof(BorrowedRecord));
+    }
+    else
+    {
+        rewind(borrowFile);
+        while (fread(record, sizeof(BorrowedRecord), 1, borrowFile) == 1)
+        {
+            if (isOpenLoan(record, memberID, bookID))
+            {
+                found = 1;
+                break;
+            }
+            index++;
+        }
+        noteScan(index + found, sizeof(BorrowedRecord));
+    }
+
+    if (!found)
+    {
+        fclose(borrowFile);
+        return LIBRARY_NO_LOAN;
+    }
+
+    // Step 1: Mark as returned
+    record->returnDate = time(NULL);
+    record->isOverdue = record->returnDate > policyDueDate(memberID, record->borrowDate);
+    int written = journalWrite(borrowFile, BORROWED_BOOKS_FILE, index * (long)sizeof(BorrowedRecord), record,
+                               sizeof(BorrowedRecord));
+    fclose(borrowFile);
+    if (!written)
+    {
+        return LIBRARY_IO_ERROR;
+    }
+    metricsCount(COUNTER_BYTES_WRITTEN, sizeof(BorrowedRecord));
+    changesRecordLoan(CHANGE_LOAN_RETURN, record);
+    loanZoneMapNoteReturn(index, record->returnDate);
+    statsRecordReturn(bookID, memberID, record->borrowDate, record->returnDate, record->isOverdue);
+    policyNoteReturn(memberID, record->borrowDate);
+
+    // Step 2: Update book quantity, or set the copy aside for a hold
+    if (item == ITEM_NONE)
+    {
+        item = itemsPick(bookID, ITEM_ON_LOAN, memberID);
+    }
+    return releaseCopy(bookID, item, heldFor);
+}
+
+LibraryStatus libraryIssueBook(int memberID, int bookID, Book *book, Member *member)
+{
+    uint64_t start = metricsNow();
+    journalBegin();
+    LibraryStatus status = finish(issue(memberID, bookID, ITEM_NONE, book, member));
+    metricsStop(TIMER_ISSUE_BOOK, start);
+    return status;
+}
+
+LibraryStatus libraryReturnBook(int memberID, int bookID, BorrowedRecord *record, int *heldFor)
+{
+    uint64_t start = metricsNow();
+    journalBegin();
+    LibraryStatus status = finish(giveBack(memberID, bookID, ITEM_NONE, record, heldFor));
+    metricsStop(TIMER_RETURN_BOOK, start);
+    return status;
+}
+
+LibraryStatus libraryIssueItem(int memberID, const char *barcode, Book *book, Member *member)
+{
+    uint64_t start = metricsNow();
+    long item = itemsFind(barcode);
+    LibraryStatus status = LIBRARY_NO_ITEM;
+    journalBegin();
+    if (item != ITEM_NONE)
+    {
+        status = itemsGet(item)->status == ITEM_WITHDRAWN
+                     ? LIBRARY_ITEM_UNAVAILABLE
+                     : issue(memberID, itemsGet(item)->bookID, item, book, member);
+    }
+    status = finish(status);
+    metricsStop(TIMER_ISSUE_BOOK, start);
+    return status;
+}
+
+LibraryStatus libraryReturnItem(const char *barcode, BorrowedRecord *record, int *heldFor)
+{
+    uint64_t start = metricsNow();
+    long item = itemsFind(barcode);
+    LibraryStatus status = LIBRARY_NO_ITEM;
+    journalBegin();
+    if (item != ITEM_NONE)
+    {
+        const ItemRecord *copy = itemsGet(item);
+        status = copy->status != ITEM_ON_LOAN ? LIBRARY_NO_LOAN
+                                              : giveBack(copy->memberID, copy->bookID, item, record, heldFor);
+    }
+    status = finish(status);
+    metricsStop(TIMER_RETURN_BOOK, start);
+    return status;
+}
+
+LibraryStatus libraryAddItem(int bookID, const char *barcode, int *heldFor)
+{
+    *heldFor = 0;
+    ShardSet books;
+    shardsOpen(&books, SHARD_BOOKS, 0);
+    Book book;
+    long pos = readRecord(&bookRecords, &books, bookID, &book);
+    shardsClose(&books);
+    if (pos < 0)
+    {
+        return LIBRARY_NO_BOOK;
+    }
+    if (itemsFind(barcode) != ITEM_NONE)
+    {
+        return LIBRARY_ITEM_EXISTS;
+    }
+    journalBegin();
+    long item = itemsAdd(bookID, barcode);
+    if (item == ITEM_NONE)
+    {
+        return finish(LIBRARY_IO_ERROR);
+    }
+    // A new copy is shelved like a returned one, so a waiting hold gets it first
+    return finish(releaseCopy(bookID, item, heldFor));
+}
+
+LibraryStatus libraryWithdrawItem(const char *barcode)
+{
+    long item = itemsFind(barcode);
+    if (item == ITEM_NONE)
+    {
+        return LIBRARY_NO_ITEM;
+    }
+    if (itemsGet(item)->status != ITEM_AVAILABLE)
+    {
+        return LIBRARY_ITEM_UNAVAILABLE; // Only a copy on the shelf can be withdrawn
+    }
+    int bookID = itemsGet(item)->bookID;
+    journalBegin();
+    if (!itemsUpdate(item, ITEM_WITHDRAWN, 0, -1))
+    {
+        return finish(LIBRARY_IO_ERROR);
+    }
+    return finish(adjustQuantity(bookID, -1));
+}
+
+long libraryReconcileItems(void)
+{
+    if (!itemsLoad())
+    {
+        return -1;
+    }
+    ShardSet books;
+    shardsOpen(&books, SHARD_BOOKS, 1);
+    Book book;
+    long pos;
+    long scanned = 0;
+    long fixed = 0;
+    journalBegin();
+    while (shardsNext(&books, &book, &pos))
+    {
+        scanned++;
+        if (itemsHasCopies(book.bookID))
+        {
+            int available = (int)itemsCount(book.bookID, ITEM_AVAILABLE);
+            if (book.quantity != available)
+            {
+                book.quantity = available;
+                if (!shardsWrite(&books, pos, &book))
+                {
+                    shardsClose(&books);
+                    noteScan(scanned, sizeof(Book));
+                    finish(LIBRARY_IO_ERROR);
+                    return -1;
+                }
+                metricsCount(COUNTER_BYTES_WRITTEN, sizeof(Book));
+                listingBookChanged(pos);
+                fixed++;
+            }
+        }
+    }
+    LibraryStatus status = shardsClose(&books) ? LIBRARY_OK : LIBRARY_IO_ERROR;
+    noteScan(scanned, sizeof(Book));
+    return finish(status) == LIBRARY_OK ? fixed : -1;
+}
+
+LibraryStatus libraryPlaceHold(int memberID, int bookID, long *position)
+{
+    if (holdsFind(bookID, memberID) >= 0)
+    {
+        return LIBRARY_HOLD_EXISTS;
+    }
+    return holdsPlace(bookID, memberID, position) ? LIBRARY_OK : LIBRARY_IO_ERROR;
+}
+
+LibraryStatus libraryCancelHold(int memberID, int bookID, int *heldFor)
+{
+    *heldFor = 0;
+    journalBegin();
+    int state = holdsClose(bookID, memberID, HOLD_CANCELLED);
+    if (state < 0)
+    {
+        return finish(LIBRARY_NO_HOLD);
+    }
+    return finish(state == HOLD_READY
+                      ? releaseCopy(bookID, itemsPick(bookID, ITEM_ON_HOLD_SHELF, memberID), heldFor)
+                      : LIBRARY_OK);
+}
+
+int libraryDeleteBook(int bookID)
+{
+    uint64_t start = metricsNow();
+    journalBegin();
+    int deleted = shardsDelete(SHARD_BOOKS, bookID);
+    if (deleted)
+    {
+        authorDictInvalidate(); // Record positions shifted
+        listingBooksInvalidate();
+        holdsCancelBook(bookID);
+        for (int status = ITEM_AVAILABLE; status < ITEM_WITHDRAWN; status++)
+        {
+            long item;
+            while ((item = itemsPick(bookID, (ItemStatus)status, 0)) != ITEM_NONE)
+            {
+                itemsUpdate(item, ITEM_WITHDRAWN, 0, -1);
+            }
+        }
+    }
+    if (finish(deleted ? LIBRARY_OK : LIBRARY_IO_ERROR) != LIBRARY_OK)
+    {
+        deleted = 0;
+    }
+    metricsStop(TIMER_DELETE_BOOK, start);
+    return deleted;
+}
+
+int libraryDeleteMember(int memberID)
+{
+    uint64_t start = metricsNow();
+    journalBegin();
+    int deleted = shardsDelete(SHARD_MEMBERS, memberID);
+    if (deleted)
+    {
+        listingMembersInvalidate();
+        // Copies set aside for the member pass to the next hold
+        MemberHold holds[16];
+        size_t count;
+        while ((count = holdsForMember(memberID, holds, 16)) > 0)
+        {
+            for (size_t i = 0; i < count && i < 16; i++)
+            {
+                int heldFor;
+                libraryCancelHold(memberID, holds[i].hold.bookID, &heldFor);
+            }
+        }
+        // A new member given this ID starts out as Standard
+        if (policyMemberCategory(memberID) != POLICY_STANDARD)
+        {
+            policySetMemberCategory(memberID, POLICY_STANDARD);
+        }
+    }
+    if (finish(deleted ? LIBRARY_OK : LIBRARY_IO_ERROR) != LIBRARY_OK)
+    {
+        deleted = 0;
+    }
+    metricsStop(TIMER_DELETE_MEMBER, start);
+    return deleted;
+}
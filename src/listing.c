@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../include/library.h"
+#include "../include/listing.h"
+#include "../include/metrics.h"
+#include "../include/shards.h"
+
+typedef int (*RecordCompare)(const void *a, const void *b);
+
+typedef struct
+{
+    uint32_t *order; // record positions in sorted order
+    size_t count;
+    size_t capacity;
+    int built;
+} SortOrder;
+
+typedef struct
+{
+    ShardKind kind;
+    size_t recordSize;
+    const RecordCompare *compares;
+    SortOrder *orders;
+    size_t keyCount;
+} SortedFile;
+
+// Ties fall back to the ID so every order is total and stable
+static int compareBookID(const void *a, const void *b)
+{
+    const Book *x = a;
+    const Book *y = b;
+    return (x->bookID > y->bookID) - (x->bookID < y->bookID);
+}
+static int compareBookTitle(const void *a, const void *b)
+{
+    int c = libraryCompareText(((const Book *)a)->title, ((const Book *)b)->title);
+    return c ? c : compareBookID(a, b);
+}
+static int compareBookAuthor(const void *a, const void *b)
+{
+    int c = libraryCompareText(((const Book *)a)->author, ((const Book *)b)->author);
+    return c ? c : compareBookTitle(a, b);
+}
+static int compareBookDate(const void *a, const void *b)
+{
+    const Book *x = a;
+    const Book *y = b;
+    if (x->publicationDate != y->publicationDate)
+    {
+        return x->publicationDate < y->publicationDate ? -1 : 1;
+    }
+    return compareBookID(a, b);
+}
+static int compareBookQuantity(const void *a, const void *b)
+{
+    const Book *x = a;
+    const Book *y = b;
+    if (x->quantity != y->quantity)
+    {
+        return x->quantity < y->quantity ? -1 : 1;
+    }
+    return compareBookID(a, b);
+}
+
+static int compareMemberID(const void *a, const void *b)
+{
+    const Member *x = a;
+    const Member *y = b;
+    return (x->memberID > y->memberID) - (x->memberID < y->memberID);
+}
+static int compareMemberName(const void *a, const void *b)
+{
+    int c = libraryCompareText(((const Member *)a)->name, ((const Member *)b)->name);
+    return c ? c : compareMemberID(a, b);
+}
+
+static const RecordCompare bookCompares[BOOK_SORT_KEY_COUNT] = {
+    compareBookID, compareBookTitle, compareBookAuthor, compareBookDate, compareBookQuantity};
+static const RecordCompare memberCompares[MEMBER_SORT_KEY_COUNT] = {compareMemberID, compareMemberName};
+
+static SortOrder bookOrders[BOOK_SORT_KEY_COUNT];
+static SortOrder memberOrders[MEMBER_SORT_KEY_COUNT];
+
+static SortedFile booksFile = {SHARD_BOOKS, sizeof(Book), bookCompares, bookOrders, BOOK_SORT_KEY_COUNT};
+static SortedFile membersFile = {SHARD_MEMBERS, sizeof(Member), memberCompares, memberOrders, MEMBER_SORT_KEY_COUNT};
+
+// qsort has no context argument, so the build sort reads these
+static const unsigned char *buildRecords;
+static size_t buildRecordSize;
+static RecordCompare buildCompare;
+
+static int compareBuildPositions(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return buildCompare(buildRecords + x * buildRecordSize, buildRecords + y * buildRecordSize);
+}
+
+static void invalidate(SortedFile *sorted)
+{
+    for (size_t k = 0; k < sorted->keyCount; k++)
+    {
+        free(sorted->orders[k].order);
+        memset(&sorted->orders[k], 0, sizeof(SortOrder));
+    }
+}
+
+static int buildOrder(SortedFile *sorted, size_t key)
+{
+    SortOrder *order = &sorted->orders[key];
+    if (order->built)
+    {
+        return 1;
+    }
+
+    // Records are sorted by their index in the buffer, then the indexes
+    // are mapped to shard positions
+    size_t count = (size_t)shardsRecordCount(sorted->kind);
+    unsigned char *records = malloc(count ? count * sorted->recordSize : 1);
+    uint32_t *positions = malloc((count ? count : 1) * sizeof(uint32_t));
+    order->order = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (!records || !positions || !order->order)
+    {
+        free(records);
+        free(positions);
+        free(order->order);
+        order->order = NULL;
+        return 0;
+    }
+    ShardSet set;
+    shardsOpen(&set, sorted->kind, 0);
+    long position;
+    size_t read = 0;
+    while (read < count && shardsNext(&set, records + read * sorted->recordSize, &position))
+    {
+        positions[read++] = (uint32_t)position;
+    }
+    shardsClose(&set);
+    count = read;
+    metricsCount(COUNTER_RECORDS_SCANNED, count);
+    metricsCount(COUNTER_BYTES_READ, count * sorted->recordSize);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        order->order[i] = (uint32_t)i;
+    }
+    buildRecords = records;
+    buildRecordSize = sorted->recordSize;
+    buildCompare = sorted->compares[key];
+    qsort(order->order, count, sizeof(uint32_t), compareBuildPositions);
+    for (size_t i = 0; i < count; i++)
+    {
+        order->order[i] = positions[order->order[i]];
+    }
+    free(records);
+    free(positions);
+
+    order->count = count;
+    order->capacity = count ? count : 1;
+    order->built = 1;
+    return 1;
+}
+
+// Binary-searches the insert position, reading the probed records from disk
+static void insertPosition(SortedFile *sorted, size_t key, ShardSet *set, uint32_t position, const void *record,
+                           void *scratch)
+{
+    SortOrder *order = &sorted->orders[key];
+    size_t lo = 0;
+    size_t hi = order->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (shardsRead(set, order->order[mid], scratch) && sorted->compares[key](scratch, record) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if (order->count == order->capacity)
+    {
+        size_t newCapacity = order->capacity * 2;
+        uint32_t *grown = realloc(order->order, newCapacity * sizeof(uint32_t));
+        if (!grown)
+        {
+            // Drop the order; it is rebuilt from the file on next use
+            free(order->order);
+            memset(order, 0, sizeof(*order));
+            return;
+        }
+        order->order = grown;
+        order->capacity = newCapacity;
+    }
+    memmove(&order->order[lo + 1], &order->order[lo], (order->count - lo) * sizeof(uint32_t));
+    order->order[lo] = position;
+    order->count++;
+}
+
+static void noteRecord(SortedFile *sorted, long recordIndex, int changed)
+{
+    // Unions keep the buffers aligned for either record type
+    union
+    {
+        Book book;
+        Member member;
+    } record, scratch;
+    ShardSet set;
+    int opened = 0;
+
+    for (size_t k = 0; k < sorted->keyCount; k++)
+    {
+        SortOrder *order = &sorted->orders[k];
+        if (!order->built)
+        {
+            continue; // Built from the file when first used
+        }
+        if (!opened)
+        {
+            shardsOpen(&set, sorted->kind, 0);
+            opened = 1;
+            if (!shardsRead(&set, recordIndex, &record))
+            {
+                shardsClose(&set);
+                invalidate(sorted);
+                return;
+            }
+        }
+        if (changed)
+        {
+            for (size_t i = 0; i < order->count; i++)
+            {
+                if (order->order[i] == (uint32_t)recordIndex)
+                {
+                    memmove(&order->order[i], &order->order[i + 1], (order->count - i - 1) * sizeof(uint32_t));
+                    order->count--;
+                    break;
+                }
+            }
+        }
+        insertPosition(sorted, k, &set, (uint32_t)recordIndex, &record, &scratch);
+    }
+    if (opened)
+    {
+        shardsClose(&set);
+    }
+}
+
+static size_t listPage(SortedFile *sorted, size_t key, size_t offset, size_t limit, void *page, size_t *total)
+{
+    *total = 0;
+    if (key >= sorted->keyCount || !buildOrder(sorted, key))
+    {
+        return 0;
+    }
+    SortOrder *order = &sorted->orders[key];
+    *total = order->count;
+    if (offset >= order->count)
+    {
+        return 0;
+    }
+
+    ShardSet set;
+    shardsOpen(&set, sorted->kind, 0);
+    size_t filled = 0;
+    for (size_t i = offset; i < order->count && filled < limit; i++)
+    {
+        if (!shardsRead(&set, order->order[i], (unsigned char *)page + filled * sorted->recordSize))
+        {
+            break;
+        }
+        filled++;
+    }
+    shardsClose(&set);
+    metricsCount(COUNTER_RECORDS_SCANNED, filled);
+    metricsCount(COUNTER_BYTES_READ, filled * sorted->recordSize);
+    return filled;
+}
+
+size_t listBooks(BookSortKey key, size_t offset, size_t limit, Book *page, size_t *total)
+{
+    return listPage(&booksFile, key, offset, limit, page, total);
+}
+
+size_t listMembers(MemberSortKey key, size_t offset, size_t limit, Member *page, size_t *total)
+{
+    return listPage(&membersFile, key, offset, limit, page, total);
+}
+
+void listingBookAdded(long recordIndex)
+{
+    noteRecord(&booksFile, recordIndex, 0);
+}
+
+void listingBookChanged(long recordIndex)
+{
+    noteRecord(&booksFile, recordIndex, 1);
+}
+
+void listingBooksInvalidate(void)
+{
+    invalidate(&booksFile);
+}
+
+void listingMemberAdded(long recordIndex)
+{
+    noteRecord(&membersFile, recordIndex, 0);
+}
+
+void listingMemberChanged(long recordIndex)
+{
+    noteRecord(&membersFile, recordIndex, 1);
+}
+
+void listingMembersInvalidate(void)
+{
+    invalidate(&membersFile);
+}
@@ -0,0 +1,573 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/library.h"
+#include "../include/codec.h"
+#include "../include/loan_archive.h"
+#include "../include/loan_query.h"
+#include "../include/journal.h"
+#include "../include/metrics.h"
+
+#define MANIFEST_MAGIC "LMSA"
+#define SEGMENT_MAGIC "LMSG"
+#define ARCHIVE_VERSION 1
+#define ACTIVE_TEMP_FILE "data/temp_borrow.dat"
+#define MANIFEST_TEMP_FILE "data/temp_borrow_archive.idx"
+// Worst case per record: four varints
+#define MAX_ENCODED_RECORD (4 * VARINT_MAX_BYTES)
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t nextSegmentID;
+    uint32_t segmentCount;
+} ManifestHeader;
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t recordCount;
+    uint32_t blockCount;
+} SegmentHeader;
+
+typedef struct
+{
+    uint32_t recordCount;
+    uint32_t rawLength;
+    uint32_t storedLength;
+    uint32_t codec;
+    int64_t minBorrow;
+    int64_t maxBorrow;
+    int64_t minReturn;
+    int64_t maxReturn;
+} BlockHeader;
+
+static int compareBorrowDate(const void *a, const void *b)
+{
+    const BorrowedRecord *ra = a;
+    const BorrowedRecord *rb = b;
+    if (ra->borrowDate != rb->borrowDate)
+    {
+        return ra->borrowDate < rb->borrowDate ? -1 : 1;
+    }
+    if (ra->returnDate != rb->returnDate)
+    {
+        return ra->returnDate < rb->returnDate ? -1 : 1;
+    }
+    return ra->bookID - rb->bookID;
+}
+
+static int readManifest(ManifestHeader *header, LoanSegmentInfo **segments)
+{
+    *segments = NULL;
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, MANIFEST_MAGIC, 4);
+    header->version = ARCHIVE_VERSION;
+    header->nextSegmentID = 1;
+
+    FILE *file = fopen(LOAN_ARCHIVE_MANIFEST, "rb");
+    if (!file)
+    {
+        return 1; // No archive yet
+    }
+    if (fread(header, sizeof(*header), 1, file) != 1 || memcmp(header->magic, MANIFEST_MAGIC, 4) != 0)
+    {
+        fclose(file);
+        return 0;
+    }
+    if (header->segmentCount > 0)
+    {
+        *segments = malloc(header->segmentCount * sizeof(LoanSegmentInfo));
+        if (!*segments ||
+            fread(*segments, sizeof(LoanSegmentInfo), header->segmentCount, file) != header->segmentCount)
+        {
+            free(*segments);
+            *segments = NULL;
+            fclose(file);
+            return 0;
+        }
+    }
+    fclose(file);
+    return 1;
+}
+
+static int writeManifest(const ManifestHeader *header, const LoanSegmentInfo *segments)
+{
+    FILE *file = fopen(MANIFEST_TEMP_FILE, "wb");
+    if (!file)
+    {
+        return 0;
+    }
+    int ok = fwrite(header, sizeof(*header), 1, file) == 1 &&
+             fwrite(segments, sizeof(LoanSegmentInfo), header->segmentCount, file) == header->segmentCount;
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        remove(MANIFEST_TEMP_FILE);
+        return 0;
+    }
+    return journalReplaceOnCommit(MANIFEST_TEMP_FILE, LOAN_ARCHIVE_MANIFEST);
+}
+
+static size_t encodeBlock(const BorrowedRecord *records, size_t count, uint8_t *out)
+{
+    int64_t prevBorrow = 0;
+    int64_t prevBook = 0;
+    int64_t prevMember = 0;
+    size_t n = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const BorrowedRecord *r = &records[i];
+        uint64_t duration = zigzagEncode((int64_t)r->returnDate - (int64_t)r->borrowDate);
+
+        n += varintEncode(zigzagEncode((int64_t)r->borrowDate - prevBorrow), out + n);
+        n += varintEncode(zigzagEncode((int64_t)r->bookID - prevBook), out + n);
+        n += varintEncode(zigzagEncode((int64_t)r->memberID - prevMember), out + n);
+        n += varintEncode((duration << 1) | (r->isOverdue ? 1 : 0), out + n);
+        prevBorrow = r->borrowDate;
+        prevBook = r->bookID;
+        prevMember = r->memberID;
+    }
+    return n;
+}
+
+static int decodeBlock(const uint8_t *in, size_t length, size_t count, BorrowedRecord *out)
+{
+    int64_t prevBorrow = 0;
+    int64_t prevBook = 0;
+    int64_t prevMember = 0;
+    size_t pos = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t fields[4];
+        for (int f = 0; f < 4; f++)
+        {
+            size_t used = varintDecode(in + pos, length - pos, &fields[f]);
+            if (used == 0)
+            {
+                return 0;
+            }
+            pos += used;
+        }
+        BorrowedRecord *r = &out[i];
+        memset(r, 0, sizeof(*r));
+        prevBorrow += zigzagDecode(fields[0]);
+        prevBook += zigzagDecode(fields[1]);
+        prevMember += zigzagDecode(fields[2]);
+        r->borrowDate = (time_t)prevBorrow;
+        r->bookID = (int)prevBook;
+        r->memberID = (int)prevMember;
+        r->returnDate = (time_t)(prevBorrow + zigzagDecode(fields[3] >> 1));
+        r->isOverdue = (int)(fields[3] & 1);
+    }
+    return pos == length;
+}
+
+static int writeSegment(uint32_t segmentID, const BorrowedRecord *records, size_t count,
+                        int codec, LoanSegmentInfo *info)
+{
+    char path[64];
+    char tempPath[72];
+    snprintf(path, sizeof(path), LOAN_ARCHIVE_SEGMENT_FORMAT, segmentID);
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    FILE *file = fopen(tempPath, "wb");
+    if (!file)
+    {
+        return 0;
+    }
+
+    size_t rawCapacity = LOAN_ARCHIVE_BLOCK_RECORDS * MAX_ENCODED_RECORD;
+    uint8_t *raw = malloc(rawCapacity);
+    uint8_t *packed = malloc(LZ_BOUND(rawCapacity));
+    int ok = raw && packed;
+
+    SegmentHeader header;
+    memcpy(header.magic, SEGMENT_MAGIC, 4);
+    header.version = ARCHIVE_VERSION;
+    header.recordCount = (uint32_t)count;
+    header.blockCount = (uint32_t)((count + LOAN_ARCHIVE_BLOCK_RECORDS - 1) / LOAN_ARCHIVE_BLOCK_RECORDS);
+    ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+
+    memset(info, 0, sizeof(*info));
+    info->segmentID = segmentID;
+    info->recordCount = header.recordCount;
+    info->blockCount = header.blockCount;
+
+    for (size_t start = 0; ok && start < count; start += LOAN_ARCHIVE_BLOCK_RECORDS)
+    {
+        size_t n = count - start < LOAN_ARCHIVE_BLOCK_RECORDS ? count - start : LOAN_ARCHIVE_BLOCK_RECORDS;
+        const BorrowedRecord *block = records + start;
+        BlockHeader bh;
+        memset(&bh, 0, sizeof(bh));
+        bh.recordCount = (uint32_t)n;
+        bh.minBorrow = block[0].borrowDate; // sorted by borrowDate
+        bh.maxBorrow = block[n - 1].borrowDate;
+        bh.minReturn = bh.maxReturn = block[0].returnDate;
+        for (size_t i = 1; i < n; i++)
+        {
+            if (block[i].returnDate < bh.minReturn)
+            {
+                bh.minReturn = block[i].returnDate;
+            }
+            if (block[i].returnDate > bh.maxReturn)
+            {
+                bh.maxReturn = block[i].returnDate;
+            }
+        }
+
+        size_t rawLength = encodeBlock(block, n, raw);
+        const uint8_t *payload = raw;
+        bh.rawLength = (uint32_t)rawLength;
+        bh.storedLength = (uint32_t)rawLength;
+        bh.codec = LOAN_CODEC_NONE;
+        if (codec == LOAN_CODEC_LZ)
+        {
+            size_t packedLength = lzCompress(raw, rawLength, packed, LZ_BOUND(rawCapacity));
+            if (packedLength > 0)
+            {
+                payload = packed;
+                bh.storedLength = (uint32_t)packedLength;
+                bh.codec = LOAN_CODEC_LZ;
+            }
+        }
+        ok = fwrite(&bh, sizeof(bh), 1, file) == 1 &&
+             fwrite(payload, 1, bh.storedLength, file) == bh.storedLength;
+
+        if (start == 0 || bh.minBorrow < info->minBorrow)
+        {
+            info->minBorrow = bh.minBorrow;
+        }
+        if (start == 0 || bh.maxBorrow > info->maxBorrow)
+        {
+            info->maxBorrow = bh.maxBorrow;
+        }
+        if (start == 0 || bh.minReturn < info->minReturn)
+        {
+            info->minReturn = bh.minReturn;
+        }
+        if (start == 0 || bh.maxReturn > info->maxReturn)
+        {
+            info->maxReturn = bh.maxReturn;
+        }
+    }
+
+    free(raw);
+    free(packed);
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        remove(tempPath);
+        return 0;
+    }
+    return journalReplaceOnCommit(tempPath, path);
+}
+
+static int compact(int codec)
+{
+    FILE *active = fopen(BORROWED_BOOKS_FILE, "rb");
+    if (!active)
+    {
+        return 0; // Nothing borrowed yet
+    }
+    FILE *openLoans = fopen(ACTIVE_TEMP_FILE, "wb");
+    if (!openLoans)
+    {
+        perror("Failed to open temporary file");
+        fclose(active);
+        return -1;
+    }
+
+    // Open loans stream straight into the new active file; closed ones are
+    // collected so they can be sorted into the segment.
+    BorrowedRecord *closed = NULL;
+    size_t closedCount = 0;
+    size_t closedCapacity = 0;
+    BorrowedRecord record;
+    int ok = 1;
+    size_t scanned = 0;
+    while (ok && fread(&record, sizeof(BorrowedRecord), 1, active) == 1)
+    {
+        scanned++;
+        if (record.returnDate == 0)
+        {
+            ok = fwrite(&record, sizeof(BorrowedRecord), 1, openLoans) == 1;
+            continue;
+        }
+        if (closedCount == closedCapacity)
+        {
+            size_t newCapacity = closedCapacity ? closedCapacity * 2 : 256;
+            BorrowedRecord *grown = realloc(closed, newCapacity * sizeof(BorrowedRecord));
+            if (!grown)
+            {
+                ok = 0;
+                break;
+            }
+            closed = grown;
+            closedCapacity = newCapacity;
+        }
+        closed[closedCount++] = record;
+    }
+    fclose(active);
+    ok = fclose(openLoans) == 0 && ok;
+    metricsCount(COUNTER_FILE_OPENS, 2);
+    metricsCount(COUNTER_RECORDS_SCANNED, scanned);
+    metricsCount(COUNTER_BYTES_READ, scanned * sizeof(BorrowedRecord));
+    metricsCount(COUNTER_BYTES_WRITTEN, (scanned - closedCount) * sizeof(BorrowedRecord));
+
+    if (!ok || closedCount == 0)
+    {
+        free(closed);
+        remove(ACTIVE_TEMP_FILE);
+        return ok ? 0 : -1;
+    }
+
+    qsort(closed, closedCount, sizeof(BorrowedRecord), compareBorrowDate);
+
+    ManifestHeader header;
+    LoanSegmentInfo *segments;
+    if (!readManifest(&header, &segments))
+    {
+        free(closed);
+        remove(ACTIVE_TEMP_FILE);
+        return -1;
+    }
+    LoanSegmentInfo *grown = realloc(segments, (header.segmentCount + 1) * sizeof(LoanSegmentInfo));
+    if (!grown || !writeSegment(header.nextSegmentID, closed, closedCount, codec, &grown[header.segmentCount]))
+    {
+        free(grown ? grown : segments);
+        free(closed);
+        remove(ACTIVE_TEMP_FILE);
+        return -1;
+    }
+    segments = grown;
+    header.segmentCount++;
+    header.nextSegmentID++;
+    free(closed);
+
+    // The segment, the manifest naming it and the active file without the
+    // archived loans are swapped in together when the operation commits
+    if (!writeManifest(&header, segments))
+    {
+        free(segments);
+        remove(ACTIVE_TEMP_FILE);
+        return -1;
+    }
+    free(segments);
+    if (!journalReplaceOnCommit(ACTIVE_TEMP_FILE, BORROWED_BOOKS_FILE))
+    {
+        return -1;
+    }
+    // Block boundaries move with the rewrite
+    if (!loanZoneMapReset())
+    {
+        return -1;
+    }
+    return (int)closedCount;
+}
+
+int loanArchiveCompact(int codec)
+{
+    uint64_t start = metricsNow();
+    journalBegin();
+    int archived = compact(codec);
+    if (archived < 0)
+    {
+        journalAbort();
+    }
+    if (!journalCommit())
+    {
+        archived = -1;
+    }
+    metricsStop(TIMER_ARCHIVE_COMPACT, start);
+    return archived;
+}
+
+int loanArchiveCompactIfNeeded(void)
+{
+    FILE *file = fopen(BORROWED_BOOKS_FILE, "rb");
+    if (!file)
+    {
+        return 0;
+    }
+    BorrowedRecord record;
+    int closedCount = 0;
+    while (fread(&record, sizeof(BorrowedRecord), 1, file) == 1)
+    {
+        if (record.returnDate != 0)
+        {
+            closedCount++;
+        }
+    }
+    fclose(file);
+    if (closedCount < LOAN_ARCHIVE_MIN_CLOSED)
+    {
+        return 0;
+    }
+    return loanArchiveCompact(LOAN_CODEC_LZ);
+}
+
+int loanArchiveSegments(LoanSegmentInfo **segments, size_t *count)
+{
+    ManifestHeader header;
+    if (!readManifest(&header, segments))
+    {
+        *count = 0;
+        return 0;
+    }
+    *count = header.segmentCount;
+    return 1;
+}
+
+// A torn or damaged block header could claim more records or bytes than
+// one block can hold, and the decode buffers are sized for a full block
+static int blockFits(const LoanBlockInfo *block)
+{
+    size_t rawCapacity = LOAN_ARCHIVE_BLOCK_RECORDS * MAX_ENCODED_RECORD;
+    if (block->recordCount > LOAN_ARCHIVE_BLOCK_RECORDS || block->rawLength > rawCapacity)
+    {
+        return 0;
+    }
+    if (block->codec == LOAN_CODEC_LZ)
+    {
+        return block->storedLength <= LZ_BOUND(rawCapacity);
+    }
+    // Stored as is: the payload is the raw block
+    return block->codec == LOAN_CODEC_NONE && block->storedLength == block->rawLength;
+}
+
+FILE *loanArchiveOpenSegment(uint32_t segmentID)
+{
+    char path[64];
+    snprintf(path, sizeof(path), LOAN_ARCHIVE_SEGMENT_FORMAT, segmentID);
+    return fopen(path, "rb");
+}
+
+int loanArchiveReadBlocks(FILE *segment, LoanBlockInfo **blocks, size_t *count)
+{
+    SegmentHeader header;
+    *blocks = NULL;
+    *count = 0;
+
+    rewind(segment);
+    if (fread(&header, sizeof(header), 1, segment) != 1 || memcmp(header.magic, SEGMENT_MAGIC, 4) != 0)
+    {
+        return 0;
+    }
+    if (header.blockCount == 0)
+    {
+        return 1;
+    }
+    *blocks = malloc(header.blockCount * sizeof(LoanBlockInfo));
+    if (!*blocks)
+    {
+        return 0;
+    }
+
+    // Walk the inline block headers, seeking over each payload
+    for (uint32_t i = 0; i < header.blockCount; i++)
+    {
+        BlockHeader bh;
+        if (fread(&bh, sizeof(bh), 1, segment) != 1)
+        {
+            free(*blocks);
+            *blocks = NULL;
+            return 0;
+        }
+        LoanBlockInfo *info = &(*blocks)[i];
+        info->recordCount = bh.recordCount;
+        info->rawLength = bh.rawLength;
+        info->storedLength = bh.storedLength;
+        info->codec = bh.codec;
+        info->minBorrow = bh.minBorrow;
+        info->maxBorrow = bh.maxBorrow;
+        info->minReturn = bh.minReturn;
+        info->maxReturn = bh.maxReturn;
+        info->payloadOffset = ftell(segment);
+        if (!blockFits(info))
+        {
+            fprintf(stderr, "Damaged loan archive segment: block %u does not fit a block\n", (unsigned)i);
+            free(*blocks);
+            *blocks = NULL;
+            return 0;
+        }
+        fseek(segment, bh.storedLength, SEEK_CUR);
+    }
+    *count = header.blockCount;
+    return 1;
+}
+
+int loanArchiveDecodeBlock(FILE *segment, const LoanBlockInfo *block, BorrowedRecord *out)
+{
+    if (!blockFits(block))
+    {
+        return 0;
+    }
+    uint8_t *stored = malloc(block->storedLength ? block->storedLength : 1);
+    uint8_t *raw = block->codec == LOAN_CODEC_LZ ? malloc(block->rawLength ? block->rawLength : 1) : stored;
+    int ok = stored && raw;
+
+    ok = ok && fseek(segment, block->payloadOffset, SEEK_SET) == 0 &&
+         fread(stored, 1, block->storedLength, segment) == block->storedLength;
+    if (ok && block->codec == LOAN_CODEC_LZ)
+    {
+        ok = lzDecompress(stored, block->storedLength, raw, block->rawLength);
+    }
+    ok = ok && decodeBlock(raw, block->rawLength, block->recordCount, out);
+
+    if (raw != stored)
+    {
+        free(raw);
+    }
+    free(stored);
+    return ok;
+}
+
+int loanArchiveForEach(int (*visit)(const BorrowedRecord *record, void *ctx), void *ctx)
+{
+    LoanSegmentInfo *segments;
+    size_t segmentCount;
+    if (!loanArchiveSegments(&segments, &segmentCount))
+    {
+        return 0;
+    }
+
+    BorrowedRecord *records = malloc(LOAN_ARCHIVE_BLOCK_RECORDS * sizeof(BorrowedRecord));
+    int ok = records != NULL;
+    int stop = 0;
+    for (size_t s = 0; ok && !stop && s < segmentCount; s++)
+    {
+        FILE *segment = loanArchiveOpenSegment(segments[s].segmentID);
+        LoanBlockInfo *blocks;
+        size_t blockCount;
+        if (!segment || !loanArchiveReadBlocks(segment, &blocks, &blockCount))
+        {
+            ok = 0;
+            if (segment)
+            {
+                fclose(segment);
+            }
+            break;
+        }
+        for (size_t b = 0; ok && !stop && b < blockCount; b++)
+        {
+            ok = loanArchiveDecodeBlock(segment, &blocks[b], records);
+            for (uint32_t i = 0; ok && i < blocks[b].recordCount; i++)
+            {
+                if (!visit(&records[i], ctx))
+                {
+                    stop = 1;
+                    break;
+                }
+            }
+        }
+        free(blocks);
+        fclose(segment);
+    }
+    free(records);
+    free(segments);
+    return ok;
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/library.h"
+#include "../include/id_index.h"
+#include "../include/loan_join.h"
+#include "../include/metrics.h"
+#include "../include/dates.h"
+#include "../include/shards.h"
+#include "../include/parallel_scan.h"
+#include "../include/arena.h"
+
+// Appends one projected row. The tables are sized from the file lengths;
+// one that grew since is copied to a larger table in the arena.
+static long addRow(char (**rows)[100], size_t *count, size_t *capacity, const char *value)
+{
+    if (*count == *capacity)
+    {
+        size_t newCapacity = *capacity ? *capacity * 2 : 256;
+        char(*grown)[100] = arenaAlloc(requestArena(), newCapacity * sizeof(**rows));
+        if (!grown)
+        {
+            return -1;
+        }
+        if (*count > 0)
+        {
+            memcpy(grown, *rows, *count * sizeof(**rows));
+        }
+        *rows = grown;
+        *capacity = newCapacity;
+    }
+    strncpy((*rows)[*count], value, sizeof(**rows) - 1);
+    (*rows)[*count][sizeof(**rows) - 1] = '\0';
+    return (long)(*count)++;
+}
+
+int loanJoinBuild(LoanJoin *join)
+{
+    Arena *arena = requestArena();
+    memset(join, 0, sizeof(*join));
+    join->mark = arenaMark(arena);
+    size_t bookCapacity = (size_t)shardsRecordCount(SHARD_BOOKS);
+    size_t memberCapacity = (size_t)shardsRecordCount(SHARD_MEMBERS);
+    join->titles = bookCapacity ? arenaAlloc(arena, bookCapacity * sizeof(*join->titles)) : NULL;
+    join->names = memberCapacity ? arenaAlloc(arena, memberCapacity * sizeof(*join->names)) : NULL;
+    if ((bookCapacity && !join->titles) || (memberCapacity && !join->names) ||
+        !idIndexInitArena(&join->bookIndex, arena, bookCapacity) ||
+        !idIndexInitArena(&join->memberIndex, arena, memberCapacity))
+    {
+        loanJoinFree(join);
+        return 0;
+    }
+
+    ShardSet set;
+    long position;
+    shardsOpen(&set, SHARD_BOOKS, 0);
+    Book book;
+    while (shardsNext(&set, &book, &position))
+    {
+        long row = addRow(&join->titles, &join->bookCount, &bookCapacity, book.title);
+        if (row < 0 || !idIndexPut(&join->bookIndex, book.bookID, row))
+        {
+            shardsClose(&set);
+            loanJoinFree(join);
+            return 0;
+        }
+    }
+    shardsClose(&set);
+
+    shardsOpen(&set, SHARD_MEMBERS, 0);
+    Member member;
+    while (shardsNext(&set, &member, &position))
+    {
+        long row = addRow(&join->names, &join->memberCount, &memberCapacity, member.name);
+        if (row < 0 || !idIndexPut(&join->memberIndex, member.memberID, row))
+        {
+            shardsClose(&set);
+            loanJoinFree(join);
+            return 0;
+        }
+    }
+    shardsClose(&set);
+    metricsCount(COUNTER_RECORDS_SCANNED, join->bookCount + join->memberCount);
+    metricsCount(COUNTER_BYTES_READ, join->bookCount * sizeof(Book) + join->memberCount * sizeof(Member));
+    return 1;
+}
+
+void loanJoinFree(LoanJoin *join)
+{
+    idIndexFree(&join->bookIndex);
+    idIndexFree(&join->memberIndex);
+    arenaRewind(requestArena(), join->mark);
+    join->titles = NULL;
+    join->names = NULL;
+    join->bookCount = join->memberCount = 0;
+}
+
+void loanJoinProbe(const LoanJoin *join, const BorrowedRecord *loan, time_t now, LoanView *view)
+{
+    long row;
+    view->loan = *loan;
+    view->title = idIndexFind(&join->bookIndex, loan->bookID, &row) ? join->titles[row] : NULL;
+    view->memberName = idIndexFind(&join->memberIndex, loan->memberID, &row) ? join->names[row] : NULL;
+    time_t end = loan->returnDate != 0 ? loan->returnDate : now;
+    view->daysOut = end > loan->borrowDate ? (int)((end - loan->borrowDate) / DATE_SECONDS_PER_DAY) : 0;
+}
+
+typedef struct
+{
+    const LoanJoin *join;
+    time_t now;
+    LoanViewVisitor visit;
+    void *ctx;
+} OpenLoanScan;
+
+static int isOpenLoan(const void *record, void *ctx)
+{
+    (void)ctx;
+    return ((const BorrowedRecord *)record)->returnDate == 0;
+}
+
+static int visitOpenLoan(const void *record, unsigned file, long index, void *ctx)
+{
+    (void)file;
+    (void)index;
+    OpenLoanScan *scan = ctx;
+    LoanView view;
+    loanJoinProbe(scan->join, record, scan->now, &view);
+    return scan->visit(&view, scan->ctx);
+}
+
+long loanJoinOpenLoans(const LoanJoin *join, LoanViewVisitor visit, void *ctx)
+{
+    const char *files[] = {BORROWED_BOOKS_FILE};
+    OpenLoanScan scan = {join, time(NULL), visit, ctx};
+    ScanJob job = {files, 1, sizeof(BorrowedRecord), isOpenLoan, NULL, visitOpenLoan, &scan};
+    return parallelScan(&job);
+}
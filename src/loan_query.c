@@ -0,0 +1,557 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../include/library.h"
+#include "../include/loan_archive.h"
+#include "../include/loan_query.h"
+#include "../include/journal.h"
+#include "../include/metrics.h"
+
+#define ZONE_MAGIC "LMSZ"
+#define ZONE_VERSION 1
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t blockRecords;
+    uint32_t recordCount; // borrow.dat records covered by the zone map
+} ZoneHeader;
+
+typedef struct
+{
+    int64_t minBorrow;
+    int64_t maxBorrow;
+    int64_t minReturn; // over returned loans only
+    int64_t maxReturn;
+    uint32_t recordCount;
+    uint32_t openCount;
+} ZoneEntry;
+
+typedef struct
+{
+    size_t source; // 0 = borrow.dat, otherwise 1 + index into the segment list
+    uint32_t blockIndex;
+    ZoneEntry zone;
+    LoanBlockInfo archive;
+} BlockRef;
+
+typedef struct
+{
+    BorrowedRecord *records;
+    size_t count;
+    size_t pos;
+    size_t order; // tie-breaker so equal timestamps come out in block order
+} Cursor;
+
+static void zoneReset(ZoneEntry *zone)
+{
+    zone->minBorrow = INT64_MAX;
+    zone->maxBorrow = INT64_MIN;
+    zone->minReturn = INT64_MAX;
+    zone->maxReturn = INT64_MIN;
+    zone->recordCount = 0;
+    zone->openCount = 0;
+}
+
+static void zoneAdd(ZoneEntry *zone, const BorrowedRecord *record)
+{
+    if (record->borrowDate < zone->minBorrow)
+    {
+        zone->minBorrow = record->borrowDate;
+    }
+    if (record->borrowDate > zone->maxBorrow)
+    {
+        zone->maxBorrow = record->borrowDate;
+    }
+    if (record->returnDate == 0)
+    {
+        zone->openCount++;
+    }
+    else
+    {
+        if (record->returnDate < zone->minReturn)
+        {
+            zone->minReturn = record->returnDate;
+        }
+        if (record->returnDate > zone->maxReturn)
+        {
+            zone->maxReturn = record->returnDate;
+        }
+    }
+    zone->recordCount++;
+}
+
+// Writes the whole map to a temp file and renames it over the old one, so
+// a crash leaves either map, never a torn one
+static void saveZoneMap(const ZoneEntry *zones, size_t blocks, uint32_t recordCount)
+{
+    ZoneHeader header;
+    memcpy(header.magic, ZONE_MAGIC, 4);
+    header.version = ZONE_VERSION;
+    header.blockRecords = LOAN_ZONE_BLOCK_RECORDS;
+    header.recordCount = recordCount;
+    FILE *mapFile = fopen(LOAN_ZONE_TEMP_FILE, "wb");
+    if (!mapFile)
+    {
+        return; // Only a cache: the next query scans again
+    }
+    int ok = fwrite(&header, sizeof(header), 1, mapFile) == 1 &&
+             fwrite(zones, sizeof(ZoneEntry), blocks, mapFile) == blocks;
+    ok = fclose(mapFile) == 0 && ok;
+    metricsCount(COUNTER_BYTES_WRITTEN, sizeof(header) + blocks * sizeof(ZoneEntry));
+    if (!ok || !journalReplaceFile(LOAN_ZONE_TEMP_FILE, LOAN_ZONE_MAP_FILE))
+    {
+        remove(LOAN_ZONE_TEMP_FILE);
+    }
+}
+
+// Loads the borrow.dat zone map, scanning only the records appended since
+// it was last saved. The caller frees *zones.
+static int loadZoneMap(ZoneEntry **zones, size_t *blockCount)
+{
+    *zones = NULL;
+    *blockCount = 0;
+
+    FILE *borrowFile = fopen(BORROWED_BOOKS_FILE, "rb");
+    if (!borrowFile)
+    {
+        return 1; // Nothing borrowed yet
+    }
+    fseek(borrowFile, 0, SEEK_END);
+    uint32_t fileRecords = (uint32_t)(ftell(borrowFile) / (long)sizeof(BorrowedRecord));
+    size_t blocks = (fileRecords + LOAN_ZONE_BLOCK_RECORDS - 1) / LOAN_ZONE_BLOCK_RECORDS;
+    if (blocks == 0)
+    {
+        fclose(borrowFile);
+        return 1;
+    }
+    *zones = malloc(blocks * sizeof(ZoneEntry));
+    if (!*zones)
+    {
+        fclose(borrowFile);
+        return 0;
+    }
+
+    ZoneHeader header;
+    uint32_t covered = 0;
+    FILE *mapFile = fopen(LOAN_ZONE_MAP_FILE, "rb");
+    if (mapFile && fread(&header, sizeof(header), 1, mapFile) == 1 && memcmp(header.magic, ZONE_MAGIC, 4) == 0 &&
+        header.version == ZONE_VERSION && header.blockRecords == LOAN_ZONE_BLOCK_RECORDS &&
+        header.recordCount <= fileRecords)
+    {
+        // Whole blocks can be reused; a trailing partial block is rescanned
+        uint32_t fullBlocks = header.recordCount / LOAN_ZONE_BLOCK_RECORDS;
+        if (fread(*zones, sizeof(ZoneEntry), fullBlocks, mapFile) == fullBlocks)
+        {
+            covered = fullBlocks * LOAN_ZONE_BLOCK_RECORDS;
+        }
+    }
+    if (mapFile)
+    {
+        fclose(mapFile);
+    }
+
+    if (covered < fileRecords)
+    {
+        BorrowedRecord record;
+        size_t block = covered / LOAN_ZONE_BLOCK_RECORDS;
+        fseek(borrowFile, (long)covered * (long)sizeof(BorrowedRecord), SEEK_SET);
+        zoneReset(&(*zones)[block]);
+        for (uint32_t i = covered; i < fileRecords && fread(&record, sizeof(record), 1, borrowFile) == 1; i++)
+        {
+            if (i / LOAN_ZONE_BLOCK_RECORDS != block)
+            {
+                block = i / LOAN_ZONE_BLOCK_RECORDS;
+                zoneReset(&(*zones)[block]);
+            }
+            zoneAdd(&(*zones)[block], &record);
+        }
+        // A read-only process (a replica) keeps the extension in memory
+        if (!journalIsReadOnly())
+        {
+            saveZoneMap(*zones, blocks, fileRecords);
+        }
+    }
+    fclose(borrowFile);
+    *blockCount = blocks;
+    return 1;
+}
+
+void loanZoneMapNoteReturn(long recordIndex, time_t returnDate)
+{
+    FILE *mapFile = fopen(LOAN_ZONE_MAP_FILE, "rb+");
+    if (!mapFile)
+    {
+        if (errno != ENOENT)
+        {
+            journalAbort(); // a map that missed the return would hide it from queries
+        }
+        return;
+    }
+    ZoneHeader header;
+    ZoneEntry zone;
+    long offset = (long)sizeof(header) + (recordIndex / LOAN_ZONE_BLOCK_RECORDS) * (long)sizeof(ZoneEntry);
+    if (fread(&header, sizeof(header), 1, mapFile) == 1 && memcmp(header.magic, ZONE_MAGIC, 4) == 0 &&
+        recordIndex < (long)header.recordCount && fseek(mapFile, offset, SEEK_SET) == 0 &&
+        fread(&zone, sizeof(zone), 1, mapFile) == 1)
+    {
+        if (zone.openCount > 0)
+        {
+            zone.openCount--;
+        }
+        if (returnDate < zone.minReturn)
+        {
+            zone.minReturn = returnDate;
+        }
+        if (returnDate > zone.maxReturn)
+        {
+            zone.maxReturn = returnDate;
+        }
+        journalWrite(mapFile, LOAN_ZONE_MAP_FILE, offset, &zone, sizeof(zone));
+    }
+    fclose(mapFile);
+}
+
+int loanZoneMapReset(void)
+{
+    // A map covering no records: the next query rescans borrow.dat from
+    // the start. Swapped in by the caller's operation, so the old map stays
+    // whenever the rewrite of borrow.dat that outdates it does not happen.
+    ZoneHeader header;
+    memcpy(header.magic, ZONE_MAGIC, 4);
+    header.version = ZONE_VERSION;
+    header.blockRecords = LOAN_ZONE_BLOCK_RECORDS;
+    header.recordCount = 0;
+    FILE *mapFile = fopen(LOAN_ZONE_TEMP_FILE, "wb");
+    if (!mapFile)
+    {
+        perror("Failed to write zone map");
+        return 0;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, mapFile) == 1;
+    if (fclose(mapFile) != 0 || !ok)
+    {
+        remove(LOAN_ZONE_TEMP_FILE);
+        return 0;
+    }
+    return journalReplaceOnCommit(LOAN_ZONE_TEMP_FILE, LOAN_ZONE_MAP_FILE);
+}
+
+static int zoneMayMatch(const LoanQuery *query, const ZoneEntry *zone)
+{
+    if (zone->recordCount == 0 || zone->minBorrow > query->to)
+    {
+        return 0;
+    }
+    if (query->mode == LOAN_QUERY_BORROWED)
+    {
+        return zone->maxBorrow >= query->from;
+    }
+    // Active during the range: anything still out, or returned after from
+    return zone->openCount > 0 || zone->maxReturn >= query->from;
+}
+
+static int recordMatches(const LoanQuery *query, const BorrowedRecord *record)
+{
+    if ((query->bookID && record->bookID != query->bookID) ||
+        (query->memberID && record->memberID != query->memberID) || record->borrowDate > query->to)
+    {
+        return 0;
+    }
+    if (query->mode == LOAN_QUERY_BORROWED)
+    {
+        return record->borrowDate >= query->from;
+    }
+    return record->returnDate == 0 || record->returnDate >= query->from;
+}
+
+static int compareBlockStart(const void *a, const void *b)
+{
+    const BlockRef *ba = a;
+    const BlockRef *bb = b;
+    if (ba->zone.minBorrow != bb->zone.minBorrow)
+    {
+        return ba->zone.minBorrow < bb->zone.minBorrow ? -1 : 1;
+    }
+    return 0;
+}
+
+static int compareBorrowDate(const void *a, const void *b)
+{
+    const BorrowedRecord *ra = a;
+    const BorrowedRecord *rb = b;
+    if (ra->borrowDate != rb->borrowDate)
+    {
+        return ra->borrowDate < rb->borrowDate ? -1 : 1;
+    }
+    return 0;
+}
+
+static int cursorLess(const Cursor *a, const Cursor *b)
+{
+    time_t ta = a->records[a->pos].borrowDate;
+    time_t tb = b->records[b->pos].borrowDate;
+    return ta < tb || (ta == tb && a->order < b->order);
+}
+
+static void heapPush(Cursor *heap, size_t *size, Cursor cursor)
+{
+    size_t i = (*size)++;
+    heap[i] = cursor;
+    while (i > 0 && cursorLess(&heap[i], &heap[(i - 1) / 2]))
+    {
+        Cursor tmp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+static void heapSiftDown(Cursor *heap, size_t size)
+{
+    size_t i = 0;
+    for (;;)
+    {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < size && cursorLess(&heap[left], &heap[smallest]))
+        {
+            smallest = left;
+        }
+        if (right < size && cursorLess(&heap[right], &heap[smallest]))
+        {
+            smallest = right;
+        }
+        if (smallest == i)
+        {
+            return;
+        }
+        Cursor tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// Adds the blocks of every source whose zone can match to *refs
+static int collectBlocks(const LoanQuery *query, LoanSegmentInfo *segments, size_t segmentCount,
+                         FILE **segmentFiles, BlockRef **refs, size_t *refCount)
+{
+    size_t capacity = 0;
+    *refs = NULL;
+    *refCount = 0;
+
+    ZoneEntry *zones;
+    size_t zoneCount;
+    if (!loadZoneMap(&zones, &zoneCount))
+    {
+        return 0;
+    }
+    // Upper bound: every active block plus every archive block
+    capacity = zoneCount;
+    for (size_t s = 0; s < segmentCount; s++)
+    {
+        capacity += segments[s].blockCount;
+    }
+    *refs = malloc((capacity ? capacity : 1) * sizeof(BlockRef));
+    if (!*refs)
+    {
+        free(zones);
+        return 0;
+    }
+
+    for (size_t b = 0; b < zoneCount; b++)
+    {
+        if (zoneMayMatch(query, &zones[b]))
+        {
+            BlockRef *ref = &(*refs)[(*refCount)++];
+            memset(ref, 0, sizeof(*ref));
+            ref->source = 0;
+            ref->blockIndex = (uint32_t)b;
+            ref->zone = zones[b];
+        }
+    }
+    free(zones);
+
+    for (size_t s = 0; s < segmentCount; s++)
+    {
+        ZoneEntry segmentZone;
+        segmentZone.minBorrow = segments[s].minBorrow;
+        segmentZone.maxBorrow = segments[s].maxBorrow;
+        segmentZone.minReturn = segments[s].minReturn;
+        segmentZone.maxReturn = segments[s].maxReturn;
+        segmentZone.recordCount = segments[s].recordCount;
+        segmentZone.openCount = 0;
+        if (!zoneMayMatch(query, &segmentZone))
+        {
+            continue; // The whole segment is out of range
+        }
+
+        segmentFiles[s] = loanArchiveOpenSegment(segments[s].segmentID);
+        LoanBlockInfo *blocks;
+        size_t blockCount;
+        if (!segmentFiles[s] || !loanArchiveReadBlocks(segmentFiles[s], &blocks, &blockCount))
+        {
+            return 0;
+        }
+        for (size_t b = 0; b < blockCount && *refCount < capacity; b++)
+        {
+            BlockRef ref;
+            memset(&ref, 0, sizeof(ref));
+            ref.source = s + 1;
+            ref.blockIndex = (uint32_t)b;
+            ref.archive = blocks[b];
+            ref.zone.minBorrow = blocks[b].minBorrow;
+            ref.zone.maxBorrow = blocks[b].maxBorrow;
+            ref.zone.minReturn = blocks[b].minReturn;
+            ref.zone.maxReturn = blocks[b].maxReturn;
+            ref.zone.recordCount = blocks[b].recordCount;
+            if (zoneMayMatch(query, &ref.zone))
+            {
+                (*refs)[(*refCount)++] = ref;
+            }
+        }
+        free(blocks);
+    }
+    return 1;
+}
+
+static int openBlock(const BlockRef *ref, FILE *borrowFile, FILE **segmentFiles, Cursor *cursor)
+{
+    cursor->records = malloc(ref->zone.recordCount * sizeof(BorrowedRecord));
+    cursor->count = ref->zone.recordCount;
+    cursor->pos = 0;
+    if (!cursor->records)
+    {
+        return 0;
+    }
+    if (ref->source != 0)
+    {
+        // Archive blocks are stored sorted by borrowDate
+        return loanArchiveDecodeBlock(segmentFiles[ref->source - 1], &ref->archive, cursor->records);
+    }
+
+    long offset = (long)ref->blockIndex * LOAN_ZONE_BLOCK_RECORDS * (long)sizeof(BorrowedRecord);
+    if (fseek(borrowFile, offset, SEEK_SET) != 0)
+    {
+        return 0;
+    }
+    cursor->count = fread(cursor->records, sizeof(BorrowedRecord), cursor->count, borrowFile);
+    metricsCount(COUNTER_RECORDS_SCANNED, cursor->count);
+    metricsCount(COUNTER_BYTES_READ, cursor->count * sizeof(BorrowedRecord));
+    // borrow.dat is appended in time order, so this is normally already sorted
+    qsort(cursor->records, cursor->count, sizeof(BorrowedRecord), compareBorrowDate);
+    return 1;
+}
+
+long loanQueryRun(const LoanQuery *query, LoanVisitor visit, void *ctx)
+{
+    LoanSegmentInfo *segments;
+    size_t segmentCount;
+    if (!loanArchiveSegments(&segments, &segmentCount))
+    {
+        return -1;
+    }
+    FILE **segmentFiles = calloc(segmentCount ? segmentCount : 1, sizeof(FILE *));
+    BlockRef *refs = NULL;
+    size_t refCount = 0;
+    Cursor *heap = NULL;
+    size_t heapSize = 0;
+    FILE *borrowFile = NULL;
+    long visited = -1;
+
+    if (!segmentFiles || !collectBlocks(query, segments, segmentCount, segmentFiles, &refs, &refCount))
+    {
+        goto done;
+    }
+    qsort(refs, refCount, sizeof(BlockRef), compareBlockStart);
+    heap = malloc((refCount ? refCount : 1) * sizeof(Cursor));
+    borrowFile = fopen(BORROWED_BOOKS_FILE, "rb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!heap)
+    {
+        goto done;
+    }
+
+    visited = 0;
+    size_t next = 0;
+    for (;;)
+    {
+        // Open every block that could hold a loan earlier than the heap top
+        while (next < refCount &&
+               (heapSize == 0 || refs[next].zone.minBorrow <= heap[0].records[heap[0].pos].borrowDate))
+        {
+            Cursor cursor;
+            cursor.order = next;
+            if (!openBlock(&refs[next], borrowFile, segmentFiles, &cursor))
+            {
+                free(cursor.records);
+                visited = -1;
+                goto done;
+            }
+            next++;
+            if (cursor.count > 0)
+            {
+                heapPush(heap, &heapSize, cursor);
+            }
+            else
+            {
+                free(cursor.records);
+            }
+        }
+        if (heapSize == 0)
+        {
+            break;
+        }
+
+        BorrowedRecord record = heap[0].records[heap[0].pos++];
+        if (heap[0].pos == heap[0].count)
+        {
+            free(heap[0].records);
+            heap[0] = heap[--heapSize];
+        }
+        if (heapSize > 0)
+        {
+            heapSiftDown(heap, heapSize);
+        }
+
+        if (record.borrowDate > query->to)
+        {
+            break; // Everything after this is later still
+        }
+        if (recordMatches(query, &record))
+        {
+            visited++;
+            if (!visit(&record, ctx) || (query->limit && (size_t)visited >= query->limit))
+            {
+                break;
+            }
+        }
+    }
+
+done:
+    for (size_t i = 0; i < heapSize; i++)
+    {
+        free(heap[i].records);
+    }
+    free(heap);
+    free(refs);
+    if (borrowFile)
+    {
+        fclose(borrowFile);
+    }
+    for (size_t s = 0; segmentFiles && s < segmentCount; s++)
+    {
+        if (segmentFiles[s])
+        {
+            fclose(segmentFiles[s]);
+        }
+    }
+    free(segmentFiles);
+    free(segments);
+    return visited;
+}
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "../include/sha256.h"
+#include "../include/console.h"
 
 #define MAX_USER 50
 #define LOGIN_FILE "../data/login.dat"
@@ -100,7 +101,7 @@ int main(void)
         printf("Invalid choice.\n");
         break;
     }
-    system("pause");
+    consolePause();
 
     return 0;
 }
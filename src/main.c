@@ -4,10 +4,29 @@
 #include <time.h>
 #include <ctype.h>
 #include "../include/sha256.h"
+#include "../include/library.h"
+#include "../include/author_dict.h"
+#include "../include/loan_archive.h"
+#include "../include/loan_query.h"
+#include "../include/id_index.h"
+#include "../include/circulation_stats.h"
+#include "../include/loan_join.h"
+#include "../include/output_buffer.h"
+#include "../include/listing.h"
+#include "../include/dates.h"
+#include "../include/metrics.h"
+#include "../include/console.h"
+#include "../include/holds.h"
+#include "../include/items.h"
+#include "../include/policy.h"
+#include "../include/export.h"
+#include "../include/backup.h"
+#include "../include/journal.h"
+#include "../include/shards.h"
+#include "../include/replica.h"
 
 #define MAX_USER 50
 #define LOGIN_FILE "data/login.dat"
-#define BORROW_DURATION_DAYS 7
 
 void printMainMenu(void);
 void handleMainMenu(void);
@@ -25,58 +44,99 @@ void editMemberMenu(int memberID);
 void issueReturnBookMenu(void);
 void issueBook(int, int);
 void returnBook(int, int);
+void issueItem(void);
+void returnItem(void);
+void copiesMenu(void);
+void policiesMenu(void);
 void viewCurrentIssuedBooks(void);
+void viewMemberHolds(void);
+void cancelHold(void);
+void archiveReturnedLoans(void);
+void viewLoanHistory(void);
+void reportsMenu(void);
+void exportData(void);
+void backupMenu(void);
 void clearInput(void);
 int isValidEmail(const char *email);
 int isDigitsOnly(const char *s);
-int isValidBookID(int bookID);
-char *strptime(const char *buf, const char *format, struct tm *tm);
 
-typedef struct
-{
-    int bookID;
-    char title[100];
-    char author[100];
-    time_t publicationDate;
-    int quantity;
-} Book;
-typedef struct
-{
-    int memberID;
-    char name[100];
-    char email[100];
-    char phone[11]; // 10 digits + null terminator
-} Member;
-typedef struct
-{
-    int bookID;
-    int memberID;
-    time_t borrowDate;
-    time_t returnDate; // 0 if not yet returned
-    int isOverdue;     // 1 if overdue, 0 otherwise
-} BorrowedRecord;
-
-const char *BOOKS_FILE = "data/books.dat";
-
-const char *MEMBERS_FILE = "data/members.dat";
-
-const char *BORROWED_BOOKS_FILE = "data/borrow.dat";
+static int readOnly = 0; // a replica: lms_follow applies the primary's changes
+static uint64_t seenApplied = 0;
 
 // Main function to start the program
 int main()
 {
+    metricsInit();
+    if (replicaIsFollower())
+    {
+        // The journal belongs to lms_follow: recovering here could undo
+        // the batch it is applying
+        readOnly = 1;
+        journalSetReadOnly(1);
+        seenApplied = replicaApplied();
+        printf("Read-only replica at change %llu: searches, listings and reports only.\n",
+               (unsigned long long)seenApplied);
+    }
+    else
+    {
+        // Undo or finish whatever a crash interrupted, before anything is loaded
+        switch (journalRecover())
+        {
+        case JOURNAL_ROLLED_BACK:
+            puts("An interrupted operation was rolled back.");
+            break;
+        case JOURNAL_COMPLETED:
+            puts("An interrupted operation was completed.");
+            break;
+        case JOURNAL_FAILED:
+            puts("⚠️ Could not recover from " JOURNAL_FILE "; changes are disabled until it can be.");
+            break;
+        default:
+            break;
+        }
+    }
     login_user();
 
     return 0;
 }
 
+// A replica changes under the program: reread the data when lms_follow
+// has applied more since the last screen
+static void catchUpReplica(void)
+{
+    uint64_t applied = readOnly ? replicaApplied() : seenApplied;
+    if (applied != seenApplied)
+    {
+        seenApplied = applied;
+        libraryReload();
+    }
+}
+
+// Writes are refused on a replica, before any prompt
+static int refuseOnReplica(void)
+{
+    if (!readOnly)
+    {
+        return 0;
+    }
+    puts("⚠️ This is a read-only replica. Stop lms_follow and run \"lms_follow promote\" to make changes.");
+    consolePause();
+    return 1;
+}
+
 // ultils functions
 void clearInput(void)
 {
     int c;
-    while (c = getchar() != '\n' && c != EOF)
+    while ((c = getchar()) != '\n' && c != EOF)
     {
     }
+    if (c == EOF)
+    {
+        // Every prompt retries through here, so stop instead of spinning
+        puts("\nInput closed. Exiting.");
+        exit(0);
+    }
 }
 
 // Check if the string contains only digits
@@ -104,94 +164,16 @@ int isValidEmail(const char *email)
     return at && dot && at > email && dot > at && dot[1] != '\0';
 }
 
-// Check if bookID is valid, to use for adding or editing books
-int isValidBookID(int bookID)
-{
-    if (bookID <= 0)
-    {
-        return 0; // Invalid book ID
-    }
-
-    FILE *file = fopen(BOOKS_FILE, "rb");
-    if (!file)
-    {
-        return 1; // No books file, so any ID is valid
-    }
-
-    Book book;
-    while (fread(&book, sizeof(Book), 1, file) == 1)
-    {
-        if (book.bookID == bookID)
-        {
-            fclose(file);
-            return 0; // Book ID found, so it is invalid
-        }
-    }
-    fclose(file);
-    return 1; // Book ID not found, so it is valid
-}
-int isValidMemberID(int memberID)
-{
-    if (memberID <= 0)
-    {
-        return 0; // Invalid member ID
-    }
-
-    FILE *file = fopen(MEMBERS_FILE, "rb");
-    if (!file)
-    {
-        return 1; // No members file, so any ID is valid
-    }
-
-    Member member;
-    while (fread(&member, sizeof(Member), 1, file) == 1)
-    {
-        if (member.memberID == memberID)
-        {
-            fclose(file);
-            return 0; // Member ID found, so it is invalid
-        }
-    }
-    fclose(file);
-    return 1; // Member ID not found, so it is valid
-}
-
-// Check if the string is a valid date in the format YYYY-MM-DD and within the range 1970-01-01 to current date
-int isValidDate(const char *dateStr)
+// Check if the string is a valid date in the format YYYY-MM-DD and not in the future
+int isValidDate(const char *dateStr, DayNumber *day)
 {
-    struct tm tm = {0};
-    char *result = strptime(dateStr, "%Y-%m-%d", &tm);
-    if (result == NULL || *result != '\0')
-    {
-        return 0; // Invalid format or extra characters
-    }
-
-    // Save original input
-    int inputYear, inputMonth, inputDay;
-    if (sscanf(dateStr, "%d-%d-%d", &inputYear, &inputMonth, &inputDay) != 3)
+    DayNumber parsed;
+    if (!dateParse(dateStr, &parsed) || parsed > dateToday())
     {
         return 0;
     }
-
-    // Normalize date with mktime (adjusts out-of-range values)
-    time_t epoch = mktime(&tm);
-    if (epoch == -1)
-        return 0; // mktime failed
-
-    // Validate that mktime didn’t adjust the values
-    if (tm.tm_year != inputYear - 1900 || tm.tm_mon != inputMonth - 1 || tm.tm_mday != inputDay)
-    {
-        return 0; // mktime adjusted the values → invalid date
-    }
-
-    // Optional: prevent future dates
-    time_t now = time(NULL);
-    if (difftime(epoch, now) > 0)
-    {
-        return 0; // Date is in the future
-    }
-
-    return 1; // ✅ Valid date
+    *day = parsed;
+    return 1;
 }
 int isValidPhone(const char *phone)
 {
@@ -203,26 +185,6 @@ int isValidPhone(const char *phone)
     return 1; // Valid phone number
 }
 
-#ifdef _WIN32
-// Fallback strptime() for Windows (supports only "%Y-%m-%d")
-char *strptime(const char *buf, const char *format, struct tm *tm)
-{
-    if (strcmp(format, "%Y-%m-%d") == 0)
-    {
-        int y, m, d;
-        if (sscanf(buf, "%d-%d-%d", &y, &m, &d) == 3)
-        {
-            tm->tm_year = y - 1900;
-            tm->tm_mon = m - 1;
-            tm->tm_mday = d;
-            tm->tm_hour = tm->tm_min = tm->tm_sec = 0;
-            return (char *)buf + strlen(buf);
-        }
-    }
-    return NULL;
-}
-#endif
-
 // Function to login user
 
 void login_user()
@@ -240,7 +202,7 @@ void login_user()
     if (!file)
     {
         printf("No account found. Please register first.\n");
-        system("pause");
+        consolePause();
         return;
     }
 
@@ -257,15 +219,27 @@ void login_user()
     // Hash input password
     unsigned char input_hash[32];
     SHA256_CTX ctx;
+    uint64_t start = metricsNow();
     sha256_init(&ctx);
     sha256_update(&ctx, (const BYTE *)password, strlen(password));
     sha256_final(&ctx, input_hash);
+    metricsStop(TIMER_LOGIN, start);
 
     if (strcmp(username, stored_user) == 0 &&
         memcmp(input_hash, stored_hash, 32) == 0)
     {
         printf("✅ Login successful!\n");
-        system("pause");
+        // Move returned loans out of borrow.dat once enough have piled up
+        int archived = readOnly ? 0 : loanArchiveCompactIfNeeded();
+        if (archived > 0)
+        {
+            printf("Archived %d returned loans.\n", archived);
+        }
+        if (!readOnly)
+        {
+            statsLoad(); // Seeds the circulation counters on first run
+        }
+        consolePause();
         printMainMenu();
         handleMainMenu();
     }
@@ -276,7 +250,7 @@ void login_user()
         if (failed_attempts >= 3)
         {
             printf("Too many failed attempts. Exiting...\n");
-            system("pause");
+            consolePause();
         }
         else
         {
@@ -289,12 +263,14 @@ void login_user()
 // UI functions
 void printMainMenu(void)
 {
-    system("cls"); // Clear the console screen
+    catchUpReplica();
+    consoleClear();
     puts("===== LIBRARY MANAGEMENT SYSTEM =====");
     puts("1. Books");
     puts("2. Members");
     puts("3. Issue/Return Book");
-    puts("4. Exit");
+    puts("4. Reports");
+    puts("5. Exit");
     printf("Select > ");
 }
 
@@ -317,11 +293,14 @@ void handleMainMenu(void)
         issueReturnBookMenu();
         break;
     case 4:
+        reportsMenu();
+        break;
+    case 5:
         puts("Exiting the system.");
         exit(0);
     default:
         puts("Invalid choice. Please try again.");
-        system("pause");
+        consolePause();
         clearInput(); // Clear the input buffer
         printMainMenu();
         break;
@@ -331,12 +310,14 @@ void handleMainMenu(void)
 // Function to display the books menu
 void booksMenu(void)
 {
-    system("cls"); // Clear the console screen
+    catchUpReplica();
+    consoleClear();
     puts("===== BOOKS MENU =====");
     puts("1. Add Book");
     puts("2. View Books");
     puts("3. Search Books");
-    puts("4. Back to Main Menu");
+    puts("4. Manage Copies");
+    puts("5. Back to Main Menu");
     printf("Select > ");
 
     int choice;
@@ -358,6 +339,10 @@ void booksMenu(void)
         searchBooks();
         break;
     case 4:
+        clearInput(); // Clear the newline character from the input buffer
+        copiesMenu();
+        break;
+    case 5:
         printMainMenu();
         handleMainMenu();
         break;
@@ -370,14 +355,13 @@ void booksMenu(void)
 
 void addBook(void)
 {
-    system("cls"); // Clear the console screen
-    Book newBook;
-    FILE *file = fopen(BOOKS_FILE, "ab+");
-    if (!file)
+    if (refuseOnReplica())
     {
-        perror("Failed to open books file");
+        booksMenu();
         return;
     }
+    consoleClear();
+    Book newBook;
 
     printf("Enter book ID: ");
     while (scanf("%d", &newBook.bookID) != 1 || isValidBookID(newBook.bookID) == 0)
@@ -414,21 +398,19 @@ void addBook(void)
 
     printf("Enter publication date (YYYY-MM-DD): ");
     char dateStr[11];
-    struct tm tm = {0};
+    DayNumber publicationDay;
     // Check if the input is valid
     while (1)
     {
         fgets(dateStr, sizeof(dateStr), stdin);
         dateStr[strcspn(dateStr, "\n")] = '\0'; // Remove trailing newline
-        if (isValidDate(dateStr))
+        if (isValidDate(dateStr, &publicationDay))
             break;
         else
             printf("Invalid date format. Please enter a valid date (YYYY-MM-DD): ");
     }
 
-    // Parse the date string into a tm structure
-    strptime(dateStr, "%Y-%m-%d", &tm);
-    newBook.publicationDate = mktime(&tm);
+    newBook.publicationDate = dateToTime(publicationDay);
     printf("Enter quantity: ");
     while (scanf("%d", &newBook.quantity) != 1 || newBook.quantity < 0)
     {
@@ -436,80 +418,157 @@ void addBook(void)
         printf("Invalid input. Please enter a non-negative integer for quantity: ");
     }
 
-    fwrite(&newBook, sizeof(Book), 1, file);
-    fclose(file);
+    uint64_t start = metricsNow();
+    long recordIndex = shardsAppend(SHARD_BOOKS, &newBook);
+    if (recordIndex < 0)
+    {
+        puts("❌ Failed to save the book.");
+        consolePause();
+        booksMenu();
+        return;
+    }
+    authorDictAddBook(newBook.author, newBook.bookID, recordIndex);
+    listingBookAdded(recordIndex);
+    metricsStop(TIMER_ADD_RECORD, start);
 
     puts("✅ Book added successfully!");
-    system("pause");
+    consolePause();
     booksMenu();
 }
 
-void viewBooks(void)
+// Reads a listing command: returns the ID typed, 0 to go back, or -1 for
+// the N/P/S paging commands (stored in *command)
+static int readListingCommand(char *command)
 {
-    system("cls"); // Clear the console screen
-    puts("===== LIST OF BOOKS =====");
-    FILE *file = fopen(BOOKS_FILE, "rb");
-    if (!file)
+    char input[16];
+    for (;;)
     {
-        puts("No books found.");
-        system("pause");
-        booksMenu();
+        if (scanf(" %15s", input) != 1)
+        {
+            return 0;
+        }
+        clearInput(); // Clear the newline character from the input buffer
+        *command = (char)toupper((unsigned char)input[0]);
+        if (input[1] == '\0' && (*command == 'N' || *command == 'P' || *command == 'S'))
+        {
+            return -1;
+        }
+        if (isDigitsOnly(input))
+        {
+            return atoi(input);
+        }
+        printf("Invalid input. Please enter N, P, S, an ID or 0 to return: ");
     }
-    else
+}
+
+static int readSortKey(const char *const *names, int count)
+{
+    puts("Sort by:");
+    for (int i = 0; i < count; i++)
     {
-        Book book;
-        int count = 0;
-        while (fread(&book, sizeof(Book), 1, file) == 1)
+        printf("%d. %s\n", i + 1, names[i]);
+    }
+    printf("Select > ");
+    int choice;
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > count)
+    {
+        clearInput();
+        printf("Invalid input. Please select a valid option: ");
+    }
+    clearInput(); // Clear the newline character from the input buffer
+    return choice - 1;
+}
+
+void viewBooks(void)
+{
+    static const char *const sortNames[BOOK_SORT_KEY_COUNT] = {"ID", "Title", "Author", "Publication Date",
+                                                               "Quantity"};
+    BookSortKey sortKey = BOOK_SORT_ID;
+    size_t offset = 0;
+    Book page[LISTING_PAGE_SIZE];
+    OutputBuffer out;
+    outputBufferInit(&out, OUTPUT_BUFFER_DEFAULT_CAPACITY);
+
+    for (;;)
+    {
+        size_t total;
+        uint64_t start = metricsNow();
+        size_t count = listBooks(sortKey, offset, LISTING_PAGE_SIZE, page, &total);
+        metricsStop(TIMER_LIST_PAGE, start);
+        consoleClear();
+        outputBufferPuts(&out, "===== LIST OF BOOKS =====");
+        if (total == 0)
         {
-            printf("Book ID: %d\n", book.bookID);
-            printf("Title: %s\n", book.title);
-            printf("Author: %s\n", book.author);
-            char dateStr[11];
-            strftime(dateStr, sizeof(dateStr), "%Y-%m-%d", localtime(&book.publicationDate));
-            printf("Publication Date: %s\n", dateStr);
-            printf("Quantity: %d\n", book.quantity);
-            puts("-------------------------");
-            count++;
+            outputBufferPuts(&out, "No books found.");
+            outputBufferFlush(&out, stdout);
+            outputBufferFree(&out);
+            consolePause();
+            booksMenu();
+            return;
         }
-        fclose(file);
-        if (count == 0)
+
+        // The whole page is formatted in memory and written at once
+        for (size_t i = 0; i < count; i++)
         {
-            puts("No books found.");
+            char dateStr[DATE_TEXT_SIZE];
+            outputBufferPrintf(&out,
+                               "Book ID: %d\nTitle: %s\nAuthor: %s\nPublication Date: %s\nQuantity: %d\n"
+                               "-------------------------\n",
+                               page[i].bookID, page[i].title, page[i].author,
+                               dateFormat(dateFromTime(page[i].publicationDate), dateStr), page[i].quantity);
         }
-        else
+        outputBufferPrintf(&out, "Showing %zu-%zu of %zu books, sorted by %s\n", offset + 1, offset + count, total,
+                           sortNames[sortKey]);
+        outputBufferPuts(&out, "===========================");
+        outputBufferPuts(&out, "N: next page, P: previous page, S: change sort order");
+        outputBufferPuts(&out, "Type Book ID to edit or delete a book, or 0 to return to the books menu.");
+        outputBufferAppend(&out, "> ", 2);
+        outputBufferFlush(&out, stdout);
+
+        char command;
+        int bookID = readListingCommand(&command);
+        if (bookID > 0)
         {
-            puts("End of book list.");
-            puts("===========================");
-            printf("Total books: %d\n", count);
-            puts("===========================");
-            puts("Type Book ID to edit or delete a book, or 0 to return to the books menu.");
-            printf("> ");
-            int bookID;
-            while (scanf("%d", &bookID) != 1 || bookID < 0)
-            {
-                clearInput();
-                printf("Invalid input. Please enter a valid book ID or 0 to return: ");
-            }
-            clearInput(); // Clear the newline character from the input buffer
-            if (bookID > 0)
-            {
-                editBookMenu(bookID);
-            }
-            else if (bookID == 0)
-            {
-                booksMenu();
-            }
+            outputBufferFree(&out);
+            editBookMenu(bookID);
+            return;
+        }
+        if (bookID == 0)
+        {
+            outputBufferFree(&out);
+            booksMenu();
+            return;
+        }
+        if (command == 'N' && offset + LISTING_PAGE_SIZE < total)
+        {
+            offset += LISTING_PAGE_SIZE;
+        }
+        else if (command == 'P')
+        {
+            offset = offset >= LISTING_PAGE_SIZE ? offset - LISTING_PAGE_SIZE : 0;
+        }
+        else if (command == 'S')
+        {
+            sortKey = (BookSortKey)readSortKey(sortNames, BOOK_SORT_KEY_COUNT);
+            offset = 0;
         }
     }
 }
 void editBookMenu(int bookID)
 {
-    system("cls"); // Clear the console screen
+    if (refuseOnReplica())
+    {
+        booksMenu();
+        return;
+    }
+    consoleClear();
     puts("===== EDIT BOOK =====");
-    FILE *file = fopen(BOOKS_FILE, "rb+");
+    ShardSet books;
+    shardsOpen(&books, SHARD_BOOKS, 1);
     Book book;
+    long recordIndex;
     int found = 0;
-    while (fread(&book, sizeof(Book), 1, file) == 1)
+    while (shardsNext(&books, &book, &recordIndex))
     {
         if (book.bookID == bookID)
         {
@@ -521,21 +580,21 @@ void editBookMenu(int bookID)
     if (!found)
     {
         puts("Book not found.");
-        fclose(file);
+        shardsClose(&books);
         puts("Returning to the books menu...");
-        system("pause");
+        consolePause();
         // Return to the books menu
-        fclose(file);
         booksMenu();
         return;
     }
     char dateStr[11];
-    struct tm tm = {0};
+    DayNumber publicationDay;
+    char oldAuthor[sizeof(book.author)];
+    strcpy(oldAuthor, book.author);
     printf("Book ID: %d\n", book.bookID);
     printf("Current Title: %s\n", book.title);
     printf("Current Author: %s\n", book.author);
-    strftime(dateStr, sizeof(dateStr), "%Y-%m-%d", localtime(&book.publicationDate));
-    printf("Current Publication Date: %s\n", dateStr);
+    printf("Current Publication Date: %s\n", dateFormat(dateFromTime(book.publicationDate), dateStr));
     printf("Current Quantity: %d\n", book.quantity);
     puts("-------------------------");
 
@@ -602,7 +661,7 @@ void editBookMenu(int bookID)
                 continue;
             }
 
-            if (isValidDate(dateStr))
+            if (isValidDate(dateStr, &publicationDay))
             {
                 break;
             }
@@ -612,8 +671,7 @@ void editBookMenu(int bookID)
             }
         }
 
-        strptime(dateStr, "%Y-%m-%d", &tm);
-        book.publicationDate = mktime(&tm);
+        book.publicationDate = dateToTime(publicationDay);
         puts("✅ Publication date updated successfully.");
         break;
 
@@ -665,7 +723,7 @@ void editBookMenu(int bookID)
                 continue;
             }
 
-            if (isValidDate(dateStr))
+            if (isValidDate(dateStr, &publicationDay))
             {
                 break;
             }
@@ -674,8 +732,7 @@ void editBookMenu(int bookID)
                 printf("Invalid date format. Please enter a valid date (YYYY-MM-DD):\n");
             }
         }
-        strptime(dateStr, "%Y-%m-%d", &tm);
-        book.publicationDate = mktime(&tm);
+        book.publicationDate = dateToTime(publicationDay);
 
         printf("Enter new quantity: ");
         while (scanf("%d", &book.quantity) != 1 || book.quantity < 0)
@@ -688,56 +745,77 @@ void editBookMenu(int bookID)
     case 6:
     {
         // Delete the book
-        FILE *tempFile = fopen("data/temp_books.dat", "wb+");
-        if (!tempFile)
+        shardsClose(&books);
+        if (!libraryDeleteBook(bookID))
         {
-            perror("Failed to open temporary file");
-            fclose(file);
+            puts("❌ Failed to delete the book.");
+            consolePause();
+            booksMenu();
             return;
         }
-        Book tempBook;
-        rewind(file); // Reset file pointer to the beginning
-        while (fread(&tempBook, sizeof(Book), 1, file) == 1)
-        {
-            if (tempBook.bookID != bookID)
-            {
-                fwrite(&tempBook, sizeof(Book), 1, tempFile);
-            }
-        }
-        fclose(file);
-        fclose(tempFile);
-        remove(BOOKS_FILE);
-        rename("data/temp_books.dat", BOOKS_FILE);
         puts("✅ Book deleted successfully!");
-        break;
+        consolePause();
+        booksMenu();
+        return;
     }
     case 7:
         puts("Cancelled. Returning to the books menu...");
-        fclose(file);
-        system("pause");
+        shardsClose(&books);
+        consolePause();
         booksMenu();
         return;
     default:
         puts("Invalid choice. Please try again.");
-        fclose(file);
-        system("pause");
+        shardsClose(&books);
+        consolePause();
         booksMenu();
         return;
     }
     // Write the updated book back to the file
-    fseek(file, -(long)sizeof(Book), SEEK_CUR); // Move the file pointer back to the position of the book
-    fwrite(&book, sizeof(Book), 1, file);
-    fclose(file);
-    system("pause");
+    uint64_t start = metricsNow();
+    if (!shardsWrite(&books, recordIndex, &book))
+    {
+        // The indexes keep describing the book as it is on disk
+        puts("❌ Failed to save the book.");
+        shardsClose(&books);
+        consolePause();
+        booksMenu();
+        return;
+    }
+    shardsClose(&books);
+    if (strcmp(oldAuthor, book.author) != 0)
+    {
+        authorDictRemoveBook(oldAuthor, book.bookID);
+        authorDictAddBook(book.author, book.bookID, recordIndex);
+    }
+    listingBookChanged(recordIndex);
+    metricsCount(COUNTER_BYTES_WRITTEN, sizeof(Book));
+    metricsStop(TIMER_EDIT_RECORD, start);
+    consolePause();
     booksMenu();
 }
 
+static int printFoundBook(const Book *book, void *ctx)
+{
+    (void)ctx;
+    char dateStr[DATE_TEXT_SIZE];
+    printf("Book ID: %d\n", book->bookID);
+    printf("Title: %s\n", book->title);
+    printf("Author: %s\n", book->author);
+    printf("Publication Date: %s\n", dateFormat(dateFromTime(book->publicationDate), dateStr));
+    printf("Quantity: %d\n", book->quantity);
+    puts("-------------------------");
+    return 1;
+}
+
 void searchBooks(void)
 {
-    FILE *file = fopen(BOOKS_FILE, "rb+");
+    ShardSet books;
+    shardsOpen(&books, SHARD_BOOKS, 0);
     Book book;
+    long position;
     int found = 0;
-    system("cls"); // Clear the console screen
+    consoleClear();
     puts("===== BOOK SEARCH =====");
     puts("Choose a search option:");
     puts("1. Search by ID");
@@ -753,12 +831,12 @@ void searchBooks(void)
         printf("Invalid input. Please select a valid option: ");
     }
     clearInput(); // Clear the newline character from the input buffer
+    uint64_t start = 0;
     switch (choice)
     {
     case 1:
         printf("Enter book ID: ");
         int bookID;
-        rewind(file);
         while (scanf("%d", &bookID) != 1 || bookID <= 0)
         {
             clearInput();
@@ -767,21 +845,18 @@ void searchBooks(void)
         clearInput(); // Clear the newline character from the input buffer
         printf("Searching for book with ID: %d\n", bookID);
         printf("===========================\n");
-        while (fread(&book, sizeof(Book), 1, file) == 1)
+        start = metricsNow();
+        // IDs are unique, and only the ID's shard is read
+        if (shardsFind(&books, bookID, &book, &position))
         {
-            if (book.bookID == bookID)
-            {
-
-                printf("Book ID: %d\n", book.bookID);
-                printf("Title: %s\n", book.title);
-                printf("Author: %s\n", book.author);
-                char dateStr[11];
-                strftime(dateStr, sizeof(dateStr), "%Y-%m-%d", localtime(&book.publicationDate));
-                printf("Publication Date: %s\n", dateStr);
-                printf("Quantity: %d\n", book.quantity);
-                puts("-------------------------");
-                found += 1;
-            }
+            printf("Book ID: %d\n", book.bookID);
+            printf("Title: %s\n", book.title);
+            printf("Author: %s\n", book.author);
+            char dateStr[DATE_TEXT_SIZE];
+            printf("Publication Date: %s\n", dateFormat(dateFromTime(book.publicationDate), dateStr));
+            printf("Quantity: %d\n", book.quantity);
+            puts("-------------------------");
+            found += 1;
         }
         break;
     case 2:
@@ -796,21 +871,8 @@ void searchBooks(void)
         title[strcspn(title, "\n")] = '\0'; // Remove trailing newline
         printf("Searching for books with title containing: %s\n", title);
         printf("===========================\n");
-        while (fread(&book, sizeof(Book), 1, file) == 1)
-        {
-            if (_stricmp(book.title, title) == 0) // compare strings for case-insensitive match
-            {
-                printf("Book ID: %d\n", book.bookID);
-                printf("Title: %s\n", book.title);
-                printf("Author: %s\n", book.author);
-                char dateStr[11];
-                strftime(dateStr, sizeof(dateStr), "%Y-%m-%d", localtime(&book.publicationDate));
-                printf("Publication Date: %s\n", dateStr);
-                printf("Quantity: %d\n", book.quantity);
-                puts("-------------------------");
-                found += 1;
-            }
-        }
+        start = metricsNow();
+        found = (int)librarySearchTitle(title, printFoundBook, NULL);
         break;
     case 3:
         printf("Enter book author: ");
@@ -822,18 +884,21 @@ void searchBooks(void)
             fgets(author, sizeof(author), stdin);
         }
         author[strcspn(author, "\n")] = '\0'; // Remove trailing newline
-        printf("Searching for books by author containing: %s\n", author);
+        printf("Searching for books by author: %s\n", author);
         printf("===========================\n");
-        while (fread(&book, sizeof(Book), 1, file) == 1)
+        start = metricsNow();
+        // One dictionary lookup, then read only the books on the posting list
+        size_t postingCount;
+        const AuthorPosting *postings = authorDictPostings(authorDictLookup(author), &postingCount);
+        for (size_t i = 0; i < postingCount; i++)
         {
-            if (_stricmp(book.author, author) == 0)
+            if (shardsRead(&books, postings[i].recordIndex, &book) && book.bookID == postings[i].bookID)
             {
                 printf("Book ID: %d\n", book.bookID);
                 printf("Title: %s\n", book.title);
                 printf("Author: %s\n", book.author);
-                char dateStr[11];
-                strftime(dateStr, sizeof(dateStr), "%Y-%m-%d", localtime(&book.publicationDate));
-                printf("Publication Date: %s\n", dateStr);
+                char dateStr[DATE_TEXT_SIZE];
+                printf("Publication Date: %s\n", dateFormat(dateFromTime(book.publicationDate), dateStr));
                 printf("Quantity: %d\n", book.quantity);
                 puts("-------------------------");
                 found += 1;
@@ -842,12 +907,13 @@ void searchBooks(void)
         break;
     case 4:
         puts("Returning to the books menu...");
-        fclose(file);
-        system("pause");
+        shardsClose(&books);
+        consolePause();
         booksMenu();
         return;
     }
-    fclose(file);
+    shardsClose(&books);
+    metricsStop(TIMER_SEARCH_BOOKS, start);
     if (found == 0)
     {
         puts("No books found matching your search criteria.");
@@ -858,19 +924,21 @@ void searchBooks(void)
     }
     puts("End of search results.");
     puts("===========================");
-    system("pause");
+    consolePause();
     booksMenu();
 }
 
 // Function to display the members menu
 void membersMenu(void)
 {
-    system("cls"); // Clear the console screen
+    catchUpReplica();
+    consoleClear();
     puts("===== MEMBERS MENU =====");
     puts("1. Add Member");
     puts("2. View Members");
     // puts("3. Issue/Return Book");
-    puts("3. Back to Main Menu");
+    puts("3. Borrowing Policies");
+    puts("4. Back to Main Menu");
     printf("Select > ");
 
     int choice;
@@ -889,6 +957,9 @@ void membersMenu(void)
         viewMembers();
         break;
     case 3:
+        policiesMenu();
+        break;
+    case 4:
         printMainMenu();
         handleMainMenu();
         break;
@@ -901,14 +972,13 @@ void membersMenu(void)
 
 void addMember(void)
 {
-    system("cls"); // Clear the console screen
-    Member newMember;
-    FILE *file = fopen(MEMBERS_FILE, "ab+");
-    if (!file)
+    if (refuseOnReplica())
     {
-        perror("Failed to open members file");
+        membersMenu();
         return;
     }
+    consoleClear();
+    Member newMember;
 
     printf("Enter member ID: ");
     while (scanf("%d", &newMember.memberID) != 1 || isValidMemberID(newMember.memberID) == 0)
@@ -956,79 +1026,107 @@ void addMember(void)
         newMember.phone[strcspn(newMember.phone, "\n")] = '\0'; // Remove trailing newline
     }
 
-    fwrite(&newMember, sizeof(Member), 1, file);
-    fclose(file);
+    uint64_t start = metricsNow();
+    long recordIndex = shardsAppend(SHARD_MEMBERS, &newMember);
+    if (recordIndex < 0)
+    {
+        puts("❌ Failed to save the member.");
+        consolePause();
+        membersMenu();
+        return;
+    }
+    listingMemberAdded(recordIndex);
+    metricsStop(TIMER_ADD_RECORD, start);
 
     puts("✅ Member added successfully!");
-    system("pause");
+    consolePause();
     membersMenu();
 }
 void viewMembers(void)
 {
-    system("cls"); // Clear the console screen
-    puts("===== LIST OF MEMBERS =====");
-    FILE *file = fopen(MEMBERS_FILE, "rb");
-    if (!file)
-    {
-        puts("No members found.");
-        system("pause");
-        membersMenu();
-    }
-    else
-    {
-        Member member;
-        int count = 0;
-        while (fread(&member, sizeof(Member), 1, file) == 1)
+    static const char *const sortNames[MEMBER_SORT_KEY_COUNT] = {"ID", "Name"};
+    MemberSortKey sortKey = MEMBER_SORT_ID;
+    size_t offset = 0;
+    Member page[LISTING_PAGE_SIZE];
+    OutputBuffer out;
+    outputBufferInit(&out, OUTPUT_BUFFER_DEFAULT_CAPACITY);
+
+    for (;;)
+    {
+        size_t total;
+        uint64_t start = metricsNow();
+        size_t count = listMembers(sortKey, offset, LISTING_PAGE_SIZE, page, &total);
+        metricsStop(TIMER_LIST_PAGE, start);
+        consoleClear();
+        outputBufferPuts(&out, "===== LIST OF MEMBERS =====");
+        if (total == 0)
         {
-            printf("Member ID: %d\n", member.memberID);
-            printf("Name: %s\n", member.name);
-            printf("Email: %s\n", member.email);
-            printf("Phone: %s\n", member.phone);
-            puts("-------------------------");
-            count++;
+            outputBufferPuts(&out, "No members found.");
+            outputBufferFlush(&out, stdout);
+            outputBufferFree(&out);
+            consolePause();
+            membersMenu();
+            return;
         }
-        fclose(file);
-        if (count == 0)
+
+        for (size_t i = 0; i < count; i++)
         {
-            puts("No members found.");
+            outputBufferPrintf(&out, "Member ID: %d\nName: %s\nEmail: %s\nPhone: %s\n-------------------------\n",
+                               page[i].memberID, page[i].name, page[i].email, page[i].phone);
         }
-        else
+        outputBufferPrintf(&out, "Showing %zu-%zu of %zu members, sorted by %s\n", offset + 1, offset + count, total,
+                           sortNames[sortKey]);
+        outputBufferPuts(&out, "===========================");
+        outputBufferPuts(&out, "N: next page, P: previous page, S: change sort order");
+        outputBufferPuts(&out, "Type Member ID to edit or delete a member, or 0 to return to the members menu.");
+        outputBufferAppend(&out, "> ", 2);
+        outputBufferFlush(&out, stdout);
+
+        char command;
+        int memberID = readListingCommand(&command);
+        if (memberID > 0)
         {
-            puts("End of member list.");
-            puts("===========================");
-            printf("Total members: %d\n", count);
-            puts("===========================");
-            puts("Type Member ID to edit or delete a member, or 0 to return to the members menu.");
-            printf("> ");
-            int memberID;
-            while (scanf("%d", &memberID) != 1 || memberID < 0)
-            {
-                clearInput();
-                printf("Invalid input. Please enter a valid member ID or 0 to return: ");
-            }
-            clearInput(); // Clear the newline character from the input buffer
-            if (memberID > 0)
-            {
-                editMemberMenu(memberID);
-            }
-            else if (memberID == 0)
-            {
-                membersMenu();
-            }
+            outputBufferFree(&out);
+            editMemberMenu(memberID);
+            return;
+        }
+        if (memberID == 0)
+        {
+            outputBufferFree(&out);
+            membersMenu();
+            return;
+        }
+        if (command == 'N' && offset + LISTING_PAGE_SIZE < total)
+        {
+            offset += LISTING_PAGE_SIZE;
+        }
+        else if (command == 'P')
+        {
+            offset = offset >= LISTING_PAGE_SIZE ? offset - LISTING_PAGE_SIZE : 0;
+        }
+        else if (command == 'S')
+        {
+            sortKey = (MemberSortKey)readSortKey(sortNames, MEMBER_SORT_KEY_COUNT);
+            offset = 0;
         }
     }
-    system("pause");
-    membersMenu();
 }
 
 void editMemberMenu(int memberID)
 {
-    system("cls"); // Clear the console screen
-    puts("===== EDIT MEMBER =====");
-    FILE *file = fopen(MEMBERS_FILE, "rb+");
-    Member member;
+    if (refuseOnReplica())
+    {
+        membersMenu();
+        return;
+    }
+    consoleClear();
+    puts("===== EDIT MEMBER =====");
+    ShardSet members;
+    shardsOpen(&members, SHARD_MEMBERS, 1);
+    Member member;
+    long recordIndex;
     int found = 0;
-    while (fread(&member, sizeof(Member), 1, file) == 1)
+    while (shardsNext(&members, &member, &recordIndex))
     {
         if (member.memberID == memberID)
         {
@@ -1040,11 +1138,10 @@ void editMemberMenu(int memberID)
     if (!found)
     {
         puts("Member not found.");
-        fclose(file);
+        shardsClose(&members);
         puts("Returning to the members menu...");
-        system("pause");
+        consolePause();
         // Return to the members menu
-        fclose(file);
         clearInput(); // Clear the input buffer
         membersMenu();
         return;
@@ -1154,59 +1251,71 @@ void editMemberMenu(int memberID)
     case 5:
     {
         // Delete the member
-        FILE *tempFile = fopen("data/temp_members.dat", "wb+");
-        if (!tempFile)
+        shardsClose(&members);
+        if (!libraryDeleteMember(memberID))
         {
-            perror("Failed to open temporary file");
-            fclose(file);
+            puts("❌ Failed to delete the member.");
+            consolePause();
+            membersMenu();
             return;
         }
-        Member tempMember;
-        rewind(file); // Reset file pointer to the beginning
-        while (fread(&tempMember, sizeof(Member), 1, file) == 1)
-        {
-            if (tempMember.memberID != memberID)
-            {
-                fwrite(&tempMember, sizeof(Member), 1, tempFile);
-            }
-        }
-        fclose(file);
-        fclose(tempFile);
-        remove(MEMBERS_FILE);
-        rename("data/temp_members.dat", MEMBERS_FILE);
         puts("✅ Member deleted successfully!");
-        break;
+        consolePause();
+        membersMenu();
+        return;
     }
     case 6:
         puts("Cancelled. Returning to the members menu...");
-        fclose(file);
-        system("pause");
+        shardsClose(&members);
+        consolePause();
         membersMenu();
         return;
     }
     // Write the updated member back to the file
-    fseek(file, -(long)sizeof(Member), SEEK_CUR); // Move the file pointer back to the position of the member
-    fwrite(&member, sizeof(Member), 1, file);
-    fclose(file);
-    system("pause");
+    uint64_t start = metricsNow();
+    if (!shardsWrite(&members, recordIndex, &member))
+    {
+        puts("❌ Failed to save the member.");
+        shardsClose(&members);
+        consolePause();
+        membersMenu();
+        return;
+    }
+    shardsClose(&members);
+    listingMemberChanged(recordIndex);
+    metricsCount(COUNTER_BYTES_WRITTEN, sizeof(Member));
+    metricsStop(TIMER_EDIT_RECORD, start);
+    consolePause();
     membersMenu();
 }
 void issueReturnBookMenu(void)
 {
-    system("cls"); // Clear the console screen
+    consoleClear();
     puts("===== ISSUE/RETURN BOOK =====");
     puts("1. Issue Book");
     puts("2. Return Book");
-    puts("3. View current issued books");
-    puts("4. Back to Main Menu");
+    puts("3. Issue by Barcode");
+    puts("4. Return by Barcode");
+    puts("5. View current issued books");
+    puts("6. Archive returned loans");
+    puts("7. View loan history");
+    puts("8. View member holds");
+    puts("9. Cancel a hold");
+    puts("10. Back to Main Menu");
     printf("Select > ");
     int choice;
-    while (scanf("%d", &choice) != 1 || choice < 1 || choice > 4)
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > 10)
     {
         clearInput();
         printf("Invalid input. Please select a valid option: ");
     }
     clearInput(); // Clear the newline character from the input buffer
+    // Everything but the views and the way back changes the data
+    if (choice != 5 && choice != 7 && choice != 8 && choice != 10 && refuseOnReplica())
+    {
+        issueReturnBookMenu();
+        return;
+    }
     switch (choice)
     {
     case 1:
@@ -1246,9 +1355,27 @@ void issueReturnBookMenu(void)
         returnBook(memberID, bookID);
         break;
     case 3:
-        viewCurrentIssuedBooks();
+        issueItem();
         break;
     case 4:
+        returnItem();
+        break;
+    case 5:
+        viewCurrentIssuedBooks();
+        break;
+    case 6:
+        archiveReturnedLoans();
+        break;
+    case 7:
+        viewLoanHistory();
+        break;
+    case 8:
+        viewMemberHolds();
+        break;
+    case 9:
+        cancelHold();
+        break;
+    case 10:
         printMainMenu();
         handleMainMenu();
         return;
@@ -1260,205 +1387,1102 @@ void issueReturnBookMenu(void)
 }
 void issueBook(int memberID, int bookID)
 {
-    FILE *bookFile = fopen(BOOKS_FILE, "rb+");
-    if (!bookFile)
+    Book book;
+    Member member;
+    switch (libraryIssueBook(memberID, bookID, &book, &member))
     {
-        perror("Failed to open books file");
+    case LIBRARY_OK:
+        break;
+    case LIBRARY_NO_MEMBER:
+        printf("❌ Member ID %d not found.\n", memberID);
+        return;
+    case LIBRARY_NO_BOOK:
+        printf("❌ Book ID %d not found.\n", bookID);
+        return;
+    case LIBRARY_OUT_OF_STOCK:
+        printf("⚠️ Book '%s' is currently out of stock.\n", book.title);
+        printf("%ld member(s) waiting. Place a hold for '%s'? (y/n): ", holdsWaiting(bookID), member.name);
+        int answer = getchar();
+        if (answer != '\n')
+        {
+            clearInput();
+        }
+        if (answer == 'y' || answer == 'Y')
+        {
+            long position;
+            switch (libraryPlaceHold(memberID, bookID, &position))
+            {
+            case LIBRARY_OK:
+                printf("✅ Hold placed. Position in queue: %ld\n", position);
+                break;
+            case LIBRARY_HOLD_EXISTS:
+                puts("⚠️ This member already has a hold on this book.");
+                break;
+            default:
+                puts("❌ Failed to place the hold.");
+                break;
+            }
+        }
+        consolePause();
+        issueReturnBookMenu();
+        return;
+    case LIBRARY_LIMIT_REACHED:
+        printf("⚠️ Member '%s' already has the most loans their category allows.\n", member.name);
+        consolePause();
+        issueReturnBookMenu();
+        return;
+    case LIBRARY_OVERDUE_BLOCKED:
+        printf("⚠️ Member '%s' has overdue books and must return them first.\n", member.name);
+        consolePause();
+        issueReturnBookMenu();
+        return;
+    default:
+        puts("❌ Failed to save the loan.");
+        consolePause();
+        issueReturnBookMenu();
         return;
     }
 
-    FILE *memberFile = fopen(MEMBERS_FILE, "rb");
-    if (!memberFile)
+    printf("✅ Book '%s' issued to member '%s'.\n", book.title, member.name);
+    consolePause();
+    viewCurrentIssuedBooks();
+}
+
+void returnBook(int memberID, int bookID)
+{
+    BorrowedRecord record;
+    int heldFor;
+    switch (libraryReturnBook(memberID, bookID, &record, &heldFor))
     {
-        perror("Failed to open members file");
-        fclose(bookFile);
+    case LIBRARY_OK:
+        break;
+    case LIBRARY_NO_LOAN:
+        printf("❌ No active borrowing record found for Member ID %d and Book ID %d.\n", memberID, bookID);
+        consolePause();
+        issueReturnBookMenu();
+        return;
+    default:
+        puts("❌ Failed to save the return.");
+        consolePause();
+        issueReturnBookMenu();
         return;
     }
 
-    // Step 1: Validate Member ID
-    Member member;
-    int memberFound = 0;
-    while (fread(&member, sizeof(Member), 1, memberFile) == 1)
+    printf("✅ Book ID %d successfully returned by Member ID %d.\n", bookID, memberID);
+    if (heldFor)
     {
-        if (member.memberID == memberID)
-        {
-            memberFound = 1;
-            break;
-        }
+        printf("Copy set aside for Member ID %d, who is first in the hold queue.\n", heldFor);
     }
-    fclose(memberFile);
+    consolePause();
+    viewCurrentIssuedBooks();
+}
+static void printLoanView(const LoanView *view)
+{
+    char brdateStr[DATETIME_TEXT_SIZE];
+    char rtdateStr[DATETIME_TEXT_SIZE];
+    printf("Member: %s (ID %d)\n", view->memberName ? view->memberName : "(deleted)", view->loan.memberID);
+    printf("Book: %s (ID %d)\n", view->title ? view->title : "(deleted)", view->loan.bookID);
+    printf("Borrow Date: %s\n", dateTimeFormat(view->loan.borrowDate, brdateStr));
+    printf("Return Date: %s\n",
+           view->loan.returnDate == 0 ? "Not returned yet" : dateTimeFormat(view->loan.returnDate, rtdateStr));
+    printf("Days Out: %d\n", view->daysOut);
+    puts("-------------------------");
+}
 
-    if (!memberFound)
-    {
-        printf("❌ Member ID %d not found.\n", memberID);
-        fclose(bookFile);
-        return;
-    }
+static int printIssuedLoan(const LoanView *view, void *ctx)
+{
+    (void)ctx;
+    printLoanView(view);
+    return 1;
+}
 
-    // Step 2: Validate Book ID and check quantity
-    Book book;
-    int bookFound = 0;
-    long pos = 0;
-    while (fread(&book, sizeof(Book), 1, bookFile) == 1)
+// Reads a scanned or typed barcode, asking again until it is well formed
+static void readBarcode(char *barcode)
+{
+    char line[100];
+    for (;;)
     {
-        if (book.bookID == bookID)
+        printf("Scan or enter barcode: ");
+        if (!fgets(line, sizeof(line), stdin))
         {
-            bookFound = 1;
-            break;
+            clearInput(); // Exits at end of input
+            continue;
         }
-        pos += sizeof(Book);
+        line[strcspn(line, "\r\n")] = '\0';
+        if (itemsValidBarcode(line))
+        {
+            strcpy(barcode, line);
+            return;
+        }
+        printf("Invalid barcode. Use at most %d characters without spaces.\n", ITEM_BARCODE_SIZE - 1);
     }
+}
 
-    if (!bookFound)
+void issueItem(void)
+{
+    printf("Enter Member ID: ");
+    int memberID;
+    while (scanf("%d", &memberID) != 1 || memberID <= 0)
     {
-        printf("❌ Book ID %d not found.\n", bookID);
-        fclose(bookFile);
-        return;
+        clearInput();
+        printf("Invalid Member ID. Please enter a valid positive integer: ");
     }
+    clearInput(); // Clear the newline character from the input buffer
+    char barcode[ITEM_BARCODE_SIZE];
+    readBarcode(barcode);
 
-    if (book.quantity <= 0)
+    Book book;
+    Member member;
+    switch (libraryIssueItem(memberID, barcode, &book, &member))
     {
-        printf("⚠️ Book '%s' is currently out of stock.\n", book.title);
-        fclose(bookFile);
-        return;
+    case LIBRARY_OK:
+        printf("✅ Copy %s of '%s' issued to member '%s'.\n", barcode, book.title, member.name);
+        break;
+    case LIBRARY_NO_MEMBER:
+        printf("❌ Member ID %d not found.\n", memberID);
+        break;
+    case LIBRARY_NO_ITEM:
+        printf("❌ No copy has barcode %s.\n", barcode);
+        break;
+    case LIBRARY_NO_BOOK:
+        printf("❌ The book of copy %s no longer exists.\n", barcode);
+        break;
+    case LIBRARY_ITEM_UNAVAILABLE:
+        printf("⚠️ Copy %s is on loan, withdrawn or set aside for another member's hold.\n", barcode);
+        break;
+    case LIBRARY_OUT_OF_STOCK:
+        printf("⚠️ Book '%s' shows no copies in stock. Reconcile its quantity from Manage Copies.\n", book.title);
+        break;
+    case LIBRARY_LIMIT_REACHED:
+        printf("⚠️ Member '%s' already has the most loans their category allows.\n", member.name);
+        break;
+    case LIBRARY_OVERDUE_BLOCKED:
+        printf("⚠️ Member '%s' has overdue books and must return them first.\n", member.name);
+        break;
+    default:
+        puts("❌ Failed to save the loan.");
+        break;
     }
+    consolePause();
+    issueReturnBookMenu();
+}
 
-    // Step 3: Deduct quantity
-    book.quantity -= 1;
-    fseek(bookFile, pos, SEEK_SET);
-    fwrite(&book, sizeof(Book), 1, bookFile);
-    fclose(bookFile);
+void returnItem(void)
+{
+    char barcode[ITEM_BARCODE_SIZE];
+    readBarcode(barcode);
 
-    // Step 4: Create borrowing record
     BorrowedRecord record;
-    record.memberID = memberID;
-    record.bookID = bookID;
-    record.borrowDate = time(NULL);
-    record.returnDate = 0; // 0 indicates the book is not returned yet
-
-    FILE *borrowFile = fopen(BORROWED_BOOKS_FILE, "ab");
-    if (!borrowFile)
+    int heldFor;
+    switch (libraryReturnItem(barcode, &record, &heldFor))
     {
-        perror("Failed to open borrow file");
-        return;
+    case LIBRARY_OK:
+        printf("✅ Copy %s (Book ID %d) returned by Member ID %d.\n", barcode, record.bookID, record.memberID);
+        if (heldFor)
+        {
+            printf("Copy set aside for Member ID %d, who is first in the hold queue.\n", heldFor);
+        }
+        break;
+    case LIBRARY_NO_ITEM:
+        printf("❌ No copy has barcode %s.\n", barcode);
+        break;
+    case LIBRARY_NO_LOAN:
+        printf("❌ Copy %s is not on loan.\n", barcode);
+        break;
+    default:
+        puts("❌ Failed to save the return.");
+        break;
     }
-    fwrite(&record, sizeof(BorrowedRecord), 1, borrowFile);
-    fclose(borrowFile);
-
-    printf("✅ Book '%s' issued to member '%s'.\n", book.title, member.name);
-    system("pause");
-    viewCurrentIssuedBooks();
+    consolePause();
+    issueReturnBookMenu();
 }
 
-void returnBook(int memberID, int bookID)
+static const char *itemStatusName(int status)
 {
-    FILE *borrowFile = fopen(BORROWED_BOOKS_FILE, "rb+");
-    if (!borrowFile)
-    {
-        perror("Failed to open borrow file");
-        return;
+    switch (status)
+    {
+    case ITEM_AVAILABLE:
+        return "On shelf";
+    case ITEM_ON_LOAN:
+        return "On loan";
+    case ITEM_ON_HOLD_SHELF:
+        return "Set aside for hold";
+    default:
+        return "Withdrawn";
     }
+}
 
-    BorrowedRecord record;
-    long pos = 0;
-    int found = 0;
-
-    while (fread(&record, sizeof(BorrowedRecord), 1, borrowFile) == 1)
+static int printItem(const ItemRecord *item, void *ctx)
+{
+    char dateStr[DATETIME_TEXT_SIZE];
+    printf("Barcode: %s | %s", item->barcode, itemStatusName(item->status));
+    if (item->memberID)
     {
-        if (record.memberID == memberID && record.bookID == bookID && record.returnDate == 0)
-        {
-            found = 1;
-            break;
-        }
-        pos += sizeof(BorrowedRecord);
+        printf(" (Member ID %d)", item->memberID);
     }
+    printf(" | since %s\n", dateTimeFormat(item->since, dateStr));
+    (*(int *)ctx)++;
+    return 1;
+}
 
-    if (!found)
+void copiesMenu(void)
+{
+    consoleClear();
+    puts("===== MANAGE COPIES =====");
+    puts("1. Register a copy");
+    puts("2. Withdraw a copy");
+    puts("3. List copies of a book");
+    puts("4. Reconcile quantities with copies");
+    puts("5. Back to Books Menu");
+    printf("Select > ");
+    int choice;
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > 5)
     {
-        printf("❌ No active borrowing record found for Member ID %d and Book ID %d.\n", memberID, bookID);
-        fclose(borrowFile);
-        system("pause");
-        issueReturnBookMenu();
+        clearInput();
+        printf("Invalid input. Please select a valid option: ");
     }
+    clearInput(); // Clear the newline character from the input buffer
 
-    // Step 1: Mark as returned
-    record.returnDate = time(NULL);
-    fseek(borrowFile, pos, SEEK_SET);
-    fwrite(&record, sizeof(BorrowedRecord), 1, borrowFile);
-    fclose(borrowFile);
-
-    // Step 2: Update book quantity
-    FILE *bookFile = fopen(BOOKS_FILE, "rb+");
-    if (!bookFile)
+    if (choice != 3 && choice != 5 && refuseOnReplica())
     {
-        perror("Failed to open books file");
+        copiesMenu();
         return;
     }
-
-    Book book;
-    pos = 0;
-    while (fread(&book, sizeof(Book), 1, bookFile) == 1)
+    int bookID;
+    char barcode[ITEM_BARCODE_SIZE];
+    switch (choice)
     {
-        if (book.bookID == bookID)
+    case 1:
+    {
+        printf("Enter Book ID: ");
+        while (scanf("%d", &bookID) != 1 || bookID <= 0)
+        {
+            clearInput();
+            printf("Invalid Book ID. Please enter a valid positive integer: ");
+        }
+        clearInput(); // Clear the newline character from the input buffer
+        readBarcode(barcode);
+        int heldFor;
+        switch (libraryAddItem(bookID, barcode, &heldFor))
+        {
+        case LIBRARY_OK:
+            printf("✅ Copy %s registered for Book ID %d.\n", barcode, bookID);
+            if (heldFor)
+            {
+                printf("Copy set aside for Member ID %d, who is first in the hold queue.\n", heldFor);
+            }
+            break;
+        case LIBRARY_NO_BOOK:
+            printf("❌ Book ID %d not found.\n", bookID);
+            break;
+        case LIBRARY_ITEM_EXISTS:
+            printf("❌ Barcode %s is already in use.\n", barcode);
+            break;
+        default:
+            puts("❌ Failed to register the copy.");
+            break;
+        }
+        break;
+    }
+    case 2:
+        readBarcode(barcode);
+        switch (libraryWithdrawItem(barcode))
         {
-            book.quantity += 1;
-            fseek(bookFile, pos, SEEK_SET);
-            fwrite(&book, sizeof(Book), 1, bookFile);
+        case LIBRARY_OK:
+            printf("✅ Copy %s withdrawn.\n", barcode);
+            break;
+        case LIBRARY_NO_ITEM:
+            printf("❌ No copy has barcode %s.\n", barcode);
+            break;
+        case LIBRARY_ITEM_UNAVAILABLE:
+            printf("⚠️ Copy %s is not on the shelf.\n", barcode);
+            break;
+        default:
+            puts("❌ Failed to withdraw the copy.");
             break;
         }
-        pos += sizeof(Book);
+        break;
+    case 3:
+    {
+        printf("Enter Book ID: ");
+        while (scanf("%d", &bookID) != 1 || bookID <= 0)
+        {
+            clearInput();
+            printf("Invalid Book ID. Please enter a valid positive integer: ");
+        }
+        clearInput(); // Clear the newline character from the input buffer
+        int count = 0;
+        itemsForBook(bookID, printItem, &count);
+        if (count == 0)
+        {
+            puts("No copies are registered for this book.");
+        }
+        else
+        {
+            printf("Total copies: %d (%zu on shelf)\n", count, itemsCount(bookID, ITEM_AVAILABLE));
+        }
+        break;
+    }
+    case 4:
+    {
+        long fixed = libraryReconcileItems();
+        if (fixed < 0)
+        {
+            puts("❌ Failed to read the books or copies.");
+        }
+        else
+        {
+            printf("✅ %ld book quantities corrected.\n", fixed);
+        }
+        break;
+    }
+    case 5:
+        booksMenu();
+        return;
     }
+    puts("===========================");
+    consolePause();
+    copiesMenu();
+}
 
-    fclose(bookFile);
-    printf("✅ Book ID %d successfully returned by Member ID %d.\n", bookID, memberID);
-    system("pause");
-    viewCurrentIssuedBooks();
+static void printPolicy(int category)
+{
+    const LoanPolicy *policy = policyGet(category);
+    char cap[16];
+    char block[16];
+    snprintf(cap, sizeof(cap), policy->maxLoans > 0 ? "%d" : "no cap", policy->maxLoans);
+    snprintf(block, sizeof(block), policy->overdueBlock > 0 ? "%d" : "never", policy->overdueBlock);
+    printf("%d. %-12s | Loans: %-6s | Days: %-4d | Blocked at overdue: %s\n", category + 1, policy->name, cap,
+           policy->loanDays, block);
 }
-void viewCurrentIssuedBooks(void)
+
+static int readCategory(void)
 {
-    system("cls"); // Clear the console screen
-    puts("===== ISSUED BOOKS =====");
-    FILE *borrowFile = fopen(BORROWED_BOOKS_FILE, "rb");
-    if (!borrowFile)
+    for (int category = 0; category < POLICY_CATEGORY_COUNT; category++)
     {
-        puts("No books have been issued.");
-        system("pause");
-        membersMenu();
-        return;
+        printf("%d. %s\n", category + 1, policyGet(category)->name);
     }
-
-    BorrowedRecord record;
-    int count = 0;
-    while (fread(&record, sizeof(BorrowedRecord), 1, borrowFile) == 1)
-    {
-        if (record.returnDate == 0) // Only show currently issued books
-        {
-            printf("Member ID: %d\n", record.memberID);
-            printf("Book ID: %d\n", record.bookID);
-            char brdateStr[20];
-            char rtdateStr[20];
-            strftime(brdateStr, sizeof(brdateStr), "%Y-%m-%d %H:%M:%S", localtime(&record.borrowDate));
-            strftime(rtdateStr, sizeof(rtdateStr), "%Y-%m-%d %H:%M:%S", localtime(&record.returnDate));
-            printf("Borrow Date: %s\n", brdateStr);
-            printf("Return Date: %s\n", record.returnDate == 0 ? "Not returned yet" : rtdateStr);
-            puts("-------------------------");
-            count++;
-        }
+    printf("Select category > ");
+    int choice;
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > POLICY_CATEGORY_COUNT)
+    {
+        clearInput();
+        printf("Invalid input. Please select a valid category: ");
     }
-    fclose(borrowFile);
+    clearInput(); // Clear the newline character from the input buffer
+    return choice - 1;
+}
 
-    if (count == 0)
+static int readCount(const char *prompt, int min)
+{
+    int value;
+    printf("%s", prompt);
+    while (scanf("%d", &value) != 1 || value < min)
     {
-        puts("No books are currently issued.");
+        clearInput();
+        printf("Invalid number. Please enter a value of at least %d: ", min);
     }
-    else
+    clearInput(); // Clear the newline character from the input buffer
+    return value;
+}
+
+void policiesMenu(void)
+{
+    consoleClear();
+    puts("===== BORROWING POLICIES =====");
+    puts("1. View policies");
+    puts("2. Edit a policy");
+    puts("3. Set a member's category");
+    puts("4. Show a member's standing");
+    puts("5. Back to Members Menu");
+    printf("Select > ");
+    int choice;
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > 5)
+    {
+        clearInput();
+        printf("Invalid input. Please select a valid option: ");
+    }
+    clearInput(); // Clear the newline character from the input buffer
+
+    if ((choice == 2 || choice == 3) && refuseOnReplica())
+    {
+        policiesMenu();
+        return;
+    }
+    int memberID;
+    switch (choice)
+    {
+    case 1:
+        for (int category = 0; category < POLICY_CATEGORY_COUNT; category++)
+        {
+            printPolicy(category);
+        }
+        break;
+    case 2:
+    {
+        int category = readCategory();
+        LoanPolicy policy = *policyGet(category);
+        policy.maxLoans = readCount("Maximum concurrent loans (0 for no cap): ", 0);
+        policy.loanDays = readCount("Loan period in days: ", 1);
+        policy.overdueBlock = readCount("Overdue loans that block borrowing (0 never blocks): ", 0);
+        if (policySet(category, &policy))
+        {
+            printf("✅ Policy '%s' updated.\n", policy.name);
+        }
+        else
+        {
+            puts("❌ Failed to save the policy.");
+        }
+        break;
+    }
+    case 3:
+    {
+        memberID = readCount("Enter Member ID: ", 1);
+        if (isValidMemberID(memberID))
+        {
+            printf("❌ Member ID %d not found.\n", memberID);
+            break;
+        }
+        int category = readCategory();
+        if (policySetMemberCategory(memberID, category))
+        {
+            printf("✅ Member ID %d is now in category '%s'.\n", memberID, policyGet(category)->name);
+        }
+        else
+        {
+            puts("❌ Failed to save the member's category.");
+        }
+        break;
+    }
+    case 4:
+    {
+        memberID = readCount("Enter Member ID: ", 1);
+        if (isValidMemberID(memberID))
+        {
+            printf("❌ Member ID %d not found.\n", memberID);
+            break;
+        }
+        MemberStanding standing;
+        PolicyDecision decision = policyCheckIssue(memberID, time(NULL), &standing);
+        printf("Category: %s\n", policyGet(standing.category)->name);
+        printf("Open loans: %d\n", standing.openLoans);
+        printf("Overdue loans: %d\n", standing.overdueLoans);
+        printf("May borrow: %s\n", decision == POLICY_ALLOW            ? "yes"
+                                   : decision == POLICY_LIMIT_REACHED ? "no, loan limit reached"
+                                                                      : "no, overdue loans");
+        break;
+    }
+    case 5:
+        membersMenu();
+        return;
+    }
+    puts("===========================");
+    consolePause();
+    policiesMenu();
+}
+
+#define MEMBER_HOLDS_SHOWN 64
+
+typedef struct
+{
+    ShardKind kind;
+    const IdIndex *wanted;
+    char (*names)[100];
+} NameLookup;
+
+static int recordID(ShardKind kind, const void *record)
+{
+    return kind == SHARD_BOOKS ? ((const Book *)record)->bookID : ((const Member *)record)->memberID;
+}
+
+static int isWantedRecord(const void *record, void *ctx)
+{
+    const NameLookup *lookup = ctx;
+    return idIndexFind(lookup->wanted, recordID(lookup->kind, record), NULL);
+}
+
+static int copyRecordName(const void *record, long position, void *ctx)
+{
+    (void)position;
+    NameLookup *lookup = ctx;
+    long row;
+    idIndexFind(lookup->wanted, recordID(lookup->kind, record), &row);
+    strcpy(lookup->names[row],
+           lookup->kind == SHARD_BOOKS ? ((const Book *)record)->title : ((const Member *)record)->name);
+    return 1;
+}
+
+// One pass over the books (members) copies the title (name) of every ID in
+// wanted to names[row]
+static void lookupNames(ShardKind kind, const IdIndex *wanted, char (*names)[100])
+{
+    NameLookup lookup = {kind, wanted, names};
+    shardsScan(kind, isWantedRecord, &lookup, copyRecordName, &lookup);
+}
+
+void viewMemberHolds(void)
+{
+    printf("Enter Member ID: ");
+    int memberID;
+    while (scanf("%d", &memberID) != 1 || memberID <= 0)
+    {
+        clearInput();
+        printf("Invalid Member ID. Please enter a valid positive integer: ");
+    }
+    clearInput(); // Clear the newline character from the input buffer
+
+    consoleClear();
+    printf("===== HOLDS FOR MEMBER %d =====\n", memberID);
+    MemberHold holds[MEMBER_HOLDS_SHOWN];
+    size_t total = holdsForMember(memberID, holds, MEMBER_HOLDS_SHOWN);
+    size_t count = total < MEMBER_HOLDS_SHOWN ? total : MEMBER_HOLDS_SHOWN;
+
+    // One pass over the books picks up the titles
+    char titles[MEMBER_HOLDS_SHOWN][100] = {{0}};
+    IdIndex wanted;
+    idIndexInit(&wanted);
+    for (size_t i = 0; i < count; i++)
+    {
+        idIndexPut(&wanted, holds[i].hold.bookID, (long)i);
+    }
+    if (count > 0)
+    {
+        lookupNames(SHARD_BOOKS, &wanted, titles);
+    }
+    idIndexFree(&wanted);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        char dateStr[DATETIME_TEXT_SIZE];
+        printf("Book: %s (ID %d)\n", titles[i][0] ? titles[i] : "(deleted)", holds[i].hold.bookID);
+        printf("Placed: %s\n", dateTimeFormat(holds[i].hold.placedDate, dateStr));
+        if (holds[i].hold.state == HOLD_READY)
+        {
+            printf("Status: Ready for pickup since %s\n", dateTimeFormat(holds[i].hold.readyDate, dateStr));
+        }
+        else
+        {
+            printf("Status: Waiting, position %ld of %ld\n", holds[i].position, holdsWaiting(holds[i].hold.bookID));
+        }
+        puts("-------------------------");
+    }
+    if (total == 0)
+    {
+        puts("This member has no holds.");
+    }
+    else
+    {
+        printf("Total holds: %zu\n", total);
+    }
+    puts("===========================");
+    consolePause();
+    issueReturnBookMenu();
+}
+
+void cancelHold(void)
+{
+    printf("Enter Member ID: ");
+    int memberID;
+    while (scanf("%d", &memberID) != 1 || memberID <= 0)
+    {
+        clearInput();
+        printf("Invalid Member ID. Please enter a valid positive integer: ");
+    }
+    clearInput(); // Clear the newline character from the input buffer
+    printf("Enter Book ID: ");
+    int bookID;
+    while (scanf("%d", &bookID) != 1 || bookID <= 0)
+    {
+        clearInput();
+        printf("Invalid Book ID. Please enter a valid positive integer: ");
+    }
+    clearInput(); // Clear the newline character from the input buffer
+
+    int heldFor;
+    switch (libraryCancelHold(memberID, bookID, &heldFor))
+    {
+    case LIBRARY_OK:
+        printf("✅ Hold on Book ID %d cancelled for Member ID %d.\n", bookID, memberID);
+        if (heldFor)
+        {
+            printf("Its copy passes to Member ID %d, who is next in the hold queue.\n", heldFor);
+        }
+        break;
+    case LIBRARY_NO_HOLD:
+        printf("❌ Member ID %d has no hold on Book ID %d.\n", memberID, bookID);
+        break;
+    default:
+        puts("❌ Failed to save the hold cancellation.");
+        break;
+    }
+    consolePause();
+    issueReturnBookMenu();
+}
+
+void viewCurrentIssuedBooks(void)
+{
+    consoleClear();
+    puts("===== ISSUED BOOKS =====");
+    FILE *borrowFile = fopen(BORROWED_BOOKS_FILE, "rb");
+    if (!borrowFile)
+    {
+        puts("No books have been issued.");
+        consolePause();
+        membersMenu();
+        return;
+    }
+    fclose(borrowFile);
+
+    // Build the book/member hash tables once, then stream the loans past them
+    LoanJoin join;
+    long count = -1;
+    uint64_t start = metricsNow();
+    if (loanJoinBuild(&join))
+    {
+        count = loanJoinOpenLoans(&join, printIssuedLoan, NULL);
+        loanJoinFree(&join);
+    }
+    metricsStop(TIMER_VIEW_ISSUED, start);
+
+    if (count < 0)
+    {
+        puts("❌ Failed to load books and members.");
+    }
+    else if (count == 0)
+    {
+        puts("No books are currently issued.");
+    }
+    else
     {
         puts("End of issued books list.");
         puts("===========================");
-        printf("Total issued books: %d\n", count);
+        printf("Total issued books: %ld\n", count);
         puts("===========================");
     }
-    system("pause");
+    consolePause();
     printMainMenu();
     handleMainMenu();
 }
+
+void archiveReturnedLoans(void)
+{
+    consoleClear();
+    puts("===== ARCHIVE RETURNED LOANS =====");
+    int archived = loanArchiveCompact(LOAN_CODEC_LZ);
+    if (archived < 0)
+    {
+        puts("❌ Failed to archive returned loans.");
+    }
+    else if (archived == 0)
+    {
+        puts("No returned loans to archive.");
+    }
+    else
+    {
+        printf("✅ Archived %d returned loans.\n", archived);
+    }
+    consolePause();
+    issueReturnBookMenu();
+}
+
+// Reads a YYYY-MM-DD date; returns 0 when the user leaves it blank
+static int readOptionalDate(const char *prompt, DayNumber *day)
+{
+    char dateStr[32];
+    for (;;)
+    {
+        printf("%s", prompt);
+        if (!fgets(dateStr, sizeof(dateStr), stdin))
+        {
+            return 0;
+        }
+        dateStr[strcspn(dateStr, "\n")] = '\0'; // Remove trailing newline
+        if (strspn(dateStr, " \t\r") == strlen(dateStr))
+        {
+            return 0;
+        }
+        if (isValidDate(dateStr, day))
+        {
+            return 1;
+        }
+        puts("Invalid date format. Please enter a valid date (YYYY-MM-DD).");
+    }
+}
+
+typedef struct
+{
+    const LoanJoin *join;
+    time_t now;
+} HistoryContext;
+
+static int printHistoryLoan(const BorrowedRecord *record, void *ctx)
+{
+    HistoryContext *history = ctx;
+    LoanView view;
+    loanJoinProbe(history->join, record, history->now, &view);
+    printLoanView(&view);
+    return 1;
+}
+
+void viewLoanHistory(void)
+{
+    consoleClear();
+    puts("===== LOAN HISTORY =====");
+    LoanQuery query = {0};
+    DayNumber day;
+    query.from = 0;
+    query.to = time(NULL);
+    if (readOptionalDate("Start date (YYYY-MM-DD, blank for earliest): ", &day))
+    {
+        query.from = dateLocalStart(day);
+    }
+    if (readOptionalDate("End date (YYYY-MM-DD, blank for today): ", &day))
+    {
+        query.to = dateLocalStart(day + 1) - 1; // Include the whole end day
+    }
+
+    printf("Book ID (0 for all books): ");
+    while (scanf("%d", &query.bookID) != 1 || query.bookID < 0)
+    {
+        clearInput();
+        printf("Invalid Book ID. Please enter a non-negative integer: ");
+    }
+    printf("Member ID (0 for all members): ");
+    while (scanf("%d", &query.memberID) != 1 || query.memberID < 0)
+    {
+        clearInput();
+        printf("Invalid Member ID. Please enter a non-negative integer: ");
+    }
+    puts("1. Loans borrowed in this period");
+    puts("2. Loans out at any time in this period");
+    printf("Select > ");
+    int choice;
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > 2)
+    {
+        clearInput();
+        printf("Invalid input. Please select a valid option: ");
+    }
+    clearInput(); // Clear the newline character from the input buffer
+    query.mode = choice == 1 ? LOAN_QUERY_BORROWED : LOAN_QUERY_ACTIVE;
+
+    puts("===========================");
+    LoanJoin join;
+    long count = -1;
+    uint64_t start = metricsNow();
+    if (loanJoinBuild(&join))
+    {
+        HistoryContext history = {&join, time(NULL)};
+        count = loanQueryRun(&query, printHistoryLoan, &history);
+        loanJoinFree(&join);
+    }
+    metricsStop(TIMER_LOAN_HISTORY, start);
+    if (count < 0)
+    {
+        puts("❌ Failed to read the loan history.");
+    }
+    else if (count == 0)
+    {
+        puts("No loans found.");
+    }
+    else
+    {
+        puts("End of loan history.");
+        puts("===========================");
+        printf("Total loans: %ld\n", count);
+        puts("===========================");
+    }
+    consolePause();
+    issueReturnBookMenu();
+}
+
+#define REPORT_TOP_N 10
+
+// Function to display the reports menu
+void reportsMenu(void)
+{
+    catchUpReplica();
+    consoleClear();
+    puts("===== REPORTS =====");
+    puts("1. Most borrowed books");
+    puts("2. Most active members");
+    puts("3. Circulation summary");
+    puts("4. Verify statistics");
+    puts("5. Export data (CSV/JSON Lines)");
+    puts("6. Backup snapshots");
+    puts("7. Back to Main Menu");
+    printf("Select > ");
+    int choice;
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > 7)
+    {
+        clearInput();
+        printf("Invalid input. Please select a valid option: ");
+    }
+    clearInput(); // Clear the newline character from the input buffer
+
+    CirculationCounter top[REPORT_TOP_N];
+    size_t count;
+    IdIndex wanted;
+    idIndexInit(&wanted);
+    uint64_t start = metricsNow();
+    switch (choice)
+    {
+    case 1:
+    {
+        consoleClear();
+        puts("===== MOST BORROWED BOOKS =====");
+        count = statsTopBooks(top, REPORT_TOP_N);
+        // One pass over the books picks up the titles of the top books
+        char titles[REPORT_TOP_N][100] = {{0}};
+        for (size_t i = 0; i < count; i++)
+        {
+            idIndexPut(&wanted, top[i].id, (long)i);
+        }
+        lookupNames(SHARD_BOOKS, &wanted, titles);
+        for (size_t i = 0; i < count; i++)
+        {
+            printf("%2zu. Book ID: %d | %s | %u loans (%u out now)\n", i + 1, top[i].id,
+                   titles[i][0] ? titles[i] : "(deleted)", top[i].loans, top[i].open);
+        }
+        break;
+    }
+    case 2:
+    {
+        consoleClear();
+        puts("===== MOST ACTIVE MEMBERS =====");
+        count = statsTopMembers(top, REPORT_TOP_N);
+        char names[REPORT_TOP_N][100] = {{0}};
+        for (size_t i = 0; i < count; i++)
+        {
+            idIndexPut(&wanted, top[i].id, (long)i);
+        }
+        lookupNames(SHARD_MEMBERS, &wanted, names);
+        for (size_t i = 0; i < count; i++)
+        {
+            printf("%2zu. Member ID: %d | %s | %u loans (%u out now)\n", i + 1, top[i].id,
+                   names[i][0] ? names[i] : "(deleted)", top[i].loans, top[i].open);
+        }
+        break;
+    }
+    case 3:
+    {
+        consoleClear();
+        puts("===== CIRCULATION SUMMARY =====");
+        CirculationTotals totals;
+        statsTotals(&totals);
+        printf("Total loans: %llu\n", (unsigned long long)totals.loans);
+        printf("Currently issued: %llu\n", (unsigned long long)totals.open);
+        printf("Returned: %llu\n", (unsigned long long)totals.returned);
+        if (totals.returned > 0)
+        {
+            printf("Average loan duration: %.1f days\n",
+                   (double)totals.durationSum / (double)totals.returned / DATE_SECONDS_PER_DAY);
+            printf("Overdue rate: %.1f%% (%llu returned late)\n",
+                   100.0 * (double)totals.overdue / (double)totals.returned, (unsigned long long)totals.overdue);
+        }
+        break;
+    }
+    case 4:
+    {
+        consoleClear();
+        puts("===== VERIFY STATISTICS =====");
+        long mismatches = statsVerify();
+        if (mismatches < 0)
+        {
+            puts("❌ Failed to read the loan history.");
+        }
+        else if (mismatches == 0)
+        {
+            puts("✅ Statistics match the loan history.");
+        }
+        else
+        {
+            printf("⚠️ %ld counters differ from the loan history. Rebuilding...\n", mismatches);
+            puts(statsRebuild() ? "✅ Statistics rebuilt." : "❌ Failed to rebuild statistics.");
+        }
+        break;
+    }
+    case 5:
+        exportData();
+        return;
+    case 6:
+        backupMenu();
+        return;
+    case 7:
+        printMainMenu();
+        handleMainMenu();
+        return;
+    }
+    idIndexFree(&wanted);
+    metricsStop(TIMER_REPORT, start);
+    puts("===========================");
+    consolePause();
+    reportsMenu();
+}
+
+static int readYesNo(const char *prompt)
+{
+    printf("%s (y/n): ", prompt);
+    int answer = getchar();
+    if (answer != '\n')
+    {
+        clearInput();
+    }
+    return answer == 'y' || answer == 'Y';
+}
+
+void exportData(void)
+{
+    consoleClear();
+    puts("===== EXPORT DATA =====");
+    puts("1. Books");
+    puts("2. Members");
+    puts("3. Loans");
+    printf("Select > ");
+    int choice;
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > 3)
+    {
+        clearInput();
+        printf("Invalid input. Please select a valid option: ");
+    }
+    ExportOptions options;
+    exportDefaults(&options, choice == 1 ? EXPORT_BOOKS : choice == 2 ? EXPORT_MEMBERS : EXPORT_LOANS);
+
+    printf("Format (1. CSV, 2. JSON Lines) > ");
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > 2)
+    {
+        clearInput();
+        printf("Invalid input. Please select 1 or 2: ");
+    }
+    clearInput(); // Clear the newline character from the input buffer
+    options.format = choice == 1 ? EXPORT_CSV : EXPORT_JSONL;
+
+    if (options.table == EXPORT_BOOKS)
+    {
+        options.outOfStockOnly = readYesNo("Only books that are out of stock?");
+    }
+    else if (options.table == EXPORT_LOANS)
+    {
+        DayNumber day;
+        options.from = 0;
+        options.to = time(NULL);
+        if (readOptionalDate("Borrowed from (YYYY-MM-DD, blank for earliest): ", &day))
+        {
+            options.from = dateLocalStart(day);
+            options.hasRange = 1;
+        }
+        if (readOptionalDate("Borrowed until (YYYY-MM-DD, blank for today): ", &day))
+        {
+            options.to = dateLocalStart(day + 1) - 1; // Include the whole end day
+            options.hasRange = 1;
+        }
+        options.openOnly = readYesNo("Only loans that are still open?");
+        options.joined = readYesNo("Include book titles and member names?");
+    }
+
+    char path[256];
+    printf("Output file (blank for data/export.%s): ", options.format == EXPORT_CSV ? "csv" : "jsonl");
+    if (!fgets(path, sizeof(path), stdin))
+    {
+        path[0] = '\0';
+    }
+    path[strcspn(path, "\r\n")] = '\0';
+    if (path[0] == '\0')
+    {
+        strcpy(path, options.format == EXPORT_CSV ? "data/export.csv" : "data/export.jsonl");
+    }
+
+    FILE *out = fopen(path, "wb");
+    if (!out)
+    {
+        perror("Failed to open export file");
+    }
+    else
+    {
+        long rows = exportRun(&options, out);
+        if (fclose(out) != 0)
+        {
+            rows = -1;
+        }
+        if (rows < 0)
+        {
+            puts("❌ Export failed.");
+        }
+        else
+        {
+            printf("✅ %ld rows written to %s.\n", rows, path);
+        }
+    }
+    puts("===========================");
+    consolePause();
+    reportsMenu();
+}
+
+static void printSnapshot(const BackupSnapshotInfo *info)
+{
+    char taken[DATETIME_TEXT_SIZE];
+    printf("%s | %s | %u files, %llu bytes | %llu new pages\n", info->id, dateTimeFormat(info->taken, taken),
+           info->files, (unsigned long long)info->bytes, (unsigned long long)info->pagesWritten);
+}
+
+// Snapshots can be taken while the program runs; restoring is left to
+// lms_backup because it replaces the files this program has loaded.
+void backupMenu(void)
+{
+    consoleClear();
+    puts("===== BACKUP SNAPSHOTS =====");
+    puts("1. Take a snapshot");
+    puts("2. List snapshots");
+    puts("3. Back to Reports");
+    printf("Select > ");
+    int choice;
+    while (scanf("%d", &choice) != 1 || choice < 1 || choice > 3)
+    {
+        clearInput();
+        printf("Invalid input. Please select a valid option: ");
+    }
+    clearInput(); // Clear the newline character from the input buffer
+
+    if (choice == 1)
+    {
+        BackupSnapshotInfo info;
+        if (backupSnapshot(NULL, &info))
+        {
+            printf("✅ Snapshot %s saved to %s/ (%llu bytes copied).\n", info.id, backupDirectory(NULL),
+                   (unsigned long long)info.bytesWritten);
+        }
+        else
+        {
+            puts("❌ Snapshot failed.");
+        }
+    }
+    else if (choice == 2)
+    {
+        BackupSnapshotInfo *snapshots;
+        size_t count;
+        if (!backupList(NULL, &snapshots, &count))
+        {
+            puts("❌ Failed to read the snapshots.");
+        }
+        else if (count == 0)
+        {
+            puts("No snapshots yet.");
+        }
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                printSnapshot(&snapshots[i]);
+            }
+            free(snapshots);
+            puts("Restore one with: lms_backup restore --at <id or YYYY-MM-DD>");
+        }
+    }
+    else
+    {
+        reportsMenu();
+        return;
+    }
+    puts("===========================");
+    consolePause();
+    backupMenu();
+}
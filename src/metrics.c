@@ -0,0 +1,292 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "../include/metrics.h"
+
+#ifndef LMS_NO_METRICS
+
+#define SUB_BUCKET_BITS 4
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define MAX_VALUE_BITS 42 // about 73 minutes in nanoseconds
+#define HISTOGRAM_BUCKETS ((MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+#define DEFAULT_METRICS_FILE "data/metrics.log"
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define THREAD_LOCAL _Thread_local
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+// One per thread, only ever written by its owner; blocks are never freed so
+// a dump can still read the totals of threads that have exited
+typedef struct MetricsBlock
+{
+    Histogram timers[TIMER_COUNT];
+    uint64_t counters[COUNTER_COUNT];
+    struct MetricsBlock *next;
+} MetricsBlock;
+
+static const char *const timerNames[TIMER_COUNT] = {
+    "login",          "is_valid_book_id", "is_valid_member_id", "add_record",   "edit_record",  "delete_book",
+    "delete_member",  "list_page",        "search_books",       "issue_book",   "return_book",  "view_issued",
+    "loan_history",   "archive_compact",  "stats_load",         "report",
+    "export"};
+static const char *const counterNames[COUNTER_COUNT] = {"file_opens",    "records_scanned", "bytes_read",
+                                                         "bytes_written", "fsyncs",          "cache_hits",
+                                                         "cache_misses"};
+
+static MetricsBlock *volatile allBlocks;
+static THREAD_LOCAL MetricsBlock *localBlock;
+static volatile sig_atomic_t dumpRequested;
+static uint64_t startedAt;
+
+static int highestBit(uint64_t value)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1)
+    {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static int bucketIndex(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+    {
+        return (int)value;
+    }
+    int bit = highestBit(value);
+    if (bit >= MAX_VALUE_BITS)
+    {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    int sub = (int)(value >> (bit - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (bit - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+// Midpoint of the values that land in a bucket
+static uint64_t bucketValue(int index)
+{
+    if (index < SUB_BUCKETS)
+    {
+        return (uint64_t)index;
+    }
+    int shift = index / SUB_BUCKETS - 1;
+    uint64_t low = (uint64_t)(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    return low + ((uint64_t)1 << shift) / 2;
+}
+
+// The list only grows at the head, so a compare-and-swap push is enough
+static void pushBlock(MetricsBlock *block)
+{
+#if defined(_MSC_VER)
+    do
+    {
+        block->next = allBlocks;
+    } while (InterlockedCompareExchangePointer((PVOID volatile *)&allBlocks, block, block->next) != block->next);
+#else
+    do
+    {
+        block->next = allBlocks;
+    } while (!__sync_bool_compare_and_swap(&allBlocks, block->next, block));
+#endif
+}
+
+static MetricsBlock *threadBlock(void)
+{
+    if (!localBlock)
+    {
+        localBlock = calloc(1, sizeof(MetricsBlock));
+        if (localBlock)
+        {
+            pushBlock(localBlock);
+        }
+    }
+    return localBlock;
+}
+
+uint64_t metricsNow(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static void dumpToConfiguredFile(void)
+{
+    const char *path = getenv("LMS_METRICS_FILE");
+    if (!path)
+    {
+        path = DEFAULT_METRICS_FILE;
+    }
+    if (strcmp(path, "off") == 0 || path[0] == '\0')
+    {
+        return;
+    }
+    if (strcmp(path, "-") == 0)
+    {
+        metricsDump(stderr);
+        return;
+    }
+    FILE *file = fopen(path, "a");
+    if (file)
+    {
+        metricsDump(file);
+        fclose(file);
+    }
+}
+
+void metricsRecord(MetricsTimer timer, uint64_t nanoseconds)
+{
+    MetricsBlock *block = threadBlock();
+    if (block)
+    {
+        Histogram *histogram = &block->timers[timer];
+        histogram->count++;
+        histogram->total += nanoseconds;
+        if (nanoseconds > histogram->max)
+        {
+            histogram->max = nanoseconds;
+        }
+        histogram->buckets[bucketIndex(nanoseconds)]++;
+    }
+    if (dumpRequested)
+    {
+        dumpRequested = 0;
+        dumpToConfiguredFile();
+    }
+}
+
+void metricsCount(MetricsCounter counter, uint64_t amount)
+{
+    MetricsBlock *block = threadBlock();
+    if (block)
+    {
+        block->counters[counter] += amount;
+    }
+}
+
+static uint64_t percentile(const Histogram *histogram, double fraction)
+{
+    uint64_t rank = (uint64_t)(fraction * (double)histogram->count + 0.5);
+    uint64_t seen = 0;
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= rank)
+        {
+            uint64_t value = bucketValue(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+// One "timer" or "counter" line per metric, as space-separated key=value
+// pairs, preceded by a "#" header line
+int metricsDump(FILE *out)
+{
+    static Histogram merged[TIMER_COUNT];
+    uint64_t counters[COUNTER_COUNT] = {0};
+    memset(merged, 0, sizeof(merged));
+
+    for (MetricsBlock *block = allBlocks; block; block = block->next)
+    {
+        for (int t = 0; t < TIMER_COUNT; t++)
+        {
+            const Histogram *source = &block->timers[t];
+            merged[t].count += source->count;
+            merged[t].total += source->total;
+            if (source->max > merged[t].max)
+            {
+                merged[t].max = source->max;
+            }
+            for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+            {
+                merged[t].buckets[i] += source->buckets[i];
+            }
+        }
+        for (int c = 0; c < COUNTER_COUNT; c++)
+        {
+            counters[c] += block->counters[c];
+        }
+    }
+
+    fprintf(out, "# metrics time=%lld uptime_ms=%.1f\n", (long long)time(NULL),
+            (double)(metricsNow() - startedAt) / 1e6);
+    for (int t = 0; t < TIMER_COUNT; t++)
+    {
+        const Histogram *histogram = &merged[t];
+        if (histogram->count == 0)
+        {
+            continue;
+        }
+        fprintf(out, "timer %s count=%llu total_us=%.1f mean_us=%.1f p50_us=%.1f p90_us=%.1f p99_us=%.1f max_us=%.1f\n",
+                timerNames[t], (unsigned long long)histogram->count, (double)histogram->total / 1e3,
+                (double)histogram->total / 1e3 / (double)histogram->count, (double)percentile(histogram, 0.50) / 1e3,
+                (double)percentile(histogram, 0.90) / 1e3, (double)percentile(histogram, 0.99) / 1e3,
+                (double)histogram->max / 1e3);
+    }
+    for (int c = 0; c < COUNTER_COUNT; c++)
+    {
+        fprintf(out, "counter %s value=%llu\n", counterNames[c], (unsigned long long)counters[c]);
+    }
+    return fflush(out) == 0;
+}
+
+#ifdef SIGUSR1
+static void requestDump(int signalNumber)
+{
+    (void)signalNumber;
+    dumpRequested = 1; // stdio is not async-signal-safe, so dump later
+}
+#endif
+
+void metricsInit(void)
+{
+    startedAt = metricsNow();
+    atexit(dumpToConfiguredFile);
+#ifdef SIGUSR1
+    signal(SIGUSR1, requestDump);
+#endif
+}
+
+#endif // LMS_NO_METRICS
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "../include/output_buffer.h"
+
+int outputBufferInit(OutputBuffer *buffer, size_t capacity)
+{
+    buffer->data = malloc(capacity ? capacity : 1);
+    buffer->length = 0;
+    buffer->capacity = buffer->data ? (capacity ? capacity : 1) : 0;
+    return buffer->data != NULL;
+}
+
+void outputBufferFree(OutputBuffer *buffer)
+{
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->length = buffer->capacity = 0;
+}
+
+void outputBufferReset(OutputBuffer *buffer)
+{
+    buffer->length = 0;
+}
+
+static int reserve(OutputBuffer *buffer, size_t extra)
+{
+    if (buffer->length + extra <= buffer->capacity)
+    {
+        return 1;
+    }
+    size_t newCapacity = buffer->capacity ? buffer->capacity : OUTPUT_BUFFER_DEFAULT_CAPACITY;
+    while (newCapacity < buffer->length + extra)
+    {
+        newCapacity *= 2;
+    }
+    char *grown = realloc(buffer->data, newCapacity);
+    if (!grown)
+    {
+        return 0;
+    }
+    buffer->data = grown;
+    buffer->capacity = newCapacity;
+    return 1;
+}
+
+int outputBufferAppend(OutputBuffer *buffer, const char *text, size_t length)
+{
+    if (!reserve(buffer, length))
+    {
+        return 0;
+    }
+    memcpy(buffer->data + buffer->length, text, length);
+    buffer->length += length;
+    return 1;
+}
+
+int outputBufferPuts(OutputBuffer *buffer, const char *line)
+{
+    return outputBufferAppend(buffer, line, strlen(line)) && outputBufferAppend(buffer, "\n", 1);
+}
+
+int outputBufferPrintf(OutputBuffer *buffer, const char *format, ...)
+{
+    va_list args;
+    size_t room = buffer->capacity - buffer->length;
+
+    // Format in place; only retry when the first attempt did not fit
+    va_start(args, format);
+    int needed = vsnprintf(buffer->data + buffer->length, room, format, args);
+    va_end(args);
+    if (needed < 0)
+    {
+        return 0;
+    }
+    if ((size_t)needed >= room)
+    {
+        if (!reserve(buffer, (size_t)needed + 1))
+        {
+            return 0;
+        }
+        va_start(args, format);
+        vsnprintf(buffer->data + buffer->length, (size_t)needed + 1, format, args);
+        va_end(args);
+    }
+    buffer->length += (size_t)needed;
+    return 1;
+}
+
+int outputBufferFlush(OutputBuffer *buffer, FILE *stream)
+{
+    int ok = fwrite(buffer->data, 1, buffer->length, stream) == buffer->length;
+    ok = fflush(stream) == 0 && ok;
+    buffer->length = 0;
+    return ok;
+}
@@ -0,0 +1,532 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include "../include/parallel_scan.h"
+#include "../include/metrics.h"
+#include "../include/arena.h"
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION ScanMutex;
+typedef CONDITION_VARIABLE ScanCondition;
+typedef HANDLE ScanThread;
+#define mutexInit(mutex) InitializeCriticalSection(mutex)
+#define mutexDestroy(mutex) DeleteCriticalSection(mutex)
+#define mutexLock(mutex) EnterCriticalSection(mutex)
+#define mutexUnlock(mutex) LeaveCriticalSection(mutex)
+#define conditionInit(condition) InitializeConditionVariable(condition)
+#define conditionDestroy(condition) ((void)(condition))
+#define conditionWait(condition, mutex) SleepConditionVariableCS((condition), (mutex), INFINITE)
+#define conditionBroadcast(condition) WakeAllConditionVariable(condition)
+#else
+typedef pthread_mutex_t ScanMutex;
+typedef pthread_cond_t ScanCondition;
+typedef pthread_t ScanThread;
+#define mutexInit(mutex) pthread_mutex_init((mutex), NULL)
+#define mutexDestroy(mutex) pthread_mutex_destroy(mutex)
+#define mutexLock(mutex) pthread_mutex_lock(mutex)
+#define mutexUnlock(mutex) pthread_mutex_unlock(mutex)
+#define conditionInit(condition) pthread_cond_init((condition), NULL)
+#define conditionDestroy(condition) pthread_cond_destroy(condition)
+#define conditionWait(condition, mutex) pthread_cond_wait((condition), (mutex))
+#define conditionBroadcast(condition) pthread_cond_broadcast(condition)
+#endif
+
+typedef enum
+{
+    CHUNK_PENDING,
+    CHUNK_DONE,
+    CHUNK_FAILED
+} ChunkState;
+
+typedef struct
+{
+    unsigned file;
+    long first; // record index within the file
+    long count;
+    ChunkState state;  // guarded by Scan.lock
+    char *matches;     // the matching records, packed, in the worker's arena
+    long *indexes;
+    long matchCount;
+} ScanChunk;
+
+// The run of chunks a worker still owns: it takes from the front, thieves
+// from the back
+typedef struct
+{
+    ScanMutex lock;
+    long next;
+    long end;
+} WorkQueue;
+
+typedef struct
+{
+    const ScanJob *job;
+    ScanChunk *chunks;
+    long chunkCount;
+    long chunkRecords;
+    WorkQueue *queues;
+    unsigned workers;
+    ScanMutex lock;
+    ScanCondition changed;
+    int stop;
+    int failed;
+} Scan;
+
+typedef struct
+{
+    Scan *scan;
+    unsigned id;
+    FILE **files;  // opened as its chunks need them
+    char *buffer;  // one chunk
+    long *indexes; // of the matches in buffer
+    Arena *arena;  // keeps the matches until the scan ends
+    long opens;    // counted here and noted by the calling thread, since a
+    long scanned;  // worker thread would get a metrics block of its own
+} Worker;
+
+// Match storage, one arena per worker slot, reused by every scan; a scan
+// started by a visitor while they are in use runs inline
+static Arena workerArenas[SCAN_MAX_THREADS];
+static int scanning = 0;
+
+unsigned parallelScanThreads(void)
+{
+    const char *setting = getenv("LMS_SCAN_THREADS");
+    long threads = setting ? atol(setting) : 0;
+    if (threads <= 0)
+    {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        threads = (long)info.dwNumberOfProcessors;
+#else
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    return threads > SCAN_MAX_THREADS ? SCAN_MAX_THREADS : (unsigned)threads;
+}
+
+static FILE *openScanFile(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file && errno != ENOENT)
+    {
+        perror(path);
+    }
+    else if (file)
+    {
+        setvbuf(file, NULL, _IONBF, 0); // Chunks are read whole: no stdio buffer to allocate and copy through
+    }
+    return file;
+}
+
+static int readChunk(const ScanJob *job, FILE *file, const ScanChunk *chunk, char *buffer)
+{
+    return fseek(file, chunk->first * (long)job->recordSize, SEEK_SET) == 0 &&
+           fread(buffer, job->recordSize, (size_t)chunk->count, file) == (size_t)chunk->count;
+}
+
+static void noteScan(const ScanJob *job, long opens, long records)
+{
+    metricsCount(COUNTER_FILE_OPENS, (uint64_t)opens);
+    metricsCount(COUNTER_RECORDS_SCANNED, (uint64_t)records);
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)records * job->recordSize);
+}
+
+// Moves the matching records of a chunk read into buffer to its front and
+// notes their indexes; returns how many there are
+static long filterChunk(const ScanJob *job, const ScanChunk *chunk, char *buffer, long *indexes)
+{
+    long kept = 0;
+    for (long i = 0; i < chunk->count; i++)
+    {
+        char *record = buffer + (size_t)i * job->recordSize;
+        if (!job->filter || job->filter(record, job->filterCtx))
+        {
+            if (kept != i)
+            {
+                memcpy(buffer + (size_t)kept * job->recordSize, record, job->recordSize);
+            }
+            indexes[kept++] = chunk->first + i;
+        }
+    }
+    return kept;
+}
+
+static int isStopped(Scan *scan)
+{
+    mutexLock(&scan->lock);
+    int stop = scan->stop;
+    mutexUnlock(&scan->lock);
+    return stop;
+}
+
+// Next chunk for a worker: the front of its own run, or else the back half
+// of the largest run another worker still has. -1 when none is left.
+static long takeChunk(Scan *scan, unsigned id)
+{
+    WorkQueue *own = &scan->queues[id];
+    long chunk = -1;
+    mutexLock(&own->lock);
+    if (own->next < own->end)
+    {
+        chunk = own->next++;
+    }
+    mutexUnlock(&own->lock);
+
+    while (chunk < 0)
+    {
+        unsigned victim = id;
+        long most = 0;
+        for (unsigned w = 0; w < scan->workers; w++)
+        {
+            WorkQueue *queue = &scan->queues[w];
+            mutexLock(&queue->lock);
+            long left = queue->end - queue->next;
+            mutexUnlock(&queue->lock);
+            if (w != id && left > most)
+            {
+                most = left;
+                victim = w;
+            }
+        }
+        if (most == 0)
+        {
+            return -1;
+        }
+        WorkQueue *queue = &scan->queues[victim];
+        long first = -1;
+        long end = 0;
+        mutexLock(&queue->lock);
+        long left = queue->end - queue->next;
+        if (left > 0)
+        {
+            end = queue->end;
+            queue->end -= (left + 1) / 2;
+            first = queue->end;
+        }
+        mutexUnlock(&queue->lock);
+        if (first >= 0) // else the victim finished it meanwhile: look again
+        {
+            mutexLock(&own->lock);
+            own->next = first + 1;
+            own->end = end;
+            mutexUnlock(&own->lock);
+            chunk = first;
+        }
+    }
+    return chunk;
+}
+
+static void runWorker(Worker *worker)
+{
+    Scan *scan = worker->scan;
+    const ScanJob *job = scan->job;
+    long number;
+    while (!isStopped(scan) && (number = takeChunk(scan, worker->id)) >= 0)
+    {
+        ScanChunk *chunk = &scan->chunks[number];
+        FILE **file = &worker->files[chunk->file];
+        if (!*file)
+        {
+            *file = openScanFile(job->files[chunk->file]);
+            worker->opens++;
+        }
+        int ok = *file && readChunk(job, *file, chunk, worker->buffer);
+        worker->scanned += ok ? chunk->count : 0;
+        if (ok && (chunk->matchCount = filterChunk(job, chunk, worker->buffer, worker->indexes)) > 0)
+        {
+            chunk->matches = arenaAlloc(worker->arena, (size_t)chunk->matchCount * job->recordSize);
+            chunk->indexes = arenaAlloc(worker->arena, (size_t)chunk->matchCount * sizeof(long));
+            ok = chunk->matches && chunk->indexes;
+            if (ok)
+            {
+                memcpy(chunk->matches, worker->buffer, (size_t)chunk->matchCount * job->recordSize);
+                memcpy(chunk->indexes, worker->indexes, (size_t)chunk->matchCount * sizeof(long));
+            }
+        }
+        mutexLock(&scan->lock);
+        chunk->state = ok ? CHUNK_DONE : CHUNK_FAILED;
+        if (!ok)
+        {
+            scan->failed = 1;
+            scan->stop = 1;
+        }
+        conditionBroadcast(&scan->changed);
+        mutexUnlock(&scan->lock);
+    }
+    for (unsigned i = 0; i < job->fileCount; i++)
+    {
+        if (worker->files[i])
+        {
+            fclose(worker->files[i]);
+        }
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI workerMain(LPVOID arg)
+{
+    runWorker(arg);
+    return 0;
+}
+
+static int startThread(ScanThread *thread, Worker *worker)
+{
+    *thread = CreateThread(NULL, 0, workerMain, worker, 0, NULL);
+    return *thread != NULL;
+}
+
+static void joinThread(ScanThread thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#else
+static void *workerMain(void *arg)
+{
+    runWorker(arg);
+    return NULL;
+}
+
+static int startThread(ScanThread *thread, Worker *worker)
+{
+    return pthread_create(thread, NULL, workerMain, worker) == 0;
+}
+
+static void joinThread(ScanThread thread)
+{
+    pthread_join(thread, NULL);
+}
+#endif
+
+// One worker, or a single chunk: read and visit on the calling thread
+static long scanInline(Scan *scan, FILE **files)
+{
+    const ScanJob *job = scan->job;
+    char *buffer = arenaAlloc(requestArena(), (size_t)scan->chunkRecords * job->recordSize);
+    long visited = 0;
+    int ok = buffer != NULL;
+    long scanned = 0;
+    for (long number = 0; ok && number < scan->chunkCount; number++)
+    {
+        const ScanChunk *chunk = &scan->chunks[number];
+        ok = readChunk(job, files[chunk->file], chunk, buffer);
+        scanned += ok ? chunk->count : 0;
+        for (long i = 0; ok && i < chunk->count; i++)
+        {
+            const char *record = buffer + (size_t)i * job->recordSize;
+            if (!job->filter || job->filter(record, job->filterCtx))
+            {
+                visited++;
+                if (!job->visit(record, chunk->file, chunk->first + i, job->visitCtx))
+                {
+                    number = scan->chunkCount; // Stop after this record
+                    break;
+                }
+            }
+        }
+    }
+    noteScan(job, 0, scanned);
+    return ok ? visited : -1;
+}
+
+// Hands each worker its buffers from the request arena, then visits the
+// chunks in order as the workers finish them
+static long scanParallel(Scan *scan)
+{
+    const ScanJob *job = scan->job;
+    Arena *arena = requestArena();
+    ScanThread threads[SCAN_MAX_THREADS];
+    Worker workers[SCAN_MAX_THREADS];
+    ArenaMark marks[SCAN_MAX_THREADS];
+    unsigned started = 0;
+
+    for (unsigned w = 0; w < scan->workers; w++)
+    {
+        workers[w].scan = scan;
+        workers[w].id = w;
+        workers[w].files = arenaAlloc(arena, job->fileCount * sizeof(FILE *));
+        workers[w].buffer = arenaAlloc(arena, (size_t)scan->chunkRecords * job->recordSize);
+        workers[w].indexes = arenaAlloc(arena, (size_t)scan->chunkRecords * sizeof(long));
+        workers[w].arena = &workerArenas[w];
+        workers[w].opens = 0;
+        workers[w].scanned = 0;
+        marks[w] = arenaMark(&workerArenas[w]);
+        if (!workers[w].files || !workers[w].buffer || !workers[w].indexes)
+        {
+            return -1;
+        }
+        memset(workers[w].files, 0, job->fileCount * sizeof(FILE *));
+    }
+
+    mutexInit(&scan->lock);
+    conditionInit(&scan->changed);
+    for (unsigned w = 0; w < scan->workers; w++)
+    {
+        mutexInit(&scan->queues[w].lock);
+        scan->queues[w].next = scan->chunkCount * w / scan->workers;
+        scan->queues[w].end = scan->chunkCount * (w + 1) / scan->workers;
+    }
+    scanning = 1;
+    for (unsigned w = 0; w < scan->workers; w++)
+    {
+        if (startThread(&threads[started], &workers[w]))
+        {
+            started++; // The runs of workers that did not start get stolen
+        }
+    }
+    if (started == 0)
+    {
+        runWorker(&workers[0]); // No threads: do every chunk here first
+    }
+
+    long visited = 0;
+    int ok = 1;
+    for (long number = 0; ok && number < scan->chunkCount; number++)
+    {
+        ScanChunk *chunk = &scan->chunks[number];
+        mutexLock(&scan->lock);
+        while (chunk->state == CHUNK_PENDING && !scan->failed)
+        {
+            conditionWait(&scan->changed, &scan->lock);
+        }
+        ok = chunk->state == CHUNK_DONE;
+        mutexUnlock(&scan->lock);
+
+        for (long i = 0; ok && i < chunk->matchCount; i++)
+        {
+            visited++;
+            if (!job->visit(chunk->matches + (size_t)i * job->recordSize, chunk->file, chunk->indexes[i],
+                            job->visitCtx))
+            {
+                number = scan->chunkCount; // Stop after this record
+                break;
+            }
+        }
+    }
+
+    mutexLock(&scan->lock);
+    scan->stop = 1;
+    mutexUnlock(&scan->lock);
+    for (unsigned t = 0; t < started; t++)
+    {
+        joinThread(threads[t]);
+    }
+    scanning = 0;
+    for (unsigned w = 0; w < scan->workers; w++)
+    {
+        noteScan(job, workers[w].opens, workers[w].scanned);
+        arenaRewind(&workerArenas[w], marks[w]);
+        mutexDestroy(&scan->queues[w].lock);
+    }
+    conditionDestroy(&scan->changed);
+    mutexDestroy(&scan->lock);
+    return ok ? visited : -1;
+}
+
+long parallelScan(const ScanJob *job)
+{
+    Arena *arena = requestArena();
+    ArenaMark mark = arenaMark(arena);
+    size_t fileSlots = job->fileCount ? job->fileCount : 1;
+    FILE **files = arenaAlloc(arena, fileSlots * sizeof(FILE *));
+    long *records = arenaAlloc(arena, fileSlots * sizeof(long));
+    Scan scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.job = job;
+    scan.chunkRecords = SCAN_CHUNK_BYTES / (long)job->recordSize;
+    if (scan.chunkRecords < 1)
+    {
+        scan.chunkRecords = 1;
+    }
+
+    // Size every file and cut it into chunks
+    int ok = files && records;
+    if (ok)
+    {
+        memset(files, 0, fileSlots * sizeof(FILE *));
+    }
+    for (unsigned i = 0; ok && i < job->fileCount; i++)
+    {
+        records[i] = 0;
+        files[i] = openScanFile(job->files[i]);
+        noteScan(job, 1, 0);
+        if (!files[i])
+        {
+            ok = errno == ENOENT;
+            continue;
+        }
+        ok = fseek(files[i], 0, SEEK_END) == 0;
+        long size = ok ? ftell(files[i]) : -1;
+        ok = size >= 0;
+        records[i] = ok ? size / (long)job->recordSize : 0;
+        scan.chunkCount += (records[i] + scan.chunkRecords - 1) / scan.chunkRecords;
+    }
+    if (ok && scan.chunkCount > 0)
+    {
+        scan.chunks = arenaAlloc(arena, (size_t)scan.chunkCount * sizeof(ScanChunk));
+        ok = scan.chunks != NULL;
+    }
+    long number = 0;
+    for (unsigned i = 0; ok && i < job->fileCount; i++)
+    {
+        for (long first = 0; first < records[i]; first += scan.chunkRecords)
+        {
+            ScanChunk *chunk = &scan.chunks[number++];
+            memset(chunk, 0, sizeof(*chunk));
+            chunk->file = i;
+            chunk->first = first;
+            chunk->count = records[i] - first < scan.chunkRecords ? records[i] - first : scan.chunkRecords;
+        }
+    }
+
+    long visited = ok ? 0 : -1;
+    if (ok && scan.chunkCount > 0)
+    {
+        unsigned threads = scanning ? 1 : parallelScanThreads();
+        scan.workers = (long)threads < scan.chunkCount ? threads : (unsigned)scan.chunkCount;
+        scan.queues = scan.workers > 1 ? arenaAlloc(arena, scan.workers * sizeof(WorkQueue)) : NULL;
+        if (scan.queues)
+        {
+            // Workers open their own handles
+            for (unsigned i = 0; i < job->fileCount; i++)
+            {
+                if (files[i])
+                {
+                    fclose(files[i]);
+                    files[i] = NULL;
+                }
+            }
+            visited = scanParallel(&scan);
+        }
+        else
+        {
+            visited = scanInline(&scan, files);
+        }
+    }
+
+    for (unsigned i = 0; files && i < job->fileCount; i++)
+    {
+        if (files[i])
+        {
+            fclose(files[i]);
+        }
+    }
+    arenaRewind(arena, mark);
+    return visited;
+}
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/library.h"
+#include "../include/dates.h"
+#include "../include/id_index.h"
+#include "../include/journal.h"
+#include "../include/policy.h"
+#include "../include/metrics.h"
+
+static const LoanPolicy defaultPolicies[POLICY_CATEGORY_COUNT] = {
+    {"Standard", 5, POLICY_STANDARD_LOAN_DAYS, 1},
+    {"Student", 3, 7, 1},
+    {"Staff", 10, 28, 3},
+    {"Restricted", 1, 7, 1},
+};
+
+typedef struct
+{
+    int memberID;
+    int category;
+} CategoryRecord;
+
+typedef struct
+{
+    int category;
+    long fileSlot; // position in member_categories.dat, -1 when never assigned
+    int openCount;
+    int openCapacity;
+    time_t *openLoans; // borrow dates of the open loans, oldest first
+} MemberState;
+
+static LoanPolicy policies[POLICY_CATEGORY_COUNT];
+static MemberState *members;
+static size_t memberCount;
+static size_t memberCapacity;
+static IdIndex memberIndex; // memberID -> position in members
+static long categoryRecords; // records in member_categories.dat
+static int loaded = 0;
+
+static void clearState(void)
+{
+    for (size_t i = 0; i < memberCount; i++)
+    {
+        free(members[i].openLoans);
+    }
+    free(members);
+    members = NULL;
+    memberCount = memberCapacity = 0;
+    categoryRecords = 0;
+    idIndexFree(&memberIndex);
+    idIndexInit(&memberIndex);
+}
+
+static MemberState *findMember(int memberID, int create)
+{
+    long position;
+    if (idIndexFind(&memberIndex, memberID, &position))
+    {
+        return &members[position];
+    }
+    if (!create)
+    {
+        return NULL;
+    }
+    if (memberCount == memberCapacity)
+    {
+        size_t newCapacity = memberCapacity ? memberCapacity * 2 : 256;
+        MemberState *grown = realloc(members, newCapacity * sizeof(MemberState));
+        if (!grown)
+        {
+            return NULL;
+        }
+        members = grown;
+        memberCapacity = newCapacity;
+    }
+    if (!idIndexPut(&memberIndex, memberID, (long)memberCount))
+    {
+        return NULL;
+    }
+    MemberState *state = &members[memberCount++];
+    memset(state, 0, sizeof(*state));
+    state->category = POLICY_STANDARD;
+    state->fileSlot = -1;
+    return state;
+}
+
+// Keeps openLoans sorted; new loans are the latest, so this is an append
+static int addOpenLoan(MemberState *state, time_t borrowDate)
+{
+    if (state->openCount == state->openCapacity)
+    {
+        int newCapacity = state->openCapacity ? state->openCapacity * 2 : 4;
+        time_t *grown = realloc(state->openLoans, (size_t)newCapacity * sizeof(time_t));
+        if (!grown)
+        {
+            return 0;
+        }
+        state->openLoans = grown;
+        state->openCapacity = newCapacity;
+    }
+    int i = state->openCount++;
+    while (i > 0 && state->openLoans[i - 1] > borrowDate)
+    {
+        state->openLoans[i] = state->openLoans[i - 1];
+        i--;
+    }
+    state->openLoans[i] = borrowDate;
+    return 1;
+}
+
+static int loadPolicies(void)
+{
+    memcpy(policies, defaultPolicies, sizeof(policies));
+    FILE *file = fopen(POLICIES_FILE, "rb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (file)
+    {
+        // A short file keeps the defaults for the categories it lacks
+        size_t read = fread(policies, sizeof(LoanPolicy), POLICY_CATEGORY_COUNT, file);
+        fclose(file);
+        metricsCount(COUNTER_BYTES_READ, read * sizeof(LoanPolicy));
+        for (size_t i = 0; i < read; i++)
+        {
+            policies[i].name[POLICY_NAME_SIZE - 1] = '\0';
+        }
+    }
+    return 1;
+}
+
+static int loadCategories(void)
+{
+    FILE *file = fopen(MEMBER_CATEGORIES_FILE, "rb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        return 1;
+    }
+    CategoryRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        MemberState *state = findMember(record.memberID, 1);
+        if (!state)
+        {
+            fclose(file);
+            return 0;
+        }
+        state->category = record.category;
+        state->fileSlot = categoryRecords++;
+    }
+    fclose(file);
+    metricsCount(COUNTER_RECORDS_SCANNED, (uint64_t)categoryRecords);
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)categoryRecords * sizeof(CategoryRecord));
+    return 1;
+}
+
+// Open loans only ever live in borrow.dat; the archive holds returned ones
+static int loadOpenLoans(void)
+{
+    FILE *file = fopen(BORROWED_BOOKS_FILE, "rb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        return 1;
+    }
+    BorrowedRecord record;
+    long scanned = 0;
+    int ok = 1;
+    while (ok && fread(&record, sizeof(record), 1, file) == 1)
+    {
+        scanned++;
+        if (record.returnDate == 0)
+        {
+            MemberState *state = findMember(record.memberID, 1);
+            ok = state && addOpenLoan(state, record.borrowDate);
+        }
+    }
+    fclose(file);
+    metricsCount(COUNTER_RECORDS_SCANNED, (uint64_t)scanned);
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)scanned * sizeof(BorrowedRecord));
+    return ok;
+}
+
+void policyInvalidate(void)
+{
+    loaded = 0;
+}
+
+int policyLoad(void)
+{
+    if (loaded)
+    {
+        return 1;
+    }
+    clearState();
+    if (!loadPolicies() || !loadCategories() || !loadOpenLoans())
+    {
+        clearState();
+        return 0;
+    }
+    loaded = 1;
+    return 1;
+}
+
+const LoanPolicy *policyGet(int category)
+{
+    if (category < 0 || category >= POLICY_CATEGORY_COUNT)
+    {
+        return NULL;
+    }
+    policyLoad(); // Falls back to the defaults if the load failed
+    return loaded ? &policies[category] : &defaultPolicies[category];
+}
+
+int policySet(int category, const LoanPolicy *policy)
+{
+    if (category < 0 || category >= POLICY_CATEGORY_COUNT || !policyLoad())
+    {
+        return 0;
+    }
+    // The table is tiny, so it is rewritten whole; the cached copy only
+    // takes the change once the write has gone through
+    LoanPolicy updated[POLICY_CATEGORY_COUNT];
+    memcpy(updated, policies, sizeof(updated));
+    updated[category] = *policy;
+    updated[category].name[POLICY_NAME_SIZE - 1] = '\0';
+
+    FILE *file = fopen(POLICIES_FILE, "rb+");
+    if (!file)
+    {
+        file = fopen(POLICIES_FILE, "wb");
+    }
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to open policies file");
+        journalAbort();
+        return 0;
+    }
+    int ok = journalWrite(file, POLICIES_FILE, 0, updated, sizeof(updated));
+    ok = fclose(file) == 0 && ok;
+    metricsCount(COUNTER_BYTES_WRITTEN, sizeof(updated));
+    if (ok)
+    {
+        memcpy(policies, updated, sizeof(policies));
+    }
+    return ok;
+}
+
+int policyMemberCategory(int memberID)
+{
+    MemberState *state = policyLoad() ? findMember(memberID, 0) : NULL;
+    return state ? state->category : POLICY_STANDARD;
+}
+
+int policySetMemberCategory(int memberID, int category)
+{
+    if (category < 0 || category >= POLICY_CATEGORY_COUNT || !policyLoad())
+    {
+        return 0;
+    }
+    MemberState *state = findMember(memberID, 1);
+    if (!state)
+    {
+        return 0;
+    }
+    CategoryRecord record = {memberID, category};
+    FILE *file = fopen(MEMBER_CATEGORIES_FILE, state->fileSlot >= 0 ? "rb+" : "ab");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to open member categories file");
+        journalAbort();
+        return 0;
+    }
+    long offset = state->fileSlot >= 0 ? state->fileSlot * (long)sizeof(CategoryRecord) : JOURNAL_APPEND;
+    int ok = journalWrite(file, MEMBER_CATEGORIES_FILE, offset, &record, sizeof(record));
+    ok = fclose(file) == 0 && ok;
+    metricsCount(COUNTER_BYTES_WRITTEN, sizeof(record));
+    if (ok)
+    {
+        state->category = category;
+        if (state->fileSlot < 0)
+        {
+            state->fileSlot = categoryRecords++;
+        }
+    }
+    return ok;
+}
+
+static time_t loanPeriod(int category)
+{
+    return (time_t)policyGet(category)->loanDays * DATE_SECONDS_PER_DAY;
+}
+
+time_t policyDueDate(int memberID, time_t borrowDate)
+{
+    return borrowDate + loanPeriod(policyMemberCategory(memberID));
+}
+
+PolicyDecision policyCheckIssue(int memberID, time_t now, MemberStanding *standing)
+{
+    MemberState *state = policyLoad() ? findMember(memberID, 0) : NULL;
+    int category = state ? state->category : POLICY_STANDARD;
+    int open = state ? state->openCount : 0;
+    const LoanPolicy *policy = policyGet(category);
+    time_t period = loanPeriod(category);
+
+    if (standing)
+    {
+        standing->category = category;
+        standing->openLoans = open;
+        standing->overdueLoans = 0;
+        while (standing->overdueLoans < open && state->openLoans[standing->overdueLoans] + period < now)
+        {
+            standing->overdueLoans++;
+        }
+    }
+
+    // Loans are sorted by borrow date, so the member has at least n overdue
+    // loans exactly when the n-th oldest is overdue
+    int block = policy->overdueBlock;
+    if (block > 0 && open >= block && state->openLoans[block - 1] + period < now)
+    {
+        return POLICY_OVERDUE_BLOCKED;
+    }
+    if (policy->maxLoans > 0 && open >= policy->maxLoans)
+    {
+        return POLICY_LIMIT_REACHED;
+    }
+    return POLICY_ALLOW;
+}
+
+void policyNoteIssue(int memberID, time_t borrowDate)
+{
+    MemberState *state = policyLoad() ? findMember(memberID, 1) : NULL;
+    if (state && !addOpenLoan(state, borrowDate))
+    {
+        loaded = 0; // Rebuild from borrow.dat next time
+    }
+}
+
+void policyNoteReturn(int memberID, time_t borrowDate)
+{
+    MemberState *state = policyLoad() ? findMember(memberID, 0) : NULL;
+    if (!state)
+    {
+        return;
+    }
+    for (int i = 0; i < state->openCount; i++)
+    {
+        if (state->openLoans[i] == borrowDate)
+        {
+            memmove(&state->openLoans[i], &state->openLoans[i + 1],
+                    (size_t)(state->openCount - i - 1) * sizeof(time_t));
+            state->openCount--;
+            return;
+        }
+    }
+}
@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/library.h"
+#include "../include/record_cache.h"
+#include "../include/id_index.h"
+#include "../include/metrics.h"
+
+#define RECORD_CACHE_FIRST_ENTRIES 256
+
+typedef struct
+{
+    int id;
+    int kind;
+    long newer; // towards the most recently used; -1 at the newest
+    long older;
+    long position;
+    union
+    {
+        Book book;
+        Member member;
+    } record;
+} CacheEntry;
+
+static CacheEntry *entries;
+static long allocated;
+static long used;
+static long capacity = -1; // read from the environment on first use
+static long newest = -1;
+static long oldest = -1;
+static IdIndex slots[SHARD_KIND_COUNT]; // ID -> entry, per kind
+
+static long budgetEntries(void)
+{
+    const char *setting = getenv("LMS_RECORD_CACHE");
+    long kilobytes = RECORD_CACHE_DEFAULT_KB;
+    if (setting)
+    {
+        kilobytes = strcmp(setting, "off") == 0 ? 0 : atol(setting);
+    }
+    // The ID index keeps its load under 70%, so it can take up to three
+    // slots for each entry
+    size_t perEntry = sizeof(CacheEntry) + 3 * (sizeof(int) + sizeof(long));
+    return kilobytes > 0 ? (long)((size_t)kilobytes * 1024 / perEntry) : 0;
+}
+
+static int enabled(void)
+{
+    if (capacity < 0)
+    {
+        capacity = budgetEntries();
+    }
+    return capacity > 0;
+}
+
+size_t recordCacheCapacity(void)
+{
+    return enabled() ? (size_t)capacity : 0;
+}
+
+static void detach(long slot)
+{
+    CacheEntry *entry = &entries[slot];
+    if (entry->newer >= 0)
+    {
+        entries[entry->newer].older = entry->older;
+    }
+    else
+    {
+        newest = entry->older;
+    }
+    if (entry->older >= 0)
+    {
+        entries[entry->older].newer = entry->newer;
+    }
+    else
+    {
+        oldest = entry->newer;
+    }
+}
+
+static void pushNewest(long slot)
+{
+    entries[slot].newer = -1;
+    entries[slot].older = newest;
+    if (newest >= 0)
+    {
+        entries[newest].newer = slot;
+    }
+    else
+    {
+        oldest = slot;
+    }
+    newest = slot;
+}
+
+// Frees an entry by moving the last one into its place
+static void release(long slot)
+{
+    detach(slot);
+    idIndexRemove(&slots[entries[slot].kind], entries[slot].id);
+    long last = --used;
+    if (slot == last)
+    {
+        return;
+    }
+    CacheEntry *entry = &entries[slot];
+    *entry = entries[last];
+    if (entry->newer >= 0)
+    {
+        entries[entry->newer].older = slot;
+    }
+    else
+    {
+        newest = slot;
+    }
+    if (entry->older >= 0)
+    {
+        entries[entry->older].newer = slot;
+    }
+    else
+    {
+        oldest = slot;
+    }
+    // The index just lost an ID, so this overwrite cannot grow it
+    idIndexPut(&slots[entry->kind], entry->id, slot);
+}
+
+// A free entry: a new one while the budget allows, else the least
+// recently used
+static long takeEntry(void)
+{
+    if (used == allocated && allocated < capacity)
+    {
+        long grown = allocated ? allocated * 2 : RECORD_CACHE_FIRST_ENTRIES;
+        grown = grown > capacity ? capacity : grown;
+        CacheEntry *larger = realloc(entries, (size_t)grown * sizeof(CacheEntry));
+        if (larger)
+        {
+            entries = larger;
+            allocated = grown;
+        }
+    }
+    if (used == allocated)
+    {
+        if (oldest < 0)
+        {
+            return -1;
+        }
+        release(oldest);
+    }
+    return used++;
+}
+
+int recordCacheGet(ShardKind kind, int id, void *record, long *position)
+{
+    if (!enabled())
+    {
+        return 0;
+    }
+    long slot;
+    if (!idIndexFind(&slots[kind], id, &slot))
+    {
+        metricsCount(COUNTER_CACHE_MISSES, 1);
+        return 0;
+    }
+    metricsCount(COUNTER_CACHE_HITS, 1);
+    memcpy(record, &entries[slot].record, shardsRecordSize(kind));
+    *position = entries[slot].position;
+    if (slot != newest)
+    {
+        detach(slot);
+        pushNewest(slot);
+    }
+    return 1;
+}
+
+void recordCachePut(ShardKind kind, long position, const void *record)
+{
+    int id;
+    memcpy(&id, record, sizeof(int)); // Both records start with their ID
+    if (!enabled() || id <= 0 || position < 0)
+    {
+        return;
+    }
+    long slot;
+    if (idIndexFind(&slots[kind], id, &slot))
+    {
+        detach(slot);
+    }
+    else
+    {
+        slot = takeEntry();
+        if (slot < 0)
+        {
+            return;
+        }
+        if (!idIndexPut(&slots[kind], id, slot))
+        {
+            used--; // Taken last, so nothing else points past it
+            return;
+        }
+        entries[slot].id = id;
+        entries[slot].kind = (int)kind;
+    }
+    entries[slot].position = position;
+    memcpy(&entries[slot].record, record, shardsRecordSize(kind));
+    pushNewest(slot);
+}
+
+void recordCacheRemove(ShardKind kind, int id)
+{
+    long slot;
+    if (used > 0 && idIndexFind(&slots[kind], id, &slot))
+    {
+        release(slot);
+    }
+}
+
+void recordCacheClear(void)
+{
+    for (int kind = 0; kind < SHARD_KIND_COUNT; kind++)
+    {
+        if (slots[kind].capacity > 0)
+        {
+            idIndexClear(&slots[kind]);
+        }
+    }
+    used = 0;
+    newest = -1;
+    oldest = -1;
+}
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/library.h"
+#include "../include/replica.h"
+#include "../include/changes.h"
+#include "../include/circulation_stats.h"
+#include "../include/loan_query.h"
+#include "../include/journal.h"
+#include "../include/metrics.h"
+#include "../include/shards.h"
+
+#define REPLICA_MAGIC "LMSREP1"
+#define REPLICA_READ_RECORDS 4096 // borrow.dat records per fread when looking for a loan
+#define REPLICA_IDLE_WAIT_MS 1000 // between checks that the folder is still a follower
+
+typedef struct
+{
+    char magic[8];
+    uint64_t applied;
+} ReplicaPosition;
+
+typedef union
+{
+    Book book;
+    Member member;
+} AnyRecord;
+
+static int readPosition(ReplicaPosition *position)
+{
+    FILE *file = fopen(REPLICA_FILE, "rb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        return 0;
+    }
+    int ok = fread(position, sizeof(*position), 1, file) == 1 &&
+             memcmp(position->magic, REPLICA_MAGIC, sizeof(position->magic)) == 0;
+    fclose(file);
+    return ok;
+}
+
+int replicaIsFollower(void)
+{
+    FILE *file = fopen(REPLICA_FILE, "rb");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (file)
+    {
+        fclose(file);
+    }
+    return file != NULL;
+}
+
+uint64_t replicaApplied(void)
+{
+    ReplicaPosition position;
+    return readPosition(&position) ? position.applied : 0;
+}
+
+// Joins the batch; the marker must still be there, or the folder was
+// promoted under a running follower and the batch is dropped
+static int savePosition(uint64_t applied)
+{
+    FILE *file = fopen(REPLICA_FILE, "rb+");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        journalAbort();
+        return 0;
+    }
+    ReplicaPosition position;
+    memcpy(position.magic, REPLICA_MAGIC, sizeof(position.magic));
+    position.applied = applied;
+    int ok = journalWrite(file, REPLICA_FILE, 0, &position, sizeof(position));
+    fclose(file);
+    return ok;
+}
+
+int replicaInit(void)
+{
+    if (replicaIsFollower())
+    {
+        return 1;
+    }
+    FILE *file = fopen(REPLICA_FILE, "ab");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to create " REPLICA_FILE);
+        return 0;
+    }
+    ReplicaPosition position;
+    memcpy(position.magic, REPLICA_MAGIC, sizeof(position.magic));
+    position.applied = changesCommitted();
+    int ok = journalWrite(file, REPLICA_FILE, JOURNAL_APPEND, &position, sizeof(position));
+    fclose(file);
+    return ok;
+}
+
+// Inserts and updates both write the record where its ID is, or append
+// it, so a change applied twice leaves one copy
+static int putRecord(ShardKind kind, int id, const void *record)
+{
+    ShardSet set;
+    AnyRecord old;
+    long position;
+    shardsOpen(&set, kind, 1);
+    int ok = shardsFind(&set, id, &old, &position) ? shardsWrite(&set, position, record)
+                                                   : shardsAppend(kind, record) >= 0;
+    return shardsClose(&set) && ok;
+}
+
+static int removeRecord(ShardKind kind, int id)
+{
+    ShardSet set;
+    AnyRecord old;
+    long position;
+    shardsOpen(&set, kind, 0);
+    int found = shardsFind(&set, id, &old, &position);
+    return shardsClose(&set) && (!found || shardsDelete(kind, id));
+}
+
+static int applyIssue(const BorrowedRecord *loan)
+{
+    FILE *file = fopen(BORROWED_BOOKS_FILE, "ab");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to open borrow file");
+        journalAbort();
+        return 0;
+    }
+    int ok = journalWrite(file, BORROWED_BOOKS_FILE, JOURNAL_APPEND, loan, sizeof(*loan));
+    fclose(file);
+    if (ok)
+    {
+        metricsCount(COUNTER_BYTES_WRITTEN, sizeof(*loan));
+        statsRecordIssue(loan->bookID, loan->memberID);
+        changesRecordLoan(CHANGE_LOAN_ISSUE, loan);
+    }
+    return ok;
+}
+
+// The open loan the return closes: same book, member and borrow time
+static long findOpenLoan(FILE *file, const BorrowedRecord *loan)
+{
+    BorrowedRecord *records = malloc(REPLICA_READ_RECORDS * sizeof(BorrowedRecord));
+    if (!records)
+    {
+        return -2;
+    }
+    long index = 0;
+    long found = -1;
+    size_t count;
+    while (found < 0 && (count = fread(records, sizeof(BorrowedRecord), REPLICA_READ_RECORDS, file)) > 0)
+    {
+        for (size_t i = 0; i < count; i++, index++)
+        {
+            if (records[i].bookID == loan->bookID && records[i].memberID == loan->memberID &&
+                records[i].borrowDate == loan->borrowDate && records[i].returnDate == 0)
+            {
+                found = index;
+                break;
+            }
+        }
+    }
+    found = ferror(file) ? -2 : found;
+    free(records);
+    metricsCount(COUNTER_RECORDS_SCANNED, (uint64_t)index);
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)index * sizeof(BorrowedRecord));
+    return found;
+}
+
+static int applyReturn(const BorrowedRecord *loan)
+{
+    FILE *file = fopen(BORROWED_BOOKS_FILE, "rb+");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to open borrow file");
+        journalAbort();
+        return 0;
+    }
+    long index = findOpenLoan(file, loan);
+    int ok = index != -2;
+    if (index >= 0)
+    {
+        ok = journalWrite(file, BORROWED_BOOKS_FILE, index * (long)sizeof(BorrowedRecord), loan, sizeof(*loan));
+    }
+    fclose(file);
+    if (ok && index >= 0)
+    {
+        metricsCount(COUNTER_BYTES_WRITTEN, sizeof(*loan));
+        loanZoneMapNoteReturn(index, loan->returnDate);
+        statsRecordReturn(loan->bookID, loan->memberID, loan->borrowDate, loan->returnDate, loan->isOverdue);
+        changesRecordLoan(CHANGE_LOAN_RETURN, loan);
+    }
+    return ok; // Not open here: returned already
+}
+
+static int applyChange(const ChangeRecord *change)
+{
+    switch (change->type)
+    {
+    case CHANGE_BOOK_INSERT:
+    case CHANGE_BOOK_UPDATE:
+        return putRecord(SHARD_BOOKS, change->id, &change->record.book);
+    case CHANGE_BOOK_DELETE:
+        return removeRecord(SHARD_BOOKS, change->id);
+    case CHANGE_MEMBER_INSERT:
+    case CHANGE_MEMBER_UPDATE:
+        return putRecord(SHARD_MEMBERS, change->id, &change->record.member);
+    case CHANGE_MEMBER_DELETE:
+        return removeRecord(SHARD_MEMBERS, change->id);
+    case CHANGE_LOAN_ISSUE:
+        return applyIssue(&change->record.loan);
+    case CHANGE_LOAN_RETURN:
+        return applyReturn(&change->record.loan);
+    default:
+        fprintf(stderr, "Change %llu has unknown type %d\n", (unsigned long long)change->sequence, change->type);
+        return 0;
+    }
+}
+
+long replicaApply(ChangeCursor *cursor)
+{
+    uint64_t start = cursor->next;
+    ChangeRecord change;
+    long applied = 0;
+    int read = 0;
+    int ok = 1;
+    journalBegin();
+    int alone = 0;
+    while (ok && !alone && applied < REPLICA_BATCH && (read = changesNext(cursor, &change)) == 1)
+    {
+        // A delete swaps its shard in when the operation commits, so a
+        // change after it in the batch would be written to the old file
+        alone = change.type == CHANGE_BOOK_DELETE || change.type == CHANGE_MEMBER_DELETE;
+        if (alone && applied > 0)
+        {
+            cursor->next--; // Starts the next batch
+            break;
+        }
+        // A gap means the primary's log is not the one this folder follows
+        ok = change.sequence == start + (uint64_t)applied;
+        if (!ok)
+        {
+            fprintf(stderr, "Expected change %llu of the primary, found %llu\n",
+                    (unsigned long long)(start + (uint64_t)applied), (unsigned long long)change.sequence);
+        }
+        ok = ok && applyChange(&change);
+        applied++;
+    }
+    ok = ok && read >= 0 && (applied == 0 || savePosition(start + (uint64_t)applied - 1));
+    if (!ok)
+    {
+        journalAbort();
+    }
+    if (!journalCommit())
+    {
+        libraryReload(); // The statistics cache counted the batch
+        cursor->next = start;
+        return -1;
+    }
+    return applied;
+}
+
+int replicaFollow(const char *primaryLog)
+{
+    if (!replicaInit())
+    {
+        return 0;
+    }
+    ChangeCursor cursor;
+    changesOpenFile(&cursor, primaryLog, replicaApplied());
+    int result = 0;
+    for (;;)
+    {
+        long applied = replicaApply(&cursor);
+        if (!replicaIsFollower())
+        {
+            result = 1;
+            break;
+        }
+        if (applied < 0 || (applied == 0 && changesWait(&cursor, REPLICA_IDLE_WAIT_MS) < 0))
+        {
+            break;
+        }
+    }
+    changesClose(&cursor);
+    return result;
+}
+
+int replicaPromote(void)
+{
+    // Settles the batch a stopped follower left in flight
+    if (journalRecover() == JOURNAL_FAILED)
+    {
+        return 0;
+    }
+    if (remove(REPLICA_FILE) != 0 && errno != ENOENT)
+    {
+        perror("Failed to remove " REPLICA_FILE);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,559 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/library.h"
+#include "../include/shards.h"
+#include "../include/journal.h"
+#include "../include/metrics.h"
+#include "../include/parallel_scan.h"
+#include "../include/changes.h"
+#include "../include/record_cache.h"
+#include "../include/id_filter.h"
+
+#define SHARDS_PATH_SIZE 64
+#define SHARDS_TEMP_FILE "data/temp_shards.idx"
+
+static const char *const kindNames[SHARD_KIND_COUNT] = {"books", "members"};
+static const char *const openErrors[SHARD_KIND_COUNT] = {"Failed to open books file", "Failed to open members file"};
+
+static unsigned counts[SHARD_KIND_COUNT];
+static int manifestLoaded = 0;
+
+// Book and Member both start with their int ID, so either view reads it
+typedef union
+{
+    Book book;
+    Member member;
+} AnyRecord;
+
+static void loadManifest(void)
+{
+    for (int kind = 0; kind < SHARD_KIND_COUNT; kind++)
+    {
+        counts[kind] = 1;
+    }
+    manifestLoaded = 1;
+    FILE *file = fopen(SHARDS_FILE, "r");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        return; // Never resharded: one file per kind
+    }
+    int version;
+    char name[16];
+    unsigned count;
+    if (fscanf(file, "LMS-SHARDS %d", &version) != 1 || version != 1)
+    {
+        fprintf(stderr, "%s: unknown format, reading unsharded files\n", SHARDS_FILE);
+    }
+    else
+    {
+        while (fscanf(file, "%15s %u", name, &count) == 2)
+        {
+            for (int kind = 0; kind < SHARD_KIND_COUNT; kind++)
+            {
+                if (strcmp(name, kindNames[kind]) == 0 && count >= 1 && count <= SHARDS_MAX)
+                {
+                    counts[kind] = count;
+                }
+            }
+        }
+    }
+    fclose(file);
+}
+
+static int writeManifest(const unsigned *newCounts)
+{
+    FILE *file = fopen(SHARDS_TEMP_FILE, "w");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror("Failed to write the shard manifest");
+        return 0;
+    }
+    int ok = fprintf(file, "LMS-SHARDS 1\n") > 0;
+    for (int kind = 0; kind < SHARD_KIND_COUNT; kind++)
+    {
+        ok = fprintf(file, "%s %u\n", kindNames[kind], newCounts[kind]) > 0 && ok;
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        remove(SHARDS_TEMP_FILE);
+    }
+    return ok;
+}
+
+size_t shardsRecordSize(ShardKind kind)
+{
+    return kind == SHARD_BOOKS ? sizeof(Book) : sizeof(Member);
+}
+
+unsigned shardsCount(ShardKind kind)
+{
+    if (!manifestLoaded)
+    {
+        loadManifest();
+    }
+    return counts[kind];
+}
+
+void shardsPath(ShardKind kind, unsigned shard, unsigned count, char *path, size_t size)
+{
+    if (count == 1)
+    {
+        snprintf(path, size, "%s", kind == SHARD_BOOKS ? BOOKS_FILE : MEMBERS_FILE);
+    }
+    else
+    {
+        snprintf(path, size, "data/%s_%03u.dat", kindNames[kind], shard);
+    }
+}
+
+// Rewrites are built here and renamed over the shard; the backup skips
+// temp_ files
+static void tempPath(ShardKind kind, unsigned shard, unsigned count, char *path, size_t size)
+{
+    if (count == 1)
+    {
+        snprintf(path, size, "data/temp_%s.dat", kindNames[kind]);
+    }
+    else
+    {
+        snprintf(path, size, "data/temp_%s_%03u.dat", kindNames[kind], shard);
+    }
+}
+
+static unsigned shardOf(int id, unsigned count)
+{
+    return (unsigned)id % count;
+}
+
+void shardsOpen(ShardSet *set, ShardKind kind, int writable)
+{
+    memset(set, 0, sizeof(*set));
+    set->kind = kind;
+    set->count = shardsCount(kind);
+    set->writable = writable;
+}
+
+int shardsClose(ShardSet *set)
+{
+    for (unsigned i = 0; i < set->count; i++)
+    {
+        if (set->files[i])
+        {
+            fclose(set->files[i]);
+            set->files[i] = NULL;
+        }
+    }
+    return !set->failed;
+}
+
+// A shard that does not exist yet holds no records; any other failure to
+// open one is an error
+static FILE *openShard(ShardSet *set, unsigned shard)
+{
+    if (!set->opened[shard])
+    {
+        char path[SHARDS_PATH_SIZE];
+        shardsPath(set->kind, shard, set->count, path, sizeof(path));
+        set->opened[shard] = 1;
+        set->files[shard] = fopen(path, set->writable ? "rb+" : "rb");
+        metricsCount(COUNTER_FILE_OPENS, 1);
+        if (!set->files[shard] && errno != ENOENT)
+        {
+            perror(openErrors[set->kind]);
+            set->failed = 1;
+        }
+    }
+    return set->files[shard];
+}
+
+int shardsNext(ShardSet *set, void *record, long *position)
+{
+    size_t size = shardsRecordSize(set->kind);
+    while (set->scanShard < set->count)
+    {
+        FILE *file = openShard(set, set->scanShard);
+        if (file)
+        {
+            if (set->moved)
+            {
+                fseek(file, set->scanSlot * (long)size, SEEK_SET);
+                set->moved = 0;
+            }
+            if (fread(record, size, 1, file) == 1)
+            {
+                *position = set->scanSlot * (long)set->count + (long)set->scanShard;
+                set->scanSlot++;
+                return 1;
+            }
+            if (ferror(file))
+            {
+                set->failed = 1;
+                return 0;
+            }
+        }
+        else if (set->failed)
+        {
+            return 0;
+        }
+        set->scanShard++;
+        set->scanSlot = 0;
+        set->moved = 1; // Random reads may have left the next file anywhere
+    }
+    return 0;
+}
+
+// Logs a record written to or removed from a set; change is the offset of
+// the change type from CHANGE_BOOK_INSERT (insert, update, delete)
+static int logChange(ShardKind kind, int change, const void *record)
+{
+    if (kind == SHARD_BOOKS)
+    {
+        return changesRecordBook((ChangeType)(CHANGE_BOOK_INSERT + change), record);
+    }
+    return changesRecordMember((ChangeType)(CHANGE_MEMBER_INSERT + change), record);
+}
+
+void shardsRewind(ShardSet *set)
+{
+    set->scanShard = 0;
+    set->scanSlot = 0;
+    set->moved = 1;
+}
+
+int shardsRead(ShardSet *set, long position, void *record)
+{
+    if (position < 0)
+    {
+        return 0;
+    }
+    size_t size = shardsRecordSize(set->kind);
+    FILE *file = openShard(set, (unsigned)(position % (long)set->count));
+    if (!file)
+    {
+        return 0;
+    }
+    set->moved = 1;
+    if (fseek(file, position / (long)set->count * (long)size, SEEK_SET) != 0 || fread(record, size, 1, file) != 1)
+    {
+        set->failed |= ferror(file) != 0;
+        return 0;
+    }
+    return 1;
+}
+
+int shardsWrite(ShardSet *set, long position, const void *record)
+{
+    unsigned shard = (unsigned)(position % (long)set->count);
+    FILE *file = set->writable && position >= 0 ? openShard(set, shard) : NULL;
+    if (!file)
+    {
+        journalAbort();
+        return 0;
+    }
+    char path[SHARDS_PATH_SIZE];
+    shardsPath(set->kind, shard, set->count, path, sizeof(path));
+    size_t size = shardsRecordSize(set->kind);
+    set->moved = 1;
+    journalBegin();
+    int ok = journalWrite(file, path, position / (long)set->count * (long)size, record, size) &&
+             logChange(set->kind, 1, record);
+    ok = journalCommit() && ok;
+    if (ok)
+    {
+        recordCachePut(set->kind, position, record);
+    }
+    return ok;
+}
+
+int shardsFind(ShardSet *set, int id, void *record, long *position)
+{
+    if (recordCacheGet(set->kind, id, record, position))
+    {
+        return 1;
+    }
+    unsigned shard = shardOf(id, set->count);
+    FILE *file = openShard(set, shard);
+    if (!file)
+    {
+        return 0;
+    }
+    size_t size = shardsRecordSize(set->kind);
+    set->moved = 1;
+    rewind(file);
+    long slot = 0;
+    int found = 0;
+    int foundID;
+    while (fread(record, size, 1, file) == 1)
+    {
+        memcpy(&foundID, record, sizeof(int));
+        if (foundID == id)
+        {
+            found = 1;
+            *position = slot * (long)set->count + (long)shard;
+            break;
+        }
+        slot++;
+    }
+    set->failed |= ferror(file) != 0;
+    metricsCount(COUNTER_RECORDS_SCANNED, (uint64_t)(slot + found));
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)(slot + found) * size);
+    if (found)
+    {
+        recordCachePut(set->kind, *position, record);
+    }
+    return found;
+}
+
+long shardsAppend(ShardKind kind, const void *record)
+{
+    unsigned count = shardsCount(kind);
+    int id;
+    memcpy(&id, record, sizeof(int));
+    unsigned shard = shardOf(id, count);
+    char path[SHARDS_PATH_SIZE];
+    shardsPath(kind, shard, count, path, sizeof(path));
+    FILE *file = fopen(path, "ab");
+    metricsCount(COUNTER_FILE_OPENS, 1);
+    if (!file)
+    {
+        perror(openErrors[kind]);
+        journalAbort();
+        return -1;
+    }
+    // Appending, so the new record lands at the current end of the file
+    size_t size = shardsRecordSize(kind);
+    fseek(file, 0, SEEK_END);
+    long slot = ftell(file) / (long)size;
+    journalBegin();
+    int written = idFilterAdd(kind, id) && journalWrite(file, path, JOURNAL_APPEND, record, size);
+    fclose(file);
+    written = written && logChange(kind, 0, record);
+    written = journalCommit() && written;
+    if (!written)
+    {
+        return -1;
+    }
+    metricsCount(COUNTER_BYTES_WRITTEN, size);
+    long position = slot * (long)count + (long)shard;
+    recordCachePut(kind, position, record);
+    return position;
+}
+
+long shardsRecordCount(ShardKind kind)
+{
+    unsigned count = shardsCount(kind);
+    long records = 0;
+    char path[SHARDS_PATH_SIZE];
+    for (unsigned i = 0; i < count; i++)
+    {
+        shardsPath(kind, i, count, path, sizeof(path));
+        FILE *file = fopen(path, "rb");
+        if (file)
+        {
+            setvbuf(file, NULL, _IONBF, 0); // Only its length is needed: no buffer to allocate
+            fseek(file, 0, SEEK_END);
+            records += ftell(file) / (long)shardsRecordSize(kind);
+            fclose(file);
+        }
+    }
+    return records;
+}
+
+typedef struct
+{
+    unsigned count;
+    ShardVisitor visit;
+    void *ctx;
+} ShardScan;
+
+static int visitShardRecord(const void *record, unsigned file, long index, void *ctx)
+{
+    ShardScan *scan = ctx;
+    return scan->visit(record, index * (long)scan->count + (long)file, scan->ctx);
+}
+
+long shardsScan(ShardKind kind, ScanFilter filter, void *filterCtx, ShardVisitor visit, void *ctx)
+{
+    unsigned count = shardsCount(kind);
+    char paths[SHARDS_MAX][SHARDS_PATH_SIZE];
+    const char *files[SHARDS_MAX];
+    for (unsigned i = 0; i < count; i++)
+    {
+        shardsPath(kind, i, count, paths[i], sizeof(paths[i]));
+        files[i] = paths[i];
+    }
+    ShardScan scan = {count, visit, ctx};
+    ScanJob job = {files, count, shardsRecordSize(kind), filter, filterCtx, visitShardRecord, &scan};
+    return parallelScan(&job);
+}
+
+// Copies every record of the shard except the one with the given ID to a
+// temp file, then swaps it in
+int shardsDelete(ShardKind kind, int id)
+{
+    unsigned count = shardsCount(kind);
+    unsigned shard = shardOf(id, count);
+    char path[SHARDS_PATH_SIZE];
+    char temp[SHARDS_PATH_SIZE];
+    shardsPath(kind, shard, count, path, sizeof(path));
+    tempPath(kind, shard, count, temp, sizeof(temp));
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        perror("Failed to open data file");
+        return 0;
+    }
+    FILE *tempFile = fopen(temp, "wb");
+    metricsCount(COUNTER_FILE_OPENS, 2);
+    if (!tempFile)
+    {
+        perror("Failed to open temporary file");
+        fclose(file);
+        return 0;
+    }
+    size_t size = shardsRecordSize(kind);
+    AnyRecord record;
+    AnyRecord removed;
+    long scanned = 0;
+    long kept = 0;
+    int ok = 1;
+    while (ok && fread(&record, size, 1, file) == 1)
+    {
+        scanned++;
+        if (record.book.bookID != id)
+        {
+            ok = fwrite(&record, size, 1, tempFile) == 1;
+            kept++;
+        }
+        else
+        {
+            removed = record;
+        }
+    }
+    ok = !ferror(file) && ok;
+    fclose(file);
+    ok = fclose(tempFile) == 0 && ok;
+    metricsCount(COUNTER_RECORDS_SCANNED, (uint64_t)scanned);
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)scanned * size);
+    metricsCount(COUNTER_BYTES_WRITTEN, (uint64_t)kept * size);
+    if (!ok)
+    {
+        remove(temp);
+        return 0;
+    }
+    // Swapped in when the delete commits, together with the holds and
+    // copies it closes
+    journalBegin();
+    recordCacheRemove(kind, id);
+    ok = journalReplaceOnCommit(temp, path) && (kept == scanned || (logChange(kind, 2, &removed) && idFilterNoteDelete(kind)));
+    return journalCommit() && ok;
+}
+
+int shardsReshard(ShardKind kind, unsigned count)
+{
+    if (count < 1 || count > SHARDS_MAX)
+    {
+        return 0;
+    }
+    unsigned oldCount = shardsCount(kind);
+    if (count == oldCount)
+    {
+        return 1;
+    }
+
+    // Deal the records out to the new shards in their current scan order
+    FILE *temps[SHARDS_MAX] = {NULL};
+    char path[SHARDS_PATH_SIZE];
+    char temp[SHARDS_PATH_SIZE];
+    size_t size = shardsRecordSize(kind);
+    int ok = 1;
+    for (unsigned i = 0; ok && i < count; i++)
+    {
+        tempPath(kind, i, count, temp, sizeof(temp));
+        temps[i] = fopen(temp, "wb");
+        metricsCount(COUNTER_FILE_OPENS, 1);
+        if (!temps[i])
+        {
+            perror("Failed to open temporary file");
+            ok = 0;
+        }
+    }
+    ShardSet set;
+    shardsOpen(&set, kind, 0);
+    AnyRecord record;
+    long position;
+    long moved = 0;
+    while (ok && shardsNext(&set, &record, &position))
+    {
+        ok = fwrite(&record, size, 1, temps[shardOf(record.book.bookID, count)]) == 1;
+        moved++;
+    }
+    ok = shardsClose(&set) && ok;
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (temps[i])
+        {
+            ok = fclose(temps[i]) == 0 && ok;
+        }
+    }
+    metricsCount(COUNTER_RECORDS_SCANNED, (uint64_t)moved);
+    metricsCount(COUNTER_BYTES_READ, (uint64_t)moved * size);
+    metricsCount(COUNTER_BYTES_WRITTEN, (uint64_t)moved * size);
+
+    // Every shard and the manifest change together
+    unsigned newCounts[SHARD_KIND_COUNT];
+    for (int other = 0; other < SHARD_KIND_COUNT; other++)
+    {
+        newCounts[other] = shardsCount((ShardKind)other);
+    }
+    newCounts[kind] = count;
+    journalBegin();
+    for (unsigned i = 0; ok && i < count; i++)
+    {
+        tempPath(kind, i, count, temp, sizeof(temp));
+        shardsPath(kind, i, count, path, sizeof(path));
+        ok = journalReplaceOnCommit(temp, path);
+    }
+    ok = ok && writeManifest(newCounts) && journalReplaceOnCommit(SHARDS_TEMP_FILE, SHARDS_FILE);
+    if (!ok)
+    {
+        journalAbort();
+    }
+    ok = journalCommit() && ok;
+    shardsInvalidate();
+    if (!ok)
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            tempPath(kind, i, count, temp, sizeof(temp));
+            remove(temp);
+        }
+        return 0;
+    }
+
+    // The old files no longer named by the manifest. One left behind by a
+    // crash here is never read, and a later reshard overwrites it.
+    for (unsigned i = 0; i < oldCount; i++)
+    {
+        if (oldCount == 1 || count == 1 || i >= count)
+        {
+            shardsPath(kind, i, oldCount, path, sizeof(path));
+            remove(path);
+        }
+    }
+    // Compacted, so the filter can forget the deleted IDs; it stays valid
+    // if this fails
+    idFilterRebuild(kind);
+    return 1;
+}
+
+void shardsInvalidate(void)
+{
+    manifestLoaded = 0;
+    recordCacheClear();
+    idFilterInvalidate();
+}
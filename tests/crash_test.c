@@ -0,0 +1,1029 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../include/library.h"
+#include "../include/holds.h"
+#include "../include/items.h"
+#include "../include/policy.h"
+#include "../include/loan_archive.h"
+#include "../include/circulation_stats.h"
+#include "../include/journal.h"
+#include "../include/shards.h"
+#include "../include/changes.h"
+#include "../include/id_filter.h"
+
+// Fault-injection test for the journal (journal.h).
+//
+// The binary is linked with --wrap for the calls that change files (fopen
+// for writing, fwrite, fflush, fclose of a written file, rename, remove,
+// fsync, ftruncate). Every such call is a numbered fault point. For each
+// seed a random workload of issues, returns, holds, category changes,
+// deletions, archive compactions and reshards is run once cleanly (even
+// seeds start with books and members already sharded), recording after
+// every operation the point count and a digest of the logical contents of
+// data/. Then, for every point K of that run, the workload is replayed in a
+// child process that either
+//
+//   crashes at K: the call does not happen (a write is torn in half first)
+//   and the process exits on the spot, keeping whatever reached the file
+//   system; a fresh process then recovers, itself crashing at a random
+//   point of the recovery in a quarter of the runs, and checks the data; or
+//
+//   fails at K: the call reports an error (a short write, EIO) and the
+//   process carries on, checks the data after the failed operation, then
+//   runs more operations on its caches and checks again.
+//
+// The checks: the data matches the digest from before or after the
+// operation in flight; every book's initial stock equals its quantity plus
+// its open loans plus the copies set aside for holds, and copies agree with
+// both; no book, member, copy or open hold appears twice; the circulation
+// statistics match the loan history; the journal is empty; the change log
+// is numbered 1, 2, 3, ... and its header counts every change in it; the
+// ID filters pass every book and member.
+//
+//   crash_test [--seeds N] [--first-seed N] [--ops N] [--point K] [--dir DIR] [--verbose]
+//
+// A failure prints the seed, mode and point; rerun it alone with
+// --first-seed S --seeds 1 --point K, adding --verbose for the program's
+// own messages and CRASH_TRACE=1 to list the points as they are passed.
+// Crashes here are process crashes: the page cache survives, so fsync is
+// counted as a point but not performed.
+
+#define BOOK_COUNT 10
+#define MEMBER_COUNT 6
+#define MAX_OPS 200
+#define EXTRA_OPS 10
+#define CRASH_EXIT 86
+#define CHECK_FAILED 1
+
+// ----- fault points -----
+
+typedef enum
+{
+    FAULT_NONE,
+    FAULT_CRASH,
+    FAULT_FAIL
+} FaultMode;
+
+static int armed;
+static long points;
+static long faultAt = -1;
+static FaultMode faultMode;
+static int faultFired;
+
+#define MAX_WRITABLE 64
+static FILE *writable[MAX_WRITABLE];
+
+FILE *__real_fopen(const char *path, const char *mode);
+size_t __real_fwrite(const void *data, size_t size, size_t count, FILE *file);
+int __real_fflush(FILE *file);
+int __real_fclose(FILE *file);
+int __real_rename(const char *from, const char *to);
+int __real_remove(const char *path);
+int __real_fsync(int fd);
+int __real_ftruncate(int fd, off_t length);
+
+// 1 when this call is the injected failure; does not return for a crash
+static int faultPoint(const char *call)
+{
+    if (!armed)
+    {
+        return 0;
+    }
+    if (getenv("CRASH_TRACE"))
+        fprintf(stderr, "point %ld %s\n", points, call);
+    if (points++ != faultAt)
+    {
+        return 0;
+    }
+    faultFired = 1;
+    if (faultMode == FAULT_CRASH)
+    {
+        _exit(CRASH_EXIT);
+    }
+    errno = EIO;
+    return 1;
+}
+
+static int isWritable(FILE *file)
+{
+    for (int i = 0; i < MAX_WRITABLE; i++)
+    {
+        if (writable[i] == file)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+FILE *__wrap_fopen(const char *path, const char *mode)
+{
+    int writes = strpbrk(mode, "wa+") != NULL;
+    if (writes && faultPoint(path))
+    {
+        return NULL;
+    }
+    FILE *file = __real_fopen(path, mode);
+    if (file && writes)
+    {
+        int slot = isWritable(NULL);
+        if (slot >= 0)
+        {
+            writable[slot] = file;
+        }
+    }
+    return file;
+}
+
+size_t __wrap_fwrite(const void *data, size_t size, size_t count, FILE *file)
+{
+    if (armed && points == faultAt && size * count > 1)
+    {
+        // Torn: half of the bytes get out before the crash or the error
+        size_t half = size * count / 2;
+        __real_fwrite(data, 1, half, file);
+        if (faultMode == FAULT_CRASH)
+        {
+            __real_fflush(file);
+        }
+        faultPoint("fwrite torn");
+        return half / size;
+    }
+    if (faultPoint("fwrite"))
+    {
+        return 0;
+    }
+    return __real_fwrite(data, size, count, file);
+}
+
+int __wrap_fflush(FILE *file)
+{
+    if (faultPoint("fflush"))
+    {
+        return EOF;
+    }
+    return __real_fflush(file);
+}
+
+int __wrap_fclose(FILE *file)
+{
+    int slot = file ? isWritable(file) : -1;
+    if (slot < 0)
+    {
+        return __real_fclose(file);
+    }
+    writable[slot] = NULL;
+    int failed = faultPoint("fclose"); // a crash loses what is still buffered
+    int status = __real_fclose(file);
+    return failed ? EOF : status;
+}
+
+int __wrap_rename(const char *from, const char *to)
+{
+    return faultPoint(to) ? -1 : __real_rename(from, to);
+}
+
+int __wrap_remove(const char *path)
+{
+    return faultPoint(path) ? -1 : __real_remove(path);
+}
+
+int __wrap_fsync(int fd)
+{
+    (void)fd;
+    return faultPoint("fsync") ? -1 : 0;
+}
+
+int __wrap_ftruncate(int fd, off_t length)
+{
+    return faultPoint("ftruncate") ? -1 : __real_ftruncate(fd, length);
+}
+
+static void arm(long at, FaultMode mode)
+{
+    points = 0;
+    faultAt = at;
+    faultMode = mode;
+    faultFired = 0;
+    armed = 1;
+}
+
+// ----- data set -----
+
+static int initialStock[BOOK_COUNT + 1];
+static int verbose;
+
+static int hasCopies(int bookID)
+{
+    return bookID % 2 == 0;
+}
+
+static void makeBarcode(int bookID, int copy, char *barcode)
+{
+    snprintf(barcode, ITEM_BARCODE_SIZE, "B%02dC%d", bookID, copy);
+}
+
+static int writeFile(const char *path, const void *data, size_t size)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        perror(path);
+        return 0;
+    }
+    int ok = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+// Empties data/ and writes the starting books, members and copies
+static int resetData(unsigned seed)
+{
+    DIR *dir = opendir("data");
+    if (!dir)
+    {
+        if (mkdir("data", 0755) != 0)
+        {
+            perror("data");
+            return 0;
+        }
+    }
+    else
+    {
+        struct dirent *entry;
+        char path[512];
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (entry->d_name[0] != '.')
+            {
+                snprintf(path, sizeof(path), "data/%s", entry->d_name);
+                remove(path);
+            }
+        }
+        closedir(dir);
+    }
+
+    Book books[BOOK_COUNT];
+    Member members[MEMBER_COUNT];
+    ItemRecord items[BOOK_COUNT * 3];
+    size_t itemCount = 0;
+    memset(books, 0, sizeof(books));
+    memset(members, 0, sizeof(members));
+    memset(items, 0, sizeof(items));
+    for (int i = 0; i < BOOK_COUNT; i++)
+    {
+        Book *book = &books[i];
+        book->bookID = i + 1;
+        snprintf(book->title, sizeof(book->title), "Title %d", i + 1);
+        snprintf(book->author, sizeof(book->author), "Author %d", i % 4);
+        book->quantity = (i + 1) % 3 + 1;
+        initialStock[book->bookID] = book->quantity;
+        for (int copy = 0; hasCopies(book->bookID) && copy < book->quantity; copy++)
+        {
+            ItemRecord *item = &items[itemCount++];
+            makeBarcode(book->bookID, copy, item->barcode);
+            item->bookID = book->bookID;
+            item->status = ITEM_AVAILABLE;
+            item->loanIndex = -1;
+        }
+    }
+    for (int i = 0; i < MEMBER_COUNT; i++)
+    {
+        members[i].memberID = i + 1;
+        snprintf(members[i].name, sizeof(members[i].name), "Member %d", i + 1);
+        snprintf(members[i].phone, sizeof(members[i].phone), "0123456789");
+    }
+    shardsInvalidate();
+    int ok = writeFile(BOOKS_FILE, books, sizeof(books)) && writeFile(MEMBERS_FILE, members, sizeof(members)) &&
+             writeFile(ITEMS_FILE, items, itemCount * sizeof(ItemRecord)) &&
+             (seed % 2 || (shardsReshard(SHARD_BOOKS, 3) && shardsReshard(SHARD_MEMBERS, 2))) &&
+             idFilterRebuild(SHARD_BOOKS) && idFilterRebuild(SHARD_MEMBERS);
+    // Each child reads the layout its own run left behind, and opens its
+    // own journal instead of sharing the reshard's stream
+    shardsInvalidate();
+    return ok && journalRecover() == JOURNAL_CLEAN;
+}
+
+// ----- logical digest -----
+
+// Everything a user could observe, minus timestamps, which differ between
+// runs of the same workload
+typedef struct
+{
+    uint64_t hash;
+} Digest;
+
+static void mix(Digest *digest, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++)
+    {
+        digest->hash = (digest->hash ^ bytes[i]) * 1099511628211ULL;
+    }
+}
+
+static void mixInt(Digest *digest, int64_t value)
+{
+    mix(digest, &value, sizeof(value));
+}
+
+// Reads a whole data file; a missing file reads as empty
+static void *readFile(const char *path, size_t recordSize, size_t *count)
+{
+    *count = 0;
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    void *data = malloc(size > 0 ? (size_t)size : 1);
+    if (data && size > 0 && fread(data, 1, (size_t)size, file) == (size_t)size)
+    {
+        *count = (size_t)size / recordSize;
+    }
+    fclose(file);
+    return data;
+}
+
+// Reads every book or member, shard by shard
+static void *readShards(ShardKind kind, size_t *count)
+{
+    size_t size = shardsRecordSize(kind);
+    long total = shardsRecordCount(kind);
+    unsigned char *records = malloc(total > 0 ? (size_t)total * size : 1);
+    *count = 0;
+    ShardSet set;
+    long position;
+    shardsOpen(&set, kind, 0);
+    while (records && *count < (size_t)total && shardsNext(&set, records + *count * size, &position))
+    {
+        (*count)++;
+    }
+    shardsClose(&set);
+    return records;
+}
+
+// Archived loans are sorted by borrowDate, and loans of the same second
+// may come out in either order, so their digests are summed
+static int addArchived(const BorrowedRecord *record, void *ctx)
+{
+    Digest one = {14695981039346656037ULL};
+    mixInt(&one, record->bookID);
+    mixInt(&one, record->memberID);
+    *(uint64_t *)ctx += one.hash;
+    return 1;
+}
+
+static uint64_t digestData(void)
+{
+    int wasArmed = armed;
+    armed = 0;
+    Digest digest = {14695981039346656037ULL};
+    size_t count;
+
+    Book *books = readShards(SHARD_BOOKS, &count);
+    mixInt(&digest, (int64_t)count);
+    for (size_t i = 0; i < count; i++)
+    {
+        mixInt(&digest, books[i].bookID);
+        mixInt(&digest, books[i].quantity);
+        mix(&digest, books[i].title, strlen(books[i].title));
+    }
+    free(books);
+
+    Member *members = readShards(SHARD_MEMBERS, &count);
+    mixInt(&digest, (int64_t)count);
+    for (size_t i = 0; i < count; i++)
+    {
+        mixInt(&digest, members[i].memberID);
+    }
+    free(members);
+
+    // Loans: open ones in order, and how many were returned, wherever
+    // compaction has put them
+    BorrowedRecord *loans = readFile(BORROWED_BOOKS_FILE, sizeof(BorrowedRecord), &count);
+    int64_t returned = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (loans[i].returnDate == 0)
+        {
+            mixInt(&digest, loans[i].bookID);
+            mixInt(&digest, loans[i].memberID);
+        }
+        else
+        {
+            returned++;
+        }
+    }
+    free(loans);
+    uint64_t archived = 0;
+    loanArchiveForEach(addArchived, &archived);
+    mixInt(&digest, (int64_t)archived);
+    LoanSegmentInfo *segments;
+    size_t segmentCount;
+    if (loanArchiveSegments(&segments, &segmentCount))
+    {
+        for (size_t i = 0; i < segmentCount; i++)
+        {
+            returned += segments[i].recordCount;
+        }
+        free(segments);
+    }
+    mixInt(&digest, returned);
+
+    HoldRecord *holds = readFile(HOLDS_FILE, sizeof(HoldRecord), &count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (holds[i].state == HOLD_WAITING || holds[i].state == HOLD_READY)
+        {
+            mixInt(&digest, holds[i].bookID);
+            mixInt(&digest, holds[i].memberID);
+            mixInt(&digest, holds[i].state);
+        }
+    }
+    free(holds);
+
+    ItemRecord *items = readFile(ITEMS_FILE, sizeof(ItemRecord), &count);
+    for (size_t i = 0; i < count; i++)
+    {
+        mix(&digest, items[i].barcode, strlen(items[i].barcode));
+        mixInt(&digest, items[i].status);
+        mixInt(&digest, items[i].memberID);
+    }
+    free(items);
+
+    void *categories = readFile(MEMBER_CATEGORIES_FILE, 1, &count);
+    mix(&digest, categories, count);
+    free(categories);
+
+    // Every change in the log, committed or not: a failed write may leave
+    // the header behind until the next settle
+    unsigned char *log = readFile(CHANGES_FILE, 1, &count);
+    count = count > CHANGES_HEADER_SIZE ? (count - CHANGES_HEADER_SIZE) / sizeof(ChangeRecord) : 0;
+    mixInt(&digest, (int64_t)count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const ChangeRecord *change = (const ChangeRecord *)(log + CHANGES_HEADER_SIZE) + i;
+        mixInt(&digest, change->type);
+        mixInt(&digest, change->id);
+        mixInt(&digest, change->record.loan.memberID);
+    }
+    free(log);
+
+    armed = wasArmed;
+    return digest.hash;
+}
+
+// ----- invariants -----
+
+static const char *checkInvariants(int journalEmptied)
+{
+    static char problem[256];
+    int wasArmed = armed;
+    armed = 0;
+    problem[0] = '\0';
+    int open[BOOK_COUNT + 1] = {0}, ready[BOOK_COUNT + 1] = {0}, present[BOOK_COUNT + 1] = {0};
+    int onLoan[BOOK_COUNT + 1] = {0}, onShelf[BOOK_COUNT + 1] = {0}, setAside[BOOK_COUNT + 1] = {0};
+    size_t count, bookCount, memberCount;
+
+    Book *books = readShards(SHARD_BOOKS, &bookCount);
+    Member *members = readShards(SHARD_MEMBERS, &memberCount);
+    BorrowedRecord *loans = readFile(BORROWED_BOOKS_FILE, sizeof(BorrowedRecord), &count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (loans[i].returnDate == 0 && loans[i].bookID >= 1 && loans[i].bookID <= BOOK_COUNT)
+        {
+            open[loans[i].bookID]++;
+        }
+    }
+    free(loans);
+
+    HoldRecord *holds = readFile(HOLDS_FILE, sizeof(HoldRecord), &count);
+    for (size_t i = 0; i < count && !problem[0]; i++)
+    {
+        if (holds[i].state != HOLD_WAITING && holds[i].state != HOLD_READY)
+            continue;
+        if (holds[i].state == HOLD_READY && holds[i].bookID >= 1 && holds[i].bookID <= BOOK_COUNT)
+            ready[holds[i].bookID]++;
+        for (size_t j = 0; j < i; j++)
+        {
+            if ((holds[j].state == HOLD_WAITING || holds[j].state == HOLD_READY) &&
+                holds[j].bookID == holds[i].bookID && holds[j].memberID == holds[i].memberID)
+            {
+                snprintf(problem, sizeof(problem), "two open holds of member %d on book %d", holds[i].memberID,
+                         holds[i].bookID);
+            }
+        }
+    }
+    free(holds);
+
+    ItemRecord *items = readFile(ITEMS_FILE, sizeof(ItemRecord), &count);
+    for (size_t i = 0; i < count && !problem[0]; i++)
+    {
+        int bookID = items[i].bookID;
+        if (bookID < 1 || bookID > BOOK_COUNT)
+        {
+            snprintf(problem, sizeof(problem), "copy %s of unknown book %d", items[i].barcode, bookID);
+            break;
+        }
+        if (items[i].status == ITEM_AVAILABLE)
+            onShelf[bookID]++;
+        else if (items[i].status == ITEM_ON_LOAN)
+            onLoan[bookID]++;
+        else if (items[i].status == ITEM_ON_HOLD_SHELF)
+            setAside[bookID]++;
+        for (size_t j = 0; j < i; j++)
+        {
+            if (strcmp(items[j].barcode, items[i].barcode) == 0)
+                snprintf(problem, sizeof(problem), "copy %s registered twice", items[i].barcode);
+        }
+    }
+    free(items);
+
+    for (size_t i = 0; i < bookCount && !problem[0]; i++)
+    {
+        const Book *book = &books[i];
+        if (book->bookID < 1 || book->bookID > BOOK_COUNT || present[book->bookID]++)
+        {
+            snprintf(problem, sizeof(problem), "book %d duplicated or unknown", book->bookID);
+            break;
+        }
+        int id = book->bookID;
+        if (book->quantity + open[id] + ready[id] != initialStock[id])
+        {
+            snprintf(problem, sizeof(problem), "book %d: quantity %d + %d open loans + %d ready holds != stock %d",
+                     id, book->quantity, open[id], ready[id], initialStock[id]);
+        }
+        else if (hasCopies(id) && (onShelf[id] != book->quantity || onLoan[id] != open[id] || setAside[id] != ready[id]))
+        {
+            snprintf(problem, sizeof(problem),
+                     "book %d: copies %d shelved, %d lent, %d set aside; quantity %d, %d open loans, %d ready holds",
+                     id, onShelf[id], onLoan[id], setAside[id], book->quantity, open[id], ready[id]);
+        }
+    }
+    for (size_t i = 0; i < memberCount && !problem[0]; i++)
+    {
+        for (size_t j = 0; j < i; j++)
+        {
+            if (members[j].memberID == members[i].memberID)
+                snprintf(problem, sizeof(problem), "member %d duplicated", members[i].memberID);
+        }
+    }
+
+    struct stat journal;
+    if (!problem[0] && journalEmptied && stat(JOURNAL_FILE, &journal) == 0 && journal.st_size != 0)
+    {
+        snprintf(problem, sizeof(problem), "journal left with %lld bytes", (long long)journal.st_size);
+    }
+    if (!problem[0] && journalEmptied)
+    {
+        size_t size;
+        unsigned char *log = readFile(CHANGES_FILE, 1, &size);
+        count = size > CHANGES_HEADER_SIZE ? (size - CHANGES_HEADER_SIZE) / sizeof(ChangeRecord) : 0;
+        for (size_t i = 0; i < count && !problem[0]; i++)
+        {
+            const ChangeRecord *change = (const ChangeRecord *)(log + CHANGES_HEADER_SIZE) + i;
+            if (change->sequence != i + 1)
+                snprintf(problem, sizeof(problem), "change %zu numbered %llu", i + 1,
+                         (unsigned long long)change->sequence);
+        }
+        free(log);
+        if (!problem[0] && (size_t)changesCommitted() != count)
+            snprintf(problem, sizeof(problem), "change log holds %zu changes, header says %llu", count,
+                     (unsigned long long)changesCommitted());
+    }
+    // Read back from disk: a filter that matches the shards must pass
+    // every ID in them
+    idFilterInvalidate();
+    for (size_t i = 0; i < bookCount && !problem[0]; i++)
+    {
+        if (!idFilterMayContain(SHARD_BOOKS, books[i].bookID))
+            snprintf(problem, sizeof(problem), "book %d missing from the ID filter", books[i].bookID);
+    }
+    for (size_t i = 0; i < memberCount && !problem[0]; i++)
+    {
+        if (!idFilterMayContain(SHARD_MEMBERS, members[i].memberID))
+            snprintf(problem, sizeof(problem), "member %d missing from the ID filter", members[i].memberID);
+    }
+    free(books);
+    free(members);
+    if (!problem[0])
+    {
+        long mismatches = statsVerify();
+        if (mismatches != 0)
+            snprintf(problem, sizeof(problem), "statistics: %ld mismatches", mismatches);
+    }
+    armed = wasArmed;
+    return problem[0] ? problem : NULL;
+}
+
+// ----- workload -----
+
+typedef struct
+{
+    uint64_t state;
+    int loans[64][2]; // member, book of loans issued so far
+    int loanCount;
+    int holds[64][2];
+    int holdCount;
+    int nextCopy;
+} Workload;
+
+static uint32_t nextRandom(Workload *work)
+{
+    work->state ^= work->state << 13;
+    work->state ^= work->state >> 7;
+    work->state ^= work->state << 17;
+    return (uint32_t)(work->state >> 32);
+}
+
+static int pick(Workload *work, int n)
+{
+    return (int)(nextRandom(work) % (uint32_t)n);
+}
+
+static void remember(int list[][2], int *count, int memberID, int bookID)
+{
+    if (*count < 64)
+    {
+        list[*count][0] = memberID;
+        list[*count][1] = bookID;
+        (*count)++;
+    }
+}
+
+// Runs one operation. The random draws never depend on the outcome, so the
+// same seed runs the same operations however the file calls fare.
+static void runOperation(Workload *work)
+{
+    int kind = pick(work, 100);
+    int memberID = pick(work, MEMBER_COUNT) + 1;
+    int bookID = pick(work, BOOK_COUNT) + 1;
+    int choice = pick(work, 64);
+    Book book;
+    Member member;
+    BorrowedRecord record;
+    int heldFor;
+    long position;
+    char barcode[ITEM_BARCODE_SIZE];
+
+    if (kind < 30)
+    {
+        if (libraryIssueBook(memberID, bookID, &book, &member) == LIBRARY_OK)
+            remember(work->loans, &work->loanCount, memberID, bookID);
+    }
+    else if (kind < 55)
+    {
+        if (work->loanCount > 0)
+        {
+            int *loan = work->loans[choice % work->loanCount];
+            libraryReturnBook(loan[0], loan[1], &record, &heldFor);
+        }
+    }
+    else if (kind < 63)
+    {
+        makeBarcode(bookID & ~1, choice % 3, barcode);
+        if (libraryIssueItem(memberID, barcode, &book, &member) == LIBRARY_OK)
+            remember(work->loans, &work->loanCount, memberID, book.bookID);
+    }
+    else if (kind < 68)
+    {
+        makeBarcode(bookID & ~1, choice % 3, barcode);
+        libraryReturnItem(barcode, &record, &heldFor);
+    }
+    else if (kind < 78)
+    {
+        if (libraryPlaceHold(memberID, bookID, &position) == LIBRARY_OK)
+            remember(work->holds, &work->holdCount, memberID, bookID);
+    }
+    else if (kind < 84)
+    {
+        if (work->holdCount > 0)
+        {
+            int *hold = work->holds[choice % work->holdCount];
+            libraryCancelHold(hold[0], hold[1], &heldFor);
+        }
+    }
+    else if (kind < 90)
+    {
+        policySetMemberCategory(memberID, choice % POLICY_CATEGORY_COUNT);
+    }
+    else if (kind < 92)
+    {
+        libraryDeleteBook(bookID);
+    }
+    else if (kind < 94)
+    {
+        libraryDeleteMember(memberID);
+    }
+    else if (kind < 98)
+    {
+        loanArchiveCompact(choice % 2 ? LOAN_CODEC_LZ : LOAN_CODEC_NONE);
+    }
+    else
+    {
+        shardsReshard(choice % 2 ? SHARD_BOOKS : SHARD_MEMBERS, (unsigned)(choice / 2 % 4 + 1));
+    }
+}
+
+static void startWorkload(Workload *work, unsigned seed)
+{
+    memset(work, 0, sizeof(*work));
+    work->state = 0x9E3779B97F4A7C15ULL * (seed + 1);
+}
+
+// ----- schedules -----
+
+typedef struct
+{
+    int ops;
+    long boundary[MAX_OPS + 1]; // points used once operation i has finished
+    uint64_t digest[MAX_OPS + 1];
+} Trace;
+
+static void quiet(void)
+{
+    if (!verbose)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0)
+        {
+            dup2(null, STDERR_FILENO);
+            close(null);
+        }
+    }
+}
+
+static int waitChild(pid_t pid)
+{
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+            return -1;
+    }
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+// Clean run of the workload in a child, which sends back the trace
+static int traceWorkload(unsigned seed, int ops, Trace *trace)
+{
+    int fds[2];
+    if (!resetData(seed) || pipe(fds) != 0)
+        return 0;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        quiet();
+        Workload work;
+        startWorkload(&work, seed);
+        trace->ops = ops;
+        trace->digest[0] = digestData();
+        arm(-1, FAULT_NONE);
+        trace->boundary[0] = 0;
+        for (int i = 1; i <= ops; i++)
+        {
+            runOperation(&work);
+            trace->boundary[i] = points;
+            trace->digest[i] = digestData();
+        }
+        armed = 0;
+        const char *problem = checkInvariants(1);
+        if (problem)
+        {
+            fprintf(stdout, "seed %u clean run: %s\n", seed, problem);
+            _exit(CHECK_FAILED);
+        }
+        ssize_t written = write(fds[1], trace, sizeof(*trace));
+        _exit(written == (ssize_t)sizeof(*trace) ? 0 : CHECK_FAILED);
+    }
+    close(fds[1]);
+    ssize_t got = read(fds[0], trace, sizeof(*trace));
+    close(fds[0]);
+    return waitChild(pid) == 0 && got == (ssize_t)sizeof(*trace);
+}
+
+// The operation in flight at point K
+static int operationAt(const Trace *trace, long point)
+{
+    int i = 1;
+    while (i < trace->ops && trace->boundary[i] <= point)
+        i++;
+    return i;
+}
+
+static const char *checkOutcome(const Trace *trace, int op, int journalEmptied)
+{
+    static char problem[256];
+    uint64_t digest = digestData();
+    if (digest != trace->digest[op - 1] && digest != trace->digest[op])
+    {
+        snprintf(problem, sizeof(problem), "data matches neither the state before nor after operation %d", op);
+        return problem;
+    }
+    return checkInvariants(journalEmptied);
+}
+
+static void report(unsigned seed, const char *mode, long point, const char *problem)
+{
+    printf("FAIL seed %u, %s at point %ld: %s\n", seed, mode, point, problem);
+    fflush(stdout);
+}
+
+// Crash at K, then recover (possibly crashing during recovery first)
+static int crashSchedule(unsigned seed, const Trace *trace, long point, Workload *random, long *recoveryCrashes)
+{
+    if (!resetData(seed))
+        return 0;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        quiet();
+        Workload run;
+        startWorkload(&run, seed);
+        arm(point, FAULT_CRASH);
+        for (int i = 1; i <= trace->ops; i++)
+            runOperation(&run);
+        _exit(0); // the point was never reached
+    }
+    int status = waitChild(pid);
+    if (status != CRASH_EXIT)
+    {
+        report(seed, "crash", point, "process did not stop at the point");
+        return 0;
+    }
+
+    // A quarter of the recoveries are themselves interrupted
+    if (nextRandom(random) % 4 == 0)
+    {
+        long at = nextRandom(random) % 8;
+        pid = fork();
+        if (pid == 0)
+        {
+            quiet();
+            arm(at, FAULT_CRASH);
+            journalRecover();
+            _exit(0);
+        }
+        if (waitChild(pid) == CRASH_EXIT)
+            (*recoveryCrashes)++;
+    }
+
+    pid = fork();
+    if (pid == 0)
+    {
+        quiet();
+        if (journalRecover() == JOURNAL_FAILED)
+        {
+            report(seed, "crash", point, "recovery failed");
+            _exit(CHECK_FAILED);
+        }
+        const char *problem = checkOutcome(trace, operationAt(trace, point), 1);
+        if (problem)
+        {
+            report(seed, "crash", point, problem);
+            _exit(CHECK_FAILED);
+        }
+        _exit(0);
+    }
+    return waitChild(pid) == 0;
+}
+
+// Fail the call at K, keep going on the same caches
+static int failSchedule(unsigned seed, const Trace *trace, long point)
+{
+    if (!resetData(seed))
+        return 0;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        quiet();
+        Workload work;
+        startWorkload(&work, seed);
+        arm(point, FAULT_FAIL);
+        int op = 0;
+        while (op < trace->ops && !faultFired)
+        {
+            runOperation(&work);
+            op++;
+        }
+        if (!faultFired)
+            _exit(0);
+        armed = 0;
+        // A failed call may leave the journal to the next start
+        const char *problem = checkOutcome(trace, op, 0);
+        if (!problem)
+        {
+            for (int i = 0; i < EXTRA_OPS; i++)
+                runOperation(&work);
+            problem = journalRecover() == JOURNAL_FAILED ? "recovery failed" : checkInvariants(1);
+        }
+        if (problem)
+        {
+            report(seed, "failure", point, problem);
+            _exit(CHECK_FAILED);
+        }
+        _exit(0);
+    }
+    return waitChild(pid) == 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: crash_test [--seeds N] [--first-seed N] [--ops N] [--point K] [--dir DIR] [--verbose]\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned seeds = 3, firstSeed = 1;
+    int ops = 30;
+    long onlyPoint = -1;
+    const char *dir = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--verbose") == 0)
+        {
+            verbose = 1;
+            continue;
+        }
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value)
+        {
+            usage();
+            return 2;
+        }
+        if (strcmp(argv[i], "--seeds") == 0)
+            seeds = (unsigned)atoi(value);
+        else if (strcmp(argv[i], "--first-seed") == 0)
+            firstSeed = (unsigned)atoi(value);
+        else if (strcmp(argv[i], "--ops") == 0)
+            ops = atoi(value);
+        else if (strcmp(argv[i], "--dir") == 0)
+            dir = value;
+        else if (strcmp(argv[i], "--point") == 0)
+            onlyPoint = atol(value);
+        else
+        {
+            usage();
+            return 2;
+        }
+        i++;
+    }
+    if (ops < 1 || ops > MAX_OPS)
+    {
+        fprintf(stderr, "crash_test: --ops must be 1 to %d\n", MAX_OPS);
+        return 2;
+    }
+    if (dir)
+    {
+        mkdir(dir, 0755);
+        if (chdir(dir) != 0)
+        {
+            perror(dir);
+            return 1;
+        }
+    }
+
+    long schedules = 0, failures = 0, recoveryCrashes = 0;
+    Trace trace;
+    Workload spare;
+    for (unsigned seed = firstSeed; seed < firstSeed + seeds; seed++)
+    {
+        if (!traceWorkload(seed, ops, &trace))
+        {
+            printf("FAIL seed %u: the clean run failed\n", seed);
+            return 1;
+        }
+        long total = trace.boundary[trace.ops];
+        startWorkload(&spare, seed ^ 0x5A5A5A5Au);
+        for (long point = 0; point < total; point++)
+        {
+            if (onlyPoint >= 0 && point != onlyPoint)
+                continue;
+            if (!crashSchedule(seed, &trace, point, &spare, &recoveryCrashes))
+                failures++;
+            if (!failSchedule(seed, &trace, point))
+                failures++;
+            schedules += 2;
+        }
+    }
+    printf("%ld schedules, %ld recoveries interrupted, %ld failed\n", schedules, recoveryCrashes, failures);
+    return failures == 0 ? 0 : 1;
+}
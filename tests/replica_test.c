@@ -0,0 +1,436 @@
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/library.h"
+#include "../include/journal.h"
+#include "../include/shards.h"
+#include "../include/changes.h"
+#include "../include/replica.h"
+#include "../include/id_filter.h"
+
+// Two-process test for replication (replica.h).
+//
+// DIR/primary and DIR/follower start from the same data/. A child process
+// follows the primary's change log from DIR/follower while this process
+// runs issues, returns, book and member inserts, updates and deletes on
+// the primary. The follower is killed halfway and started again, which
+// must resume after the last batch it committed. Once it has applied every
+// committed change, the books, members and open loans of the two folders
+// must match, and both folders' ID filters must still cover every record;
+// the follower must refuse writes while it is one and accept them once
+// promoted.
+//
+//   replica_test [--dir DIR] [--ops N] [--seed N]
+
+#define BOOK_COUNT 20
+#define MEMBER_COUNT 10
+#define CATCH_UP_MS 20000
+
+static char primaryDir[PATH_MAX];
+static char followerDir[PATH_MAX];
+static char primaryLog[PATH_MAX + 32];
+
+static int enter(const char *dir)
+{
+    if (chdir(dir) != 0)
+    {
+        perror(dir);
+        return 0;
+    }
+    // The caches and the open files belong to the folder left behind
+    changesInvalidate();
+    shardsInvalidate();
+    libraryReload();
+    return 1;
+}
+
+static int writeFile(const char *path, const void *data, size_t size)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        perror(path);
+        return 0;
+    }
+    int ok = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+// Writes the starting books and members into dir/data, which is emptied
+static int seedData(const char *dir)
+{
+    char command[PATH_MAX + 32];
+    snprintf(command, sizeof(command), "rm -rf '%s' && mkdir -p '%s/data'", dir, dir);
+    if (system(command) != 0 || !enter(dir))
+    {
+        return 0;
+    }
+    Book books[BOOK_COUNT];
+    Member members[MEMBER_COUNT];
+    memset(books, 0, sizeof(books));
+    memset(members, 0, sizeof(members));
+    for (int i = 0; i < BOOK_COUNT; i++)
+    {
+        books[i].bookID = i + 1;
+        snprintf(books[i].title, sizeof(books[i].title), "Title %d", i + 1);
+        snprintf(books[i].author, sizeof(books[i].author), "Author %d", i % 5);
+        books[i].quantity = i % 3 + 1;
+    }
+    for (int i = 0; i < MEMBER_COUNT; i++)
+    {
+        members[i].memberID = i + 1;
+        snprintf(members[i].name, sizeof(members[i].name), "Member %d", i + 1);
+        snprintf(members[i].phone, sizeof(members[i].phone), "0123456789");
+    }
+    return writeFile(BOOKS_FILE, books, sizeof(books)) && writeFile(MEMBERS_FILE, members, sizeof(members)) &&
+           journalRecover() == JOURNAL_CLEAN && idFilterRebuild(SHARD_BOOKS) && idFilterRebuild(SHARD_MEMBERS);
+}
+
+// ----- digest -----
+
+static uint64_t hashBytes(const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Books, members and open loans of the current folder, in any order
+static uint64_t digestData(void)
+{
+    uint64_t digest = 0;
+    ShardSet set;
+    long position;
+    Book book;
+    shardsOpen(&set, SHARD_BOOKS, 0);
+    while (shardsNext(&set, &book, &position))
+    {
+        digest += hashBytes(&book, sizeof(book));
+    }
+    shardsClose(&set);
+    Member member;
+    shardsOpen(&set, SHARD_MEMBERS, 0);
+    while (shardsNext(&set, &member, &position))
+    {
+        digest += 3 * hashBytes(&member, sizeof(member));
+    }
+    shardsClose(&set);
+    FILE *file = fopen(BORROWED_BOOKS_FILE, "rb");
+    BorrowedRecord loan;
+    while (file && fread(&loan, sizeof(loan), 1, file) == 1)
+    {
+        if (loan.returnDate == 0)
+        {
+            digest += 5 * hashBytes(&loan, sizeof(loan));
+        }
+    }
+    if (file)
+    {
+        fclose(file);
+    }
+    return digest;
+}
+
+// The ID filters of the current folder, read back from disk, pass every
+// record, without having to be rebuilt: inserts and deletes kept them current
+static int filtersCover(void)
+{
+    static const char *const paths[] = {ID_FILTER_BOOKS_FILE, ID_FILTER_MEMBERS_FILE};
+    struct stat before[2], after[2];
+    if (stat(paths[0], &before[0]) != 0 || stat(paths[1], &before[1]) != 0)
+    {
+        return 0;
+    }
+    idFilterInvalidate();
+    int covered = 1;
+    ShardSet set;
+    long position;
+    Book book; // Both records start with their ID
+    Member member;
+    shardsOpen(&set, SHARD_BOOKS, 0);
+    while (covered && shardsNext(&set, &book, &position))
+    {
+        covered = idFilterMayContain(SHARD_BOOKS, book.bookID);
+    }
+    shardsClose(&set);
+    shardsOpen(&set, SHARD_MEMBERS, 0);
+    while (covered && shardsNext(&set, &member, &position))
+    {
+        covered = idFilterMayContain(SHARD_MEMBERS, member.memberID);
+    }
+    shardsClose(&set);
+    return covered && stat(paths[0], &after[0]) == 0 && stat(paths[1], &after[1]) == 0 &&
+           before[0].st_ino == after[0].st_ino && before[1].st_ino == after[1].st_ino;
+}
+
+// ----- workload -----
+
+static uint64_t state;
+
+static int pick(int n)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (int)((uint32_t)(state >> 32) % (uint32_t)n);
+}
+
+static void runOperation(int *nextBook, int *nextMember)
+{
+    int kind = pick(100);
+    int memberID = pick(*nextMember - 1) + 1;
+    int bookID = pick(*nextBook - 1) + 1;
+    Book book;
+    Member member;
+    BorrowedRecord record;
+    ShardSet set;
+    long position;
+    int heldFor;
+
+    if (kind < 40)
+    {
+        libraryIssueBook(memberID, bookID, &book, &member);
+    }
+    else if (kind < 70)
+    {
+        libraryReturnBook(memberID, bookID, &record, &heldFor);
+    }
+    else if (kind < 80)
+    {
+        shardsOpen(&set, SHARD_BOOKS, 1);
+        if (shardsFind(&set, bookID, &book, &position))
+        {
+            book.quantity++;
+            shardsWrite(&set, position, &book);
+        }
+        shardsClose(&set);
+    }
+    else if (kind < 86)
+    {
+        memset(&book, 0, sizeof(book));
+        book.bookID = (*nextBook)++;
+        snprintf(book.title, sizeof(book.title), "Added %d", book.bookID);
+        book.quantity = 2;
+        shardsAppend(SHARD_BOOKS, &book);
+    }
+    else if (kind < 90)
+    {
+        memset(&member, 0, sizeof(member));
+        member.memberID = (*nextMember)++;
+        snprintf(member.name, sizeof(member.name), "Joined %d", member.memberID);
+        shardsAppend(SHARD_MEMBERS, &member);
+    }
+    else if (kind < 95)
+    {
+        libraryDeleteBook(bookID);
+    }
+    else
+    {
+        libraryDeleteMember(memberID);
+    }
+}
+
+// ----- follower -----
+
+static pid_t startFollower(void)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Settles the batch a killed follower left in flight, as lms_follow does
+        int ok = enter(followerDir) && journalRecover() != JOURNAL_FAILED && replicaFollow(primaryLog);
+        _exit(ok ? 0 : 1);
+    }
+    return pid;
+}
+
+static int stopFollower(pid_t pid)
+{
+    int status;
+    kill(pid, SIGKILL);
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+            return 0;
+    }
+    // Anything but the kill is the follower giving up on its own
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL;
+}
+
+static uint64_t followerApplied(void)
+{
+    if (chdir(followerDir) != 0)
+    {
+        return 0;
+    }
+    uint64_t applied = replicaApplied();
+    return chdir(primaryDir) == 0 ? applied : 0;
+}
+
+static void sleepMs(long ms)
+{
+    struct timespec delay = {ms / 1000, ms % 1000 * 1000000L};
+    nanosleep(&delay, NULL);
+}
+
+static int catchUp(uint64_t target)
+{
+    for (long waited = 0; waited < CATCH_UP_MS; waited += 10)
+    {
+        if (followerApplied() >= target)
+        {
+            return 1;
+        }
+        sleepMs(10);
+    }
+    printf("FAIL the follower applied %llu of %llu changes\n", (unsigned long long)followerApplied(),
+           (unsigned long long)target);
+    return 0;
+}
+
+static int fail(const char *problem)
+{
+    printf("FAIL %s\n", problem);
+    return 1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: replica_test [--dir DIR] [--ops N] [--seed N]\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = "replica_data";
+    int ops = 300;
+    unsigned seed = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value)
+        {
+            usage();
+            return 2;
+        }
+        if (strcmp(argv[i], "--dir") == 0)
+            dir = value;
+        else if (strcmp(argv[i], "--ops") == 0)
+            ops = atoi(value);
+        else if (strcmp(argv[i], "--seed") == 0)
+            seed = (unsigned)atoi(value);
+        else
+        {
+            usage();
+            return 2;
+        }
+        i++;
+    }
+    mkdir(dir, 0755);
+    char root[PATH_MAX];
+    if (!realpath(dir, root))
+    {
+        perror(dir);
+        return 1;
+    }
+    snprintf(primaryDir, sizeof(primaryDir), "%.*s/primary", PATH_MAX - 16, root);
+    snprintf(followerDir, sizeof(followerDir), "%.*s/follower", PATH_MAX - 16, root);
+    snprintf(primaryLog, sizeof(primaryLog), "%s/%s", primaryDir, CHANGES_FILE);
+    state = 0x9E3779B97F4A7C15ULL * (seed + 1);
+
+    // The follower starts as a copy of the primary's data/
+    if (!seedData(followerDir) || !replicaInit() || !seedData(primaryDir))
+    {
+        return fail("could not set up the folders");
+    }
+
+    // A follower's own writes are refused
+    if (!enter(followerDir))
+        return 1;
+    journalSetReadOnly(1);
+    Book book;
+    Member member;
+    if (libraryIssueBook(1, 1, &book, &member) == LIBRARY_OK)
+    {
+        return fail("a read-only follower issued a book");
+    }
+    journalSetReadOnly(0);
+    if (!enter(primaryDir))
+        return 1;
+
+    int nextBook = BOOK_COUNT + 1, nextMember = MEMBER_COUNT + 1;
+    pid_t follower = startFollower();
+    for (int i = 0; i < ops / 2; i++)
+    {
+        runOperation(&nextBook, &nextMember);
+    }
+    // Killed wherever it is, then resumed
+    if (!stopFollower(follower))
+    {
+        return fail("the follower stopped on an error");
+    }
+    uint64_t resumedAt = followerApplied();
+    follower = startFollower();
+    for (int i = ops / 2; i < ops; i++)
+    {
+        runOperation(&nextBook, &nextMember);
+    }
+    uint64_t committed = changesCommitted();
+    if (!catchUp(committed))
+    {
+        stopFollower(follower);
+        return 1;
+    }
+    if (!stopFollower(follower))
+    {
+        return fail("the follower stopped on an error");
+    }
+
+    uint64_t primaryDigest = digestData();
+    if (!filtersCover())
+    {
+        return fail("the primary's ID filters are out of date");
+    }
+    if (!enter(followerDir))
+        return 1;
+    if (!filtersCover())
+    {
+        return fail("the follower's ID filters are out of date");
+    }
+    if (digestData() != primaryDigest)
+    {
+        return fail("the follower's books, members or loans differ from the primary's");
+    }
+    if (changesCommitted() != committed)
+    {
+        return fail("the follower's change log is not in step with the primary's");
+    }
+    if (!replicaPromote() || replicaIsFollower() || journalRecover() != JOURNAL_CLEAN)
+    {
+        return fail("promotion failed");
+    }
+    memset(&book, 0, sizeof(book));
+    book.bookID = nextBook;
+    snprintf(book.title, sizeof(book.title), "After promotion");
+    if (shardsAppend(SHARD_BOOKS, &book) < 0 || changesCommitted() != committed + 1)
+    {
+        return fail("the promoted folder refused a write");
+    }
+    printf("%llu changes replicated (resumed at %llu), promoted\n", (unsigned long long)committed,
+           (unsigned long long)resumedAt);
+    return 0;
+}
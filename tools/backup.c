@@ -0,0 +1,202 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <direct.h>
+#define chdir _chdir
+#else
+#include <unistd.h>
+#endif
+#include "../include/dates.h"
+#include "../include/backup.h"
+
+// Command-line snapshots of data/:
+//
+//   lms_backup snapshot [--dir DIR] [--backup-dir PATH]
+//   lms_backup list     [--dir DIR] [--backup-dir PATH]
+//   lms_backup restore  [--at YYYY-MM-DD[THH:MM:SS] | --at SNAPSHOT-ID] [--dir DIR] [--backup-dir PATH]
+//   lms_backup prune    --keep N [--dir DIR] [--backup-dir PATH]
+//
+// DIR is the folder that holds data/ (default: the current one) and PATH
+// is relative to it (default: LMS_BACKUP_DIR or backups/). --at is local
+// time; restore picks the newest snapshot taken at or before it, and with
+// no --at the latest one. Stop the program before restoring.
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: lms_backup snapshot|list [--dir DIR] [--backup-dir PATH]\n"
+                    "       lms_backup restore [--at YYYY-MM-DD[THH:MM:SS]|SNAPSHOT-ID] [--dir DIR] [--backup-dir PATH]\n"
+                    "       lms_backup prune --keep N [--dir DIR] [--backup-dir PATH]\n");
+}
+
+static void formatLocal(time_t when, char *text, size_t size)
+{
+    struct tm *local = localtime(&when);
+    if (!local || strftime(text, size, "%Y-%m-%d %H:%M:%S", local) == 0)
+    {
+        snprintf(text, size, "%lld", (long long)when);
+    }
+}
+
+static void printSnapshot(const BackupSnapshotInfo *info)
+{
+    char taken[32];
+    formatLocal(info->taken, taken, sizeof(taken));
+    printf("%-20s %s  %u files, %llu bytes, %llu new pages (%llu bytes)\n", info->id, taken, info->files,
+           (unsigned long long)info->bytes, (unsigned long long)info->pagesWritten,
+           (unsigned long long)info->bytesWritten);
+}
+
+// Accepts a local date with an optional time, or the id of a snapshot
+static int parseAt(const char *backupDir, const char *text, time_t *at)
+{
+    DayNumber day;
+    int hour = 23, minute = 59, second = 59;
+    char date[11];
+    if (strlen(text) >= 10)
+    {
+        memcpy(date, text, 10);
+        date[10] = '\0';
+        if (dateParse(date, &day) &&
+            (text[10] == '\0' ||
+             (sscanf(text + 10, "T%2d:%2d:%2d", &hour, &minute, &second) == 3 && hour < 24 && minute < 60 &&
+              second < 60)))
+        {
+            *at = dateLocalStart(day) + hour * 3600 + minute * 60 + second;
+            return 1;
+        }
+    }
+
+    BackupSnapshotInfo *snapshots;
+    size_t count;
+    int found = 0;
+    if (backupList(backupDir, &snapshots, &count))
+    {
+        for (size_t i = 0; i < count && !found; i++)
+        {
+            if (strcmp(snapshots[i].id, text) == 0)
+            {
+                *at = snapshots[i].taken;
+                found = 1;
+            }
+        }
+        free(snapshots);
+    }
+    if (!found)
+    {
+        fprintf(stderr, "lms_backup: %s is neither a date nor a snapshot id\n", text);
+    }
+    return found;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        usage();
+        return 2;
+    }
+    const char *command = argv[1];
+    if (strcmp(command, "snapshot") != 0 && strcmp(command, "list") != 0 && strcmp(command, "restore") != 0 &&
+        strcmp(command, "prune") != 0)
+    {
+        usage();
+        return 2;
+    }
+
+    const char *dir = NULL;
+    const char *backupDir = NULL;
+    const char *atText = NULL;
+    long keep = -1;
+    for (int i = 2; i < argc; i++)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value)
+        {
+            usage();
+            return 2;
+        }
+        if (strcmp(argv[i], "--dir") == 0)
+            dir = value;
+        else if (strcmp(argv[i], "--backup-dir") == 0)
+            backupDir = value;
+        else if (strcmp(argv[i], "--at") == 0 && strcmp(command, "restore") == 0)
+            atText = value;
+        else if (strcmp(argv[i], "--keep") == 0 && strcmp(command, "prune") == 0)
+            keep = atol(value);
+        else
+        {
+            usage();
+            return 2;
+        }
+        i++;
+    }
+    if (strcmp(command, "prune") == 0 && keep < 1)
+    {
+        fprintf(stderr, "lms_backup: prune needs --keep 1 or more\n");
+        return 2;
+    }
+
+    if (dir && chdir(dir) != 0)
+    {
+        perror(dir);
+        return 1;
+    }
+
+    BackupSnapshotInfo info;
+    if (strcmp(command, "snapshot") == 0)
+    {
+        if (!backupSnapshot(backupDir, &info))
+        {
+            fprintf(stderr, "lms_backup: snapshot failed\n");
+            return 1;
+        }
+        printSnapshot(&info);
+        return 0;
+    }
+    if (strcmp(command, "list") == 0)
+    {
+        BackupSnapshotInfo *snapshots;
+        size_t count;
+        if (!backupList(backupDir, &snapshots, &count))
+        {
+            fprintf(stderr, "lms_backup: cannot read %s\n", backupDirectory(backupDir));
+            return 1;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            printSnapshot(&snapshots[i]);
+        }
+        free(snapshots);
+        return 0;
+    }
+    if (strcmp(command, "restore") == 0)
+    {
+        time_t at = 0;
+        if (atText && !parseAt(backupDir, atText, &at))
+        {
+            return 2;
+        }
+        if (!backupRestore(backupDir, at, &info))
+        {
+            fprintf(stderr, "lms_backup: no snapshot restored\n");
+            return 1;
+        }
+        printf("restored ");
+        printSnapshot(&info);
+        return 0;
+    }
+
+    long removed = backupPrune(backupDir, (size_t)keep);
+    if (removed < 0)
+    {
+        fprintf(stderr, "lms_backup: prune failed\n");
+        return 1;
+    }
+    printf("%ld pages removed\n", removed);
+    return 0;
+}
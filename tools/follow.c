@@ -0,0 +1,170 @@
+#ifndef _WIN32
+#define _XOPEN_SOURCE 700 // realpath
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#ifdef _WIN32
+#include <direct.h>
+#define chdir _chdir
+#else
+#include <unistd.h>
+#endif
+#include "../include/journal.h"
+#include "../include/changes.h"
+#include "../include/replica.h"
+
+// Keeps a standby copy of the library in step with a running primary:
+//
+//   lms_follow run --primary DIR [--dir DIR]
+//   lms_follow status [--primary DIR] [--dir DIR]
+//   lms_follow promote [--dir DIR]
+//
+// --dir is the follower's folder and --primary the primary's, each the one
+// that holds data/. Start from a copy of the primary's data/ (lms_backup
+// restore of a snapshot, or a plain copy with the program stopped); "run"
+// then applies the primary's change log from where the copy was taken and
+// waits for more until it is stopped. "promote" makes a stopped follower a
+// primary of its own.
+
+#ifndef PATH_MAX
+#define PATH_MAX 1024
+#endif
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: lms_follow run --primary DIR [--dir DIR]\n"
+                    "       lms_follow status [--primary DIR] [--dir DIR]\n"
+                    "       lms_follow promote [--dir DIR]\n");
+}
+
+// The primary's change log as an absolute path, since the follower changes
+// into its own folder first
+static int primaryLogPath(const char *primary, char *path)
+{
+    char resolved[PATH_MAX];
+#ifdef _WIN32
+    if (!_fullpath(resolved, primary, sizeof(resolved)))
+#else
+    if (!realpath(primary, resolved))
+#endif
+    {
+        perror(primary);
+        return 0;
+    }
+    if (strlen(resolved) + 1 + strlen(CHANGES_FILE) >= PATH_MAX)
+    {
+        fprintf(stderr, "lms_follow: %s: path too long\n", primary);
+        return 0;
+    }
+    sprintf(path, "%s/%s", resolved, CHANGES_FILE);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || (strcmp(argv[1], "run") != 0 && strcmp(argv[1], "status") != 0 &&
+                     strcmp(argv[1], "promote") != 0))
+    {
+        usage();
+        return 2;
+    }
+    const char *command = argv[1];
+    const char *dir = NULL;
+    const char *primary = NULL;
+    for (int i = 2; i < argc; i++)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value)
+        {
+            usage();
+            return 2;
+        }
+        if (strcmp(argv[i], "--dir") == 0)
+            dir = value;
+        else if (strcmp(argv[i], "--primary") == 0)
+            primary = value;
+        else
+        {
+            usage();
+            return 2;
+        }
+        i++;
+    }
+    if (strcmp(command, "run") == 0 && !primary)
+    {
+        usage();
+        return 2;
+    }
+
+    char primaryLog[PATH_MAX];
+    if (primary && !primaryLogPath(primary, primaryLog))
+    {
+        return 1;
+    }
+    if (dir && chdir(dir) != 0)
+    {
+        perror(dir);
+        return 1;
+    }
+
+    if (strcmp(command, "status") == 0)
+    {
+        if (!replicaIsFollower())
+        {
+            puts("not a follower");
+            return 0;
+        }
+        uint64_t applied = replicaApplied();
+        printf("applied through change %llu\n", (unsigned long long)applied);
+        if (primary)
+        {
+            ChangeCursor cursor;
+            changesOpenFile(&cursor, primaryLog, applied);
+            changesWait(&cursor, 0); // reads the primary's committed count
+            changesClose(&cursor);
+            uint64_t committed = cursor.committed > applied ? cursor.committed : applied;
+            printf("primary at change %llu, %llu behind\n", (unsigned long long)committed,
+                   (unsigned long long)(committed - applied));
+        }
+        return 0;
+    }
+    if (strcmp(command, "promote") == 0)
+    {
+        if (!replicaIsFollower())
+        {
+            fprintf(stderr, "lms_follow: not a follower\n");
+            return 1;
+        }
+        // The position as of the last batch that committed
+        uint64_t applied = journalRecover() == JOURNAL_FAILED ? 0 : replicaApplied();
+        if (!replicaPromote())
+        {
+            fprintf(stderr, "lms_follow: promotion failed\n");
+            return 1;
+        }
+        printf("promoted at change %llu; the program can now change the data\n", (unsigned long long)applied);
+        return 0;
+    }
+
+    // An apply a crash or a stop interrupted is rolled back first
+    if (journalRecover() == JOURNAL_FAILED)
+    {
+        fprintf(stderr, "lms_follow: the journal could not be recovered\n");
+        return 1;
+    }
+    if (!replicaInit())
+    {
+        return 1;
+    }
+    printf("following %s from change %llu\n", primaryLog, (unsigned long long)replicaApplied() + 1);
+    fflush(stdout);
+    if (!replicaFollow(primaryLog))
+    {
+        fprintf(stderr, "lms_follow: stopped at change %llu after an error\n", (unsigned long long)replicaApplied());
+        return 1;
+    }
+    puts("the folder was promoted; stopped following");
+    return 0;
+}
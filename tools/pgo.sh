@@ -0,0 +1,35 @@
+#!/bin/sh
+# Profile-guided build: compile with instrumentation, train on the synthetic
+# circulation workload from the benchmark, then rebuild in the same build
+# directory with the collected profile.
+#
+#   tools/pgo.sh [build-dir] [training scale]
+#
+# BUILD_TYPE=LTO tools/pgo.sh combines the profile with link-time optimization.
+set -e
+
+SOURCE_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR=${1:-$SOURCE_DIR/build-pgo}
+SCALE=${2:-100000}
+BUILD_TYPE=${BUILD_TYPE:-Release}
+PROFILE_DIR=$BUILD_DIR/pgo-profile
+
+rm -rf "$PROFILE_DIR"
+mkdir -p "$PROFILE_DIR"
+
+cmake -S "$SOURCE_DIR" -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE="$BUILD_TYPE" -DLMS_PGO=GENERATE \
+      -DLMS_PGO_DIR="$PROFILE_DIR"
+cmake --build "$BUILD_DIR" --clean-first
+
+echo "Training on $SCALE books/members and $((SCALE * 4)) loans"
+"$BUILD_DIR/bench" all --dir "$BUILD_DIR/pgo-train" --scale "$SCALE" --loans $((SCALE * 4)) \
+    --iterations 100 --heavy-iterations 5 > "$BUILD_DIR/pgo-train.json"
+
+# Clang writes raw profiles that have to be merged first
+if ls "$PROFILE_DIR"/*.profraw > /dev/null 2>&1; then
+    llvm-profdata merge -output="$PROFILE_DIR/lms.profdata" "$PROFILE_DIR"/*.profraw
+fi
+
+cmake -S "$SOURCE_DIR" -B "$BUILD_DIR" -DLMS_PGO=USE
+cmake --build "$BUILD_DIR" --clean-first
+echo "Profile-optimized binaries are in $BUILD_DIR"
@@ -0,0 +1,95 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#define chdir _chdir
+#else
+#include <unistd.h>
+#endif
+#include "../include/journal.h"
+#include "../include/shards.h"
+
+// Splits books and members into shard files, or merges them back:
+//
+//   lms_shard [--books N] [--members N] [--dir DIR]
+//
+// DIR is the folder that holds data/ (default: the current one). N is 1 to
+// 64; 1 goes back to the single books.dat/members.dat. Without --books or
+// --members it prints the current layout. Stop the program first.
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: lms_shard [--books N] [--members N] [--dir DIR]\n");
+}
+
+static void printLayout(ShardKind kind, const char *name)
+{
+    unsigned count = shardsCount(kind);
+    printf("%-8s %2u %s, %ld records\n", name, count, count == 1 ? "shard" : "shards", shardsRecordCount(kind));
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = NULL;
+    long counts[SHARD_KIND_COUNT] = {0, 0};
+    for (int i = 1; i < argc; i++)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value)
+        {
+            usage();
+            return 2;
+        }
+        if (strcmp(argv[i], "--dir") == 0)
+            dir = value;
+        else if (strcmp(argv[i], "--books") == 0)
+            counts[SHARD_BOOKS] = atol(value);
+        else if (strcmp(argv[i], "--members") == 0)
+            counts[SHARD_MEMBERS] = atol(value);
+        else
+        {
+            usage();
+            return 2;
+        }
+        i++;
+    }
+    for (int kind = 0; kind < SHARD_KIND_COUNT; kind++)
+    {
+        if (counts[kind] < 0 || counts[kind] > SHARDS_MAX)
+        {
+            fprintf(stderr, "lms_shard: a shard count is 1 to %d\n", SHARDS_MAX);
+            return 2;
+        }
+    }
+
+    if (dir && chdir(dir) != 0)
+    {
+        perror(dir);
+        return 1;
+    }
+    // An operation a crash left unfinished is settled against the old layout
+    if (journalRecover() == JOURNAL_FAILED)
+    {
+        fprintf(stderr, "lms_shard: the journal could not be recovered\n");
+        return 1;
+    }
+
+    const char *names[SHARD_KIND_COUNT] = {"books", "members"};
+    for (int kind = 0; kind < SHARD_KIND_COUNT; kind++)
+    {
+        if (counts[kind] > 0 && !shardsReshard((ShardKind)kind, (unsigned)counts[kind]))
+        {
+            fprintf(stderr, "lms_shard: resharding %s failed; the old files are unchanged\n", names[kind]);
+            return 1;
+        }
+    }
+    for (int kind = 0; kind < SHARD_KIND_COUNT; kind++)
+    {
+        printLayout((ShardKind)kind, names[kind]);
+    }
+    return 0;
+}